@@ -6,10 +6,16 @@ CREATE TABLE cities
     id_joinkey   BYTEA     NOT NULL,
     name         BYTEA     NOT NULL,
     name_bi      BYTEA     NOT NULL,
-    kladr_id     BYTEA     NOT NULL,
+    name_tokens  TEXT[]    NOT NULL,
+    kladr_id     BYTEA,
+    name_kladr_id_bi BYTEA,
     priority     BYTEA,
+    priority_ore BYTEA,
+    priority_he  NUMERIC,
     created_at   BYTEA     NOT NULL,
+    created_at_ore BYTEA   NOT NULL,
     updated_at   BYTEA     NOT NULL,
+    updated_at_bucket BYTEA NOT NULL,
     timezone     BYTEA
 );
 
@@ -24,5 +30,13 @@ CREATE TABLE city2region
 CREATE INDEX cities_id_bi_idx ON cities (id_bi);
 CREATE INDEX cities_id_joinkey_idx ON cities (id_joinkey);
 CREATE INDEX cities_name_bi_idx ON cities (name_bi);
+CREATE INDEX cities_name_tokens_idx ON cities USING gin (name_tokens);
+CREATE INDEX cities_name_kladr_id_bi_idx ON cities (name_kladr_id_bi);
+CREATE INDEX cities_priority_ore_idx ON cities (priority_ore);
+CREATE INDEX cities_created_at_ore_idx ON cities (created_at_ore);
+CREATE INDEX cities_updated_at_bucket_idx ON cities (updated_at_bucket);
 
 CREATE INDEX city2region_id_joinkey_idx ON city2region (id_joinkey);
+
+CREATE OR REPLACE FUNCTION tde_paillier_sum_step(numeric, numeric, numeric) RETURNS numeric AS 'SELECT mod($1 * $2, $3)' LANGUAGE SQL IMMUTABLE STRICT;
+CREATE OR REPLACE AGGREGATE tde_paillier_sum(numeric, numeric) (SFUNC = tde_paillier_sum_step, STYPE = numeric);
@@ -0,0 +1,139 @@
+"""
+Migrates a plaintext table into a TDE table.
+
+Rows are read from the plaintext table in batches ordered by the primary key and are written
+into the TDE table with COPY ... FROM STDIN through Postgres TDE. The proxy encrypts the values
+and computes blind indexes and join keys for the whole COPY stream, so no per-row statements
+are involved. Both tables must have the same columns, the TDE table also has the helper columns
+(<column>_bi, <column>_joinkey, <column>_ore, <column>_bucket, <column>_tokens, <column>_he and
+the composite blind indexes) which the proxy fills in.
+
+Progress is saved to the checkpoint file after each batch is committed, so an interrupted
+migration continues from the last committed batch when started again with the same checkpoint.
+If the process is killed between the commit and the checkpoint update, the last batch is copied
+again - remove its rows or pass --resume-from explicitly in this case.
+
+The primary key is used as is from the COPY text output, so it shouldn't contain tabs,
+newlines or backslashes (integers, UUIDs and most textual keys are fine).
+
+Usage example:
+    python3 migrate.py --source-table cities_open --target-table cities --pk id \
+        --columns id,name,kladr_id,priority,created_at,updated_at,timezone \
+        --batch-size 10000 --checkpoint cities.checkpoint
+"""
+
+import argparse
+import io
+import json
+import os
+import time
+
+import psycopg2
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Migrate a plaintext table into a TDE table")
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--source-port", default="5432",
+                        help="port to read the plaintext table from, Postgres itself by default")
+    parser.add_argument("--port", default="5433", help="Postgres TDE listener port")
+    parser.add_argument("--dbname", default="postgres")
+    parser.add_argument("--user", default="postgres")
+    parser.add_argument("--password", default="postgres")
+    parser.add_argument("--source-table", required=True)
+    parser.add_argument("--target-table", required=True)
+    parser.add_argument("--pk", required=True, help="primary key column of the source table")
+    parser.add_argument("--columns", required=True, help="comma-separated list of columns to copy")
+    parser.add_argument("--batch-size", type=int, default=10000)
+    parser.add_argument("--checkpoint", default="",
+                        help="file to save progress to and resume from")
+    parser.add_argument("--resume-from", default=None,
+                        help="primary key value to start after, overrides the checkpoint")
+    return parser.parse_args()
+
+
+def load_checkpoint(path):
+    if not path or not os.path.exists(path):
+        return None, 0
+
+    with open(path) as f:
+        checkpoint = json.load(f)
+    return checkpoint["last_pk"], checkpoint["rows"]
+
+
+def save_checkpoint(path, last_pk, rows):
+    if not path:
+        return
+
+    # Replace atomically, so the checkpoint is never left half-written
+    tmp_path = path + ".tmp"
+    with open(tmp_path, "w") as f:
+        json.dump({"last_pk": last_pk, "rows": rows}, f)
+    os.replace(tmp_path, path)
+
+
+def main():
+    args = parse_args()
+    columns = [column.strip() for column in args.columns.split(",")]
+    if args.pk in columns:
+        columns.remove(args.pk)
+    # Primary key goes first to find the position of the batch easily
+    columns.insert(0, args.pk)
+
+    source = psycopg2.connect(dbname=args.dbname, host=args.host, port=args.source_port,
+                              user=args.user, password=args.password)
+    source.autocommit = True
+    target = psycopg2.connect(dbname=args.dbname, host=args.host, port=args.port,
+                              user=args.user, password=args.password)
+    target.autocommit = True
+    source_cursor = source.cursor()
+    target_cursor = target.cursor()
+
+    last_pk, processed = load_checkpoint(args.checkpoint)
+    if args.resume_from is not None:
+        last_pk = args.resume_from
+    if last_pk is not None:
+        print(f"resuming after {args.pk} = {last_pk}, {processed} rows already copied")
+
+    column_list = ", ".join(columns)
+    copy_in = f"COPY {args.target_table} ({column_list}) FROM STDIN"
+
+    started_at = time.monotonic()
+    copied = 0
+
+    while True:
+        condition = ""
+        if last_pk is not None:
+            condition = source_cursor.mogrify(f"WHERE {args.pk} > %s", (last_pk,)).decode()
+
+        # Batch is read and written in the COPY text format, without conversion of the values
+        batch = io.StringIO()
+        source_cursor.copy_expert(
+            f"COPY (SELECT {column_list} FROM {args.source_table} {condition} "
+            f"ORDER BY {args.pk} LIMIT {args.batch_size}) TO STDOUT", batch)
+
+        # COPY rows end with \n, other line breaks are data (splitlines() would split on them too)
+        rows = batch.getvalue().split("\n")[:-1]
+        if not rows:
+            break
+
+        batch.seek(0)
+        target_cursor.copy_expert(copy_in, batch)
+
+        last_pk = rows[-1].split("\t", 1)[0]
+        copied += len(rows)
+        processed += len(rows)
+        save_checkpoint(args.checkpoint, last_pk, processed)
+
+        elapsed = time.monotonic() - started_at
+        print(f"copied {processed} rows, {copied / elapsed:.1f} rows/s, "
+              f"resume from {last_pk}", flush=True)
+
+    elapsed = time.monotonic() - started_at
+    print(f"done: {processed} rows, {copied} in {elapsed:.1f}s")
+    source.close()
+    target.close()
+
+
+if __name__ == "__main__":
+    main()
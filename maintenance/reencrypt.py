@@ -0,0 +1,38 @@
+"""
+Re-encrypts a TDE table with the active keys after key rotation.
+
+Rows are rewritten through Postgres TDE (see rewrite.py), so the proxy decrypts them with
+whatever key version they were encrypted with and encrypts them again with the active keys,
+recomputing blind indexes and join keys.
+
+Usage example:
+    python3 reencrypt.py --table cities --pk id \
+        --columns id,name,kladr_id,priority,created_at,updated_at,timezone \
+        --batch-size 100 --max-rows-per-second 500
+"""
+
+import argparse
+
+import rewrite
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Re-encrypt a TDE table with the active keys")
+    parser.add_argument("--table", required=True)
+    parser.add_argument("--pk", required=True, help="primary key column, must have a blind index")
+    parser.add_argument("--columns", required=True, help="comma-separated list of columns to rewrite")
+    rewrite.add_arguments(parser)
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    columns = [column.strip() for column in args.columns.split(",")]
+    if args.pk not in columns:
+        columns.insert(0, args.pk)
+
+    rewrite.rewrite_rows(args, args.table, args.pk, columns)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,100 @@
+"""
+Rewrites the rows of a TDE table through Postgres TDE, shared by the maintenance scripts.
+
+The rows are read and written back through the proxy, so it decrypts them with whatever key
+they were encrypted with and encrypts them again with the active schema, recomputing the helper
+columns (blind indexes, join keys etc.). The table is walked in batches ordered by the blind
+index of the primary key. A row whose blind index changes may be visited twice, which is
+harmless.
+
+Transactions can't be run through the proxy, so a row is only written back if it is unchanged
+since it was read (its xmin is the same). A row written by the application in the meantime is
+read and written back again, so the concurrent write is never overwritten with the old values.
+"""
+
+import time
+
+import psycopg2
+
+
+def add_arguments(parser):
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", default="5433", help="Postgres TDE listener port")
+    parser.add_argument("--dbname", default="postgres")
+    parser.add_argument("--user", default="postgres")
+    parser.add_argument("--password", default="postgres")
+    parser.add_argument("--batch-size", type=int, default=100)
+    parser.add_argument("--max-rows-per-second", type=float, default=100.0,
+                        help="rate limit, so the job doesn't affect production latency")
+    parser.add_argument("--resume-from", default="",
+                        help="hex blind index value reported by the previous run")
+
+
+def to_literal(value):
+    # Values are passed as plain literals - the proxy only accepts literals for encrypted columns
+    if value is None or isinstance(value, int):
+        return value
+    return str(value)
+
+
+def write_back(cursor, table, pk, columns, row):
+    """Writes the values of the row (xmin, pk, columns...) back unless it changed since it was read"""
+    set_list = ", ".join(f"{column} = %s" for column in columns)
+    # The key is qualified, the proxy doesn't resolve unqualified columns of UPDATE ... WHERE
+    cursor.execute(f"UPDATE {table} SET {set_list} WHERE {table}.{pk} = %s AND {table}.xmin = %s",
+                   [to_literal(value) for value in row[2:]] + [to_literal(row[1]), row[0]])
+    return cursor.rowcount == 1
+
+
+def rewrite_rows(args, table, pk, columns):
+    """Writes the columns of every row of the table back, pk must have a blind index"""
+    conn = psycopg2.connect(dbname=args.dbname, host=args.host, port=args.port,
+                            user=args.user, password=args.password)
+    conn.autocommit = True
+    cursor = conn.cursor()
+
+    select_list = ", ".join(f"t.{column}" for column in [pk] + columns)
+
+    last_bi = args.resume_from
+    processed = 0
+    retried = 0
+    started_at = time.monotonic()
+    min_batch_time = args.batch_size / args.max_rows_per_second
+
+    while True:
+        batch_started_at = time.monotonic()
+
+        cursor.execute(
+            f"SELECT t.{pk}_bi AS tde_cursor, t.xmin AS tde_version, {select_list} FROM {table} t "
+            f"WHERE t.{pk}_bi > '\\x{last_bi}' ORDER BY t.{pk}_bi LIMIT {args.batch_size}")
+        rows = cursor.fetchall()
+        if not rows:
+            break
+
+        for row in rows:
+            row = row[1:]
+            while not write_back(cursor, table, pk, columns, row):
+                # Written by the application since it was read, the current values are written back
+                cursor.execute(f"SELECT t.xmin AS tde_version, {select_list} FROM {table} t "
+                               f"WHERE t.{pk} = %s", [to_literal(row[1])])
+                row = cursor.fetchone()
+                if row is None:
+                    # Deleted in the meantime
+                    break
+                retried += 1
+
+        last_bi = bytes(rows[-1][0]).hex()
+        processed += len(rows)
+
+        elapsed = time.monotonic() - started_at
+        print(f"processed {processed} rows ({retried} written concurrently), "
+              f"{processed / elapsed:.1f} rows/s, resume from {last_bi}", flush=True)
+
+        # Rate limit
+        batch_time = time.monotonic() - batch_started_at
+        if batch_time < min_batch_time:
+            time.sleep(min_batch_time - batch_time)
+
+    elapsed = time.monotonic() - started_at
+    print(f"done: {processed} rows in {elapsed:.1f}s")
+    conn.close()
@@ -0,0 +1,103 @@
+"""
+Reports the false positive rate of the probabilistic joins and widens the join keys of a column.
+
+Join keys are truncated hashes, so a join fetches the rows with equal keys and the proxy discards
+the ones with different values. The proxy counts the fetched and the kept rows of each join
+(<stat_prefix>.join.<table>.<column>.<table>.<column>.rows_fetched / rows_kept), the script reads
+the counters from the Envoy admin interface and reports the share of the discarded rows.
+
+Once the rate of a join passes the threshold, the keys of one of its columns are widened:
+1. Set join_key_size of the column to the new size and previous_join_key_size to the old one
+   in the encryption schema. New rows get the wider keys, joins still compare the keys by the
+   prefix of the old size, so the existing rows are matched as before.
+2. Run the script with --table, --column and --pk. If the observed rate of any join of the
+   column passes the threshold, the rows are written back through Postgres TDE, so the proxy
+   recomputes their join keys with the new size (see rewrite.py).
+3. Remove previous_join_key_size from the schema, joins compare the wider keys from now on.
+
+Usage example:
+    python3 widen_join_keys.py --threshold 0.5
+    python3 widen_join_keys.py --table city2region --column id --pk id \
+        --batch-size 100 --max-rows-per-second 500
+"""
+
+import argparse
+import json
+import urllib.parse
+import urllib.request
+
+import rewrite
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Widen the join keys of a TDE column")
+    parser.add_argument("--admin-url", default="http://localhost:8001",
+                        help="Envoy admin interface to read the join counters from")
+    parser.add_argument("--stat-prefix", default="postgres.stats",
+                        help="prefix of the filter stats, postgres.<stat_prefix>")
+    parser.add_argument("--threshold", type=float, default=0.5,
+                        help="share of the discarded rows the keys are widened after")
+    parser.add_argument("--min-rows", type=int, default=1000,
+                        help="joins with fewer fetched rows are not taken into account")
+    parser.add_argument("--table", default="", help="table of the column to widen the keys of")
+    parser.add_argument("--column", default="", help="column to widen the keys of")
+    parser.add_argument("--pk", default="", help="primary key column, must have a blind index")
+    parser.add_argument("--force", action="store_true",
+                        help="rewrite the rows regardless of the observed rate")
+    rewrite.add_arguments(parser)
+    return parser.parse_args()
+
+
+def read_join_stats(admin_url, stat_prefix):
+    prefix = f"{stat_prefix}.join."
+    stats_filter = urllib.parse.quote("^" + prefix.replace(".", "[.]"))
+    url = f"{admin_url}/stats?format=json&filter={stats_filter}"
+    with urllib.request.urlopen(url) as response:
+        stats = json.load(response)["stats"]
+
+    # {(left table, left column, right table, right column): [rows fetched, rows kept]}
+    joins = {}
+    for stat in stats:
+        name = stat.get("name", "")
+        if not name.startswith(prefix) or "value" not in stat:
+            continue
+
+        parts = name[len(prefix):].split(".")
+        if len(parts) != 5 or parts[4] not in ("rows_fetched", "rows_kept"):
+            continue
+
+        counters = joins.setdefault(tuple(parts[:4]), [0, 0])
+        counters[0 if parts[4] == "rows_fetched" else 1] = stat["value"]
+
+    return joins
+
+
+def main():
+    args = parse_args()
+
+    over_threshold = False
+    for join, (fetched, kept) in sorted(read_join_stats(args.admin_url, args.stat_prefix).items()):
+        rate = (fetched - kept) / fetched if fetched else 0.0
+        column_joined = (args.table, args.column) in (join[:2], join[2:])
+        if fetched >= args.min_rows and rate > args.threshold and column_joined:
+            over_threshold = True
+
+        print(f"{join[0]}.{join[1]} = {join[2]}.{join[3]}: {fetched} rows fetched, {kept} kept, "
+              f"{rate:.1%} discarded")
+
+    if not args.table or not args.column:
+        return
+
+    if not args.pk:
+        raise SystemExit("--pk is required to rewrite the rows")
+
+    if not over_threshold and not args.force:
+        print(f"joins of {args.table}.{args.column} don't pass the threshold, nothing to do")
+        return
+
+    # Writing the value back makes the proxy recompute the join key with the active size
+    rewrite.rewrite_rows(args, args.table, args.pk, [args.column])
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 #include <vector>
 
 #include "envoy/buffer/buffer.h"
@@ -20,6 +21,78 @@ namespace Crypto {
 
 using Utils::Result;
 
+// AES decryption context with the key schedule prepared once, so that it can be
+// cheaply reused for decryption of many values encrypted with the same key.
+// Not thread safe.
+class AESDecryptionContext {
+public:
+  virtual ~AESDecryptionContext() = default;
+
+  virtual Result decrypt(absl::string_view encrypted_data, std::vector<uint8_t>& out) PURE;
+};
+
+using AESDecryptionContextPtr = std::unique_ptr<AESDecryptionContext>;
+
+// AES encryption context with the key schedule prepared once, for bulk encryption
+// of many values with the same key. A fresh random IV is generated for each value.
+// Not thread safe.
+class AESEncryptionContext {
+public:
+  virtual ~AESEncryptionContext() = default;
+
+  // Output has the same [IV][ciphertext] layout as UtilityExt::AESEncrypt
+  virtual void encrypt(absl::string_view plain_data, std::vector<uint8_t>& out) PURE;
+};
+
+using AESEncryptionContextPtr = std::unique_ptr<AESEncryptionContext>;
+
+// Keyed order-preserving encryption of 64-bit unsigned integers. Ciphertexts are
+// deterministic and compare (as big-endian byte strings) in the same order as the
+// plaintexts, so the database can do range scans over them with a regular B-tree.
+// The order of the values and the approximate distances between them are revealed.
+// Not thread safe.
+class OrderPreservingContext {
+public:
+  static constexpr size_t CIPHERTEXT_SIZE = 16;
+
+  virtual ~OrderPreservingContext() = default;
+
+  virtual void encrypt(uint64_t value, std::vector<uint8_t>& out) PURE;
+};
+
+using OrderPreservingContextPtr = std::unique_ptr<OrderPreservingContext>;
+
+// HMAC-SHA256 with the key prepared once, for hashing many values with the same key.
+// Produces the same output as Envoy::Common::Crypto::Utility::getSha256Hmac.
+// Not thread safe.
+class HMACContext {
+public:
+  virtual ~HMACContext() = default;
+
+  virtual void compute(absl::string_view data, std::vector<uint8_t>& out) PURE;
+};
+
+using HMACContextPtr = std::unique_ptr<HMACContext>;
+
+// Paillier cryptosystem with the key pair prepared once. Ciphertexts are decimal strings, so
+// that the database can multiply them with numeric arithmetic: the product of ciphertexts
+// modulo modulus() is the ciphertext of the sum of the plaintexts. Encryption is randomized.
+// Immutable once created, so a single context may be shared between threads.
+class HomomorphicContext {
+public:
+  virtual ~HomomorphicContext() = default;
+
+  // Square of the public modulus in decimal
+  virtual const std::string& modulus() const PURE;
+
+  virtual void encrypt(int64_t value, std::string& out) const PURE;
+  // Decrypts a ciphertext or a product of ciphertexts into the signed decimal sum
+  virtual Result decrypt(absl::string_view ciphertext, std::string& out) const PURE;
+};
+
+using HomomorphicContextPtr = std::unique_ptr<HomomorphicContext>;
+using HomomorphicContextConstSharedPtr = std::shared_ptr<const HomomorphicContext>;
+
 class UtilityExt {
 public:
   virtual ~UtilityExt() = default;
@@ -28,6 +101,14 @@ public:
 
   virtual std::vector<uint8_t> AESEncrypt(const std::vector<uint8_t>& key, absl::string_view plain_data) PURE;
   virtual Result AESDecrypt(const std::vector<uint8_t>& key, absl::string_view encrypted_data, std::vector<uint8_t>& out) PURE;
+  virtual AESDecryptionContextPtr createAESDecryptionContext(const std::vector<uint8_t>& key) PURE;
+  virtual AESEncryptionContextPtr createAESEncryptionContext(const std::vector<uint8_t>& key) PURE;
+  virtual OrderPreservingContextPtr createOrderPreservingContext(const std::vector<uint8_t>& key) PURE;
+  virtual HMACContextPtr createHMACContext(const std::vector<uint8_t>& key) PURE;
+  // Deterministically derives the Paillier key pair from a 256-bit key. Searching for the primes
+  // is expensive, so the result should be kept and passed to createHomomorphicContext
+  virtual std::vector<uint8_t> deriveHomomorphicKey(const std::vector<uint8_t>& key) PURE;
+  virtual HomomorphicContextPtr createHomomorphicContext(const std::vector<uint8_t>& key) PURE;
 
   virtual std::vector<uint8_t> getSha256Digest(absl::string_view data) PURE;
 };
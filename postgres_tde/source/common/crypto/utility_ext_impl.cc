@@ -4,13 +4,16 @@
 #include "source/common/crypto/crypto_impl.h"
 
 #include "absl/container/fixed_array.h"
+#include "absl/numeric/int128.h"
 #include "absl/strings/ascii.h"
 #include "absl/strings/str_cat.h"
 
 #include "absl/strings/escaping.h"
 
+#include "openssl/bn.h"
 #include "openssl/rand.h"
 #include "openssl/evp.h"
+#include "openssl/hmac.h"
 #include "openssl/sha.h"
 
 namespace Envoy {
@@ -20,6 +23,86 @@ namespace Crypto {
 
 static const size_t AES_256_KEY_LENGTH = 32;
 static const size_t AES_CBC_IV_LENGTH = 16;
+// Primes of the Paillier key, giving a 2048-bit modulus
+static const size_t PAILLIER_PRIME_LENGTH = 128;
+
+namespace {
+
+// splitmix64 finalizer
+inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+inline uint64_t load64(const uint8_t* data) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+bssl::UniquePtr<BIGNUM> newBignum() {
+  bssl::UniquePtr<BIGNUM> bn(BN_new());
+  RELEASE_ASSERT(bn != nullptr, "bignum allocation failed");
+  return bn;
+}
+
+bssl::UniquePtr<BIGNUM> copyBignum(const BIGNUM* value) {
+  bssl::UniquePtr<BIGNUM> bn(BN_dup(value));
+  RELEASE_ASSERT(bn != nullptr, "bignum allocation failed");
+  return bn;
+}
+
+bssl::UniquePtr<BN_MONT_CTX> newMontgomeryContext(const BIGNUM* modulus, BN_CTX* ctx) {
+  bssl::UniquePtr<BN_MONT_CTX> mont(BN_MONT_CTX_new());
+  RELEASE_ASSERT(mont != nullptr, "failed to init Montgomery context");
+  int ok = BN_MONT_CTX_set(mont.get(), modulus, ctx);
+  RELEASE_ASSERT(ok == 1, "failed to init Montgomery context");
+  return mont;
+}
+
+// Prime of PAILLIER_PRIME_LENGTH bytes, the search starts at the point expanded from the key
+// with HMAC-SHA256 and goes up, so the same key always gives the same prime
+bssl::UniquePtr<BIGNUM> derivePrime(const std::vector<uint8_t>& key, uint8_t label, BN_CTX* ctx) {
+  uint8_t seed[PAILLIER_PRIME_LENGTH];
+  for (size_t block = 0; block < PAILLIER_PRIME_LENGTH / SHA256_DIGEST_LENGTH; block++) {
+    const uint8_t message[] = {'p', 'a', 'i', 'l', 'l', 'i', 'e', 'r', label,
+                               static_cast<uint8_t>(block)};
+    uint8_t* out = HMAC(EVP_sha256(), key.data(), key.size(), message, sizeof(message),
+                        seed + block * SHA256_DIGEST_LENGTH, nullptr);
+    RELEASE_ASSERT(out != nullptr, "homomorphic key derivation failed");
+  }
+
+  bssl::UniquePtr<BIGNUM> prime(BN_bin2bn(seed, sizeof(seed), nullptr));
+  RELEASE_ASSERT(prime != nullptr, "homomorphic key derivation failed");
+
+  // Two top bits make the product of two primes exactly twice as long, the bottom one makes
+  // the candidate odd
+  int ok = BN_set_bit(prime.get(), PAILLIER_PRIME_LENGTH * 8 - 1) &&
+           BN_set_bit(prime.get(), PAILLIER_PRIME_LENGTH * 8 - 2) && BN_set_bit(prime.get(), 0);
+  RELEASE_ASSERT(ok == 1, "homomorphic key derivation failed");
+
+  while (true) {
+    int is_prime = BN_is_prime_fasttest_ex(prime.get(), BN_prime_checks, ctx, 1, nullptr);
+    RELEASE_ASSERT(is_prime >= 0, "homomorphic key derivation failed");
+    if (is_prime == 1) {
+      break;
+    }
+    ok = BN_add_word(prime.get(), 2);
+    RELEASE_ASSERT(ok == 1, "homomorphic key derivation failed");
+  }
+
+  RELEASE_ASSERT(static_cast<size_t>(BN_num_bytes(prime.get())) == PAILLIER_PRIME_LENGTH,
+                 "homomorphic key derivation failed");
+  return prime;
+}
+
+} // namespace
 
 std::vector<uint8_t> UtilityExtImpl::GenerateAESKey() {
   std::vector<uint8_t> key(AES_256_KEY_LENGTH);
@@ -112,6 +195,360 @@ Result UtilityExtImpl::AESDecrypt(const std::vector<uint8_t>& key, absl::string_
   return Result::ok;
 }
 
+AESDecryptionContextPtr UtilityExtImpl::createAESDecryptionContext(const std::vector<uint8_t>& key) {
+  return std::make_unique<AESDecryptionContextImpl>(key);
+}
+
+AESDecryptionContextImpl::AESDecryptionContextImpl(const std::vector<uint8_t>& key) {
+  RELEASE_ASSERT(key.size() == AES_256_KEY_LENGTH, "invalid key length");
+
+  // Expand the key once, IV is set for each value separately
+  int ok = EVP_DecryptInit_ex(ctx_.get(), EVP_aes_256_cbc(), NULL, key.data(), NULL);
+  RELEASE_ASSERT(ok == 1, "Failed to init decryption context");
+}
+
+Result AESDecryptionContextImpl::decrypt(absl::string_view cipher_data, std::vector<uint8_t>& out) {
+  if (cipher_data.size() < AES_CBC_IV_LENGTH) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+
+  // IV is placed at the beginning of cipher_data by AESEncrypt
+  int ok = EVP_DecryptInit_ex(ctx_.get(), NULL, NULL, NULL,
+                              reinterpret_cast<const uint8_t*>(cipher_data.data()));
+  if (ok != 1) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+
+  int encrypted_data_size = cipher_data.size() - AES_CBC_IV_LENGTH;
+  out.resize(encrypted_data_size);
+  int plain_data_size = 0;
+
+  int size = 0;
+  ok = EVP_DecryptUpdate(ctx_.get(), out.data(), &size,
+                         reinterpret_cast<const uint8_t*>(cipher_data.data()) + AES_CBC_IV_LENGTH,
+                         encrypted_data_size);
+  if (ok != 1) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+  plain_data_size = size;
+
+  ok = EVP_DecryptFinal_ex(ctx_.get(), out.data() + plain_data_size, &size);
+  if (ok != 1) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+  plain_data_size += size;
+
+  ASSERT(plain_data_size <= encrypted_data_size);
+  out.resize(plain_data_size);
+  return Result::ok;
+}
+
+AESEncryptionContextPtr UtilityExtImpl::createAESEncryptionContext(const std::vector<uint8_t>& key) {
+  return std::make_unique<AESEncryptionContextImpl>(key);
+}
+
+AESEncryptionContextImpl::AESEncryptionContextImpl(const std::vector<uint8_t>& key) {
+  RELEASE_ASSERT(key.size() == AES_256_KEY_LENGTH, "invalid key length");
+
+  // Expand the key once, IV is set for each value separately
+  int ok = EVP_EncryptInit_ex(ctx_.get(), EVP_aes_256_cbc(), NULL, key.data(), NULL);
+  RELEASE_ASSERT(ok == 1, "Failed to init encryption context");
+}
+
+void AESEncryptionContextImpl::encrypt(absl::string_view plain_data, std::vector<uint8_t>& out) {
+  int block_size = EVP_CIPHER_CTX_block_size(ctx_.get());
+  int max_encrypted_data_size = Utils::max_ciphertext_size(plain_data.size(), block_size);
+  out.resize(AES_CBC_IV_LENGTH + max_encrypted_data_size);
+
+  // Output starts with IV, as in AESEncrypt
+  int ok = RAND_bytes(out.data(), AES_CBC_IV_LENGTH);
+  RELEASE_ASSERT(ok == 1, "encryption failed");
+
+  ok = EVP_EncryptInit_ex(ctx_.get(), NULL, NULL, NULL, out.data());
+  RELEASE_ASSERT(ok == 1, "encryption failed");
+
+  int encrypted_data_size = 0;
+  int size = 0;
+  ok = EVP_EncryptUpdate(ctx_.get(), out.data() + AES_CBC_IV_LENGTH, &size,
+                         reinterpret_cast<const uint8_t*>(plain_data.data()), plain_data.size());
+  RELEASE_ASSERT(ok == 1, "encryption failed");
+  encrypted_data_size = size;
+
+  ok = EVP_EncryptFinal_ex(ctx_.get(), out.data() + AES_CBC_IV_LENGTH + encrypted_data_size,
+                           &size);
+  RELEASE_ASSERT(ok == 1, "encryption failed");
+  encrypted_data_size += size;
+
+  ASSERT(encrypted_data_size <= max_encrypted_data_size);
+  out.resize(AES_CBC_IV_LENGTH + encrypted_data_size);
+}
+
+OrderPreservingContextPtr UtilityExtImpl::createOrderPreservingContext(const std::vector<uint8_t>& key) {
+  return std::make_unique<OrderPreservingContextImpl>(key);
+}
+
+OrderPreservingContextImpl::OrderPreservingContextImpl(const std::vector<uint8_t>& key) {
+  int ok = HMAC_Init_ex(ctx_.get(), key.data(), key.size(), EVP_sha256(), nullptr);
+  RELEASE_ASSERT(ok == 1, "Failed to init HMAC context");
+}
+
+void OrderPreservingContextImpl::encrypt(uint64_t value, std::vector<uint8_t>& out) {
+  // The domain [0, 2^64) is mapped into the range [0, 2^127) by descending the binary tree of
+  // the domain. The range of each node is split between its children at a pseudorandom point,
+  // so that each child keeps at least as many range points as it has domain points. The split
+  // points depend only on the key and the path to the node, which makes the mapping
+  // deterministic and strictly increasing.
+  // One HMAC of the bits above each byte of the value is computed and stretched over the
+  // 8 levels of the byte, so a value costs 8 HMACs instead of 64.
+  absl::uint128 range_begin = 0;
+  absl::uint128 range_size = absl::uint128(1) << 127;
+  uint8_t prf[SHA256_DIGEST_LENGTH];
+  uint8_t message[9];
+
+  for (int byte_idx = 0; byte_idx < 8; byte_idx++) {
+    uint64_t prefix = byte_idx == 0 ? 0 : value >> (64 - 8 * byte_idx);
+    message[0] = byte_idx;
+    for (size_t i = 0; i < 8; i++) {
+      message[1 + i] = static_cast<uint8_t>(prefix >> (56 - 8 * i));
+    }
+
+    // Reuses the key set in the constructor
+    int ok = HMAC_Init_ex(ctx_.get(), nullptr, 0, nullptr, nullptr);
+    RELEASE_ASSERT(ok == 1, "order-preserving encryption failed");
+    ok = HMAC_Update(ctx_.get(), message, sizeof(message));
+    RELEASE_ASSERT(ok == 1, "order-preserving encryption failed");
+    ok = HMAC_Final(ctx_.get(), prf, nullptr);
+    RELEASE_ASSERT(ok == 1, "order-preserving encryption failed");
+
+    uint64_t seed_high = load64(prf);
+    uint64_t seed_low = load64(prf + 8);
+    uint8_t byte = static_cast<uint8_t>(value >> (56 - 8 * byte_idx));
+
+    for (int bit_idx = 0; bit_idx < 8; bit_idx++) {
+      int level = 8 * byte_idx + bit_idx;
+      absl::uint128 domain_size = absl::uint128(1) << (64 - level);
+      absl::uint128 slack = range_size - domain_size;
+
+      // Node of the byte subtree, numbered as in a binary heap
+      uint64_t node = (1u << bit_idx) | (bit_idx == 0 ? 0 : byte >> (8 - bit_idx));
+      absl::uint128 random = absl::MakeUint128(mix64(seed_high ^ (node * 0x9e3779b97f4a7c15ULL)),
+                                               mix64(seed_low ^ (node * 0xc2b2ae3d27d4eb4fULL)));
+
+      // Uniform split point, both children get at least half of the domain size
+      absl::uint128 left_size = domain_size / 2 + random % (slack + 1);
+      if ((byte >> (7 - bit_idx)) & 1) {
+        range_begin += left_size;
+        range_size -= left_size;
+      } else {
+        range_size = left_size;
+      }
+    }
+
+    if (byte_idx == 7) {
+      // Leaf, the value is placed randomly within its range
+      absl::uint128 random = absl::MakeUint128(mix64(load64(prf + 16) ^ byte),
+                                               mix64(load64(prf + 24) ^ byte));
+      range_begin += random % range_size;
+    }
+  }
+
+  // Big-endian, so that byte strings compare in the order of the values
+  out.resize(CIPHERTEXT_SIZE);
+  uint64_t high = absl::Uint128High64(range_begin);
+  uint64_t low = absl::Uint128Low64(range_begin);
+  for (size_t i = 0; i < 8; i++) {
+    out[i] = static_cast<uint8_t>(high >> (56 - 8 * i));
+    out[8 + i] = static_cast<uint8_t>(low >> (56 - 8 * i));
+  }
+}
+
+HMACContextPtr UtilityExtImpl::createHMACContext(const std::vector<uint8_t>& key) {
+  return std::make_unique<HMACContextImpl>(key);
+}
+
+HMACContextImpl::HMACContextImpl(const std::vector<uint8_t>& key) {
+  int ok = HMAC_Init_ex(ctx_.get(), key.data(), key.size(), EVP_sha256(), nullptr);
+  RELEASE_ASSERT(ok == 1, "Failed to init HMAC context");
+}
+
+void HMACContextImpl::compute(absl::string_view data, std::vector<uint8_t>& out) {
+  out.resize(SHA256_DIGEST_LENGTH);
+
+  // Reuses the key set in the constructor
+  int ok = HMAC_Init_ex(ctx_.get(), nullptr, 0, nullptr, nullptr);
+  RELEASE_ASSERT(ok == 1, "HMAC computation failed");
+  ok = HMAC_Update(ctx_.get(), reinterpret_cast<const uint8_t*>(data.data()), data.size());
+  RELEASE_ASSERT(ok == 1, "HMAC computation failed");
+  ok = HMAC_Final(ctx_.get(), out.data(), nullptr);
+  RELEASE_ASSERT(ok == 1, "HMAC computation failed");
+}
+
+std::vector<uint8_t> UtilityExtImpl::deriveHomomorphicKey(const std::vector<uint8_t>& key) {
+  RELEASE_ASSERT(key.size() == AES_256_KEY_LENGTH, "invalid key length");
+
+  bssl::UniquePtr<BN_CTX> ctx(BN_CTX_new());
+  RELEASE_ASSERT(ctx != nullptr, "homomorphic key derivation failed");
+
+  bssl::UniquePtr<BIGNUM> p = derivePrime(key, 0, ctx.get());
+  bssl::UniquePtr<BIGNUM> q = derivePrime(key, 1, ctx.get());
+  RELEASE_ASSERT(BN_cmp(p.get(), q.get()) != 0, "homomorphic key derivation failed");
+
+  // [p][q], both big-endian
+  std::vector<uint8_t> out(2 * PAILLIER_PRIME_LENGTH);
+  BN_bn2bin(p.get(), out.data());
+  BN_bn2bin(q.get(), out.data() + PAILLIER_PRIME_LENGTH);
+  return out;
+}
+
+HomomorphicContextPtr UtilityExtImpl::createHomomorphicContext(const std::vector<uint8_t>& key) {
+  return std::make_unique<HomomorphicContextImpl>(key);
+}
+
+HomomorphicContextImpl::HomomorphicContextImpl(const std::vector<uint8_t>& key)
+    : p_(BN_bin2bn(key.data(), PAILLIER_PRIME_LENGTH, nullptr)),
+      q_(BN_bin2bn(key.data() + PAILLIER_PRIME_LENGTH, PAILLIER_PRIME_LENGTH, nullptr)),
+      n_(newBignum()), n_squared_(newBignum()), half_n_(newBignum()), p_squared_(newBignum()),
+      q_squared_(newBignum()), mask_exponent_p_(newBignum()), mask_exponent_q_(newBignum()),
+      q_squared_inverse_(newBignum()), lambda_(newBignum()), mu_(newBignum()) {
+  RELEASE_ASSERT(key.size() == 2 * PAILLIER_PRIME_LENGTH, "invalid key length");
+  bssl::UniquePtr<BN_CTX> bn_ctx(BN_CTX_new());
+  RELEASE_ASSERT(bn_ctx != nullptr && p_ != nullptr && q_ != nullptr,
+                 "Failed to init homomorphic context");
+
+  BN_CTX* ctx = bn_ctx.get();
+  bssl::UniquePtr<BIGNUM> p_minus_one = copyBignum(p_.get());
+  bssl::UniquePtr<BIGNUM> q_minus_one = copyBignum(q_.get());
+  bssl::UniquePtr<BIGNUM> phi_p_squared = newBignum();
+  bssl::UniquePtr<BIGNUM> phi_q_squared = newBignum();
+
+  int ok = BN_mul(n_.get(), p_.get(), q_.get(), ctx) &&
+           BN_sqr(n_squared_.get(), n_.get(), ctx) && BN_rshift1(half_n_.get(), n_.get()) &&
+           BN_sqr(p_squared_.get(), p_.get(), ctx) && BN_sqr(q_squared_.get(), q_.get(), ctx) &&
+           BN_sub_word(p_minus_one.get(), 1) && BN_sub_word(q_minus_one.get(), 1) &&
+           BN_mul(lambda_.get(), p_minus_one.get(), q_minus_one.get(), ctx) &&
+           BN_mul(phi_p_squared.get(), p_.get(), p_minus_one.get(), ctx) &&
+           BN_mul(phi_q_squared.get(), q_.get(), q_minus_one.get(), ctx) &&
+           BN_nnmod(mask_exponent_p_.get(), n_.get(), phi_p_squared.get(), ctx) &&
+           BN_nnmod(mask_exponent_q_.get(), n_.get(), phi_q_squared.get(), ctx) &&
+           BN_mod_inverse(q_squared_inverse_.get(), q_squared_.get(), p_squared_.get(), ctx) &&
+           BN_mod_inverse(mu_.get(), lambda_.get(), n_.get(), ctx);
+  RELEASE_ASSERT(ok == 1, "Failed to init homomorphic context");
+
+  mont_p_squared_ = newMontgomeryContext(p_squared_.get(), ctx);
+  mont_q_squared_ = newMontgomeryContext(q_squared_.get(), ctx);
+  mont_n_squared_ = newMontgomeryContext(n_squared_.get(), ctx);
+
+  char* modulus = BN_bn2dec(n_squared_.get());
+  RELEASE_ASSERT(modulus != nullptr, "Failed to init homomorphic context");
+  modulus_ = modulus;
+  OPENSSL_free(modulus);
+}
+
+void HomomorphicContextImpl::randomMask(BIGNUM* out, BN_CTX* ctx) const {
+  bssl::UniquePtr<BIGNUM> r = newBignum();
+  bssl::UniquePtr<BIGNUM> gcd = newBignum();
+  bssl::UniquePtr<BIGNUM> reduced = newBignum();
+  bssl::UniquePtr<BIGNUM> mask_p = newBignum();
+  bssl::UniquePtr<BIGNUM> mask_q = newBignum();
+
+  // r must be coprime with n
+  int ok;
+  do {
+    ok = BN_rand_range(r.get(), n_.get()) && BN_gcd(gcd.get(), r.get(), n_.get(), ctx);
+    RELEASE_ASSERT(ok == 1, "homomorphic encryption failed");
+  } while (!BN_is_one(gcd.get()));
+
+  ok = BN_nnmod(reduced.get(), r.get(), p_squared_.get(), ctx) &&
+       BN_mod_exp_mont(mask_p.get(), reduced.get(), mask_exponent_p_.get(), p_squared_.get(), ctx,
+                       mont_p_squared_.get()) &&
+       BN_nnmod(reduced.get(), r.get(), q_squared_.get(), ctx) &&
+       BN_mod_exp_mont(mask_q.get(), reduced.get(), mask_exponent_q_.get(), q_squared_.get(), ctx,
+                       mont_q_squared_.get()) &&
+       // mask = mask_q + q^2 * ((mask_p - mask_q) * (q^2)^-1 mod p^2)
+       BN_mod_sub(out, mask_p.get(), mask_q.get(), p_squared_.get(), ctx) &&
+       BN_mod_mul(out, out, q_squared_inverse_.get(), p_squared_.get(), ctx) &&
+       BN_mul(out, out, q_squared_.get(), ctx) && BN_add(out, out, mask_q.get());
+  RELEASE_ASSERT(ok == 1, "homomorphic encryption failed");
+}
+
+void HomomorphicContextImpl::encrypt(int64_t value, std::string& out) const {
+  // Scratch space of each call, the precomputed values are only read
+  bssl::UniquePtr<BN_CTX> bn_ctx(BN_CTX_new());
+  RELEASE_ASSERT(bn_ctx != nullptr, "homomorphic encryption failed");
+  BN_CTX* ctx = bn_ctx.get();
+  bssl::UniquePtr<BIGNUM> message = newBignum();
+  bssl::UniquePtr<BIGNUM> mask = newBignum();
+
+  // Negative values are represented as n - |value|
+  int ok = BN_set_u64(message.get(), value < 0 ? -static_cast<uint64_t>(value) : value);
+  if (ok == 1 && value < 0) {
+    ok = BN_sub(message.get(), n_.get(), message.get());
+  }
+  RELEASE_ASSERT(ok == 1, "homomorphic encryption failed");
+
+  randomMask(mask.get(), ctx);
+
+  // c = g^m * r^n mod n^2, where g = n + 1, so g^m = 1 + m * n mod n^2
+  ok = BN_mul(message.get(), message.get(), n_.get(), ctx) && BN_add_word(message.get(), 1) &&
+       BN_mod_mul(message.get(), message.get(), mask.get(), n_squared_.get(), ctx);
+  RELEASE_ASSERT(ok == 1, "homomorphic encryption failed");
+
+  char* ciphertext = BN_bn2dec(message.get());
+  RELEASE_ASSERT(ciphertext != nullptr, "homomorphic encryption failed");
+  out = ciphertext;
+  OPENSSL_free(ciphertext);
+}
+
+Result HomomorphicContextImpl::decrypt(absl::string_view ciphertext, std::string& out) const {
+  bssl::UniquePtr<BN_CTX> bn_ctx(BN_CTX_new());
+  if (bn_ctx == nullptr) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+  BN_CTX* ctx = bn_ctx.get();
+
+  // BN_dec2bn needs a null-terminated string
+  std::string ciphertext_str(ciphertext);
+  BIGNUM* parsed = nullptr;
+  if (ciphertext_str.empty() ||
+      BN_dec2bn(&parsed, ciphertext_str.c_str()) != static_cast<int>(ciphertext_str.size())) {
+    BN_free(parsed);
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+  bssl::UniquePtr<BIGNUM> value(parsed);
+  if (BN_is_negative(value.get()) || BN_is_zero(value.get()) ||
+      BN_cmp(value.get(), n_squared_.get()) >= 0) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+
+  // m = L(c^lambda mod n^2) * mu mod n, where L(x) = (x - 1) / n
+  bssl::UniquePtr<BIGNUM> power = newBignum();
+  bssl::UniquePtr<BIGNUM> remainder = newBignum();
+  int ok = BN_mod_exp_mont(power.get(), value.get(), lambda_.get(), n_squared_.get(), ctx,
+                           mont_n_squared_.get()) &&
+           BN_sub_word(power.get(), 1) &&
+           BN_div(value.get(), remainder.get(), power.get(), n_.get(), ctx);
+  if (ok != 1 || !BN_is_zero(remainder.get())) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+
+  ok = BN_mod_mul(value.get(), value.get(), mu_.get(), n_.get(), ctx);
+  // Values above n / 2 are negative
+  if (ok == 1 && BN_cmp(value.get(), half_n_.get()) > 0) {
+    ok = BN_sub(value.get(), value.get(), n_.get());
+  }
+  if (ok != 1) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+
+  char* plaintext = BN_bn2dec(value.get());
+  if (plaintext == nullptr) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+  out = plaintext;
+  OPENSSL_free(plaintext);
+  return Result::ok;
+}
+
 std::vector<uint8_t> UtilityExtImpl::getSha256Digest(absl::string_view data) {
   std::vector<uint8_t> digest(SHA256_DIGEST_LENGTH);
   bssl::ScopedEVP_MD_CTX ctx;
@@ -2,11 +2,89 @@
 
 #include "postgres_tde/source/common/crypto/utility_ext.h"
 
+#include "openssl/bn.h"
+#include "openssl/evp.h"
+#include "openssl/hmac.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace Common {
 namespace Crypto {
 
+class AESDecryptionContextImpl : public AESDecryptionContext {
+public:
+  explicit AESDecryptionContextImpl(const std::vector<uint8_t>& key);
+
+  Result decrypt(absl::string_view cipher_data, std::vector<uint8_t>& out) override;
+
+private:
+  bssl::ScopedEVP_CIPHER_CTX ctx_;
+};
+
+class AESEncryptionContextImpl : public AESEncryptionContext {
+public:
+  explicit AESEncryptionContextImpl(const std::vector<uint8_t>& key);
+
+  void encrypt(absl::string_view plain_data, std::vector<uint8_t>& out) override;
+
+private:
+  bssl::ScopedEVP_CIPHER_CTX ctx_;
+};
+
+class OrderPreservingContextImpl : public OrderPreservingContext {
+public:
+  explicit OrderPreservingContextImpl(const std::vector<uint8_t>& key);
+
+  void encrypt(uint64_t value, std::vector<uint8_t>& out) override;
+
+private:
+  bssl::ScopedHMAC_CTX ctx_;
+};
+
+class HMACContextImpl : public HMACContext {
+public:
+  explicit HMACContextImpl(const std::vector<uint8_t>& key);
+
+  void compute(absl::string_view data, std::vector<uint8_t>& out) override;
+
+private:
+  bssl::ScopedHMAC_CTX ctx_;
+};
+
+class HomomorphicContextImpl : public HomomorphicContext {
+public:
+  explicit HomomorphicContextImpl(const std::vector<uint8_t>& key);
+
+  const std::string& modulus() const override { return modulus_; }
+
+  void encrypt(int64_t value, std::string& out) const override;
+  Result decrypt(absl::string_view ciphertext, std::string& out) const override;
+
+private:
+  // r^n mod n^2 computed over p^2 and q^2 and combined by CRT
+  void randomMask(BIGNUM* out, BN_CTX* ctx) const;
+
+  bssl::UniquePtr<BIGNUM> p_;
+  bssl::UniquePtr<BIGNUM> q_;
+  bssl::UniquePtr<BIGNUM> n_;
+  bssl::UniquePtr<BIGNUM> n_squared_;
+  bssl::UniquePtr<BIGNUM> half_n_;
+  bssl::UniquePtr<BIGNUM> p_squared_;
+  bssl::UniquePtr<BIGNUM> q_squared_;
+  // n mod p(p-1) and n mod q(q-1), exponents of the mask
+  bssl::UniquePtr<BIGNUM> mask_exponent_p_;
+  bssl::UniquePtr<BIGNUM> mask_exponent_q_;
+  // (q^2)^-1 mod p^2
+  bssl::UniquePtr<BIGNUM> q_squared_inverse_;
+  // lambda = (p-1)(q-1) and mu = lambda^-1 mod n
+  bssl::UniquePtr<BIGNUM> lambda_;
+  bssl::UniquePtr<BIGNUM> mu_;
+  bssl::UniquePtr<BN_MONT_CTX> mont_p_squared_;
+  bssl::UniquePtr<BN_MONT_CTX> mont_q_squared_;
+  bssl::UniquePtr<BN_MONT_CTX> mont_n_squared_;
+  std::string modulus_;
+};
+
 class UtilityExtImpl : public UtilityExt {
 public:
   std::vector<uint8_t> GenerateAESKey() override;
@@ -14,6 +92,12 @@ public:
   std::vector<uint8_t> AESEncrypt(const std::vector<uint8_t>& key, absl::string_view plain_data) override;
   Result AESDecrypt(const std::vector<uint8_t>& key, absl::string_view cipher_data,
                     std::vector<uint8_t>& out) override;
+  AESDecryptionContextPtr createAESDecryptionContext(const std::vector<uint8_t>& key) override;
+  AESEncryptionContextPtr createAESEncryptionContext(const std::vector<uint8_t>& key) override;
+  OrderPreservingContextPtr createOrderPreservingContext(const std::vector<uint8_t>& key) override;
+  HMACContextPtr createHMACContext(const std::vector<uint8_t>& key) override;
+  std::vector<uint8_t> deriveHomomorphicKey(const std::vector<uint8_t>& key) override;
+  HomomorphicContextPtr createHomomorphicContext(const std::vector<uint8_t>& key) override;
 
   std::vector<uint8_t> getSha256Digest(absl::string_view data) override;
 };
@@ -55,6 +55,24 @@ Result DumpVisitor::visitExpression(hsql::Expr* expr) {
   }
   case hsql::kExprArray:
     return visitArrayExpression(expr);
+  case hsql::kExprFunctionRef:
+    query_str_ << expr->name << "(";
+    if (expr->distinct) {
+      query_str_ << "DISTINCT ";
+    }
+    if (expr->exprList != nullptr) {
+      for (size_t i = 0; i < expr->exprList->size(); i++) {
+        if (i != 0) {
+          query_str_ << ", ";
+        }
+        CHECK_RESULT(visitExpression((*expr->exprList)[i]));
+      }
+    }
+    query_str_ << ")";
+    if (expr->alias != nullptr) {
+      query_str_ << " AS " << expr->alias;
+    }
+    return Result::ok;
   default:
     return Result::makeError("postgres_tde: unable to dump query");
   }
@@ -96,6 +114,16 @@ Result DumpVisitor::visitOperatorExpression(hsql::Expr* expr) {
     query_str_ << ")";
     return Result::ok;
 
+  case hsql::kOpNone:
+    // Custom operator produced by a mutator
+    ASSERT(expr->name != nullptr);
+    query_str_ << "(";
+    CHECK_RESULT(visitExpression(expr->expr));
+    query_str_ << ") " << expr->name << " (";
+    CHECK_RESULT(visitExpression(expr->expr2));
+    query_str_ << ")";
+    return Result::ok;
+
   case hsql::kOpIsNull:
     query_str_ << "(";
     CHECK_RESULT(visitExpression(expr->expr));
@@ -115,6 +143,17 @@ Result DumpVisitor::visitOperatorExpression(hsql::Expr* expr) {
     query_str_ << ")";
     return Result::ok;
 
+  case hsql::kOpBetween:
+    ASSERT(expr->exprList->size() == 2);
+    query_str_ << "(";
+    CHECK_RESULT(visitExpression(expr->expr));
+    query_str_ << ") BETWEEN (";
+    CHECK_RESULT(visitExpression((*expr->exprList)[0]));
+    query_str_ << ") AND (";
+    CHECK_RESULT(visitExpression((*expr->exprList)[1]));
+    query_str_ << ")";
+    return Result::ok;
+
   default:
     PANIC("not implemented");;
   }
@@ -283,6 +322,17 @@ Result DumpVisitor::visitUpdateStatement(hsql::UpdateStatement* stmt) {
   return Result::ok;
 }
 
+Result DumpVisitor::visitDeleteStatement(hsql::DeleteStatement* stmt) {
+  query_str_ << "DELETE FROM " << stmt->tableName;
+
+  if (stmt->expr != nullptr) {
+    query_str_ << " WHERE ";
+    CHECK_RESULT(visitExpression(stmt->expr));
+  }
+
+  return Result::ok;
+}
+
 const char* DumpVisitor::operatorToString(hsql::OperatorType type) {
   switch (type) {
   case hsql::kOpNone:
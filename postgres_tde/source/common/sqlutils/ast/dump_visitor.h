@@ -29,6 +29,7 @@ protected:
   Result visitSelectStatement(hsql::SelectStatement* stmt) override;
   Result visitInsertStatement(hsql::InsertStatement* stmt) override;
   Result visitUpdateStatement(hsql::UpdateStatement* stmt) override;
+  Result visitDeleteStatement(hsql::DeleteStatement* stmt) override;
 
   static const char* operatorToString(hsql::OperatorType type);
 
@@ -30,8 +30,8 @@ Result Visitor::visitStatement(hsql::SQLStatement* stmt) {
   case hsql::kStmtDelete:
     return visitDeleteStatement(dynamic_cast<hsql::DeleteStatement*>(stmt));
   default:
-    // TODO: DDL statements
-    PANIC("not implemented");;
+    // DDL statements are handled before parsing, see DDLRewriter
+    return Result::makeError("postgres_tde: unsupported statement type");
   }
 }
 
@@ -60,8 +60,8 @@ Result Visitor::visitExpression(hsql::Expr* expr) {
 
       // Save possible aliases to this column
 
-      const auto& table_name = getTableNameByAlias(expr->table);
-      auto [column, _] = select_columns_.insert(ColumnRef(table_name, expr->name));
+      absl::string_view table_name = getTableNameByAlias(expr->table);
+      auto [column, _] = select_columns_.insert(ColumnRef(std::string(table_name), expr->name));
 
       if (expr->alias != nullptr) {
         // Save actual alias if present
@@ -72,8 +72,8 @@ Result Visitor::visitExpression(hsql::Expr* expr) {
         // Basically we just should associate column name with that column,
         // but multiple columns with the same name can appear in RowDescription as the result of
         // join. It can't be dealt in easy way, so we just ban it
-        if (select_column_aliases_.find(expr->name) != select_column_aliases_.end() &&
-            *select_column_aliases_.at(expr->name) != *column) {
+        auto it = select_column_aliases_.find(expr->name);
+        if (it != select_column_aliases_.end() && *it->second != *column) {
           return Result::makeError(fmt::format("postgres_tde: detected ambiguous column name {}. "
                                                "Please specify a different alias for each column",
                                                expr->name));
@@ -87,6 +87,18 @@ Result Visitor::visitExpression(hsql::Expr* expr) {
 
     return Result::ok;
   }
+  case hsql::kExprFunctionRef:
+    // Arguments are visited as any other expressions, the function itself is up to the
+    // mutators. Star is allowed only as an argument, as in COUNT(*)
+    if (expr->exprList != nullptr) {
+      for (hsql::Expr* arg : *expr->exprList) {
+        if (!arg->isType(hsql::kExprStar)) {
+          CHECK_RESULT(visitExpression(arg));
+        }
+      }
+    }
+
+    return Result::ok;
   default:
     PANIC("not implemented");;
   }
@@ -122,7 +134,16 @@ Result Visitor::visitOperatorExpression(hsql::Expr* expr) {
   case hsql::kOpExists:
     return visitExpression(expr->expr);
 
+  case hsql::kOpNone:
+    // Binary operator unknown to the parser (like @> for arrays) produced by a mutator,
+    // the operator text is kept as the name of the expression
+    ASSERT(expr->name != nullptr);
+    CHECK_RESULT(visitExpression(expr->expr));
+    CHECK_RESULT(visitExpression(expr->expr2));
+    return Result::ok;
+
   case hsql::kOpIn:
+  case hsql::kOpBetween:
     CHECK_RESULT(visitExpression(expr->expr));
     for (hsql::Expr* exp : *expr->exprList) {
       CHECK_RESULT(visitExpression(exp));
@@ -145,11 +166,13 @@ Result Visitor::visitSelectStatement(hsql::SelectStatement* stmt) {
   bool in_select_body_old = in_select_body_;
   bool in_join_condition_old = in_join_condition_;
   bool in_group_by_old = in_group_by_;
-  in_select_body_ = in_join_condition_ = in_group_by_ = false;
+  bool in_order_by_old = in_order_by_;
+  in_select_body_ = in_join_condition_ = in_group_by_ = in_order_by_ = false;
   absl::Cleanup state_flag_restorer = [&, this]() {
     in_select_body_ = in_select_body_old;
     in_join_condition_ = in_join_condition_old;
     in_group_by_ = in_group_by_old;
+    in_order_by_ = in_order_by_old;
   };
 
   if (stmt->unionSelect != nullptr) {
@@ -185,9 +208,11 @@ Result Visitor::visitSelectStatement(hsql::SelectStatement* stmt) {
   }
 
   if (stmt->order != nullptr) {
+    in_order_by_ = true;
     for (hsql::OrderDescription* desc : *stmt->order) {
       CHECK_RESULT(visitExpression(desc->expr));
     }
+    in_order_by_ = false;
   }
 
   return Result::ok;
@@ -261,25 +286,30 @@ Result Visitor::visitUpdateStatement(hsql::UpdateStatement* stmt) {
   return Result::ok;
 }
 
-Result Visitor::visitDeleteStatement(hsql::DeleteStatement*) {
-  return Result::makeError("postgres_tde: unsupported");
-  // TODO:
+Result Visitor::visitDeleteStatement(hsql::DeleteStatement* stmt) {
+  if (stmt->expr != nullptr) {
+    CHECK_RESULT(visitExpression(stmt->expr));
+  }
+
+  return Result::ok;
 }
 
-std::string Visitor::getTableNameByAlias(const std::string& alias) const {
-  if (table_aliases_.find(alias) == table_aliases_.end()) {
+absl::string_view Visitor::getTableNameByAlias(absl::string_view alias) const {
+  auto it = table_aliases_.find(alias);
+  if (it == table_aliases_.end()) {
     return alias;
   }
 
-  return table_aliases_.at(alias);
+  return it->second;
 }
 
-const ColumnRef* Visitor::getSelectColumnByAlias(const std::string& alias) const {
-  if (select_column_aliases_.find(alias) == select_column_aliases_.end()) {
+const ColumnRef* Visitor::getSelectColumnByAlias(absl::string_view alias) const {
+  auto it = select_column_aliases_.find(alias);
+  if (it == select_column_aliases_.end()) {
     return nullptr;
   }
 
-  return select_column_aliases_.at(alias);
+  return it->second;
 }
 
 bool Visitor::isColumnSelected(const ColumnRef& column) const {
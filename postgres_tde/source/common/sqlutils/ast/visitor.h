@@ -4,6 +4,8 @@
 #include "envoy/common/platform.h"
 #include "source/common/common/logger.h"
 #include "postgres_tde/source/common/utils/utils.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 
 #define CHECK_RESULT(EXPR) { \
   Result result = (EXPR); \
@@ -49,18 +51,20 @@ protected:
   virtual Result visitUpdateStatement(hsql::UpdateStatement* stmt);
   virtual Result visitDeleteStatement(hsql::DeleteStatement* stmt);
 
-  std::string getTableNameByAlias(const std::string& alias) const;
-  const ColumnRef* getSelectColumnByAlias(const std::string& alias) const;
+  // Returned view is valid until the next statement is visited
+  absl::string_view getTableNameByAlias(absl::string_view alias) const;
+  const ColumnRef* getSelectColumnByAlias(absl::string_view alias) const;
   bool isColumnSelected(const ColumnRef& column) const;
 
 protected:
   bool in_select_body_{false};
   bool in_join_condition_{false};
   bool in_group_by_{false};
+  bool in_order_by_{false};
 
-  std::unordered_map<std::string, std::string> table_aliases_;
+  absl::flat_hash_map<std::string, std::string> table_aliases_;
   std::set<ColumnRef> select_columns_;
-  std::unordered_map<std::string, const ColumnRef*> select_column_aliases_;
+  absl::flat_hash_map<std::string, const ColumnRef*> select_column_aliases_;
 };
 
 using VisitorPtr = std::unique_ptr<Visitor>;
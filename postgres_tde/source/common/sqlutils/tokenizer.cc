@@ -0,0 +1,188 @@
+#include "postgres_tde/source/common/sqlutils/tokenizer.h"
+
+#include "source/common/common/assert.h"
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_replace.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Common {
+namespace SQLUtils {
+
+namespace {
+
+inline bool isWordStart(char c) {
+  return absl::ascii_isalpha(c) || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+}
+
+inline bool isWordChar(char c) { return isWordStart(c) || absl::ascii_isdigit(c) || c == '$'; }
+
+// Finds the end of the quoted text started at pos, the quote is escaped by doubling.
+// Returns npos if the quote is not terminated
+size_t skipQuoted(absl::string_view query, size_t pos, char quote, bool backslash_escapes) {
+  ASSERT(query[pos] == quote);
+  pos++;
+  while (pos < query.size()) {
+    if (backslash_escapes && query[pos] == '\\') {
+      pos += 2;
+      continue;
+    }
+    if (query[pos] == quote) {
+      if (pos + 1 < query.size() && query[pos + 1] == quote) {
+        pos += 2;
+        continue;
+      }
+      return pos + 1;
+    }
+    pos++;
+  }
+  return absl::string_view::npos;
+}
+
+// Returns the length of the dollar quote tag ($tag$) at pos, 0 if there is no tag
+size_t dollarTagLength(absl::string_view query, size_t pos) {
+  ASSERT(query[pos] == '$');
+  size_t end = pos + 1;
+  if (end < query.size() && isWordStart(query[end])) {
+    while (end < query.size() && isWordChar(query[end]) && query[end] != '$') {
+      end++;
+    }
+  }
+  if (end < query.size() && query[end] == '$') {
+    return end - pos + 1;
+  }
+  return 0;
+}
+
+} // namespace
+
+bool tokenizeStatement(absl::string_view query, std::vector<Token>& tokens) {
+  tokens.clear();
+
+  size_t pos = 0;
+  while (pos < query.size()) {
+    char c = query[pos];
+    size_t begin = pos;
+
+    if (absl::ascii_isspace(c)) {
+      pos++;
+      continue;
+    }
+
+    if (c == '-' && pos + 1 < query.size() && query[pos + 1] == '-') {
+      // Line comment
+      pos = query.find('\n', pos);
+      if (pos == absl::string_view::npos) {
+        pos = query.size();
+      }
+      continue;
+    }
+
+    if (c == '/' && pos + 1 < query.size() && query[pos + 1] == '*') {
+      // Block comments may be nested
+      size_t depth = 0;
+      do {
+        if (pos + 1 >= query.size()) {
+          return false;
+        }
+        if (query[pos] == '/' && query[pos + 1] == '*') {
+          depth++;
+          pos += 2;
+        } else if (query[pos] == '*' && query[pos + 1] == '/') {
+          depth--;
+          pos += 2;
+        } else {
+          pos++;
+        }
+      } while (depth > 0);
+      continue;
+    }
+
+    if (c == '\'') {
+      pos = skipQuoted(query, pos, '\'', false);
+      if (pos == absl::string_view::npos) {
+        return false;
+      }
+      tokens.push_back(
+          Token{Token::Type::Literal, std::string(query.substr(begin, pos - begin)), begin, pos});
+      continue;
+    }
+
+    if (c == '"') {
+      pos = skipQuoted(query, pos, '"', false);
+      if (pos == absl::string_view::npos) {
+        return false;
+      }
+      std::string ident =
+          absl::StrReplaceAll(query.substr(begin + 1, pos - begin - 2), {{"\"\"", "\""}});
+      tokens.push_back(Token{Token::Type::QuotedIdentifier, std::move(ident), begin, pos});
+      continue;
+    }
+
+    if (c == '$') {
+      size_t tag_length = dollarTagLength(query, pos);
+      if (tag_length > 0) {
+        // Dollar-quoted string
+        absl::string_view tag = query.substr(pos, tag_length);
+        size_t end = query.find(tag, pos + tag_length);
+        if (end == absl::string_view::npos) {
+          return false;
+        }
+        pos = end + tag_length;
+        tokens.push_back(
+            Token{Token::Type::Literal, std::string(query.substr(begin, pos - begin)), begin, pos});
+        continue;
+      }
+    }
+
+    if (isWordStart(c)) {
+      while (pos < query.size() && isWordChar(query[pos])) {
+        pos++;
+      }
+
+      if (pos - begin == 1 && pos < query.size() && query[pos] == '\'') {
+        // E'...', B'...', X'...' and N'...' string constants
+        char prefix = absl::ascii_tolower(c);
+        if (prefix == 'e' || prefix == 'b' || prefix == 'x' || prefix == 'n') {
+          pos = skipQuoted(query, pos, '\'', prefix == 'e');
+          if (pos == absl::string_view::npos) {
+            return false;
+          }
+          tokens.push_back(Token{Token::Type::Literal,
+                                 std::string(query.substr(begin, pos - begin)), begin, pos});
+          continue;
+        }
+      }
+
+      tokens.push_back(Token{Token::Type::Word,
+                             absl::AsciiStrToLower(query.substr(begin, pos - begin)), begin, pos});
+      continue;
+    }
+
+    if (absl::ascii_isdigit(c)) {
+      while (pos < query.size() &&
+             (absl::ascii_isalnum(query[pos]) || query[pos] == '.' || query[pos] == '_')) {
+        pos++;
+      }
+      tokens.push_back(
+          Token{Token::Type::Literal, std::string(query.substr(begin, pos - begin)), begin, pos});
+      continue;
+    }
+
+    pos++;
+    tokens.push_back(Token{Token::Type::Symbol, std::string(1, c), begin, pos});
+  }
+
+  return true;
+}
+
+std::string quoteIdentifier(absl::string_view ident) {
+  return absl::StrCat("\"", absl::StrReplaceAll(ident, {{"\"", "\"\""}}), "\"");
+}
+
+} // namespace SQLUtils
+} // namespace Common
+} // namespace Extensions
+} // namespace Envoy
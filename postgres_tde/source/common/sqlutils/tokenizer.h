@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Common {
+namespace SQLUtils {
+
+// Lexical token of a Postgres statement
+struct Token {
+  enum class Type {
+    // Keyword or unquoted identifier, value is folded to lower case as Postgres does
+    Word,
+    // "Quoted identifier", value is unquoted
+    QuotedIdentifier,
+    // String literal or number, value is the original text
+    Literal,
+    // Any other single character (punctuation, operators)
+    Symbol,
+  };
+
+  Type type_;
+  std::string value_;
+  // Position of the token in the statement text
+  size_t begin_;
+  size_t end_;
+
+  bool isWord(absl::string_view word) const { return type_ == Type::Word && value_ == word; }
+  bool isSymbol(char c) const {
+    return type_ == Type::Symbol && value_.size() == 1 && value_[0] == c;
+  }
+  bool isIdentifier() const { return type_ == Type::Word || type_ == Type::QuotedIdentifier; }
+};
+
+/**
+ * Splits the statement text into tokens, skipping whitespaces and comments
+ *
+ * This is a lightweight lexer for the statements that are not supported by the SQL parser
+ * (COPY, DDL). It's only concerned with the token boundaries, so that such statements can be
+ * recognized and rewritten by splicing the original text.
+ * Returns false if the text can't be tokenized (unterminated literal or comment).
+ */
+bool tokenizeStatement(absl::string_view query, std::vector<Token>& tokens);
+
+// Returns the identifier quoted for use in a generated statement
+std::string quoteIdentifier(absl::string_view ident);
+
+} // namespace SQLUtils
+} // namespace Common
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,46 @@
+#include "postgres_tde/source/filters/network/postgres_tde/bucket_index_encoder.h"
+
+#include "source/common/crypto/utility.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+BucketIndexEncoder::BucketIndexEncoder(const ColumnConfig& column_config)
+    : key_(column_config.bucketIndexKey()), data_type_(column_config.origDataType()),
+      width_(column_config.bucketWidth()) {
+  ASSERT(OrderedValue::isSupportedType(data_type_));
+}
+
+void BucketIndexEncoder::encode(const OrderedValue& value, std::vector<uint8_t>& out) const {
+  encodeBucket(bucket(value), out);
+}
+
+void BucketIndexEncoder::encodeBucket(int64_t bucket, std::vector<uint8_t>& out) const {
+  // Bucket number is hashed as a big-endian 64-bit integer
+  uint8_t data[sizeof(bucket)];
+  uint64_t bits = static_cast<uint64_t>(bucket);
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = static_cast<uint8_t>(bits >> (8 * (sizeof(data) - 1 - i)));
+  }
+
+  auto& crypto_util = Envoy::Common::Crypto::UtilitySingleton::get();
+  out = crypto_util.getSha256Hmac(
+      key_, absl::string_view(reinterpret_cast<const char*>(data), sizeof(data)));
+}
+
+bool BucketIndexEncoder::encodeText(absl::string_view value, std::vector<uint8_t>& out) const {
+  OrderedValue ordered_value;
+  if (!OrderedValue::fromText(data_type_, value, ordered_value)) {
+    return false;
+  }
+
+  encode(ordered_value, out);
+  return true;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
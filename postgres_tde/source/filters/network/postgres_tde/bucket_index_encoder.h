@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/config/column_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Computes values of the bucket index column
+ *
+ * The index value is the HMAC of the number of the bucket the value falls into, so all the
+ * values of a bucket share the index value, and a range is looked up by the index values of
+ * the buckets it covers.
+ */
+class BucketIndexEncoder {
+public:
+  explicit BucketIndexEncoder(const ColumnConfig& column_config);
+
+  void encode(const OrderedValue& value, std::vector<uint8_t>& out) const;
+  void encodeBucket(int64_t bucket, std::vector<uint8_t>& out) const;
+
+  // Returns false if the value is not valid for the column type
+  bool encodeText(absl::string_view value, std::vector<uint8_t>& out) const;
+
+  int64_t bucket(const OrderedValue& value) const { return value.bucket(width_); }
+
+private:
+  const std::vector<uint8_t>& key_;
+  int32_t data_type_;
+  uint64_t width_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace Envoy {
@@ -9,6 +10,23 @@ namespace PostgresTDE {
 
 inline const std::string POSTGRES_TDE_FILTER_NAME = "envoy.filters.network.postgres_tde";
 
+// OIDs of the original data types the values are interpreted by
+constexpr int32_t BOOLOID = 16;
+constexpr int32_t INT8OID = 20;
+constexpr int32_t INT2OID = 21;
+constexpr int32_t INT4OID = 23;
+constexpr int32_t TEXTOID = 25;
+constexpr int32_t FLOAT4OID = 700;
+constexpr int32_t FLOAT8OID = 701;
+constexpr int32_t BPCHAROID = 1042;
+constexpr int32_t VARCHAROID = 1043;
+constexpr int32_t DATEOID = 1082;
+constexpr int32_t TIMESTAMPOID = 1114;
+constexpr int32_t NUMERICOID = 1700;
+constexpr int32_t UUIDOID = 2950;
+
+constexpr int64_t USECS_PER_SECOND = 1000000;
+
 } // namespace PostgresTDE
 } // namespace NetworkFilters
 } // namespace Extensions
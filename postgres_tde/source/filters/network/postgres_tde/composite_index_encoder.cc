@@ -0,0 +1,31 @@
+#include "postgres_tde/source/filters/network/postgres_tde/composite_index_encoder.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+CompositeIndexEncoder::CompositeIndexEncoder(const CompositeIndexConfig& index_config)
+    : CompositeIndexEncoder(index_config.key()) {}
+
+CompositeIndexEncoder::CompositeIndexEncoder(const std::vector<uint8_t>& key)
+    : ctx_(Common::Crypto::UtilityExtSingleton::get().createHMACContext(key)) {}
+
+void CompositeIndexEncoder::addValue(absl::string_view hash_input) {
+  // Length is a big-endian 32-bit integer
+  uint32_t size = static_cast<uint32_t>(hash_input.size());
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    input_.push_back(static_cast<char>(size >> shift));
+  }
+  input_.append(hash_input.data(), hash_input.size());
+}
+
+void CompositeIndexEncoder::encode(std::vector<uint8_t>& out) {
+  ctx_->compute(input_, out);
+  input_.clear();
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/composite_index_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Computes values of the composite blind index column
+ *
+ * The index value is the HMAC of the blind index inputs of the tuple values, each one
+ * prefixed with its length, so that different tuples never produce the same input.
+ * Not thread safe.
+ */
+class CompositeIndexEncoder {
+public:
+  explicit CompositeIndexEncoder(const CompositeIndexConfig& index_config);
+
+  // Computes the index values with the given key, e.g. one of the previous keys of the index
+  explicit CompositeIndexEncoder(const std::vector<uint8_t>& key);
+
+  // Values are added in the order of the index columns, the same bytes as hashed by the
+  // blind index of the column
+  void addValue(absl::string_view hash_input);
+
+  // Computes the index value of the added values and starts a new tuple
+  void encode(std::vector<uint8_t>& out);
+
+private:
+  Common::Crypto::HMACContextPtr ctx_;
+  std::string input_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -21,6 +21,39 @@ NetworkFilters::PostgresTDE::PostgresTDEConfigFactory::createFilterFactoryFromPr
   config_options.terminate_ssl_ = proto_config.terminate_ssl();
   config_options.upstream_ssl_ = proto_config.upstream_ssl();
   config_options.permissive_parsing_ = proto_config.permissive_parsing();
+  config_options.proxy_sort_memory_limit_ = PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+      proto_config.proxy_sort(), memory_limit_bytes, 16 * 1024 * 1024);
+  config_options.proxy_sort_spill_directory_ = proto_config.proxy_sort().spill_directory();
+  if (config_options.proxy_sort_spill_directory_.empty()) {
+    config_options.proxy_sort_spill_directory_ = "/tmp";
+  }
+  config_options.proxy_sort_max_spill_size_ = PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+      proto_config.proxy_sort(), max_spill_bytes, 1024 * 1024 * 1024);
+  config_options.proxy_aggregation_memory_limit_ = PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+      proto_config.proxy_aggregation(), memory_limit_bytes, 16 * 1024 * 1024);
+  config_options.proxy_join_memory_limit_ = PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+      proto_config.proxy_join(), memory_limit_bytes, 16 * 1024 * 1024);
+  config_options.proxy_join_spill_directory_ = proto_config.proxy_join().spill_directory();
+  if (config_options.proxy_join_spill_directory_.empty()) {
+    config_options.proxy_join_spill_directory_ = "/tmp";
+  }
+  config_options.proxy_join_max_spill_size_ = PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+      proto_config.proxy_join(), max_spill_bytes, 1024 * 1024 * 1024);
+  config_options.semi_join_max_keys_ =
+      proto_config.has_semi_join()
+          ? PROTOBUF_GET_WRAPPED_OR_DEFAULT(proto_config.semi_join(), max_keys, 1000)
+          : 0;
+  if (proto_config.has_query_coalescing()) {
+    const auto& query_coalescing = proto_config.query_coalescing();
+    config_options.query_coalescer_provider_ = std::make_shared<QueryCoalescerProvider>(
+        context.serverFactoryContext().threadLocal(),
+        std::chrono::milliseconds(PROTOBUF_GET_MS_OR_DEFAULT(query_coalescing, result_ttl, 100)),
+        PROTOBUF_GET_WRAPPED_OR_DEFAULT(query_coalescing, max_result_bytes, 1024 * 1024),
+        PROTOBUF_GET_WRAPPED_OR_DEFAULT(query_coalescing, max_cache_bytes, 64 * 1024 * 1024));
+  }
+  config_options.encryption_config_provider_ = std::make_shared<EncryptionConfigProvider>(
+      proto_config, config_options.stats_prefix_, context.scope(),
+      context.serverFactoryContext(), context.initManager(), context.messageValidationVisitor());
 
   PostgresFilterConfigSharedPtr filter_config(
       std::make_shared<PostgresFilterConfig>(config_options, context.scope()));
@@ -1,32 +1,332 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "envoy/stats/stats.h"
+
+#include "source/common/common/assert.h"
 #include "source/common/common/logger.h"
 
+#include "absl/container/flat_hash_map.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/config/composite_index_config.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
 namespace PostgresTDE {
 
-struct ColumnConfig {
+/**
+ * Counters of a probabilistic join, named by the compared columns, e.g.
+ * <stat_prefix>.join.cities.id.city2region.id.rows_fetched
+ */
+struct JoinStats {
+  // Rows the join condition was checked on and the rows that matched
+  Stats::Counter& rows_fetched_;
+  Stats::Counter& rows_kept_;
+};
+
+/**
+ * Dense per-column record of the encryption config
+ *
+ * Records are created once when the config snapshot is built and are
+ * addressed by pointer afterwards, so all the accessors are plain loads.
+ */
+class ColumnConfig {
 public:
-  virtual ~ColumnConfig() = default;
+  ColumnConfig(uint32_t table_id, uint32_t column_id, std::string column_name)
+      : table_id_(table_id), column_id_(column_id), column_name_(std::move(column_name)) {}
+
+  // Interned identifiers, unique within the config snapshot
+  uint32_t tableId() const { return table_id_; }
+  uint32_t columnId() const { return column_id_; }
 
-  virtual const std::string& columnName() const PURE;
+  const std::string& columnName() const { return column_name_; }
 
   // Encryption
-  virtual bool isEncrypted() const PURE;
-  virtual const std::vector<uint8_t>& encryptionKey() const PURE;
-  virtual int32_t origDataType() const PURE;
-  virtual int16_t origDataSize() const PURE;
+  bool isEncrypted() const { return is_encrypted_; }
+
+  // Active key, used for encryption
+  const std::vector<uint8_t>& encryptionKey() const {
+    ASSERT(is_encrypted_);
+    return encryption_key_;
+  }
+
+  uint8_t encryptionKeyVersion() const {
+    ASSERT(is_encrypted_);
+    return encryption_key_version_;
+  }
+
+  // Key of the given version for decryption, nullptr if the version is unknown
+  const std::vector<uint8_t>* encryptionKey(uint8_t version) const {
+    ASSERT(is_encrypted_);
+    if (version == encryption_key_version_) {
+      return &encryption_key_;
+    }
+
+    for (const auto& [previous_version, key] : previous_encryption_keys_) {
+      if (previous_version == version) {
+        return &key;
+      }
+    }
+
+    return nullptr;
+  }
+
+  int32_t origDataType() const {
+    ASSERT(is_encrypted_);
+    return orig_data_type_;
+  }
+
+  int16_t origDataSize() const {
+    ASSERT(is_encrypted_);
+    return orig_data_size_;
+  }
 
   // Blind index
-  virtual bool hasBlindIndex() const PURE;
-  virtual const std::string& BIColumnName() const PURE;
-  virtual const std::vector<uint8_t>& BIKey() const PURE;
+  bool hasBlindIndex() const { return has_blind_index_; }
+
+  const std::string& BIColumnName() const {
+    ASSERT(has_blind_index_);
+    return bi_column_name_;
+  }
+
+  // Active key, used for the new values
+  const std::vector<uint8_t>& BIKey() const {
+    ASSERT(has_blind_index_);
+    return bi_key_;
+  }
+
+  // Keys still in use by the data during rotation, the lookups must match any of them
+  const std::vector<std::vector<uint8_t>>& previousBIKeys() const {
+    ASSERT(has_blind_index_);
+    return previous_bi_keys_;
+  }
 
   // Probabilistic join
-  virtual bool hasJoin() const PURE;
-  virtual const std::string& joinKeyColumnName() const PURE;
+  bool hasJoin() const { return has_join_; }
+
+  const std::string& joinKeyColumnName() const {
+    ASSERT(has_join_);
+    return join_key_column_name_;
+  }
+
+  // Size of the join keys of the new values
+  size_t joinKeySize() const {
+    ASSERT(has_join_);
+    return join_key_size_;
+  }
+
+  // Sizes of the join keys the rows of the column may have, they differ while the rows are
+  // rewritten after the size is changed
+  size_t minJoinKeySize() const {
+    ASSERT(has_join_);
+    return std::min(join_key_size_, previous_join_key_size_);
+  }
+
+  size_t maxJoinKeySize() const {
+    ASSERT(has_join_);
+    return std::max(join_key_size_, previous_join_key_size_);
+  }
+
+  // Counters of the joins with the other column, which must have join support as well
+  const JoinStats& joinStats(const ColumnConfig& other) const {
+    ASSERT(has_join_ && join_stats_.contains(&other));
+    return join_stats_.at(&other);
+  }
+
+  // Join executed by the proxy over the decrypted values
+  bool hasProxyJoin() const { return has_proxy_join_; }
+
+  // Order-preserving index
+  bool hasOrderIndex() const { return has_order_index_; }
+
+  const std::string& orderIndexColumnName() const {
+    ASSERT(has_order_index_);
+    return order_index_column_name_;
+  }
+
+  const std::vector<uint8_t>& orderIndexKey() const {
+    ASSERT(has_order_index_);
+    return order_index_key_;
+  }
+
+  // Bucket index
+  bool hasBucketIndex() const { return has_bucket_index_; }
+
+  const std::string& bucketIndexColumnName() const {
+    ASSERT(has_bucket_index_);
+    return bucket_index_column_name_;
+  }
+
+  const std::vector<uint8_t>& bucketIndexKey() const {
+    ASSERT(has_bucket_index_);
+    return bucket_index_key_;
+  }
+
+  // In the units of OrderedValue (microseconds for timestamps)
+  uint64_t bucketWidth() const {
+    ASSERT(has_bucket_index_);
+    return bucket_width_;
+  }
+
+  // Token index
+  bool hasTokenIndex() const { return has_token_index_; }
+
+  const std::string& tokenIndexColumnName() const {
+    ASSERT(has_token_index_);
+    return token_index_column_name_;
+  }
+
+  const std::vector<uint8_t>& tokenIndexKey() const {
+    ASSERT(has_token_index_);
+    return token_index_key_;
+  }
+
+  // Length of the n-grams in bytes
+  uint32_t tokenSize() const {
+    ASSERT(has_token_index_);
+    return token_size_;
+  }
+
+  // Homomorphic sum
+  bool hasHomomorphicSum() const { return has_homomorphic_sum_; }
+
+  const std::string& homomorphicColumnName() const {
+    ASSERT(has_homomorphic_sum_);
+    return homomorphic_column_name_;
+  }
+
+  // Paillier key pair derived from the configured key, the context is shared by all the
+  // queries of the snapshot
+  const Common::Crypto::HomomorphicContext& homomorphicContext() const {
+    ASSERT(has_homomorphic_sum_);
+    return *homomorphic_ctx_;
+  }
+
+  // Modulus of the ciphertext product in decimal, see HomomorphicContext::modulus
+  const std::string& homomorphicModulus() const {
+    ASSERT(has_homomorphic_sum_);
+    return homomorphic_ctx_->modulus();
+  }
+
+  // Composite blind indexes the column belongs to
+  const std::vector<const CompositeIndexConfig*>& compositeIndexes() const {
+    return composite_indexes_;
+  }
+
+  void setEncryption(std::vector<uint8_t> key, uint8_t key_version, int32_t orig_data_type,
+                     int16_t orig_data_size) {
+    is_encrypted_ = true;
+    encryption_key_ = std::move(key);
+    encryption_key_version_ = key_version;
+    orig_data_type_ = orig_data_type;
+    orig_data_size_ = orig_data_size;
+  }
+
+  void addPreviousEncryptionKey(uint8_t version, std::vector<uint8_t> key) {
+    previous_encryption_keys_.emplace_back(version, std::move(key));
+  }
+
+  void setBlindIndex(std::vector<uint8_t> key) {
+    has_blind_index_ = true;
+    bi_column_name_ = column_name_ + "_bi";
+    bi_key_ = std::move(key);
+  }
+
+  void addPreviousBIKey(std::vector<uint8_t> key) { previous_bi_keys_.push_back(std::move(key)); }
+
+  // previous_join_key_size is equal to join_key_size if the size isn't being changed
+  void setJoin(size_t join_key_size, size_t previous_join_key_size) {
+    has_join_ = true;
+    join_key_column_name_ = column_name_ + "_joinkey";
+    join_key_size_ = join_key_size;
+    previous_join_key_size_ = previous_join_key_size;
+  }
+
+  void addJoinStats(const ColumnConfig* other, JoinStats stats) {
+    join_stats_.emplace(other, stats);
+  }
+
+  void setOrderIndex(std::vector<uint8_t> key) {
+    has_order_index_ = true;
+    order_index_column_name_ = column_name_ + "_ore";
+    order_index_key_ = std::move(key);
+  }
+
+  void setBucketIndex(std::vector<uint8_t> key, uint64_t width) {
+    has_bucket_index_ = true;
+    bucket_index_column_name_ = column_name_ + "_bucket";
+    bucket_index_key_ = std::move(key);
+    bucket_width_ = width;
+  }
+
+  void addCompositeIndex(const CompositeIndexConfig* index) { composite_indexes_.push_back(index); }
+
+  void setProxyJoin() { has_proxy_join_ = true; }
+
+  void setTokenIndex(std::vector<uint8_t> key, uint32_t token_size) {
+    has_token_index_ = true;
+    token_index_column_name_ = column_name_ + "_tokens";
+    token_index_key_ = std::move(key);
+    token_size_ = token_size;
+  }
+
+  void setHomomorphicSum(Common::Crypto::HomomorphicContextConstSharedPtr ctx) {
+    has_homomorphic_sum_ = true;
+    homomorphic_column_name_ = column_name_ + "_he";
+    homomorphic_ctx_ = std::move(ctx);
+  }
+
+private:
+  uint32_t table_id_;
+  uint32_t column_id_;
+  std::string column_name_;
+
+  bool is_encrypted_{false};
+  bool has_blind_index_{false};
+  bool has_join_{false};
+  bool has_proxy_join_{false};
+  bool has_order_index_{false};
+  bool has_bucket_index_{false};
+  bool has_token_index_{false};
+  bool has_homomorphic_sum_{false};
+
+  uint8_t encryption_key_version_{0};
+  int32_t orig_data_type_{0};
+  int16_t orig_data_size_{0};
+  std::vector<uint8_t> encryption_key_;
+  std::vector<std::pair<uint8_t, std::vector<uint8_t>>> previous_encryption_keys_;
+
+  std::string bi_column_name_;
+  std::vector<uint8_t> bi_key_;
+  std::vector<std::vector<uint8_t>> previous_bi_keys_;
+
+  std::string join_key_column_name_;
+  size_t join_key_size_{0};
+  size_t previous_join_key_size_{0};
+  absl::flat_hash_map<const ColumnConfig*, JoinStats> join_stats_;
+
+  std::string order_index_column_name_;
+  std::vector<uint8_t> order_index_key_;
+
+  std::string bucket_index_column_name_;
+  std::vector<uint8_t> bucket_index_key_;
+  uint64_t bucket_width_{0};
+
+  std::string token_index_column_name_;
+  std::vector<uint8_t> token_index_key_;
+  uint32_t token_size_{0};
+
+  std::string homomorphic_column_name_;
+  Common::Crypto::HomomorphicContextConstSharedPtr homomorphic_ctx_;
+
+  std::vector<const CompositeIndexConfig*> composite_indexes_;
 };
 
 } // namespace PostgresTDE
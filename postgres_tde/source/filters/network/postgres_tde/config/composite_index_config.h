@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Blind index over a tuple of columns of a single table
+ *
+ * Records are owned by the config snapshot and are referenced by the ColumnConfig
+ * of each column of the tuple.
+ */
+class CompositeIndexConfig {
+public:
+  CompositeIndexConfig(std::vector<std::string> column_names, std::vector<uint8_t> key,
+                       std::vector<std::vector<uint8_t>> previous_keys, bool populated)
+      : column_names_(std::move(column_names)), key_(std::move(key)),
+        previous_keys_(std::move(previous_keys)), populated_(populated) {
+    for (const std::string& column_name : column_names_) {
+      column_name_.append(column_name).append("_");
+    }
+    column_name_.append("bi");
+  }
+
+  // Name of the index column
+  const std::string& columnName() const { return column_name_; }
+
+  // Columns of the tuple in the order they are hashed
+  const std::vector<std::string>& columnNames() const { return column_names_; }
+
+  const std::vector<uint8_t>& key() const { return key_; }
+
+  // Keys the existing rows may still be indexed with during key rotation
+  const std::vector<std::vector<uint8_t>>& previousKeys() const { return previous_keys_; }
+
+  // Whether all the rows have the index filled in, so lookups may be served by it
+  bool populated() const { return populated_; }
+
+private:
+  std::vector<std::string> column_names_;
+  std::string column_name_;
+  std::vector<uint8_t> key_;
+  std::vector<std::vector<uint8_t>> previous_keys_;
+  bool populated_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
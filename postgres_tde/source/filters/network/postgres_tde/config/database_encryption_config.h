@@ -1,6 +1,7 @@
 #pragma once
 
 #include "include/sqlparser/SQLParser.h"
+#include "absl/strings/string_view.h"
 #include "postgres_tde/source/common/utils/utils.h"
 #include "postgres_tde/source/filters/network/postgres_tde/config/column_config.h"
 
@@ -13,13 +14,16 @@ class DatabaseEncryptionConfig {
 public:
   virtual ~DatabaseEncryptionConfig() = default;
 
-  virtual const ColumnConfig* getColumnConfig(const std::string& table, const std::string& name) const PURE;
-  virtual bool hasTDEEnabled(const std::string& table) const PURE;
-  virtual size_t join_key_size() const PURE;
+  virtual const ColumnConfig* getColumnConfig(absl::string_view table, absl::string_view name) const PURE;
+  virtual bool hasTDEEnabled(absl::string_view table) const PURE;
 };
 
 using DatabaseEncryptionConfigPtr = std::unique_ptr<DatabaseEncryptionConfig>;
 
+// Encryption config is immutable once created, so a single instance is shared
+// between all the connections of the listener
+using DatabaseEncryptionConfigConstSharedPtr = std::shared_ptr<const DatabaseEncryptionConfig>;
+
 } // namespace PostgresTDE
 } // namespace NetworkFilters
 } // namespace Extensions
@@ -0,0 +1,186 @@
+#include "postgres_tde/source/filters/network/postgres_tde/config/encryption_config_provider.h"
+
+#include "envoy/common/exception.h"
+
+#include "source/common/protobuf/utility.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/keys/local_file_key_provider.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+EncryptionConfigProvider::EncryptionConfigProvider(
+    const envoy::extensions::filters::network::postgres_tde::PostgresTDE& proto_config,
+    const std::string& stats_prefix, Stats::Scope& scope,
+    Server::Configuration::ServerFactoryContext& context, Init::Manager& init_manager,
+    ProtobufMessage::ValidationVisitor& validation_visitor)
+    : schema_path_(proto_config.schema_path()), api_(context.api()),
+      validation_visitor_(validation_visitor), stats_prefix_(stats_prefix), scope_(scope),
+      stats_(generateStats(stats_prefix, scope)),
+      tls_(ThreadLocal::TypedSlot<ThreadLocalConfig>::makeUnique(context.threadLocal())),
+      init_target_("postgres_tde_encryption_schema",
+                   [this]() { applySchema(initial_schema_, [this]() { init_target_.ready(); }); }) {
+  if (proto_config.has_key_provider()) {
+    const auto& key_provider_config = proto_config.key_provider();
+    KeyProviderPtr key_provider;
+    switch (key_provider_config.provider_specifier_case()) {
+    case envoy::extensions::filters::network::postgres_tde::KeyProvider::kLocalFile:
+      key_provider = std::make_unique<LocalFileKeyProvider>(
+          key_provider_config.local_file(), context.api(), context.mainThreadDispatcher(),
+          validation_visitor);
+      break;
+    default:
+      PANIC_DUE_TO_CORRUPT_ENUM;
+    }
+
+    key_cache_ = std::make_unique<KeyCache>(std::move(key_provider), key_provider_config,
+                                            context.mainThreadDispatcher(), stats_prefix, scope,
+                                            [this]() { onKeysChanged(); });
+  }
+
+  // Errors in the initial schema are fatal
+  if (schema_path_.empty()) {
+    initial_schema_ = proto_config.schema();
+  } else {
+    initial_schema_ = loadSchemaFile();
+
+    watcher_ = context.mainThreadDispatcher().createFilesystemWatcher();
+    watcher_->addWatch(schema_path_,
+                       Filesystem::Watcher::Events::Modified | Filesystem::Watcher::Events::MovedTo,
+                       [this](uint32_t) { onSchemaFileChanged(); });
+  }
+
+  if (!SchemaConfig::externalKeyNames(initial_schema_).empty()) {
+    if (key_cache_ == nullptr) {
+      throw EnvoyException(
+          "postgres_tde: encryption schema references undefined keys, but no key provider is "
+          "configured");
+    }
+  } else {
+    // Validate the schema right away if it doesn't depend on the provider
+    SchemaConfig validated(initial_schema_, {}, stats_prefix_, scope_);
+  }
+
+  tls_->set([](Event::Dispatcher&) { return std::make_shared<ThreadLocalConfig>(nullptr); });
+  init_manager.add(init_target_);
+}
+
+DatabaseEncryptionConfigConstSharedPtr EncryptionConfigProvider::get() const {
+  return (*tls_)->config_;
+}
+
+EncryptionSchemaProto EncryptionConfigProvider::loadSchemaFile() {
+  EncryptionSchemaProto schema;
+  MessageUtil::loadFromFile(schema_path_, schema, validation_visitor_, api_);
+  MessageUtil::validate(schema, validation_visitor_);
+  return schema;
+}
+
+void EncryptionConfigProvider::onSchemaFileChanged() {
+  EncryptionSchemaProto schema;
+  TRY_ASSERT_MAIN_THREAD { schema = loadSchemaFile(); }
+  END_TRY
+  catch (const EnvoyException& e) {
+    ENVOY_LOG(warn, "postgres_tde: failed to reload encryption schema from {}, keeping the "
+                    "previous one: {}",
+              schema_path_, e.what());
+    stats_.schema_reload_failed_.inc();
+    return;
+  }
+
+  applySchema(schema, []() {});
+}
+
+void EncryptionConfigProvider::applySchema(const EncryptionSchemaProto& schema,
+                                           std::function<void()> on_done) {
+  std::vector<std::string> key_names = SchemaConfig::externalKeyNames(schema);
+  if (key_names.empty()) {
+    publish(schema, {});
+    on_done();
+    return;
+  }
+
+  if (key_cache_ == nullptr) {
+    ENVOY_LOG(warn, "postgres_tde: encryption schema references undefined keys, but no key "
+                    "provider is configured");
+    stats_.schema_reload_failed_.inc();
+    on_done();
+    return;
+  }
+
+  key_cache_->getKeys(key_names, [this, schema, on_done = std::move(on_done)](Result result,
+                                                                             KeyMap keys) {
+    if (!result.isOk) {
+      ENVOY_LOG(warn, "postgres_tde: unable to resolve encryption schema keys: {}",
+                result.error);
+      stats_.schema_reload_failed_.inc();
+    } else {
+      publish(schema, keys);
+    }
+
+    on_done();
+  });
+}
+
+void EncryptionConfigProvider::publish(const EncryptionSchemaProto& schema,
+                                       const KeyMap& provided_keys) {
+  DatabaseEncryptionConfigConstSharedPtr new_config;
+  TRY_ASSERT_MAIN_THREAD {
+    new_config =
+        std::make_shared<const SchemaConfig>(schema, provided_keys, stats_prefix_, scope_);
+  }
+  END_TRY
+  catch (const EnvoyException& e) {
+    ENVOY_LOG(warn, "postgres_tde: invalid encryption schema, keeping the previous one: {}",
+              e.what());
+    stats_.schema_reload_failed_.inc();
+    return;
+  }
+
+  ENVOY_LOG(info, "postgres_tde: encryption schema applied");
+  stats_.schema_reload_success_.inc();
+  current_schema_ = schema;
+  publishConfig(std::move(new_config));
+}
+
+void EncryptionConfigProvider::publishConfig(DatabaseEncryptionConfigConstSharedPtr config) {
+  // Workers pick up the new snapshot for the next query
+  tls_->runOnAllThreads([config](OptRef<ThreadLocalConfig> tls_config) {
+    if (tls_config.has_value()) {
+      tls_config->config_ = config;
+    }
+  });
+}
+
+void EncryptionConfigProvider::onKeysChanged() {
+  if (!current_schema_.has_value()) {
+    // The schema being applied gets the keys from the cache itself
+    return;
+  }
+
+  std::vector<std::string> key_names = SchemaConfig::externalKeyNames(*current_schema_);
+  if (key_names.empty()) {
+    return;
+  }
+
+  key_cache_->getKeys(key_names, [this, schema = *current_schema_](Result result, KeyMap keys) {
+    if (!result.isOk) {
+      // Queries are rejected until the keys can be fetched again
+      ENVOY_LOG(warn, "postgres_tde: encryption schema keys expired and can't be fetched, "
+                      "withdrawing the schema: {}",
+                result.error);
+      stats_.schema_keys_expired_.inc();
+      publishConfig(nullptr);
+      return;
+    }
+
+    publish(schema, keys);
+  });
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "envoy/filesystem/watcher.h"
+#include "envoy/init/manager.h"
+#include "envoy/server/factory_context.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "absl/types/optional.h"
+
+#include "source/common/common/logger.h"
+#include "source/common/init/target_impl.h"
+
+#include "postgres_tde/api/filters/network/postgres_tde/postgres_tde.pb.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/schema_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/keys/key_cache.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * All encryption schema stats. @see stats_macros.h
+ */
+#define ALL_ENCRYPTION_SCHEMA_STATS(COUNTER)                                                       \
+  COUNTER(schema_reload_success)                                                                   \
+  COUNTER(schema_reload_failed)                                                                    \
+  COUNTER(schema_keys_expired)
+
+/**
+ * Struct definition for all encryption schema stats. @see stats_macros.h
+ */
+struct EncryptionSchemaStats {
+  ALL_ENCRYPTION_SCHEMA_STATS(GENERATE_COUNTER_STRUCT)
+};
+
+/**
+ * Source of encryption config snapshots
+ *
+ * The schema is either defined inline in the filter config or loaded from a watched file.
+ * Each reload builds a new immutable snapshot which is then published to all the workers.
+ * Connections capture the snapshot at the beginning of each query, so queries in flight
+ * finish on the snapshot they were started with.
+ *
+ * Keys not defined in the schema are fetched from the key provider on the main thread
+ * before the snapshot is built, so the workers never wait for them. The listener
+ * is not ready until the initial snapshot is published. The snapshot is rebuilt once the
+ * key cache refreshes any of the keys to a new value, and is withdrawn once the keys
+ * expire and can't be fetched again, so the keys are used no longer than the cache TTL.
+ */
+class EncryptionConfigProvider : Logger::Loggable<Logger::Id::config> {
+public:
+  EncryptionConfigProvider(
+      const envoy::extensions::filters::network::postgres_tde::PostgresTDE& proto_config,
+      const std::string& stats_prefix, Stats::Scope& scope,
+      Server::Configuration::ServerFactoryContext& context, Init::Manager& init_manager,
+      ProtobufMessage::ValidationVisitor& validation_visitor);
+
+  // Returns the latest snapshot published to the calling worker, or nullptr
+  // if no valid schema has been published yet
+  DatabaseEncryptionConfigConstSharedPtr get() const;
+
+private:
+  struct ThreadLocalConfig : public ThreadLocal::ThreadLocalObject {
+    explicit ThreadLocalConfig(DatabaseEncryptionConfigConstSharedPtr config)
+        : config_(std::move(config)) {}
+
+    DatabaseEncryptionConfigConstSharedPtr config_;
+  };
+
+  EncryptionSchemaProto loadSchemaFile();
+  void onSchemaFileChanged();
+
+  // Resolves the keys, then builds and publishes the snapshot
+  void applySchema(const EncryptionSchemaProto& schema, std::function<void()> on_done);
+  void publish(const EncryptionSchemaProto& schema, const KeyMap& provided_keys);
+  void publishConfig(DatabaseEncryptionConfigConstSharedPtr config);
+  void onKeysChanged();
+
+  EncryptionSchemaStats generateStats(const std::string& prefix, Stats::Scope& scope) {
+    return EncryptionSchemaStats{ALL_ENCRYPTION_SCHEMA_STATS(POOL_COUNTER_PREFIX(scope, prefix))};
+  }
+
+  const std::string schema_path_;
+  Api::Api& api_;
+  ProtobufMessage::ValidationVisitor& validation_visitor_;
+  const std::string stats_prefix_;
+  Stats::Scope& scope_;
+  EncryptionSchemaStats stats_;
+
+  ThreadLocal::TypedSlotPtr<ThreadLocalConfig> tls_;
+  Filesystem::WatcherPtr watcher_;
+  KeyCachePtr key_cache_;
+
+  EncryptionSchemaProto initial_schema_;
+  // Schema of the latest snapshot, which is rebuilt once the keys change
+  absl::optional<EncryptionSchemaProto> current_schema_;
+  Init::TargetImpl init_target_;
+};
+
+using EncryptionConfigProviderSharedPtr = std::shared_ptr<EncryptionConfigProvider>;
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,325 @@
+#include "postgres_tde/source/filters/network/postgres_tde/config/schema_config.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/fmt.h"
+
+#include "absl/strings/str_join.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+constexpr size_t KEY_SIZE = 32;
+constexpr size_t DEFAULT_JOIN_KEY_SIZE = 1;
+constexpr uint32_t MAX_KEY_VERSION = 255;
+constexpr uint32_t DEFAULT_TOKEN_SIZE = 3;
+constexpr uint32_t MIN_TOKEN_SIZE = 2;
+constexpr uint32_t MAX_TOKEN_SIZE = 8;
+
+// Joined values are matched by their decrypted text, which is unique only for these types
+bool isProxyJoinType(int32_t data_type) {
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID:
+  case TEXTOID:
+  case VARCHAROID:
+  case UUIDOID:
+  case DATEOID:
+  case TIMESTAMPOID:
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::vector<uint8_t> getKey(const EncryptionSchemaProto& schema, const KeyMap& provided_keys,
+                            const std::string& key_name, const std::string& column_name) {
+  std::vector<uint8_t> key;
+  auto it = schema.keys().find(key_name);
+  if (it != schema.keys().end()) {
+    key.assign(it->second.begin(), it->second.end());
+  } else {
+    auto provided_it = provided_keys.find(key_name);
+    if (provided_it == provided_keys.end()) {
+      throw EnvoyException(
+          fmt::format("postgres_tde: unknown key '{}' referenced by column '{}'", key_name,
+                      column_name));
+    }
+    key = provided_it->second;
+  }
+
+  if (key.size() != KEY_SIZE) {
+    throw EnvoyException(fmt::format("postgres_tde: key '{}' must be {} bytes long, got {}",
+                                     key_name, KEY_SIZE, key.size()));
+  }
+
+  return key;
+}
+
+} // namespace
+
+SchemaConfig::SchemaConfig(const EncryptionSchemaProto& schema, const KeyMap& provided_keys,
+                           const std::string& stats_prefix, Stats::Scope& scope) {
+  size_t default_join_key_size =
+      schema.join_key_size() != 0 ? schema.join_key_size() : DEFAULT_JOIN_KEY_SIZE;
+
+  // Columns with join support as "<table>.<column>"
+  std::vector<std::pair<uint32_t, std::string>> join_columns;
+
+  uint32_t table_id = 0;
+  for (const auto& table : schema.tables()) {
+    if (!tables_.insert(table.name()).second) {
+      throw EnvoyException(fmt::format("postgres_tde: duplicate table '{}'", table.name()));
+    }
+
+    for (const auto& column : table.columns()) {
+      uint32_t column_id = columns_.size();
+      if (!column_index_.try_emplace(ColumnKey(table.name(), column.name()), column_id).second) {
+        throw EnvoyException(fmt::format("postgres_tde: duplicate column '{}.{}'", table.name(),
+                                         column.name()));
+      }
+
+      ColumnConfig& column_config = columns_.emplace_back(table_id, column_id, column.name());
+      if (!column.encryption_key().empty()) {
+        column_config.setEncryption(
+            getKey(schema, provided_keys, column.encryption_key(), column.name()),
+            static_cast<uint8_t>(column.encryption_key_version()), column.orig_data_type(),
+            static_cast<int16_t>(column.orig_data_size()));
+
+        for (const auto& [version, key_name] : column.previous_encryption_keys()) {
+          if (version > MAX_KEY_VERSION || version == column.encryption_key_version()) {
+            throw EnvoyException(fmt::format("postgres_tde: invalid key version {} for column '{}'",
+                                             version, column.name()));
+          }
+          column_config.addPreviousEncryptionKey(
+              static_cast<uint8_t>(version),
+              getKey(schema, provided_keys, key_name, column.name()));
+        }
+      } else if (!column.previous_encryption_keys().empty()) {
+        throw EnvoyException(fmt::format(
+            "postgres_tde: previous encryption keys are set for unencrypted column '{}'",
+            column.name()));
+      }
+
+      if (!column.blind_index_key().empty()) {
+        column_config.setBlindIndex(
+            getKey(schema, provided_keys, column.blind_index_key(), column.name()));
+
+        for (const std::string& key_name : column.previous_blind_index_keys()) {
+          column_config.addPreviousBIKey(getKey(schema, provided_keys, key_name, column.name()));
+        }
+      } else if (!column.previous_blind_index_keys().empty()) {
+        throw EnvoyException(fmt::format(
+            "postgres_tde: previous blind index keys are set for column '{}' without blind index",
+            column.name()));
+      }
+      if (column.join()) {
+        size_t join_key_size =
+            column.join_key_size() != 0 ? column.join_key_size() : default_join_key_size;
+        column_config.setJoin(join_key_size, column.previous_join_key_size() != 0
+                                                 ? column.previous_join_key_size()
+                                                 : join_key_size);
+        join_columns.emplace_back(column_id, fmt::format("{}.{}", table.name(), column.name()));
+      } else if (column.join_key_size() != 0 || column.previous_join_key_size() != 0) {
+        throw EnvoyException(fmt::format(
+            "postgres_tde: join key size is set for column '{}' without join support",
+            column.name()));
+      }
+
+      if (column.proxy_join()) {
+        if (!column_config.isEncrypted() || !isProxyJoinType(column.orig_data_type())) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: proxy join is not supported for column '{}', only encrypted "
+              "columns of integer, text, varchar, uuid, date and timestamp types can have it",
+              column.name()));
+        }
+        column_config.setProxyJoin();
+      }
+
+      if (!column.order_index_key().empty()) {
+        if (!column_config.isEncrypted() ||
+            !OrderedValue::isSupportedType(column.orig_data_type())) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: order index is not supported for column '{}', only encrypted "
+              "columns of integer, floating point, date and timestamp types can have it",
+              column.name()));
+        }
+        column_config.setOrderIndex(
+            getKey(schema, provided_keys, column.order_index_key(), column.name()));
+      }
+
+      if (!column.bucket_index_key().empty()) {
+        if (!column_config.isEncrypted() ||
+            !OrderedValue::isSupportedType(column.orig_data_type())) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: bucket index is not supported for column '{}', only encrypted "
+              "columns of integer, floating point, date and timestamp types can have it",
+              column.name()));
+        }
+
+        // Width of timestamp buckets is configured in seconds, but the values are microseconds
+        uint64_t unit = column.orig_data_type() == TIMESTAMPOID ? USECS_PER_SECOND : 1;
+        if (column.bucket_width() == 0 ||
+            column.bucket_width() > std::numeric_limits<int64_t>::max() / unit) {
+          throw EnvoyException(fmt::format("postgres_tde: invalid bucket width {} for column '{}'",
+                                           column.bucket_width(), column.name()));
+        }
+        column_config.setBucketIndex(
+            getKey(schema, provided_keys, column.bucket_index_key(), column.name()),
+            column.bucket_width() * unit);
+      }
+
+      if (!column.token_index_key().empty()) {
+        if (!column_config.isEncrypted() || (column.orig_data_type() != TEXTOID &&
+                                             column.orig_data_type() != VARCHAROID)) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: token index is not supported for column '{}', only encrypted "
+              "columns of text and varchar types can have it",
+              column.name()));
+        }
+
+        uint32_t token_size = column.token_size() == 0 ? DEFAULT_TOKEN_SIZE : column.token_size();
+        if (token_size < MIN_TOKEN_SIZE || token_size > MAX_TOKEN_SIZE) {
+          throw EnvoyException(fmt::format("postgres_tde: invalid token size {} for column '{}'",
+                                           token_size, column.name()));
+        }
+        column_config.setTokenIndex(
+            getKey(schema, provided_keys, column.token_index_key(), column.name()), token_size);
+      }
+
+      if (!column.homomorphic_key().empty()) {
+        if (!column_config.isEncrypted() ||
+            (column.orig_data_type() != INT2OID && column.orig_data_type() != INT4OID &&
+             column.orig_data_type() != INT8OID)) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: homomorphic sum is not supported for column '{}', only encrypted "
+              "columns of integer types can have it",
+              column.name()));
+        }
+        // Key pair and its context are prepared once per config snapshot, as searching for the
+        // primes and precomputing the Montgomery values are slow
+        auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+        std::vector<uint8_t> key = crypto_util_ext.deriveHomomorphicKey(
+            getKey(schema, provided_keys, column.homomorphic_key(), column.name()));
+        column_config.setHomomorphicSum(crypto_util_ext.createHomomorphicContext(key));
+      }
+    }
+
+    for (const auto& index : table.composite_indexes()) {
+      std::vector<ColumnConfig*> members;
+      for (const std::string& column_name : index.columns()) {
+        auto it = column_index_.find(ColumnKeyView(table.name(), column_name));
+        if (it == column_index_.end() || !columns_[it->second].isEncrypted()) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: column '{}.{}' of composite index must be an encrypted column",
+              table.name(), column_name));
+        }
+
+        ColumnConfig* member = &columns_[it->second];
+        if (std::find(members.begin(), members.end(), member) != members.end()) {
+          throw EnvoyException(fmt::format(
+              "postgres_tde: column '{}.{}' is repeated in composite index", table.name(),
+              column_name));
+        }
+        members.push_back(member);
+      }
+
+      const std::string index_name = absl::StrJoin(index.columns(), ", ");
+      std::vector<std::vector<uint8_t>> previous_keys;
+      for (const std::string& key_name : index.previous_keys()) {
+        previous_keys.push_back(getKey(schema, provided_keys, key_name, index_name));
+      }
+
+      const CompositeIndexConfig* index_config =
+          composite_indexes_
+              .emplace_back(std::make_unique<CompositeIndexConfig>(
+                  std::vector<std::string>(index.columns().begin(), index.columns().end()),
+                  getKey(schema, provided_keys, index.key(), index_name), std::move(previous_keys),
+                  index.populated()))
+              .get();
+      for (ColumnConfig* member : members) {
+        member->addCompositeIndex(index_config);
+      }
+    }
+
+    table_id++;
+  }
+
+  // Any two columns with join support may be joined, so the counters of every pair are resolved
+  // here rather than for each query
+  for (const auto& [left_id, left_name] : join_columns) {
+    for (const auto& [right_id, right_name] : join_columns) {
+      const std::string name = fmt::format("{}.join.{}.{}", stats_prefix, left_name, right_name);
+      columns_[left_id].addJoinStats(
+          &columns_[right_id], JoinStats{scope.counterFromString(name + ".rows_fetched"),
+                                         scope.counterFromString(name + ".rows_kept")});
+    }
+  }
+}
+
+std::vector<std::string> SchemaConfig::externalKeyNames(const EncryptionSchemaProto& schema) {
+  absl::flat_hash_set<std::string> names;
+  for (const auto& table : schema.tables()) {
+    for (const auto& column : table.columns()) {
+      std::vector<std::string> column_key_names = {
+          column.encryption_key(), column.blind_index_key(), column.order_index_key(),
+          column.bucket_index_key(), column.token_index_key(), column.homomorphic_key()};
+      for (const auto& [_, key_name] : column.previous_encryption_keys()) {
+        column_key_names.push_back(key_name);
+      }
+      column_key_names.insert(column_key_names.end(), column.previous_blind_index_keys().begin(),
+                              column.previous_blind_index_keys().end());
+
+      for (const std::string& key_name : column_key_names) {
+        if (!key_name.empty() && !schema.keys().contains(key_name)) {
+          names.insert(key_name);
+        }
+      }
+    }
+
+    for (const auto& index : table.composite_indexes()) {
+      std::vector<std::string> index_key_names = {index.key()};
+      index_key_names.insert(index_key_names.end(), index.previous_keys().begin(),
+                             index.previous_keys().end());
+
+      for (const std::string& key_name : index_key_names) {
+        if (!key_name.empty() && !schema.keys().contains(key_name)) {
+          names.insert(key_name);
+        }
+      }
+    }
+  }
+
+  return std::vector<std::string>(names.begin(), names.end());
+}
+
+const ColumnConfig* SchemaConfig::getColumnConfig(absl::string_view table,
+                                                  absl::string_view name) const {
+  auto it = column_index_.find(ColumnKeyView(table, name));
+  if (it == column_index_.end()) {
+    return nullptr;
+  }
+
+  return &columns_[it->second];
+}
+
+bool SchemaConfig::hasTDEEnabled(absl::string_view table) const {
+  return tables_.contains(table);
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "envoy/stats/scope.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+
+#include "postgres_tde/api/filters/network/postgres_tde/postgres_tde.pb.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/keys/key_provider.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using EncryptionSchemaProto = envoy::extensions::filters::network::postgres_tde::EncryptionSchema;
+
+/**
+ * Encryption config built from the EncryptionSchema proto
+ *
+ * Immutable once constructed - schema updates produce a new instance.
+ * Column records are stored densely and indexed by (table, column) name pairs,
+ * so a lookup by the names taken directly from the AST is a single hash probe
+ * without temporary strings.
+ */
+class SchemaConfig : public DatabaseEncryptionConfig {
+public:
+  // Keys not defined in the schema are taken from provided_keys. Join counters are created in
+  // the scope under <stats_prefix>.join.
+  // Throws EnvoyException if the schema is inconsistent
+  SchemaConfig(const EncryptionSchemaProto& schema, const KeyMap& provided_keys,
+               const std::string& stats_prefix, Stats::Scope& scope);
+
+  // Returns the names of the keys referenced by the schema but not defined in it
+  static std::vector<std::string> externalKeyNames(const EncryptionSchemaProto& schema);
+
+  const ColumnConfig* getColumnConfig(absl::string_view table,
+                                      absl::string_view name) const override;
+  bool hasTDEEnabled(absl::string_view table) const override;
+
+private:
+  using ColumnKey = std::pair<std::string, std::string>;
+  using ColumnKeyView = std::pair<absl::string_view, absl::string_view>;
+
+  // Allows lookups by ColumnKeyView
+  struct ColumnKeyHash {
+    using is_transparent = void;
+
+    size_t operator()(const ColumnKey& key) const {
+      return absl::HashOf(absl::string_view(key.first), absl::string_view(key.second));
+    }
+    size_t operator()(const ColumnKeyView& key) const {
+      return absl::HashOf(key.first, key.second);
+    }
+  };
+
+  struct ColumnKeyEq {
+    using is_transparent = void;
+
+    template <class L, class R> bool operator()(const L& left, const R& right) const {
+      return absl::string_view(left.first) == absl::string_view(right.first) &&
+             absl::string_view(left.second) == absl::string_view(right.second);
+    }
+  };
+
+  std::vector<ColumnConfig> columns_;
+  // Referenced by the columns, so the records must not move
+  std::vector<std::unique_ptr<CompositeIndexConfig>> composite_indexes_;
+  absl::flat_hash_map<ColumnKey, uint32_t, ColumnKeyHash, ColumnKeyEq> column_index_;
+  absl::flat_hash_set<std::string> tables_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
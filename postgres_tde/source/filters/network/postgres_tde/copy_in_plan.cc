@@ -0,0 +1,537 @@
+#include "postgres_tde/source/filters/network/postgres_tde/copy_in_plan.h"
+
+#include <algorithm>
+
+#include "source/common/common/assert.h"
+#include "source/common/common/fmt.h"
+#include "source/common/crypto/utility.h"
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+#include "postgres_tde/source/common/sqlutils/tokenizer.h"
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+constexpr absl::string_view COPY_NULL = "\\N";
+constexpr absl::string_view COPY_END_OF_DATA = "\\.";
+
+inline void appendHex(std::string& out, const uint8_t* data, size_t size) {
+  static constexpr char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < size; i++) {
+    out.push_back(digits[data[i] >> 4]);
+    out.push_back(digits[data[i] & 0xf]);
+  }
+}
+
+// Appends bytea hex input escaped for the COPY text format ("\\x0123...")
+inline void appendByteaHex(std::string& out, const uint8_t* data, size_t size) {
+  out.append("\\\\x");
+  appendHex(out, data, size);
+}
+
+inline int octalDigitValue(char c) { return (c >= '0' && c <= '7') ? c - '0' : -1; }
+
+inline int hexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = absl::ascii_tolower(c);
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// Removes backslash escapes of the COPY text format
+void unescapeCopyValue(absl::string_view value, std::string& out) {
+  out.clear();
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] != '\\' || i + 1 == value.size()) {
+      out.push_back(value[i]);
+      continue;
+    }
+
+    char c = value[++i];
+    switch (c) {
+    case 'b':
+      out.push_back('\b');
+      break;
+    case 'f':
+      out.push_back('\f');
+      break;
+    case 'n':
+      out.push_back('\n');
+      break;
+    case 'r':
+      out.push_back('\r');
+      break;
+    case 't':
+      out.push_back('\t');
+      break;
+    case 'v':
+      out.push_back('\v');
+      break;
+    case 'x': {
+      // \x followed by one or two hex digits
+      int code = 0;
+      size_t digits = 0;
+      while (digits < 2 && i + 1 < value.size() && hexDigitValue(value[i + 1]) >= 0) {
+        code = code * 16 + hexDigitValue(value[++i]);
+        digits++;
+      }
+      out.push_back(digits > 0 ? static_cast<char>(code) : 'x');
+      break;
+    }
+    default:
+      if (octalDigitValue(c) >= 0) {
+        // One to three octal digits
+        int code = octalDigitValue(c);
+        for (size_t digits = 1; digits < 3 && i + 1 < value.size() &&
+                                octalDigitValue(value[i + 1]) >= 0;
+             digits++) {
+          code = code * 8 + octalDigitValue(value[++i]);
+        }
+        out.push_back(static_cast<char>(code));
+      } else {
+        // Any other character is taken literally
+        out.push_back(c);
+      }
+    }
+  }
+}
+
+} // namespace
+
+bool CopyInPlan::parseStatement(absl::string_view query, Statement& statement) {
+  std::vector<Common::SQLUtils::Token> tokens;
+  if (!Common::SQLUtils::tokenizeStatement(query, tokens) || tokens.size() < 2 ||
+      !tokens[0].isWord("copy") || !tokens[1].isIdentifier()) {
+    // COPY (SELECT ...) TO is not a COPY into a table
+    return false;
+  }
+
+  statement = Statement{};
+  statement.table_ = tokens[1].value_;
+
+  size_t pos = 2;
+  if (pos + 1 < tokens.size() && tokens[pos].isSymbol('.') && tokens[pos + 1].isIdentifier()) {
+    // Schema-qualified name
+    statement.schema_ = std::move(statement.table_);
+    statement.table_ = tokens[pos + 1].value_;
+    pos += 2;
+  }
+
+  // (<columns>) FROM STDIN [;]
+  if (pos >= tokens.size() || !tokens[pos].isSymbol('(')) {
+    return true;
+  }
+  pos++;
+
+  while (pos < tokens.size() && tokens[pos].isIdentifier()) {
+    statement.columns_.push_back(tokens[pos++].value_);
+    if (pos < tokens.size() && tokens[pos].isSymbol(',')) {
+      pos++;
+    }
+  }
+  if (pos >= tokens.size() || !tokens[pos].isSymbol(')')) {
+    return true;
+  }
+  pos++;
+
+  if (pos + 1 >= tokens.size() || !tokens[pos].isWord("from") ||
+      !tokens[pos + 1].isWord("stdin")) {
+    return true;
+  }
+  pos += 2;
+
+  if (pos < tokens.size() && tokens[pos].isSymbol(';')) {
+    pos++;
+  }
+
+  statement.supported_ = pos == tokens.size() && !statement.columns_.empty();
+  return true;
+}
+
+void CopyInPlan::clear() {
+  active_ = false;
+  end_of_data_ = false;
+  rows_count_ = 0;
+  columns_.clear();
+  helpers_.clear();
+  composite_indexes_.clear();
+  pending_.clear();
+}
+
+Result CopyInPlan::compile(const DatabaseEncryptionConfig& config, const Statement& statement,
+                           std::string& query) {
+  ASSERT(statement.supported_);
+  clear();
+
+  auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+
+  query = "COPY ";
+  if (!statement.schema_.empty()) {
+    absl::StrAppend(&query, Common::SQLUtils::quoteIdentifier(statement.schema_), ".");
+  }
+  absl::StrAppend(&query, Common::SQLUtils::quoteIdentifier(statement.table_), " (");
+
+  std::string helper_columns;
+  for (size_t i = 0; i < statement.columns_.size(); i++) {
+    const std::string& column = statement.columns_[i];
+    absl::StrAppend(&query, i == 0 ? "" : ", ", Common::SQLUtils::quoteIdentifier(column));
+
+    auto column_config = config.getColumnConfig(statement.table_, column);
+    columns_.push_back(ColumnAction{column_config, nullptr, nullptr, nullptr, nullptr, nullptr});
+    if (column_config == nullptr) {
+      continue;
+    }
+
+    if (column_config->isEncrypted()) {
+      columns_.back().encryption_ctx_ =
+          crypto_util_ext.createAESEncryptionContext(column_config->encryptionKey());
+    }
+
+    if (column_config->hasBlindIndex()) {
+      helpers_.push_back(HelperColumn{i, HelperType::BlindIndex});
+      absl::StrAppend(&helper_columns, ", ",
+                      Common::SQLUtils::quoteIdentifier(column_config->BIColumnName()));
+    }
+
+    if (column_config->hasJoin()) {
+      helpers_.push_back(HelperColumn{i, HelperType::JoinKey});
+      absl::StrAppend(&helper_columns, ", ",
+                      Common::SQLUtils::quoteIdentifier(column_config->joinKeyColumnName()));
+    }
+
+    if (column_config->hasOrderIndex()) {
+      columns_.back().order_index_encoder_ = std::make_unique<OrderIndexEncoder>(*column_config);
+      helpers_.push_back(HelperColumn{i, HelperType::OrderIndex});
+      absl::StrAppend(&helper_columns, ", ",
+                      Common::SQLUtils::quoteIdentifier(column_config->orderIndexColumnName()));
+    }
+
+    if (column_config->hasBucketIndex()) {
+      columns_.back().bucket_index_encoder_ = std::make_unique<BucketIndexEncoder>(*column_config);
+      helpers_.push_back(HelperColumn{i, HelperType::BucketIndex});
+      absl::StrAppend(&helper_columns, ", ",
+                      Common::SQLUtils::quoteIdentifier(column_config->bucketIndexColumnName()));
+    }
+
+    if (column_config->hasTokenIndex()) {
+      columns_.back().token_index_encoder_ = std::make_unique<TokenIndexEncoder>(*column_config);
+      helpers_.push_back(HelperColumn{i, HelperType::TokenIndex});
+      absl::StrAppend(&helper_columns, ", ",
+                      Common::SQLUtils::quoteIdentifier(column_config->tokenIndexColumnName()));
+    }
+
+    if (column_config->hasHomomorphicSum()) {
+      columns_.back().homomorphic_ctx_ = &column_config->homomorphicContext();
+      helpers_.push_back(HelperColumn{i, HelperType::HomomorphicSum});
+      absl::StrAppend(&helper_columns, ", ",
+                      Common::SQLUtils::quoteIdentifier(column_config->homomorphicColumnName()));
+    }
+  }
+  addCompositeIndexes(statement, helper_columns);
+  query.append(helper_columns).append(") FROM STDIN");
+
+  plain_values_.resize(columns_.size());
+  hash_inputs_.resize(columns_.size());
+  order_index_values_.resize(columns_.size());
+  bucket_index_values_.resize(columns_.size());
+  token_index_values_.resize(columns_.size());
+  homomorphic_values_.resize(columns_.size());
+  active_ = true;
+
+  ENVOY_LOG(debug, "COPY plan compiled: {} columns, {} helper columns", columns_.size(),
+            helpers_.size());
+  return Result::ok;
+}
+
+Result CopyInPlan::execute(std::vector<uint8_t>& data) {
+  ASSERT(active_);
+
+  output_.clear();
+  absl::string_view chunk(reinterpret_cast<const char*>(data.data()), data.size());
+
+  size_t row_end = chunk.find('\n');
+  if (!pending_.empty() && row_end != absl::string_view::npos) {
+    // Complete the row started in the previous chunk
+    absl::StrAppend(&pending_, chunk.substr(0, row_end));
+    CHECK_RESULT(processRow(pending_, output_));
+    pending_.clear();
+    chunk.remove_prefix(row_end + 1);
+    row_end = chunk.find('\n');
+  }
+
+  while (row_end != absl::string_view::npos) {
+    CHECK_RESULT(processRow(chunk.substr(0, row_end), output_));
+    chunk.remove_prefix(row_end + 1);
+    row_end = chunk.find('\n');
+  }
+
+  absl::StrAppend(&pending_, chunk);
+  data.assign(output_.begin(), output_.end());
+  return Result::ok;
+}
+
+Result CopyInPlan::finish(std::vector<uint8_t>& data) {
+  ASSERT(active_);
+
+  output_.clear();
+  if (!pending_.empty()) {
+    CHECK_RESULT(processRow(pending_, output_));
+    pending_.clear();
+  }
+
+  data.assign(output_.begin(), output_.end());
+  return Result::ok;
+}
+
+Result CopyInPlan::processRow(absl::string_view row, std::string& out) {
+  // Rows of CRLF input end with \r, which is not a part of the last value. Carriage returns
+  // inside the values are escaped, so the rows are written back with \n only
+  absl::ConsumeSuffix(&row, "\r");
+
+  if (end_of_data_ || row == COPY_END_OF_DATA) {
+    // Postgres ignores everything after the marker
+    end_of_data_ = true;
+    absl::StrAppend(&out, row, "\n");
+    return Result::ok;
+  }
+
+  fields_.clear();
+  for (absl::string_view field : absl::StrSplit(row, '\t')) {
+    fields_.push_back(field);
+  }
+  if (fields_.size() != columns_.size()) {
+    return Result::makeError(fmt::format("postgres_tde: COPY row {} has {} columns, expected {}",
+                                         rows_count_ + 1, fields_.size(), columns_.size()));
+  }
+
+  for (size_t i = 0; i < fields_.size(); i++) {
+    if (i > 0) {
+      out.push_back('\t');
+    }
+    CHECK_RESULT(processValue(i, fields_[i], out));
+  }
+
+  for (const HelperColumn& helper : helpers_) {
+    out.push_back('\t');
+    appendHelperValue(helper, out);
+  }
+
+  out.push_back('\n');
+  rows_count_++;
+  return Result::ok;
+}
+
+Result CopyInPlan::processValue(size_t column_idx, absl::string_view value, std::string& out) {
+  const ColumnAction& action = columns_[column_idx];
+  if (action.config_ == nullptr || value == COPY_NULL) {
+    absl::StrAppend(&out, value);
+    return Result::ok;
+  }
+
+  unescapeCopyValue(value, unescaped_);
+  CHECK_RESULT(canonicalValue(column_idx, unescaped_));
+
+  if (action.order_index_encoder_ != nullptr &&
+      !action.order_index_encoder_->encodeText(unescaped_, order_index_values_[column_idx])) {
+    return Result::makeError(
+        fmt::format("postgres_tde: invalid value for the order index of column {}",
+                    action.config_->columnName()));
+  }
+
+  if (action.bucket_index_encoder_ != nullptr &&
+      !action.bucket_index_encoder_->encodeText(unescaped_, bucket_index_values_[column_idx])) {
+    return Result::makeError(
+        fmt::format("postgres_tde: invalid value for the bucket index of column {}",
+                    action.config_->columnName()));
+  }
+
+  if (action.token_index_encoder_ != nullptr) {
+    action.token_index_encoder_->encode(unescaped_, token_index_values_[column_idx]);
+  }
+
+  if (action.homomorphic_ctx_ != nullptr) {
+    // Only integer columns have it, the canonical value is their decimal form
+    int64_t ival;
+    if (!absl::SimpleAtoi(plain_values_[column_idx], &ival)) {
+      return Result::makeError(fmt::format("postgres_tde: invalid integer value for column {}",
+                                           action.config_->columnName()));
+    }
+    action.homomorphic_ctx_->encrypt(ival, homomorphic_values_[column_idx]);
+  }
+
+  if (action.encryption_ctx_ == nullptr) {
+    absl::StrAppend(&out, value);
+    return Result::ok;
+  }
+
+  action.encryption_ctx_->encrypt(plain_values_[column_idx], encrypted_data_);
+
+  // Same layout as EncryptionMutator produces
+  out.append("\\\\x");
+  uint8_t version = action.config_->encryptionKeyVersion();
+  if (version != 0) {
+    appendHex(out, &version, 1);
+  }
+  appendHex(out, encrypted_data_.data(), encrypted_data_.size());
+  return Result::ok;
+}
+
+Result CopyInPlan::canonicalValue(size_t column_idx, absl::string_view value) {
+  const ColumnConfig* config = columns_[column_idx].config_;
+  std::string& plain_value = plain_values_[column_idx];
+  std::string& hash_input = hash_inputs_[column_idx];
+
+  // Values are brought to the form INSERT literals of the same type get from the mutators,
+  // so that rows loaded by COPY are indistinguishable from the inserted ones
+  int32_t data_type = config->isEncrypted() ? config->origDataType() : 0;
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID: {
+    int64_t ival;
+    if (!absl::SimpleAtoi(value, &ival)) {
+      return Result::makeError(fmt::format("postgres_tde: invalid integer value for column {}",
+                                           config->columnName()));
+    }
+    plain_value = std::to_string(ival);
+    hash_input.assign(reinterpret_cast<const char*>(&ival), sizeof(ival));
+    return Result::ok;
+  }
+  case FLOAT4OID:
+  case FLOAT8OID: {
+    double fval;
+    if (!absl::SimpleAtod(value, &fval)) {
+      return Result::makeError(fmt::format("postgres_tde: invalid float value for column {}",
+                                           config->columnName()));
+    }
+    plain_value = std::to_string(fval);
+    hash_input.assign(reinterpret_cast<const char*>(&fval), sizeof(fval));
+    return Result::ok;
+  }
+  default:
+    plain_value.assign(value.data(), value.size());
+    hash_input.assign(value.data(), value.size());
+    return Result::ok;
+  }
+}
+
+void CopyInPlan::addCompositeIndexes(const Statement& statement, std::string& helper_columns) {
+  std::vector<const CompositeIndexConfig*> indexes;
+  for (const ColumnAction& action : columns_) {
+    if (action.config_ == nullptr) {
+      continue;
+    }
+
+    for (const CompositeIndexConfig* index : action.config_->compositeIndexes()) {
+      if (std::find(indexes.begin(), indexes.end(), index) == indexes.end()) {
+        indexes.push_back(index);
+      }
+    }
+  }
+
+  for (const CompositeIndexConfig* index : indexes) {
+    CompositeIndexAction action{std::make_unique<CompositeIndexEncoder>(*index), {}};
+    for (const std::string& column_name : index->columnNames()) {
+      auto it = std::find(statement.columns_.begin(), statement.columns_.end(), column_name);
+      if (it == statement.columns_.end()) {
+        break;
+      }
+      action.column_indices_.push_back(it - statement.columns_.begin());
+    }
+
+    // Same as INSERT, the index is left NULL unless all of its columns are copied
+    if (action.column_indices_.size() != index->columnNames().size()) {
+      continue;
+    }
+
+    helpers_.push_back(HelperColumn{composite_indexes_.size(), HelperType::CompositeIndex});
+    composite_indexes_.push_back(std::move(action));
+    absl::StrAppend(&helper_columns, ", ",
+                    Common::SQLUtils::quoteIdentifier(index->columnName()));
+  }
+}
+
+void CopyInPlan::appendHelperValue(const HelperColumn& helper, std::string& out) {
+  if (helper.type_ == HelperType::CompositeIndex) {
+    const CompositeIndexAction& action = composite_indexes_[helper.column_idx_];
+    for (size_t column_idx : action.column_indices_) {
+      if (fields_[column_idx] == COPY_NULL) {
+        absl::StrAppend(&out, COPY_NULL);
+        return;
+      }
+    }
+
+    for (size_t column_idx : action.column_indices_) {
+      action.encoder_->addValue(hash_inputs_[column_idx]);
+    }
+    action.encoder_->encode(composite_index_value_);
+    appendByteaHex(out, composite_index_value_.data(), composite_index_value_.size());
+    return;
+  }
+
+  if (fields_[helper.column_idx_] == COPY_NULL) {
+    absl::StrAppend(&out, COPY_NULL);
+    return;
+  }
+
+  const std::string& hash_input = hash_inputs_[helper.column_idx_];
+  switch (helper.type_) {
+  case HelperType::BlindIndex: {
+    auto& crypto_util = Envoy::Common::Crypto::UtilitySingleton::get();
+    auto hmac = crypto_util.getSha256Hmac(columns_[helper.column_idx_].config_->BIKey(),
+                                          hash_input);
+    appendByteaHex(out, hmac.data(), hmac.size());
+    return;
+  }
+  case HelperType::JoinKey: {
+    auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+    auto hash = crypto_util_ext.getSha256Digest(hash_input);
+    size_t join_key_size = columns_[helper.column_idx_].config_->joinKeySize();
+    ASSERT(join_key_size <= hash.size());
+    // Join key is the first few bytes of a hash
+    appendByteaHex(out, hash.data(), join_key_size);
+    return;
+  }
+  case HelperType::OrderIndex: {
+    const std::vector<uint8_t>& index_value = order_index_values_[helper.column_idx_];
+    appendByteaHex(out, index_value.data(), index_value.size());
+    return;
+  }
+  case HelperType::BucketIndex: {
+    const std::vector<uint8_t>& index_value = bucket_index_values_[helper.column_idx_];
+    appendByteaHex(out, index_value.data(), index_value.size());
+    return;
+  }
+  case HelperType::TokenIndex:
+    // Array literal of hex tokens needs no escaping
+    out.append(token_index_values_[helper.column_idx_]);
+    return;
+  case HelperType::HomomorphicSum:
+    // Decimal ciphertext needs no escaping
+    out.append(homomorphic_values_[helper.column_idx_]);
+    return;
+  case HelperType::CompositeIndex:
+    // Handled above, as it depends on several columns
+    return;
+  }
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
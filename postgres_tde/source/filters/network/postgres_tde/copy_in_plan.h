@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/common/utils/utils.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/bucket_index_encoder.h"
+#include "postgres_tde/source/filters/network/postgres_tde/composite_index_encoder.h"
+#include "postgres_tde/source/filters/network/postgres_tde/order_index_encoder.h"
+#include "postgres_tde/source/filters/network/postgres_tde/token_index_encoder.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+/**
+ * Execution plan for the data of COPY ... FROM STDIN into a table with TDE enabled
+ *
+ * Rows arrive in the text format of COPY and may be split between CopyData messages
+ * arbitrarily. Values of encrypted columns are replaced by the ciphertext and values
+ * of the helper columns (blind index, join key, order, bucket, token and composite index,
+ * homomorphic sum) are appended to each row in the order the helper columns were appended
+ * to the column list of the statement.
+ * Key schedules are prepared once per COPY, so bulk loads don't pay for the key
+ * setup on every value.
+ */
+class CopyInPlan : public Logger::Loggable<Logger::Id::filter> {
+public:
+  struct Statement {
+    // Empty unless the table name is schema-qualified
+    std::string schema_;
+    std::string table_;
+    std::vector<std::string> columns_;
+    // Statement is COPY <table> (<columns>) FROM STDIN without options
+    bool supported_{false};
+  };
+
+  // Recognizes COPY statements. Returns false if the query is not a COPY into a table
+  static bool parseStatement(absl::string_view query, Statement& statement);
+
+  void clear();
+  bool active() const { return active_; }
+  uint64_t rowsCount() const { return rows_count_; }
+
+  /**
+   * Builds the plan for the statement
+   * @param config encryption config snapshot, must outlive the plan
+   * @param query set to the rewritten statement with the helper columns added
+   */
+  Result compile(const DatabaseEncryptionConfig& config, const Statement& statement,
+                 std::string& query);
+
+  /**
+   * Processes the next chunk of COPY data in place. Only complete rows are written
+   * back, the trailing partial row is kept until the next chunk.
+   */
+  Result execute(std::vector<uint8_t>& data);
+
+  // Processes the last row if it isn't terminated by a newline, data is left empty otherwise
+  Result finish(std::vector<uint8_t>& data);
+
+private:
+  enum class HelperType {
+    BlindIndex,
+    JoinKey,
+    OrderIndex,
+    BucketIndex,
+    TokenIndex,
+    HomomorphicSum,
+    CompositeIndex,
+  };
+
+  struct ColumnAction {
+    const ColumnConfig* config_;
+    Common::Crypto::AESEncryptionContextPtr encryption_ctx_;
+    std::unique_ptr<OrderIndexEncoder> order_index_encoder_;
+    std::unique_ptr<BucketIndexEncoder> bucket_index_encoder_;
+    std::unique_ptr<TokenIndexEncoder> token_index_encoder_;
+    // Shared by the column config
+    const Common::Crypto::HomomorphicContext* homomorphic_ctx_{nullptr};
+  };
+
+  struct HelperColumn {
+    // Index of the composite index for CompositeIndex, of the column otherwise
+    size_t column_idx_;
+    HelperType type_;
+  };
+
+  struct CompositeIndexAction {
+    std::unique_ptr<CompositeIndexEncoder> encoder_;
+    // Statement columns in the order of the index columns
+    std::vector<size_t> column_indices_;
+  };
+
+  Result processRow(absl::string_view row, std::string& out);
+  Result processValue(size_t column_idx, absl::string_view value, std::string& out);
+  Result canonicalValue(size_t column_idx, absl::string_view value);
+  void addCompositeIndexes(const Statement& statement, std::string& helper_columns);
+  void appendHelperValue(const HelperColumn& helper, std::string& out);
+
+  bool active_{false};
+  // Rows after the end-of-data marker are passed as is
+  bool end_of_data_{false};
+  uint64_t rows_count_{0};
+
+  // One entry per column of the statement, config_ is null for plain columns
+  std::vector<ColumnAction> columns_;
+  std::vector<HelperColumn> helpers_;
+  std::vector<CompositeIndexAction> composite_indexes_;
+
+  // Incomplete row from the previous chunk
+  std::string pending_;
+
+  // Scratch buffers reused between values
+  std::string output_;
+  std::vector<absl::string_view> fields_;
+  std::string unescaped_;
+  // Text that is encrypted and bytes that are hashed for each column of the row
+  std::vector<std::string> plain_values_;
+  std::vector<std::string> hash_inputs_;
+  std::vector<std::vector<uint8_t>> order_index_values_;
+  std::vector<std::vector<uint8_t>> bucket_index_values_;
+  std::vector<std::string> token_index_values_;
+  std::vector<std::string> homomorphic_values_;
+  std::vector<uint8_t> composite_index_value_;
+  std::vector<uint8_t> encrypted_data_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
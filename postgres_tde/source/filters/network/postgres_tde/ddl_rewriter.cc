@@ -0,0 +1,599 @@
+#include "postgres_tde/source/filters/network/postgres_tde/ddl_rewriter.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "source/common/common/assert.h"
+#include "source/common/common/fmt.h"
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::quoteIdentifier;
+
+namespace {
+
+bool isOneOf(const Token& token, std::initializer_list<absl::string_view> words) {
+  if (token.type_ != Token::Type::Word) {
+    return false;
+  }
+
+  for (absl::string_view word : words) {
+    if (token.value_ == word) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string constraintName(const Token& token) {
+  return token.isWord("primary") ? "PRIMARY KEY" : absl::AsciiStrToUpper(token.value_);
+}
+
+// Words that end the data type of a column definition
+constexpr std::initializer_list<absl::string_view> COLUMN_CONSTRAINT_WORDS = {
+    "constraint", "not", "null", "default", "primary", "unique", "check", "references",
+    "collate", "generated"};
+
+// Column constraints that would need the plaintext of the column
+constexpr std::initializer_list<absl::string_view> PLAINTEXT_CONSTRAINT_WORDS = {
+    "default", "check", "references", "collate", "generated"};
+
+// Constraints over the ciphertext, which is randomized, so equal values never collide
+constexpr std::initializer_list<absl::string_view> KEY_CONSTRAINT_WORDS = {"primary", "unique"};
+
+// Words that start a table constraint instead of a column definition
+constexpr std::initializer_list<absl::string_view> TABLE_CONSTRAINT_WORDS = {
+    "constraint", "primary", "unique", "check", "foreign", "exclude", "like"};
+
+// Aggregate over the Paillier ciphertexts, see HomomorphicSumMutator
+constexpr absl::string_view HOMOMORPHIC_SUM_STEP_FUNCTION =
+    "CREATE OR REPLACE FUNCTION tde_paillier_sum_step(numeric, numeric, numeric) "
+    "RETURNS numeric AS 'SELECT mod($1 * $2, $3)' LANGUAGE SQL IMMUTABLE STRICT";
+constexpr absl::string_view HOMOMORPHIC_SUM_AGGREGATE =
+    "CREATE OR REPLACE AGGREGATE tde_paillier_sum(numeric, numeric) "
+    "(SFUNC = tde_paillier_sum_step, STYPE = numeric)";
+
+} // namespace
+
+bool DDLRewriter::isDDL(absl::string_view query) {
+  std::vector<Token> tokens;
+  if (!Common::SQLUtils::tokenizeStatement(query, tokens) || tokens.empty()) {
+    return false;
+  }
+
+  return isOneOf(tokens[0], {"create", "alter", "drop", "truncate"});
+}
+
+Result DDLRewriter::rewrite(std::string& query) {
+  query_ = query;
+  indexes_.clear();
+  homomorphic_sum_ = false;
+  if (!Common::SQLUtils::tokenizeStatement(query_, tokens_)) {
+    return Result::makeError("postgres_tde: unable to parse query");
+  }
+
+  std::string out;
+  for (Range statement : splitTopLevel(Range{0, tokens_.size()}, ';')) {
+    if (statement.empty()) {
+      continue;
+    }
+
+    if (!out.empty()) {
+      out.append("; ");
+    }
+    CHECK_RESULT(rewriteStatement(statement, out));
+  }
+
+  for (const std::string& index : indexes_) {
+    absl::StrAppend(&out, "; ", index);
+  }
+
+  if (homomorphic_sum_) {
+    // Postgres has no aggregate for the modular product of the ciphertexts, so it is defined
+    // once the first column that needs it is created
+    absl::StrAppend(&out, "; ", HOMOMORPHIC_SUM_STEP_FUNCTION, "; ", HOMOMORPHIC_SUM_AGGREGATE);
+  }
+
+  query = std::move(out);
+  ENVOY_LOG(debug, "rewritten DDL: {}", query);
+  return Result::ok;
+}
+
+Result DDLRewriter::rewriteStatement(Range statement, std::string& out) {
+  const Token& first = tokens_[statement.begin_];
+
+  if (isOneOf(first, {"drop", "truncate"})) {
+    absl::StrAppend(&out, text(statement));
+    return Result::ok;
+  }
+
+  if (first.isWord("create")) {
+    size_t pos = statement.begin_ + 1;
+    while (pos < statement.end_ &&
+           isOneOf(tokens_[pos], {"global", "local", "temp", "temporary", "unlogged"})) {
+      pos++;
+    }
+
+    if (pos < statement.end_ && tokens_[pos].isWord("table")) {
+      return rewriteCreateTable(statement, out);
+    }
+
+    absl::StrAppend(&out, text(statement));
+    return Result::ok;
+  }
+
+  if (first.isWord("alter")) {
+    if (statement.size() > 1 && tokens_[statement.begin_ + 1].isWord("table")) {
+      return rewriteAlterTable(statement, out);
+    }
+
+    absl::StrAppend(&out, text(statement));
+    return Result::ok;
+  }
+
+  return Result::makeError(
+      "postgres_tde: DDL statements can't be mixed with other statements in one query");
+}
+
+Result DDLRewriter::rewriteCreateTable(Range statement, std::string& out) {
+  size_t pos = statement.begin_;
+  while (!tokens_[pos].isWord("table")) {
+    pos++;
+  }
+  pos++;
+
+  bool if_not_exists = false;
+  if (pos + 2 < statement.end_ && tokens_[pos].isWord("if") && tokens_[pos + 1].isWord("not") &&
+      tokens_[pos + 2].isWord("exists")) {
+    if_not_exists = true;
+    pos += 3;
+  }
+
+  TableName table;
+  if (!parseTableName(pos, statement.end_, table)) {
+    return Result::makeError("postgres_tde: unable to parse CREATE TABLE statement");
+  }
+
+  if (!config_.hasTDEEnabled(table.name_)) {
+    absl::StrAppend(&out, text(statement));
+    return Result::ok;
+  }
+
+  if (pos >= statement.end_ || !tokens_[pos].isSymbol('(')) {
+    // CREATE TABLE ... AS, PARTITION OF etc.
+    return Result::makeError(
+        fmt::format("postgres_tde: only CREATE TABLE with column definitions is supported for "
+                    "table {} with encryption",
+                    table.name_));
+  }
+
+  size_t close = findClosingParen(pos, statement.end_);
+  if (close == statement.end_) {
+    return Result::makeError("postgres_tde: unable to parse CREATE TABLE statement");
+  }
+
+  // CREATE TABLE <name> (
+  absl::StrAppend(&out, text(Range{statement.begin_, pos + 1}));
+
+  bool first = true;
+  std::vector<std::string> columns;
+  std::vector<const CompositeIndexConfig*> composite_indexes;
+  for (Range element : splitTopLevel(Range{pos + 1, close}, ',')) {
+    if (element.empty()) {
+      return Result::makeError("postgres_tde: unable to parse CREATE TABLE statement");
+    }
+
+    if (!first) {
+      out.append(", ");
+    }
+    first = false;
+
+    if (isOneOf(tokens_[element.begin_], TABLE_CONSTRAINT_WORDS)) {
+      CHECK_RESULT(checkTableConstraint(table, element));
+      absl::StrAppend(&out, text(element));
+      continue;
+    }
+
+    std::vector<std::string> helper_columns;
+    CHECK_RESULT(rewriteColumnDefinition(table, element, if_not_exists, out, helper_columns,
+                                         composite_indexes));
+    for (const std::string& helper_column : helper_columns) {
+      absl::StrAppend(&out, ", ", helper_column);
+    }
+    columns.push_back(tokens_[element.begin_].value_);
+  }
+
+  // Composite index is computed from all of its columns, so they must be created together
+  for (const CompositeIndexConfig* index : composite_indexes) {
+    for (const std::string& column : index->columnNames()) {
+      if (std::find(columns.begin(), columns.end(), column) == columns.end()) {
+        return Result::makeError(
+            fmt::format("postgres_tde: column {}.{} of composite blind index {} must be created "
+                        "in the same statement",
+                        table.name_, column, index->columnName()));
+      }
+    }
+
+    absl::StrAppend(&out, ", ", compositeIndexColumn(*index));
+    addIndex(table, index->columnName(), if_not_exists);
+  }
+
+  // ) and the table options
+  absl::StrAppend(&out, text(Range{close, statement.end_}));
+  return Result::ok;
+}
+
+Result DDLRewriter::rewriteAlterTable(Range statement, std::string& out) {
+  size_t pos = statement.begin_ + 2;
+  if (pos + 1 < statement.end_ && tokens_[pos].isWord("if") && tokens_[pos + 1].isWord("exists")) {
+    pos += 2;
+  }
+  if (pos < statement.end_ && tokens_[pos].isWord("only")) {
+    pos++;
+  }
+
+  TableName table;
+  if (!parseTableName(pos, statement.end_, table) || pos >= statement.end_) {
+    return Result::makeError("postgres_tde: unable to parse ALTER TABLE statement");
+  }
+
+  if (!config_.hasTDEEnabled(table.name_)) {
+    absl::StrAppend(&out, text(statement));
+    return Result::ok;
+  }
+
+  // ALTER TABLE <name>
+  absl::StrAppend(&out, text(Range{statement.begin_, pos}));
+
+  bool first = true;
+  std::vector<const CompositeIndexConfig*> composite_indexes;
+  for (Range action : splitTopLevel(Range{pos, statement.end_}, ',')) {
+    if (action.empty()) {
+      return Result::makeError("postgres_tde: unable to parse ALTER TABLE statement");
+    }
+
+    out.append(first ? " " : ", ");
+    first = false;
+
+    const Token& verb = tokens_[action.begin_];
+    if (verb.isWord("add")) {
+      size_t definition = action.begin_ + 1;
+      if (definition < action.end_ && isOneOf(tokens_[definition], TABLE_CONSTRAINT_WORDS)) {
+        CHECK_RESULT(checkTableConstraint(table, action));
+        absl::StrAppend(&out, text(action));
+        continue;
+      }
+
+      if (definition < action.end_ && tokens_[definition].isWord("column")) {
+        definition++;
+      }
+
+      bool if_not_exists = false;
+      if (definition + 2 < action.end_ && tokens_[definition].isWord("if") &&
+          tokens_[definition + 1].isWord("not") && tokens_[definition + 2].isWord("exists")) {
+        if_not_exists = true;
+        definition += 3;
+      }
+
+      if (definition >= action.end_) {
+        return Result::makeError("postgres_tde: unable to parse ALTER TABLE statement");
+      }
+
+      const char* prefix = if_not_exists ? "ADD COLUMN IF NOT EXISTS " : "ADD COLUMN ";
+      out.append(prefix);
+
+      std::vector<std::string> helper_columns;
+      CHECK_RESULT(rewriteColumnDefinition(table, Range{definition, action.end_}, if_not_exists,
+                                           out, helper_columns, composite_indexes));
+      for (const std::string& helper_column : helper_columns) {
+        absl::StrAppend(&out, ", ", prefix, helper_column);
+      }
+      continue;
+    }
+
+    if (verb.isWord("drop") && action.size() > 1 &&
+        !tokens_[action.begin_ + 1].isWord("constraint")) {
+      size_t column = action.begin_ + 1;
+      if (tokens_[column].isWord("column")) {
+        column++;
+      }
+
+      bool if_exists = false;
+      if (column + 1 < action.end_ && tokens_[column].isWord("if") &&
+          tokens_[column + 1].isWord("exists")) {
+        if_exists = true;
+        column += 2;
+      }
+
+      if (column >= action.end_ || !tokens_[column].isIdentifier()) {
+        return Result::makeError("postgres_tde: unable to parse ALTER TABLE statement");
+      }
+
+      absl::StrAppend(&out, text(action));
+
+      // Helper columns go together with the column, their indexes are dropped by Postgres
+      auto column_config = config_.getColumnConfig(table.name_, tokens_[column].value_);
+      if (column_config != nullptr) {
+        const char* prefix = if_exists ? "DROP COLUMN IF EXISTS " : "DROP COLUMN ";
+        if (column_config->hasBlindIndex()) {
+          absl::StrAppend(&out, ", ", prefix, quoteIdentifier(column_config->BIColumnName()));
+        }
+        if (column_config->hasJoin()) {
+          absl::StrAppend(&out, ", ", prefix,
+                          quoteIdentifier(column_config->joinKeyColumnName()));
+        }
+        if (column_config->hasOrderIndex()) {
+          absl::StrAppend(&out, ", ", prefix,
+                          quoteIdentifier(column_config->orderIndexColumnName()));
+        }
+        if (column_config->hasBucketIndex()) {
+          absl::StrAppend(&out, ", ", prefix,
+                          quoteIdentifier(column_config->bucketIndexColumnName()));
+        }
+        if (column_config->hasTokenIndex()) {
+          absl::StrAppend(&out, ", ", prefix,
+                          quoteIdentifier(column_config->tokenIndexColumnName()));
+        }
+        if (column_config->hasHomomorphicSum()) {
+          absl::StrAppend(&out, ", ", prefix,
+                          quoteIdentifier(column_config->homomorphicColumnName()));
+        }
+        // Composite index can't be maintained without any of its columns. Other columns of
+        // the index may be dropped by the same statement
+        for (const CompositeIndexConfig* index : column_config->compositeIndexes()) {
+          absl::StrAppend(&out, ", DROP COLUMN IF EXISTS ", quoteIdentifier(index->columnName()));
+        }
+      }
+      continue;
+    }
+
+    if (verb.isWord("rename") && action.size() > 1 && tokens_[action.begin_ + 1].isWord("to")) {
+      return Result::makeError(fmt::format(
+          "postgres_tde: table {} with encryption can't be renamed, the encryption schema "
+          "refers to it by name",
+          table.name_));
+    }
+
+    // Other actions (ALTER COLUMN, RENAME COLUMN, ...) must not touch the encrypted columns
+    auto column_config = findEncryptedColumn(table, Range{action.begin_ + 1, action.end_});
+    if (column_config != nullptr) {
+      return Result::makeError(
+          fmt::format("postgres_tde: ALTER TABLE {} is not supported for column {}.{} with "
+                      "encryption",
+                      absl::AsciiStrToUpper(verb.value_), table.name_,
+                      column_config->columnName()));
+    }
+
+    absl::StrAppend(&out, text(action));
+  }
+
+  // Composite index is added with any of its columns, the other ones are expected to exist
+  // already. The statement can't tell whether the index exists too, so it's added only if it
+  // doesn't. It is NULL for the existing rows, as the added column is NULL for them
+  for (const CompositeIndexConfig* index : composite_indexes) {
+    absl::StrAppend(&out, ", ADD COLUMN IF NOT EXISTS ", compositeIndexColumn(*index));
+    addIndex(table, index->columnName(), true);
+  }
+
+  return Result::ok;
+}
+
+Result DDLRewriter::rewriteColumnDefinition(
+    const TableName& table, Range definition, bool if_not_exists, std::string& out,
+    std::vector<std::string>& helper_columns,
+    std::vector<const CompositeIndexConfig*>& composite_indexes) {
+  const Token& name = tokens_[definition.begin_];
+  if (!name.isIdentifier()) {
+    return Result::makeError("postgres_tde: unable to parse column definition");
+  }
+
+  auto column_config = config_.getColumnConfig(table.name_, name.value_);
+  if (column_config == nullptr) {
+    absl::StrAppend(&out, text(definition));
+    return Result::ok;
+  }
+
+  Range constraints{definition.begin_ + 1, definition.end_};
+  while (!constraints.empty() && !isOneOf(tokens_[constraints.begin_], COLUMN_CONSTRAINT_WORDS)) {
+    constraints.begin_++;
+  }
+
+  bool not_null = false;
+  for (size_t i = constraints.begin_; i < constraints.end_; i++) {
+    const Token& token = tokens_[i];
+    if (column_config->isEncrypted() && isOneOf(token, PLAINTEXT_CONSTRAINT_WORDS)) {
+      return Result::makeError(
+          fmt::format("postgres_tde: {} is not supported for encrypted column {}.{}",
+                      absl::AsciiStrToUpper(token.value_), table.name_, name.value_));
+    }
+
+    if (column_config->isEncrypted() && isOneOf(token, KEY_CONSTRAINT_WORDS)) {
+      return Result::makeError(
+          fmt::format("postgres_tde: {} constraint is not supported for encrypted column {}.{}",
+                      constraintName(token), table.name_, name.value_));
+    }
+
+    if (token.isWord("primary") ||
+        (token.isWord("not") && i + 1 < constraints.end_ && tokens_[i + 1].isWord("null"))) {
+      not_null = true;
+    }
+  }
+
+  if (column_config->isEncrypted()) {
+    // Ciphertext is stored instead of the value of the declared type
+    absl::StrAppend(&out, quoteIdentifier(column_config->columnName()), " BYTEA");
+    if (!constraints.empty()) {
+      absl::StrAppend(&out, " ", text(constraints));
+    }
+  } else {
+    absl::StrAppend(&out, text(definition));
+  }
+
+  // Helper columns are filled for each non-null value
+  absl::string_view helper_type = not_null ? " BYTEA NOT NULL" : " BYTEA";
+  if (column_config->hasBlindIndex()) {
+    helper_columns.push_back(
+        absl::StrCat(quoteIdentifier(column_config->BIColumnName()), helper_type));
+    addIndex(table, column_config->BIColumnName(), if_not_exists);
+  }
+
+  if (column_config->hasJoin()) {
+    helper_columns.push_back(
+        absl::StrCat(quoteIdentifier(column_config->joinKeyColumnName()), helper_type));
+    addIndex(table, column_config->joinKeyColumnName(), if_not_exists);
+  }
+
+  if (column_config->hasOrderIndex()) {
+    helper_columns.push_back(
+        absl::StrCat(quoteIdentifier(column_config->orderIndexColumnName()), helper_type));
+    addIndex(table, column_config->orderIndexColumnName(), if_not_exists);
+  }
+
+  if (column_config->hasBucketIndex()) {
+    helper_columns.push_back(
+        absl::StrCat(quoteIdentifier(column_config->bucketIndexColumnName()), helper_type));
+    addIndex(table, column_config->bucketIndexColumnName(), if_not_exists);
+  }
+
+  if (column_config->hasHomomorphicSum()) {
+    // Ciphertexts are only aggregated, never looked up, so there is no index
+    helper_columns.push_back(absl::StrCat(quoteIdentifier(column_config->homomorphicColumnName()),
+                                          not_null ? " NUMERIC NOT NULL" : " NUMERIC"));
+    homomorphic_sum_ = true;
+  }
+
+  if (column_config->hasTokenIndex()) {
+    // Tokens are looked up by containment, which needs a GIN index over the array
+    helper_columns.push_back(absl::StrCat(quoteIdentifier(column_config->tokenIndexColumnName()),
+                                          not_null ? " TEXT[] NOT NULL" : " TEXT[]"));
+    addIndex(table, column_config->tokenIndexColumnName(), if_not_exists, "gin");
+  }
+
+  // Composite index columns are added by the caller once all columns of the statement are known
+  for (const CompositeIndexConfig* index : column_config->compositeIndexes()) {
+    if (std::find(composite_indexes.begin(), composite_indexes.end(), index) ==
+        composite_indexes.end()) {
+      composite_indexes.push_back(index);
+    }
+  }
+
+  return Result::ok;
+}
+
+Result DDLRewriter::checkTableConstraint(const TableName& table, Range constraint) {
+  // Keys are meaningless over the randomized ciphertext, other constraints would need
+  // the plaintext
+  for (size_t i = constraint.begin_; i < constraint.end_; i++) {
+    if (isOneOf(tokens_[i], {"primary", "unique", "check", "foreign", "exclude"})) {
+      auto column_config = findEncryptedColumn(table, constraint);
+      if (column_config != nullptr) {
+        return Result::makeError(
+            fmt::format("postgres_tde: {} constraint is not supported for encrypted column {}.{}",
+                        constraintName(tokens_[i]), table.name_, column_config->columnName()));
+      }
+      break;
+    }
+  }
+
+  return Result::ok;
+}
+
+bool DDLRewriter::parseTableName(size_t& pos, size_t end, TableName& table) const {
+  if (pos >= end || !tokens_[pos].isIdentifier()) {
+    return false;
+  }
+
+  size_t begin = pos;
+  table.name_ = tokens_[pos++].value_;
+  if (pos + 1 < end && tokens_[pos].isSymbol('.') && tokens_[pos + 1].isIdentifier()) {
+    // Schema-qualified name, the encryption schema refers to tables by name only
+    table.name_ = tokens_[pos + 1].value_;
+    pos += 2;
+  }
+
+  table.text_ = std::string(text(Range{begin, pos}));
+  return true;
+}
+
+std::vector<DDLRewriter::Range> DDLRewriter::splitTopLevel(Range range, char separator) const {
+  std::vector<Range> parts;
+  size_t depth = 0;
+  size_t part_begin = range.begin_;
+  for (size_t i = range.begin_; i < range.end_; i++) {
+    const Token& token = tokens_[i];
+    if (token.isSymbol('(') || token.isSymbol('[')) {
+      depth++;
+    } else if ((token.isSymbol(')') || token.isSymbol(']')) && depth > 0) {
+      depth--;
+    } else if (depth == 0 && token.isSymbol(separator)) {
+      parts.push_back(Range{part_begin, i});
+      part_begin = i + 1;
+    }
+  }
+
+  parts.push_back(Range{part_begin, range.end_});
+  return parts;
+}
+
+size_t DDLRewriter::findClosingParen(size_t pos, size_t end) const {
+  ASSERT(tokens_[pos].isSymbol('('));
+  size_t depth = 0;
+  for (; pos < end; pos++) {
+    if (tokens_[pos].isSymbol('(')) {
+      depth++;
+    } else if (tokens_[pos].isSymbol(')') && --depth == 0) {
+      return pos;
+    }
+  }
+  return end;
+}
+
+const ColumnConfig* DDLRewriter::findEncryptedColumn(const TableName& table, Range range) const {
+  for (size_t i = range.begin_; i < range.end_; i++) {
+    if (!tokens_[i].isIdentifier()) {
+      continue;
+    }
+
+    auto column_config = config_.getColumnConfig(table.name_, tokens_[i].value_);
+    if (column_config != nullptr && column_config->isEncrypted()) {
+      return column_config;
+    }
+  }
+  return nullptr;
+}
+
+std::string DDLRewriter::compositeIndexColumn(const CompositeIndexConfig& index) {
+  // It stays NULL while any of the values is NULL, so it is nullable regardless of the
+  // constraints of the columns
+  return absl::StrCat(quoteIdentifier(index.columnName()), " BYTEA");
+}
+
+absl::string_view DDLRewriter::text(Range range) const {
+  ASSERT(!range.empty());
+  size_t begin = tokens_[range.begin_].begin_;
+  return query_.substr(begin, tokens_[range.end_ - 1].end_ - begin);
+}
+
+void DDLRewriter::addIndex(const TableName& table, const std::string& column, bool if_not_exists,
+                           absl::string_view method) {
+  // Same name as Postgres generates for an unnamed index
+  indexes_.push_back(fmt::format("CREATE INDEX {}{} ON {} {}({})",
+                                 if_not_exists ? "IF NOT EXISTS " : "",
+                                 quoteIdentifier(absl::StrCat(table.name_, "_", column, "_idx")),
+                                 table.text_,
+                                 method.empty() ? "" : absl::StrCat("USING ", method, " "),
+                                 quoteIdentifier(column)));
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
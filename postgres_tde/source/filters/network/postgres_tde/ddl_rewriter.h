@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/sqlutils/tokenizer.h"
+#include "postgres_tde/source/common/utils/utils.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Token;
+using Extensions::Common::Utils::Result;
+
+/**
+ * Rewrites DDL statements for the tables with TDE enabled
+ *
+ * Tables are declared with the original column types. Encrypted columns are turned into BYTEA,
+ * the helper columns (blind index, join key, order, bucket, token and composite index, homomorphic
+ * sum) are added next to them and each index column gets an index, so the storage layout always
+ * matches the encryption schema:
+ * - CREATE TABLE
+ * - ALTER TABLE ... ADD COLUMN / DROP COLUMN
+ * Other DDL statements are passed as is, except for the ones that would need the plaintext
+ * of encrypted columns (defaults, checks, foreign keys, type changes), and keys over encrypted
+ * columns, which are meaningless for the randomized ciphertext.
+ * The SQL parser doesn't support DDL, so statements are processed at the token level.
+ */
+class DDLRewriter : public Logger::Loggable<Logger::Id::filter> {
+public:
+  explicit DDLRewriter(const DatabaseEncryptionConfig& config) : config_(config) {}
+
+  // Recognizes queries starting with a DDL statement
+  static bool isDDL(absl::string_view query);
+
+  // Rewrites the query in place
+  Result rewrite(std::string& query);
+
+private:
+  // Token range [begin, end) of a statement, a column definition or an ALTER action
+  struct Range {
+    size_t begin_;
+    size_t end_;
+
+    bool empty() const { return begin_ >= end_; }
+    size_t size() const { return end_ - begin_; }
+  };
+
+  struct TableName {
+    // Table name as written in the statement, possibly schema-qualified
+    std::string text_;
+    std::string name_;
+  };
+
+  Result rewriteStatement(Range statement, std::string& out);
+  Result rewriteCreateTable(Range statement, std::string& out);
+  Result rewriteAlterTable(Range statement, std::string& out);
+
+  // Column definition of CREATE TABLE or ALTER TABLE ADD COLUMN. Helper column
+  // definitions are returned separately, as they are added in a different way. Composite
+  // indexes of the column are collected to be added once all columns of the statement are known
+  Result rewriteColumnDefinition(const TableName& table, Range definition, bool if_not_exists,
+                                 std::string& out, std::vector<std::string>& helper_columns,
+                                 std::vector<const CompositeIndexConfig*>& composite_indexes);
+  Result checkTableConstraint(const TableName& table, Range constraint);
+
+  bool parseTableName(size_t& pos, size_t end, TableName& table) const;
+  std::vector<Range> splitTopLevel(Range range, char separator) const;
+  size_t findClosingParen(size_t pos, size_t end) const;
+  const ColumnConfig* findEncryptedColumn(const TableName& table, Range range) const;
+  absl::string_view text(Range range) const;
+  static std::string compositeIndexColumn(const CompositeIndexConfig& index);
+
+  // Index of the default access method (B-tree) unless the method is given
+  void addIndex(const TableName& table, const std::string& column, bool if_not_exists,
+                absl::string_view method = "");
+
+  const DatabaseEncryptionConfig& config_;
+
+  absl::string_view query_;
+  std::vector<Token> tokens_;
+
+  // CREATE INDEX statements for the helper columns, appended after the statements
+  std::vector<std::string> indexes_;
+  // Whether a homomorphic sum column is created, so the aggregate over it must be defined
+  bool homomorphic_sum_{false};
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
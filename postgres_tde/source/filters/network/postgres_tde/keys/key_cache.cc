@@ -0,0 +1,169 @@
+#include "postgres_tde/source/filters/network/postgres_tde/keys/key_cache.h"
+
+#include <algorithm>
+
+#include "source/common/protobuf/utility.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+constexpr uint64_t DEFAULT_CACHE_TTL_MS = 60 * 60 * 1000;
+constexpr uint32_t DEFAULT_MAX_CACHED_KEYS = 1024;
+} // namespace
+
+KeyCache::KeyCache(KeyProviderPtr provider,
+                   const envoy::extensions::filters::network::postgres_tde::KeyProvider& config,
+                   Event::Dispatcher& dispatcher, const std::string& stats_prefix,
+                   Stats::Scope& scope, KeysChangedCallback on_keys_changed)
+    : provider_(std::move(provider)), dispatcher_(dispatcher),
+      on_keys_changed_(std::move(on_keys_changed)),
+      ttl_(PROTOBUF_GET_MS_OR_DEFAULT(config, cache_ttl, DEFAULT_CACHE_TTL_MS)),
+      max_keys_(PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, max_cached_keys, DEFAULT_MAX_CACHED_KEYS)),
+      stats_(generateStats(stats_prefix, scope)),
+      refresh_timer_(dispatcher.createTimer([this]() { onRefreshTimer(); })) {
+  refresh_timer_->enableTimer(ttl_ / 2);
+}
+
+void KeyCache::getKeys(const std::vector<std::string>& names, GetKeysCallback callback) {
+  KeyMap keys;
+  std::vector<std::string> missing;
+  for (const std::string& name : names) {
+    const std::vector<uint8_t>* key = lookup(name);
+    if (key != nullptr) {
+      keys[name] = *key;
+    } else {
+      missing.push_back(name);
+    }
+  }
+
+  if (missing.empty()) {
+    callback(Result::ok, std::move(keys));
+    return;
+  }
+
+  ENVOY_LOG(debug, "postgres_tde: fetching {} keys", missing.size());
+  std::weak_ptr<bool> alive = alive_;
+  MonotonicTime start = dispatcher_.timeSource().monotonicTime();
+  provider_->fetchKeys(missing, [this, alive, start, keys = std::move(keys),
+                                 callback = std::move(callback)](Result result,
+                                                                 KeyMap fetched) mutable {
+    if (alive.expired()) {
+      return;
+    }
+
+    stats_.key_fetch_latency_.recordValue(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              dispatcher_.timeSource().monotonicTime() - start)
+                                              .count());
+
+    if (!result.isOk) {
+      ENVOY_LOG(warn, "postgres_tde: key fetch failed: {}", result.error);
+      stats_.key_fetch_failed_.inc();
+      callback(result, {});
+      return;
+    }
+
+    for (auto& [name, key] : fetched) {
+      insert(name, key);
+      keys[name] = std::move(key);
+    }
+    callback(Result::ok, std::move(keys));
+  });
+}
+
+const std::vector<uint8_t>* KeyCache::lookup(const std::string& name) {
+  auto it = index_.find(name);
+  if (it == index_.end() ||
+      dispatcher_.timeSource().monotonicTime() - it->second->fetched_at_ >= ttl_) {
+    stats_.key_cache_miss_.inc();
+    return nullptr;
+  }
+
+  stats_.key_cache_hit_.inc();
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return &it->second->key_;
+}
+
+void KeyCache::insert(const std::string& name, std::vector<uint8_t> key) {
+  MonotonicTime now = dispatcher_.timeSource().monotonicTime();
+
+  auto it = index_.find(name);
+  if (it != index_.end()) {
+    it->second->key_ = std::move(key);
+    it->second->fetched_at_ = now;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+
+  entries_.push_front(Entry{name, std::move(key), now});
+  index_[name] = entries_.begin();
+
+  while (entries_.size() > max_keys_) {
+    index_.erase(entries_.back().name_);
+    entries_.pop_back();
+    stats_.key_cache_evicted_.inc();
+  }
+}
+
+void KeyCache::onRefreshTimer() {
+  refresh_timer_->enableTimer(ttl_ / 2);
+
+  // Wipe the expired entries and prefetch the ones that would expire before the next refresh
+  MonotonicTime now = dispatcher_.timeSource().monotonicTime();
+  bool expired = false;
+  std::vector<std::string> names;
+  for (Entry& entry : entries_) {
+    if (now - entry.fetched_at_ >= ttl_ && !entry.key_.empty()) {
+      std::fill(entry.key_.begin(), entry.key_.end(), 0);
+      entry.key_.clear();
+      stats_.key_cache_expired_.inc();
+      expired = true;
+    }
+    if (now - entry.fetched_at_ >= ttl_ / 2) {
+      names.push_back(entry.name_);
+    }
+  }
+
+  if (names.empty()) {
+    return;
+  }
+
+  stats_.key_prefetch_.add(names.size());
+  std::weak_ptr<bool> alive = alive_;
+  provider_->fetchKeys(names, [this, alive, expired](Result result, KeyMap fetched) {
+    if (alive.expired()) {
+      return;
+    }
+
+    if (!result.isOk) {
+      // Cached keys keep being served until they expire
+      ENVOY_LOG(warn, "postgres_tde: key prefetch failed: {}", result.error);
+      stats_.key_fetch_failed_.inc();
+      if (expired) {
+        on_keys_changed_();
+      }
+      return;
+    }
+
+    bool changed = expired;
+    for (auto& [name, key] : fetched) {
+      auto it = index_.find(name);
+      // Rotated or re-wrapped keys, as well as the expired ones, must be passed on
+      if (it != index_.end() && it->second->key_ != key) {
+        changed = true;
+      }
+      insert(name, std::move(key));
+    }
+
+    if (changed) {
+      on_keys_changed_();
+    }
+  });
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
+
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/api/filters/network/postgres_tde/postgres_tde.pb.h"
+#include "postgres_tde/source/filters/network/postgres_tde/keys/key_provider.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * All key cache stats. @see stats_macros.h
+ */
+#define ALL_KEY_CACHE_STATS(COUNTER, HISTOGRAM)                                                    \
+  COUNTER(key_cache_hit)                                                                           \
+  COUNTER(key_cache_miss)                                                                          \
+  COUNTER(key_cache_evicted)                                                                       \
+  COUNTER(key_cache_expired)                                                                       \
+  COUNTER(key_fetch_failed)                                                                        \
+  COUNTER(key_prefetch)                                                                            \
+  HISTOGRAM(key_fetch_latency, Milliseconds)
+
+/**
+ * Struct definition for all key cache stats. @see stats_macros.h
+ */
+struct KeyCacheStats {
+  ALL_KEY_CACHE_STATS(GENERATE_COUNTER_STRUCT, GENERATE_HISTOGRAM_STRUCT)
+};
+
+/**
+ * Bounded LRU cache of unwrapped data keys in front of the key provider
+ *
+ * Entries expire after the TTL. Entries older than half of the TTL are refreshed
+ * in the background, so the keys in use are normally never fetched on demand. The owner
+ * is notified once a refresh changes any of the keys or some of them expired, so the keys
+ * copied out of the cache can be replaced. Expired keys are wiped, but are kept being
+ * refreshed until they are evicted.
+ * Main thread only.
+ */
+class KeyCache : Logger::Loggable<Logger::Id::config> {
+public:
+  using GetKeysCallback = std::function<void(Result result, KeyMap keys)>;
+  using KeysChangedCallback = std::function<void()>;
+
+  KeyCache(KeyProviderPtr provider,
+           const envoy::extensions::filters::network::postgres_tde::KeyProvider& config,
+           Event::Dispatcher& dispatcher, const std::string& stats_prefix, Stats::Scope& scope,
+           KeysChangedCallback on_keys_changed);
+
+  /**
+   * Invokes the callback with all the requested keys. The callback is invoked immediately
+   * if all the keys are cached, or after the missing keys are fetched otherwise.
+   */
+  void getKeys(const std::vector<std::string>& names, GetKeysCallback callback);
+
+private:
+  struct Entry {
+    std::string name_;
+    std::vector<uint8_t> key_;
+    MonotonicTime fetched_at_;
+  };
+  using EntryList = std::list<Entry>;
+
+  const std::vector<uint8_t>* lookup(const std::string& name);
+  void insert(const std::string& name, std::vector<uint8_t> key);
+  void onRefreshTimer();
+
+  KeyCacheStats generateStats(const std::string& prefix, Stats::Scope& scope) {
+    return KeyCacheStats{ALL_KEY_CACHE_STATS(POOL_COUNTER_PREFIX(scope, prefix),
+                                             POOL_HISTOGRAM_PREFIX(scope, prefix))};
+  }
+
+  KeyProviderPtr provider_;
+  Event::Dispatcher& dispatcher_;
+  KeysChangedCallback on_keys_changed_;
+  const std::chrono::milliseconds ttl_;
+  const size_t max_keys_;
+  KeyCacheStats stats_;
+
+  // Most recently used entries go first
+  EntryList entries_;
+  absl::flat_hash_map<std::string, EntryList::iterator> index_;
+
+  Event::TimerPtr refresh_timer_;
+
+  // Fetches may complete after the cache is destroyed
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
+};
+
+using KeyCachePtr = std::unique_ptr<KeyCache>;
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "envoy/common/pure.h"
+
+#include "absl/container/flat_hash_map.h"
+
+#include "postgres_tde/source/common/utils/utils.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+// Unwrapped data keys by name
+using KeyMap = absl::flat_hash_map<std::string, std::vector<uint8_t>>;
+
+/**
+ * Source of the data encryption keys
+ *
+ * Used only on the main thread - keys are resolved before the encryption config snapshot
+ * is published to the workers.
+ */
+class KeyProvider {
+public:
+  virtual ~KeyProvider() = default;
+
+  using FetchCallback = std::function<void(Result result, KeyMap keys)>;
+
+  /**
+   * Fetches and unwraps the keys. The callback is always invoked later on the main thread,
+   * either with all the requested keys or with an error.
+   */
+  virtual void fetchKeys(const std::vector<std::string>& names, FetchCallback callback) PURE;
+};
+
+using KeyProviderPtr = std::unique_ptr<KeyProvider>;
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
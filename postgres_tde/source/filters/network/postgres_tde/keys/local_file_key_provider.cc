@@ -0,0 +1,76 @@
+#include "postgres_tde/source/filters/network/postgres_tde/keys/local_file_key_provider.h"
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/fmt.h"
+#include "source/common/protobuf/utility.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+constexpr size_t KEY_SIZE = 32;
+} // namespace
+
+LocalFileKeyProvider::LocalFileKeyProvider(
+    const envoy::extensions::filters::network::postgres_tde::KeyProvider::LocalFile& config,
+    Api::Api& api, Event::Dispatcher& dispatcher,
+    ProtobufMessage::ValidationVisitor& validation_visitor)
+    : master_key_path_(config.master_key_path()), wrapped_keys_path_(config.wrapped_keys_path()),
+      api_(api), dispatcher_(dispatcher), validation_visitor_(validation_visitor) {}
+
+void LocalFileKeyProvider::fetchKeys(const std::vector<std::string>& names,
+                                     FetchCallback callback) {
+  KeyMap keys;
+  Result result = unwrapKeys(names, keys);
+
+  // Deliver the result asynchronously as any other provider would
+  dispatcher_.post([callback = std::move(callback), result = std::move(result),
+                    keys = std::move(keys)]() mutable { callback(result, std::move(keys)); });
+}
+
+Result LocalFileKeyProvider::unwrapKeys(const std::vector<std::string>& names, KeyMap& keys) {
+  std::string master_key_str;
+  envoy::extensions::filters::network::postgres_tde::WrappedKeys wrapped_keys;
+  TRY_ASSERT_MAIN_THREAD {
+    master_key_str = api_.fileSystem().fileReadToEnd(master_key_path_);
+    MessageUtil::loadFromFile(wrapped_keys_path_, wrapped_keys, validation_visitor_, api_);
+  }
+  END_TRY
+  catch (const EnvoyException& e) {
+    return Result::makeError(fmt::format("postgres_tde: unable to read keys: {}", e.what()));
+  }
+
+  if (master_key_str.size() != KEY_SIZE) {
+    return Result::makeError(
+        fmt::format("postgres_tde: master key must be {} bytes long", KEY_SIZE));
+  }
+  std::vector<uint8_t> master_key(master_key_str.begin(), master_key_str.end());
+
+  auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+  for (const std::string& name : names) {
+    auto it = wrapped_keys.keys().find(name);
+    if (it == wrapped_keys.keys().end()) {
+      return Result::makeError(fmt::format("postgres_tde: unknown key '{}'", name));
+    }
+
+    std::vector<uint8_t> key;
+    Result result = crypto_util_ext.AESDecrypt(master_key, it->second, key);
+    if (!result.isOk || key.size() != KEY_SIZE) {
+      return Result::makeError(fmt::format("postgres_tde: unable to unwrap key '{}'", name));
+    }
+
+    keys[name] = std::move(key);
+  }
+
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
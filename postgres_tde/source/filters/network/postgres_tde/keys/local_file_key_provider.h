@@ -0,0 +1,45 @@
+#pragma once
+
+#include "envoy/api/api.h"
+#include "envoy/event/dispatcher.h"
+
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/api/filters/network/postgres_tde/postgres_tde.pb.h"
+#include "postgres_tde/source/filters/network/postgres_tde/keys/key_provider.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Key provider that reads data keys wrapped by the master key from a local file
+ *
+ * Both files are read on each fetch, so the master key is not kept in memory
+ * and updated wrapped keys are picked up without a restart.
+ */
+class LocalFileKeyProvider : public KeyProvider, Logger::Loggable<Logger::Id::config> {
+public:
+  LocalFileKeyProvider(
+      const envoy::extensions::filters::network::postgres_tde::KeyProvider::LocalFile& config,
+      Api::Api& api, Event::Dispatcher& dispatcher,
+      ProtobufMessage::ValidationVisitor& validation_visitor);
+
+  // KeyProvider
+  void fetchKeys(const std::vector<std::string>& names, FetchCallback callback) override;
+
+private:
+  Result unwrapKeys(const std::vector<std::string>& names, KeyMap& keys);
+
+  const std::string master_key_path_;
+  const std::string wrapped_keys_path_;
+  Api::Api& api_;
+  Event::Dispatcher& dispatcher_;
+  ProtobufMessage::ValidationVisitor& validation_visitor_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,132 @@
+#include "postgres_tde/source/filters/network/postgres_tde/like_pattern.h"
+
+#include <algorithm>
+
+#include "absl/strings/ascii.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Length of the UTF-8 character by its first byte, broken sequences are skipped by bytes
+size_t charLength(char first_byte) {
+  uint8_t byte = static_cast<uint8_t>(first_byte);
+  if (byte >= 0xF0) {
+    return 4;
+  }
+  if (byte >= 0xE0) {
+    return 3;
+  }
+  if (byte >= 0xC0) {
+    return 2;
+  }
+  return 1;
+}
+
+} // namespace
+
+bool LikePattern::parse(absl::string_view pattern, bool case_insensitive, LikePattern& out) {
+  out.elements_.clear();
+  out.segments_.clear();
+  out.case_insensitive_ = case_insensitive;
+
+  std::string segment;
+  bool at_start = true;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    char c = pattern[i];
+    if (c == '%' || c == '_') {
+      out.elements_.push_back(
+          Element{c == '%' ? ElementType::AnyString : ElementType::AnyChar, 0});
+      if (!segment.empty()) {
+        out.segments_.push_back(Segment{std::move(segment), at_start, false});
+        segment.clear();
+      }
+      at_start = false;
+      continue;
+    }
+
+    if (c == '\\') {
+      // Postgres rejects the patterns ending with the escape character
+      if (++i == pattern.size()) {
+        return false;
+      }
+      c = pattern[i];
+    }
+
+    out.elements_.push_back(Element{ElementType::Literal, c});
+    segment.push_back(c);
+  }
+
+  // The pattern without wildcards matches the whole value, even the empty one
+  if (!segment.empty() || out.elements_.empty()) {
+    out.segments_.push_back(Segment{std::move(segment), at_start, true});
+  }
+
+  return true;
+}
+
+bool LikePattern::matches(absl::string_view value) const {
+  // Greedy matching, backtracking to the last % on a mismatch
+  size_t pattern_pos = 0;
+  size_t value_pos = 0;
+  bool has_backtrack = false;
+  size_t backtrack_pattern_pos = 0;
+  size_t backtrack_value_pos = 0;
+
+  while (value_pos < value.size()) {
+    if (pattern_pos < elements_.size()) {
+      const Element& element = elements_[pattern_pos];
+      if (element.type_ == ElementType::AnyString) {
+        has_backtrack = true;
+        backtrack_pattern_pos = ++pattern_pos;
+        backtrack_value_pos = value_pos;
+        continue;
+      }
+
+      if (element.type_ == ElementType::AnyChar) {
+        pattern_pos++;
+        value_pos = std::min(value_pos + charLength(value[value_pos]), value.size());
+        continue;
+      }
+
+      if (literalMatches(element.c_, value[value_pos])) {
+        pattern_pos++;
+        value_pos++;
+        continue;
+      }
+    }
+
+    if (!has_backtrack) {
+      return false;
+    }
+
+    // Let the last % consume one more character
+    backtrack_value_pos = std::min(
+        backtrack_value_pos + charLength(value[backtrack_value_pos]), value.size());
+    pattern_pos = backtrack_pattern_pos;
+    value_pos = backtrack_value_pos;
+  }
+
+  while (pattern_pos < elements_.size() &&
+         elements_[pattern_pos].type_ == ElementType::AnyString) {
+    pattern_pos++;
+  }
+
+  return pattern_pos == elements_.size();
+}
+
+bool LikePattern::literalMatches(char pattern_char, char value_char) const {
+  if (case_insensitive_) {
+    return absl::ascii_tolower(pattern_char) == absl::ascii_tolower(value_char);
+  }
+
+  return pattern_char == value_char;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Pattern of the LIKE and ILIKE operators
+ *
+ * Follows the Postgres semantics with the default escape character: % matches any sequence
+ * of characters, _ matches a single UTF-8 character and backslash escapes the next character.
+ * Case-insensitive patterns fold ASCII letters only.
+ */
+class LikePattern {
+public:
+  // Literal part of the pattern between the wildcards
+  struct Segment {
+    std::string text_;
+    // The segment starts at the beginning or ends at the end of the matched value
+    bool anchored_start_;
+    bool anchored_end_;
+  };
+
+  // Returns false if the pattern is malformed
+  static bool parse(absl::string_view pattern, bool case_insensitive, LikePattern& out);
+
+  bool matches(absl::string_view value) const;
+
+  const std::vector<Segment>& segments() const { return segments_; }
+  bool caseInsensitive() const { return case_insensitive_; }
+
+private:
+  enum class ElementType {
+    Literal,
+    AnyChar,
+    AnyString,
+  };
+
+  struct Element {
+    ElementType type_;
+    char c_;
+  };
+
+  bool literalMatches(char pattern_char, char value_char) const;
+
+  std::vector<Element> elements_;
+  std::vector<Segment> segments_;
+  bool case_insensitive_{false};
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
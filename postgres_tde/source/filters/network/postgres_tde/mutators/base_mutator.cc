@@ -1,4 +1,8 @@
 #include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+
+#include <algorithm>
+#include <cstring>
+
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
 #include "source/common/common/assert.h"
 
@@ -36,6 +40,162 @@ Result BaseMutator::visitUpdateStatement(hsql::UpdateStatement* stmt) {
   return Result::ok;
 }
 
+void BaseMutator::collectConjuncts(hsql::Expr* expr, std::vector<hsql::Expr*>& conjuncts) {
+  if (expr->isType(hsql::kExprOperator) && expr->opType == hsql::kOpAnd) {
+    collectConjuncts(expr->expr, conjuncts);
+    collectConjuncts(expr->expr2, conjuncts);
+    return;
+  }
+
+  conjuncts.push_back(expr);
+}
+
+void BaseMutator::releaseConjuncts(hsql::Expr*& expr) {
+  if (expr == nullptr) {
+    return;
+  }
+
+  if (expr->isType(hsql::kExprOperator) && expr->opType == hsql::kOpAnd) {
+    releaseConjuncts(expr->expr);
+    releaseConjuncts(expr->expr2);
+    delete expr;
+  }
+
+  expr = nullptr;
+}
+
+hsql::Expr* BaseMutator::combineConjuncts(const std::vector<hsql::Expr*>& conjuncts) {
+  hsql::Expr* result = nullptr;
+  for (hsql::Expr* conjunct : conjuncts) {
+    result = result == nullptr ? conjunct
+                               : hsql::Expr::makeOpBinary(result, hsql::kOpAnd, conjunct);
+  }
+
+  return result;
+}
+
+bool BaseMutator::collectTables(const hsql::Expr* expr, const char* const (&table_names)[2],
+                                unsigned& mask) {
+  if (expr == nullptr) {
+    return true;
+  }
+
+  switch (expr->type) {
+  case hsql::kExprColumnRef:
+    if (expr->table == nullptr) {
+      return false;
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+      if (strcmp(expr->table, table_names[i]) == 0) {
+        mask |= 1u << i;
+        return true;
+      }
+    }
+    return false;
+  case hsql::kExprStar:
+  case hsql::kExprSelect:
+    return false;
+  default:
+    break;
+  }
+
+  if (expr->select != nullptr || !collectTables(expr->expr, table_names, mask) ||
+      !collectTables(expr->expr2, table_names, mask)) {
+    return false;
+  }
+
+  if (expr->exprList != nullptr) {
+    for (const hsql::Expr* item : *expr->exprList) {
+      if (!collectTables(item, table_names, mask)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool BaseMutator::isEncryptedColumn(const hsql::Expr* expr) const {
+  if (expr == nullptr || !expr->isType(hsql::kExprColumnRef) || expr->table == nullptr) {
+    return false;
+  }
+
+  const ColumnConfig* column_config = mgr_->getEncryptionConfig()->getColumnConfig(
+      getTableNameByAlias(expr->table), expr->name);
+  return column_config != nullptr && column_config->isEncrypted();
+}
+
+bool BaseMutator::hasResultChecks(const hsql::Expr* expr) const {
+  if (expr == nullptr) {
+    return false;
+  }
+
+  if (expr->isType(hsql::kExprOperator)) {
+    switch (expr->opType) {
+    case hsql::kOpLess:
+    case hsql::kOpLessEq:
+    case hsql::kOpGreater:
+    case hsql::kOpGreaterEq:
+    case hsql::kOpBetween:
+    case hsql::kOpLike:
+    case hsql::kOpILike:
+      // Checked by the proxy if looked up by the bucket or the token index
+      if (isEncryptedColumn(expr->expr) || isEncryptedColumn(expr->expr2)) {
+        return true;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (hasResultChecks(expr->expr) || hasResultChecks(expr->expr2)) {
+    return true;
+  }
+
+  if (expr->exprList != nullptr) {
+    for (const hsql::Expr* item : *expr->exprList) {
+      if (hasResultChecks(item)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+hsql::Expr* BaseMutator::resolveOrderColumn(hsql::SelectStatement* stmt, hsql::Expr* expr,
+                                            ColumnRef& column) const {
+  if (expr->isType(hsql::kExprLiteralInt)) {
+    // Position in the select list
+    if (expr->ival < 1 || static_cast<size_t>(expr->ival) > stmt->selectList->size()) {
+      return nullptr;
+    }
+
+    expr = (*stmt->selectList)[expr->ival - 1];
+  } else if (expr->isType(hsql::kExprColumnRef) && expr->table == nullptr) {
+    // Alias or name of a selected column
+    auto it = std::find_if(
+        stmt->selectList->begin(), stmt->selectList->end(), [expr](const hsql::Expr* item) {
+          return item->isType(hsql::kExprColumnRef) &&
+                 strcmp(item->alias != nullptr ? item->alias : item->name, expr->name) == 0;
+        });
+    if (it == stmt->selectList->end()) {
+      return nullptr;
+    }
+
+    expr = *it;
+  }
+
+  if (!expr->isType(hsql::kExprColumnRef) || expr->table == nullptr) {
+    return nullptr;
+  }
+
+  column = ColumnRef(std::string(getTableNameByAlias(expr->table)), expr->name);
+  return expr;
+}
+
 } // namespace PostgresTDE
 } // namespace NetworkFilters
 } // namespace Extensions
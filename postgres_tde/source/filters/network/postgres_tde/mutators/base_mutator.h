@@ -10,6 +10,7 @@ namespace NetworkFilters {
 namespace PostgresTDE {
 
 using Common::SQLUtils::Visitor;
+using Common::SQLUtils::ColumnRef;
 
 class BaseMutator : public Mutator, public Visitor {
 public:
@@ -21,6 +22,27 @@ protected:
   Result visitInsertStatement(hsql::InsertStatement* stmt) override;
   Result visitUpdateStatement(hsql::UpdateStatement* stmt) override;
 
+  // Helpers for the rewrites of the joins of two tables
+
+  static void collectConjuncts(hsql::Expr* expr, std::vector<hsql::Expr*>& conjuncts);
+  // Deletes the AND operators of the condition, the conjuncts are left to the caller
+  static void releaseConjuncts(hsql::Expr*& expr);
+  static hsql::Expr* combineConjuncts(const std::vector<hsql::Expr*>& conjuncts);
+  // Sets the bits of the tables the expression refers to (1 << index of the table name),
+  // returns false if the tables are unknown, e.g. for unqualified columns or subqueries
+  static bool collectTables(const hsql::Expr* expr, const char* const (&table_names)[2],
+                            unsigned& mask);
+  bool isEncryptedColumn(const hsql::Expr* expr) const;
+  // Whether the expression has comparisons the proxy checks on each result, so the columns of
+  // the comparison must be in the result
+  bool hasResultChecks(const hsql::Expr* expr) const;
+
+  // Resolves the column an ORDER BY item refers to, positions and unqualified names refer to
+  // the select list. Returns the qualified column reference of the query, or nullptr if the
+  // item isn't a column
+  hsql::Expr* resolveOrderColumn(hsql::SelectStatement* stmt, hsql::Expr* expr,
+                                 ColumnRef& column) const;
+
 protected:
   std::vector<hsql::InsertStatement*> insert_mutation_candidates_;
   std::vector<hsql::UpdateStatement*> update_mutation_candidates_;
@@ -1,8 +1,15 @@
 #include "postgres_tde/source/filters/network/postgres_tde/mutators/blind_index.h"
+
+#include <algorithm>
+
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "postgres_tde/source/filters/network/postgres_tde/composite_index_encoder.h"
+#include "postgres_tde/source/common/crypto/utility_ext.h"
 #include "source/common/crypto/utility.h"
 #include "source/common/common/fmt.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/escaping.h"
+#include "absl/strings/str_join.h"
 #include "absl/cleanup/cleanup.h"
 
 namespace Envoy {
@@ -10,16 +17,29 @@ namespace Extensions {
 namespace NetworkFilters {
 namespace PostgresTDE {
 
+namespace {
+
+std::string toHMACString(const std::vector<uint8_t>& hmac) {
+  std::string hmac_hex_str = std::string("\\x");
+  hmac_hex_str.append(absl::BytesToHexString(absl::string_view(reinterpret_cast<const char*>(hmac.data()), hmac.size())));
+  return hmac_hex_str;
+}
+
+} // namespace
+
 BlindIndexMutator::BlindIndexMutator(MutationManager *manager) : BaseMutator(manager) {}
 
 Result BlindIndexMutator::mutateQuery(hsql::SQLParserResult& query) {
   comparison_mutation_candidates_.clear();
+  in_list_mutation_candidates_.clear();
   group_by_mutation_candidates_.clear();
   insert_mutation_candidates_.clear();
   update_mutation_candidates_.clear();
 
   CHECK_RESULT(Visitor::visitQuery(query));
+  CHECK_RESULT(mutateCompositeLookups(query));
   CHECK_RESULT(mutateComparisons());
+  CHECK_RESULT(mutateInLists());
   CHECK_RESULT(mutateGroupByExpressions());
   CHECK_RESULT(mutateInsertStatement());
   CHECK_RESULT(mutateUpdateStatement());
@@ -52,11 +72,147 @@ Result BlindIndexMutator::visitOperatorExpression(hsql::Expr* expr) {
       return Result::ok;
     }
     return Visitor::visitOperatorExpression(expr);
+  case hsql::kOpIn:
+    // IN (SELECT ...) has no list
+    if (expr->expr->isType(hsql::kExprColumnRef) && expr->exprList != nullptr &&
+        std::all_of(expr->exprList->begin(), expr->exprList->end(),
+                    [](hsql::Expr* value) { return value->isLiteral(); })) {
+      ENVOY_LOG(debug, "blind index candidate: {} IN ({} values)", expr->expr->name, expr->exprList->size());
+      in_list_mutation_candidates_.push_back(expr);
+      return Result::ok;
+    }
+    return Visitor::visitOperatorExpression(expr);
   default:
     return Visitor::visitOperatorExpression(expr);
   }
 }
 
+Result BlindIndexMutator::mutateCompositeLookups(hsql::SQLParserResult& query) {
+  absl::flat_hash_set<hsql::Expr*> rewritten;
+  for (hsql::SQLStatement* stmt : query.getStatements()) {
+    hsql::Expr* where = nullptr;
+    if (stmt->isType(hsql::kStmtSelect)) {
+      where = dynamic_cast<hsql::SelectStatement*>(stmt)->whereClause;
+    } else if (stmt->isType(hsql::kStmtUpdate)) {
+      where = dynamic_cast<hsql::UpdateStatement*>(stmt)->where;
+    } else if (stmt->isType(hsql::kStmtDelete)) {
+      where = dynamic_cast<hsql::DeleteStatement*>(stmt)->expr;
+    }
+
+    if (where == nullptr) {
+      continue;
+    }
+
+    // Only the equalities every result row satisfies can be looked up together
+    std::map<ColumnRef, hsql::Expr*> equalities;
+    collectEqualities(where, equalities);
+
+    for (const auto& [column_ref, expr] : equalities) {
+      if (rewritten.contains(expr)) {
+        continue;
+      }
+
+      absl::string_view table_name = getTableNameByAlias(column_ref.table());
+      auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column_ref.column());
+      if (column_config == nullptr) {
+        continue;
+      }
+
+      for (const CompositeIndexConfig* index : column_config->compositeIndexes()) {
+        // Rows written before the index was configured have no index value yet
+        if (!index->populated()) {
+          continue;
+        }
+
+        std::vector<hsql::Expr*> members;
+        for (const std::string& member_name : index->columnNames()) {
+          auto it = equalities.find(ColumnRef(column_ref.table(), member_name));
+          if (it == equalities.end() || rewritten.contains(it->second)) {
+            break;
+          }
+          members.push_back(it->second);
+        }
+
+        if (members.size() != index->columnNames().size()) {
+          continue;
+        }
+
+        ENVOY_LOG(debug, "composite blind index lookup: {}.{}", table_name, index->columnName());
+        rewriteCompositeLookup(*index, members);
+        rewritten.insert(members.begin(), members.end());
+        break;
+      }
+    }
+  }
+
+  // Rewritten equalities are no longer comparisons of the columns
+  comparison_mutation_candidates_.erase(
+      std::remove_if(comparison_mutation_candidates_.begin(), comparison_mutation_candidates_.end(),
+                     [&](hsql::Expr* expr) { return rewritten.contains(expr); }),
+      comparison_mutation_candidates_.end());
+  return Result::ok;
+}
+
+void BlindIndexMutator::collectEqualities(hsql::Expr* expr, std::map<ColumnRef, hsql::Expr*>& equalities) {
+  if (!expr->isType(hsql::kExprOperator)) {
+    return;
+  }
+
+  if (expr->opType == hsql::kOpAnd) {
+    collectEqualities(expr->expr, equalities);
+    collectEqualities(expr->expr2, equalities);
+    return;
+  }
+
+  // NULL is never equal to anything, such comparisons are left as is
+  if (expr->opType == hsql::kOpEquals && expr->expr->isType(hsql::kExprColumnRef) && expr->expr->table != nullptr &&
+      expr->expr2->isLiteral() && expr->expr2->type != hsql::kExprLiteralNull) {
+    equalities.emplace(ColumnRef(std::string(expr->expr->table), std::string(expr->expr->name)), expr);
+  }
+}
+
+void BlindIndexMutator::rewriteCompositeLookup(const CompositeIndexConfig& index, const std::vector<hsql::Expr*>& equalities) {
+  std::vector<CompositeIndexEncoder> encoders;
+  encoders.emplace_back(index);
+  for (const auto& key : index.previousKeys()) {
+    encoders.emplace_back(key);
+  }
+
+  auto index_literals = new std::vector<hsql::Expr*>();
+  std::vector<uint8_t> hmac;
+  for (CompositeIndexEncoder& encoder : encoders) {
+    for (hsql::Expr* expr : equalities) {
+      encoder.addValue(hashInput(expr->expr2));
+    }
+    encoder.encode(hmac);
+    index_literals->push_back(hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(toHMACString(hmac))));
+  }
+
+  // The first equality becomes the lookup and the rest become 1 = 1, so that
+  // the surrounding conjunction stays valid
+  hsql::Expr* lookup = equalities[0];
+  free(lookup->expr->name);
+  lookup->expr->name = Common::Utils::makeOwnedCString(index.columnName());
+  delete lookup->expr2;
+  if (index_literals->size() == 1) {
+    lookup->expr2 = index_literals->front();
+    delete index_literals;
+  } else {
+    // Key rotation is in progress - the tuple may be indexed with any of the keys
+    lookup->expr2 = nullptr;
+    lookup->opType = hsql::kOpIn;
+    lookup->exprList = index_literals;
+  }
+
+  for (size_t i = 1; i < equalities.size(); i++) {
+    hsql::Expr* expr = equalities[i];
+    delete expr->expr;
+    delete expr->expr2;
+    expr->expr = hsql::Expr::makeLiteral(static_cast<int64_t>(1));
+    expr->expr2 = hsql::Expr::makeLiteral(static_cast<int64_t>(1));
+  }
+}
+
 Result BlindIndexMutator::mutateComparisons() {
   for (hsql::Expr* expr : comparison_mutation_candidates_) {
     ASSERT(expr->isType(hsql::kExprOperator)
@@ -71,7 +227,7 @@ Result BlindIndexMutator::mutateComparisons() {
         fmt::format("postgres_tde: unable to determine the source of column '{}'. Please specify an explicit table/alias reference", column->name));
     }
 
-    const std::string& table_name = getTableNameByAlias(column->table);
+    absl::string_view table_name = getTableNameByAlias(column->table);
     auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column->name);
     if (column_config == nullptr || !column_config->hasBlindIndex()) {
       ENVOY_LOG(debug, "blind index is not configured for {}.{}", column->table, column->name);
@@ -82,9 +238,86 @@ Result BlindIndexMutator::mutateComparisons() {
     free(column->name);
     column->name = Common::Utils::makeOwnedCString(bi_column_name);
 
-    hsql::Expr* bi_literal = createHashLiteral(literal, column_config);
+    if (column_config->previousBIKeys().empty()) {
+      hsql::Expr* bi_literal = createHashLiteral(literal, column_config);
+      delete expr->expr2;
+      expr->expr2 = bi_literal;
+      continue;
+    }
+
+    // Key rotation is in progress - the value may be indexed with any of the keys,
+    // so the comparison is replaced with (column_bi [NOT] IN (hash1, hash2, ...))
+    auto bi_literals = new std::vector<hsql::Expr*>();
+    bi_literals->push_back(createHashLiteral(literal, column_config));
+    for (const auto& bi_key : column_config->previousBIKeys()) {
+      bi_literals->push_back(createHashLiteral(literal, bi_key));
+    }
+
     delete expr->expr2;
-    expr->expr2 = bi_literal;
+    expr->expr2 = nullptr;
+    if (expr->opType == hsql::kOpEquals) {
+      expr->opType = hsql::kOpIn;
+      expr->exprList = bi_literals;
+    } else {
+      expr->opType = hsql::kOpNot;
+      expr->expr = hsql::Expr::makeInOperator(column, bi_literals);
+    }
+  }
+
+  return Result::ok;
+}
+
+Result BlindIndexMutator::mutateInLists() {
+  for (hsql::Expr* expr : in_list_mutation_candidates_) {
+    ASSERT(expr->isType(hsql::kExprOperator) && expr->opType == hsql::kOpIn
+           && expr->expr->isType(hsql::kExprColumnRef) && expr->exprList != nullptr);
+
+    hsql::Expr *column = expr->expr;
+    if (column->table == nullptr) {
+      return Result::makeError(
+        fmt::format("postgres_tde: unable to determine the source of column '{}'. Please specify an explicit table/alias reference", column->name));
+    }
+
+    absl::string_view table_name = getTableNameByAlias(column->table);
+    auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column->name);
+    if (column_config == nullptr || !column_config->hasBlindIndex()) {
+      ENVOY_LOG(debug, "blind index is not configured for {}.{}", column->table, column->name);
+      continue;
+    }
+
+    // Lists may be long, so the key schedules are prepared once for the whole list.
+    // During key rotation each value is looked up by the hashes of all the keys
+    auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+    std::vector<Common::Crypto::HMACContextPtr> hmac_contexts;
+    hmac_contexts.push_back(crypto_util_ext.createHMACContext(column_config->BIKey()));
+    for (const auto& bi_key : column_config->previousBIKeys()) {
+      hmac_contexts.push_back(crypto_util_ext.createHMACContext(bi_key));
+    }
+
+    auto bi_literals = new std::vector<hsql::Expr*>();
+    bi_literals->reserve(expr->exprList->size() * hmac_contexts.size());
+    std::vector<uint8_t> hmac;
+    for (hsql::Expr* literal : *expr->exprList) {
+      if (literal->type == hsql::kExprLiteralNull) {
+        bi_literals->push_back(hsql::Expr::makeNullLiteral());
+        continue;
+      }
+
+      absl::string_view data = hashInput(literal);
+      for (auto& ctx : hmac_contexts) {
+        ctx->compute(data, hmac);
+        bi_literals->push_back(hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(toHMACString(hmac))));
+      }
+    }
+
+    for (hsql::Expr* literal : *expr->exprList) {
+      delete literal;
+    }
+    delete expr->exprList;
+    expr->exprList = bi_literals;
+
+    free(column->name);
+    column->name = Common::Utils::makeOwnedCString(column_config->BIColumnName());
   }
 
   return Result::ok;
@@ -99,7 +332,7 @@ Result BlindIndexMutator::mutateGroupByExpressions() {
           fmt::format("postgres_tde: unable to determine the source of column {}. Please specify an explicit table/alias reference", column->name));
     }
 
-    const std::string& table_name = getTableNameByAlias(column->table);
+    absl::string_view table_name = getTableNameByAlias(column->table);
     auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column->name);
     if (column_config == nullptr || !column_config->hasBlindIndex()) {
       ENVOY_LOG(debug, "blind index is not configured for the column {}.{}", column->table, column->name);
@@ -148,6 +381,28 @@ Result BlindIndexMutator::mutateInsertStatement() {
       bi_values.push_back(createHashLiteral(value, column_config));
     }
 
+    // Composite index is left NULL unless all of its columns are inserted
+    for (const CompositeIndexConfig* index : getCompositeIndexes(stmt->tableName, *stmt->columns)) {
+      std::vector<hsql::Expr*> values;
+      for (const std::string& member_name : index->columnNames()) {
+        for (size_t i = 0; i < stmt->columns->size(); i++) {
+          if (member_name == (*stmt->columns)[i]) {
+            values.push_back((*stmt->values)[i]);
+            break;
+          }
+        }
+      }
+
+      if (values.size() != index->columnNames().size()) {
+        continue;
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createCompositeLiteral(*index, values, index_value));
+      bi_values.push_back(index_value);
+      bi_columns.push_back(Common::Utils::makeOwnedCString(index->columnName()));
+    }
+
     stmt->columns->insert(stmt->columns->end(), bi_columns.begin(), bi_columns.end());
     bi_columns.clear();
     stmt->values->insert(stmt->values->end(), bi_values.begin(), bi_values.end());
@@ -181,6 +436,33 @@ Result BlindIndexMutator::mutateUpdateStatement() {
       bi_updates.push_back(new hsql::UpdateClause {Common::Utils::makeOwnedCString(column_config->BIColumnName()), createHashLiteral(update->value, column_config)});
     }
 
+    std::vector<char*> updated_columns;
+    for (hsql::UpdateClause* update : *stmt->updates) {
+      updated_columns.push_back(update->column);
+    }
+
+    // Composite index can be recomputed only from the values of all of its columns
+    for (const CompositeIndexConfig* index : getCompositeIndexes(stmt->table->name, updated_columns)) {
+      std::vector<hsql::Expr*> values;
+      for (const std::string& member_name : index->columnNames()) {
+        for (hsql::UpdateClause* update : *stmt->updates) {
+          if (member_name == update->column) {
+            values.push_back(update->value);
+            break;
+          }
+        }
+      }
+
+      if (values.size() != index->columnNames().size()) {
+        return Result::makeError(fmt::format("postgres_tde: columns {} of composite blind index must be updated together",
+                                             absl::StrJoin(index->columnNames(), ", ")));
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createCompositeLiteral(*index, values, index_value));
+      bi_updates.push_back(new hsql::UpdateClause {Common::Utils::makeOwnedCString(index->columnName()), index_value});
+    }
+
     stmt->updates->insert(stmt->updates->end(), bi_updates.begin(), bi_updates.end());
     bi_updates.clear();
   }
@@ -188,46 +470,83 @@ Result BlindIndexMutator::mutateUpdateStatement() {
   return Result::ok;
 }
 
+std::vector<const CompositeIndexConfig*> BlindIndexMutator::getCompositeIndexes(const char* table_name, const std::vector<char*>& columns) {
+  std::vector<const CompositeIndexConfig*> indexes;
+  for (char* column : columns) {
+    auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column);
+    if (column_config == nullptr) {
+      continue;
+    }
+
+    for (const CompositeIndexConfig* index : column_config->compositeIndexes()) {
+      if (std::find(indexes.begin(), indexes.end(), index) == indexes.end()) {
+        indexes.push_back(index);
+      }
+    }
+  }
+
+  return indexes;
+}
+
+Result BlindIndexMutator::createCompositeLiteral(const CompositeIndexConfig& index, const std::vector<hsql::Expr*>& values, hsql::Expr*& out) {
+  for (hsql::Expr* value : values) {
+    if (!value->isLiteral()) {
+      return Result::makeError(fmt::format("postgres_tde: only literals can be used as values for columns of composite blind index {}",
+                                           index.columnName()));
+    }
+  }
+
+  // The tuple with NULL is never looked up
+  for (hsql::Expr* value : values) {
+    if (value->type == hsql::kExprLiteralNull) {
+      out = hsql::Expr::makeNullLiteral();
+      return Result::ok;
+    }
+  }
+
+  CompositeIndexEncoder encoder(index);
+  for (hsql::Expr* value : values) {
+    encoder.addValue(hashInput(value));
+  }
+
+  std::vector<uint8_t> hmac;
+  encoder.encode(hmac);
+  out = hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(toHMACString(hmac)));
+  return Result::ok;
+}
+
 hsql::Expr* BlindIndexMutator::createHashLiteral(hsql::Expr* orig_literal, const ColumnConfig *column_config) {
+  return createHashLiteral(orig_literal, column_config->BIKey());
+}
+
+hsql::Expr* BlindIndexMutator::createHashLiteral(hsql::Expr* orig_literal, const std::vector<uint8_t>& bi_key) {
   ASSERT(orig_literal->isLiteral());
 
-  switch (orig_literal->type) {
-  case hsql::kExprLiteralNull:
+  if (orig_literal->type == hsql::kExprLiteralNull) {
     // do nothing with null values
     return hsql::Expr::makeNullLiteral();
-  case hsql::kExprLiteralString: {
-    const std::string& hmac_hex_str = generateHMACString(
-        absl::string_view(static_cast<const char*>(orig_literal->name), strlen(orig_literal->name)),
-        column_config
-    );
-    return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(hmac_hex_str));
-  }
-  case hsql::kExprLiteralInt: {
-    const std::string& hmac_hex_str = generateHMACString(
-        absl::string_view(reinterpret_cast<const char*>(&orig_literal->ival), sizeof(orig_literal->ival)),
-        column_config
-    );
-    return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(hmac_hex_str));
-  }
-  case hsql::kExprLiteralFloat: {
-    const std::string& hmac_hex_str = generateHMACString(
-        absl::string_view(reinterpret_cast<const char*>(&orig_literal->fval), sizeof(orig_literal->fval)),
-        column_config
-    );
-    return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(hmac_hex_str));
   }
+
+  const std::string& hmac_hex_str = generateHMACString(hashInput(orig_literal), bi_key);
+  return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(hmac_hex_str));
+}
+
+absl::string_view BlindIndexMutator::hashInput(hsql::Expr* literal) {
+  switch (literal->type) {
+  case hsql::kExprLiteralString:
+    return absl::string_view(static_cast<const char*>(literal->name), strlen(literal->name));
+  case hsql::kExprLiteralInt:
+    return absl::string_view(reinterpret_cast<const char*>(&literal->ival), sizeof(literal->ival));
+  case hsql::kExprLiteralFloat:
+    return absl::string_view(reinterpret_cast<const char*>(&literal->fval), sizeof(literal->fval));
   default:
     PANIC("not implemented");;
   }
 }
 
-std::string BlindIndexMutator::generateHMACString(absl::string_view data, const ColumnConfig *column_config) {
+std::string BlindIndexMutator::generateHMACString(absl::string_view data, const std::vector<uint8_t>& bi_key) {
   auto& crypto_util = Envoy::Common::Crypto::UtilitySingleton::get();
-  auto hmac = crypto_util.getSha256Hmac(column_config->BIKey(), data);
-
-  std::string hmac_hex_str = std::string("\\x");
-  hmac_hex_str.append(absl::BytesToHexString(absl::string_view(reinterpret_cast<const char*>(hmac.data()), hmac.size())));
-  return hmac_hex_str;
+  return toHMACString(crypto_util.getSha256Hmac(bi_key, data));
 }
 
 } // namespace PostgresTDE
@@ -9,6 +9,7 @@ namespace NetworkFilters {
 namespace PostgresTDE {
 
 using Common::SQLUtils::Visitor;
+using Common::SQLUtils::ColumnRef;
 
 class BlindIndexMutator: public BaseMutator {
 public:
@@ -21,16 +22,26 @@ protected:
   Result visitExpression(hsql::Expr* expr) override;
   Result visitOperatorExpression(hsql::Expr* expr) override;
 
+  Result mutateCompositeLookups(hsql::SQLParserResult& query);
   Result mutateComparisons();
+  Result mutateInLists();
   Result mutateGroupByExpressions();
   Result mutateInsertStatement();
   Result mutateUpdateStatement();
 
+  void collectEqualities(hsql::Expr* expr, std::map<ColumnRef, hsql::Expr*>& equalities);
+  void rewriteCompositeLookup(const CompositeIndexConfig& index, const std::vector<hsql::Expr*>& equalities);
+  std::vector<const CompositeIndexConfig*> getCompositeIndexes(const char* table_name, const std::vector<char*>& columns);
+
+  Result createCompositeLiteral(const CompositeIndexConfig& index, const std::vector<hsql::Expr*>& values, hsql::Expr*& out);
   hsql::Expr* createHashLiteral(hsql::Expr* orig_literal, const ColumnConfig *column_config);
-  std::string generateHMACString(absl::string_view data, const ColumnConfig *column_config);
+  hsql::Expr* createHashLiteral(hsql::Expr* orig_literal, const std::vector<uint8_t>& bi_key);
+  std::string generateHMACString(absl::string_view data, const std::vector<uint8_t>& bi_key);
+  absl::string_view hashInput(hsql::Expr* literal);
 
 protected:
   std::vector<hsql::Expr*> comparison_mutation_candidates_;
+  std::vector<hsql::Expr*> in_list_mutation_candidates_;
   std::vector<hsql::Expr*> group_by_mutation_candidates_;
 };
 
@@ -0,0 +1,392 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/bucket_index.h"
+
+#include <algorithm>
+
+#include "postgres_tde/source/filters/network/postgres_tde/bucket_index_encoder.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "source/common/common/fmt.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/cleanup/cleanup.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Larger ranges would produce too long queries, they need the order index instead
+constexpr uint64_t MAX_RANGE_BUCKETS = 1000;
+
+std::string toByteaHex(const std::vector<uint8_t>& data) {
+  return absl::StrCat("\\x", absl::BytesToHexString(absl::string_view(
+                                 reinterpret_cast<const char*>(data.data()), data.size())));
+}
+
+} // namespace
+
+BucketIndexMutator::BucketIndexMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result BucketIndexMutator::mutateQuery(hsql::SQLParserResult& query) {
+  insert_mutation_candidates_.clear();
+  update_mutation_candidates_.clear();
+  range_checks_.clear();
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  // Rows can be filtered by the proxy only if the range restricts the whole result,
+  // so only the top-level conjunctions of SELECT statements are rewritten
+  for (hsql::SQLStatement* stmt : query.getStatements()) {
+    if (!stmt->isType(hsql::kStmtSelect)) {
+      continue;
+    }
+
+    auto select = dynamic_cast<hsql::SelectStatement*>(stmt);
+    if (select->whereClause == nullptr) {
+      continue;
+    }
+
+    std::map<ColumnRef, Range> ranges;
+    CHECK_RESULT(collectRanges(select->whereClause, ranges));
+    if (ranges.empty()) {
+      continue;
+    }
+
+    if (query.size() > 1) {
+      return Result::makeError("postgres_tde: ranges over columns with bucket index can't be "
+                               "used in queries with multiple statements");
+    }
+
+    CHECK_RESULT(mutateRanges(select, ranges));
+  }
+
+  CHECK_RESULT(mutateInsertStatement());
+  CHECK_RESULT(mutateUpdateStatement());
+  return Result::ok;
+}
+
+Result BucketIndexMutator::mutateRowDescription(RowDescriptionMessage& message,
+                                                ResultPlan& plan) {
+  if (range_checks_.empty()) {
+    return Result::ok;
+  }
+
+  std::map<ColumnRef, size_t> columns2idx;
+  for (size_t i = 0; i < message.column_descriptions().size(); i++) {
+    auto column_ref = getSelectColumnByAlias(message.column_descriptions()[i]->name());
+    if (column_ref != nullptr) {
+      columns2idx[*column_ref] = i;
+    }
+  }
+
+  for (auto& [column_ref, check] : range_checks_) {
+    auto it = columns2idx.find(column_ref);
+    if (it == columns2idx.end()) {
+      return Result::makeError(fmt::format("postgres_tde: column {}.{} must be present in SELECT "
+                                           "body to be compared with a range",
+                                           column_ref.table(), column_ref.column()));
+    }
+
+    ENVOY_LOG(debug, "matched range check: ({}, {}) -> column {}", column_ref.table(),
+              column_ref.column(), it->second);
+    check.column_idx_ = it->second;
+    plan.addRangeCheck(check);
+  }
+
+  return Result::ok;
+}
+
+Result BucketIndexMutator::collectRanges(hsql::Expr* expr, std::map<ColumnRef, Range>& ranges) {
+  if (!expr->isType(hsql::kExprOperator)) {
+    return Result::ok;
+  }
+
+  bool is_comparison = false;
+  switch (expr->opType) {
+  case hsql::kOpAnd:
+    CHECK_RESULT(collectRanges(expr->expr, ranges));
+    return collectRanges(expr->expr2, ranges);
+  case hsql::kOpLess:
+  case hsql::kOpLessEq:
+  case hsql::kOpGreater:
+  case hsql::kOpGreaterEq:
+    is_comparison = true;
+    if (!expr->expr->isType(hsql::kExprColumnRef) || !expr->expr2->isLiteral()) {
+      return Result::ok;
+    }
+    break;
+  case hsql::kOpBetween:
+    if (!expr->expr->isType(hsql::kExprColumnRef) || !(*expr->exprList)[0]->isLiteral() ||
+        !(*expr->exprList)[1]->isLiteral()) {
+      return Result::ok;
+    }
+    break;
+  default:
+    return Result::ok;
+  }
+
+  hsql::Expr* column = expr->expr;
+  if (column->table == nullptr) {
+    return Result::makeError(
+        fmt::format("postgres_tde: unable to determine the source of column {}. Please specify "
+                    "an explicit table/alias reference",
+                    column->name));
+  }
+
+  absl::string_view table_name = getTableNameByAlias(column->table);
+  auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column->name);
+  if (column_config == nullptr || !column_config->hasBucketIndex()) {
+    return Result::ok;
+  }
+
+  ENVOY_LOG(debug, "bucket index candidate: {}.{}", table_name, column->name);
+  Range& range = ranges[ColumnRef(std::string(table_name), std::string(column->name))];
+  range.config_ = column_config;
+  range.predicates_.push_back(expr);
+
+  if (!is_comparison) {
+    CHECK_RESULT(addBound(range, true, (*expr->exprList)[0], true));
+    return addBound(range, false, (*expr->exprList)[1], true);
+  }
+
+  bool lower = expr->opType == hsql::kOpGreater || expr->opType == hsql::kOpGreaterEq;
+  bool inclusive = expr->opType == hsql::kOpGreaterEq || expr->opType == hsql::kOpLessEq;
+  return addBound(range, lower, expr->expr2, inclusive);
+}
+
+Result BucketIndexMutator::addBound(Range& range, bool lower, hsql::Expr* literal,
+                                    bool inclusive) {
+  OrderedValue value;
+  CHECK_RESULT(getLiteralValue(literal, range.config_, value));
+
+  // The tightest bound wins
+  if (lower) {
+    if (!range.has_lower_ || value.ordinal() > range.lower_.ordinal() ||
+        (value.ordinal() == range.lower_.ordinal() && !inclusive)) {
+      range.has_lower_ = true;
+      range.lower_ = value;
+      range.lower_inclusive_ = inclusive;
+    }
+  } else {
+    if (!range.has_upper_ || value.ordinal() < range.upper_.ordinal() ||
+        (value.ordinal() == range.upper_.ordinal() && !inclusive)) {
+      range.has_upper_ = true;
+      range.upper_ = value;
+      range.upper_inclusive_ = inclusive;
+    }
+  }
+
+  return Result::ok;
+}
+
+Result BucketIndexMutator::mutateRanges(hsql::SelectStatement* stmt,
+                                        std::map<ColumnRef, Range>& ranges) {
+  for (auto& [column_ref, range] : ranges) {
+    const ColumnConfig* column_config = range.config_;
+    if (!range.has_lower_ || !range.has_upper_) {
+      return Result::makeError(fmt::format("postgres_tde: range over column {} must have both "
+                                           "bounds to be looked up by the bucket index",
+                                           column_config->columnName()));
+    }
+
+    // Rows are filtered after the database has limited or aggregated them
+    if (stmt->limit != nullptr || stmt->groupBy != nullptr) {
+      return Result::makeError(fmt::format("postgres_tde: LIMIT and GROUP BY can't be used with "
+                                           "a range over column {}",
+                                           column_config->columnName()));
+    }
+
+    if (!isColumnSelected(column_ref)) {
+      return Result::makeError(fmt::format("postgres_tde: column {}.{} must be present in SELECT "
+                                           "body to be compared with a range",
+                                           column_ref.table(), column_ref.column()));
+    }
+
+    BucketIndexEncoder encoder(*column_config);
+    int64_t first_bucket = encoder.bucket(range.lower_);
+    // Empty ranges still need a valid lookup, all the rows are filtered out anyway
+    int64_t last_bucket = std::max(encoder.bucket(range.upper_), first_bucket);
+    if (static_cast<uint64_t>(last_bucket) - static_cast<uint64_t>(first_bucket) >=
+        MAX_RANGE_BUCKETS) {
+      return Result::makeError(fmt::format(
+          "postgres_tde: range over column {} covers more than {} buckets of the bucket index",
+          column_config->columnName(), MAX_RANGE_BUCKETS));
+    }
+
+    std::vector<std::string> bucket_values;
+    std::vector<uint8_t> index_value;
+    for (int64_t bucket = first_bucket;; bucket++) {
+      encoder.encodeBucket(bucket, index_value);
+      bucket_values.push_back(toByteaHex(index_value));
+      if (bucket == last_bucket) {
+        break;
+      }
+    }
+
+    // Each predicate over the column becomes the same lookup, the conjunction stays valid
+    for (hsql::Expr* predicate : range.predicates_) {
+      hsql::Expr* column = predicate->expr;
+      free(column->name);
+      column->name = Common::Utils::makeOwnedCString(column_config->bucketIndexColumnName());
+
+      delete predicate->expr2;
+      predicate->expr2 = nullptr;
+      if (predicate->exprList != nullptr) {
+        for (hsql::Expr* bound : *predicate->exprList) {
+          delete bound;
+        }
+        delete predicate->exprList;
+      }
+
+      predicate->opType = hsql::kOpIn;
+      predicate->exprList = new std::vector<hsql::Expr*>();
+      for (const std::string& value : bucket_values) {
+        predicate->exprList->push_back(
+            hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(value)));
+      }
+    }
+
+    ENVOY_LOG(debug, "range over {}.{} is looked up by {} buckets", column_ref.table(),
+              column_ref.column(), bucket_values.size());
+    range_checks_.emplace_back(
+        column_ref, ResultPlan::RangeCheck{0, column_config, range.lower_.ordinal(),
+                                           range.lower_inclusive_, range.upper_.ordinal(),
+                                           range.upper_inclusive_});
+  }
+
+  return Result::ok;
+}
+
+Result BucketIndexMutator::mutateInsertStatement() {
+  for (hsql::InsertStatement* stmt : insert_mutation_candidates_) {
+    if (stmt->columns->size() != stmt->values->size()) {
+      return Result::makeError("postgres_tde: bad INSERT statement");
+    }
+
+    std::vector<char*> index_columns;
+    std::vector<hsql::Expr*> index_values;
+    absl::Cleanup cleanup = [&]() {
+      for (char* column : index_columns) {
+        free(column);
+      }
+      for (hsql::Expr* value : index_values) {
+        delete value;
+      }
+    };
+
+    for (size_t i = 0; i < stmt->columns->size(); i++) {
+      char* column = (*stmt->columns)[i];
+      hsql::Expr* value = (*stmt->values)[i];
+
+      auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(stmt->tableName, column);
+      if (column_config == nullptr || !column_config->hasBucketIndex()) {
+        continue;
+      }
+
+      if (!value->isLiteral()) {
+        return Result::makeError(
+            "postgres_tde: only literals can be used as INSERT values for columns with bucket index");
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createIndexLiteral(value, column_config, index_value));
+      index_values.push_back(index_value);
+      index_columns.push_back(
+          Common::Utils::makeOwnedCString(column_config->bucketIndexColumnName()));
+    }
+
+    stmt->columns->insert(stmt->columns->end(), index_columns.begin(), index_columns.end());
+    index_columns.clear();
+    stmt->values->insert(stmt->values->end(), index_values.begin(), index_values.end());
+    index_values.clear();
+  }
+
+  return Result::ok;
+}
+
+Result BucketIndexMutator::mutateUpdateStatement() {
+  for (hsql::UpdateStatement* stmt : update_mutation_candidates_) {
+    std::vector<hsql::UpdateClause*> index_updates;
+    absl::Cleanup cleanup = [&]() {
+      for (hsql::UpdateClause* update : index_updates) {
+        free(update->column);
+        delete update->value;
+        delete update;
+      }
+    };
+
+    for (hsql::UpdateClause* update : *stmt->updates) {
+      auto column_config =
+          mgr_->getEncryptionConfig()->getColumnConfig(stmt->table->name, update->column);
+      if (column_config == nullptr || !column_config->hasBucketIndex()) {
+        continue;
+      }
+
+      if (!update->value->isLiteral()) {
+        return Result::makeError(
+            "postgres_tde: only literals can be used as UPDATE values for columns with bucket index");
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createIndexLiteral(update->value, column_config, index_value));
+      index_updates.push_back(new hsql::UpdateClause{
+          Common::Utils::makeOwnedCString(column_config->bucketIndexColumnName()), index_value});
+    }
+
+    stmt->updates->insert(stmt->updates->end(), index_updates.begin(), index_updates.end());
+    index_updates.clear();
+  }
+
+  return Result::ok;
+}
+
+Result BucketIndexMutator::getLiteralValue(hsql::Expr* literal, const ColumnConfig* column_config,
+                                           OrderedValue& value) {
+  bool valid = false;
+  switch (literal->type) {
+  case hsql::kExprLiteralString:
+    valid = OrderedValue::fromText(column_config->origDataType(), literal->name, value);
+    break;
+  case hsql::kExprLiteralInt:
+    valid = OrderedValue::fromInt(column_config->origDataType(), literal->ival, value);
+    break;
+  case hsql::kExprLiteralFloat:
+    valid = OrderedValue::fromFloat(column_config->origDataType(), literal->fval, value);
+    break;
+  default:
+    break;
+  }
+
+  if (!valid) {
+    return Result::makeError(fmt::format(
+        "postgres_tde: invalid value for the bucket index of column {}", column_config->columnName()));
+  }
+
+  return Result::ok;
+}
+
+Result BucketIndexMutator::createIndexLiteral(hsql::Expr* orig_literal,
+                                              const ColumnConfig* column_config,
+                                              hsql::Expr*& index_literal) {
+  ASSERT(orig_literal->isLiteral());
+
+  if (orig_literal->type == hsql::kExprLiteralNull) {
+    // do nothing with null values
+    index_literal = hsql::Expr::makeNullLiteral();
+    return Result::ok;
+  }
+
+  OrderedValue value;
+  CHECK_RESULT(getLiteralValue(orig_literal, column_config, value));
+
+  std::vector<uint8_t> index_value;
+  BucketIndexEncoder(*column_config).encode(value, index_value);
+  index_literal = hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(toByteaHex(index_value)));
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
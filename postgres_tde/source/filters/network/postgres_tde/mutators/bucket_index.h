@@ -0,0 +1,61 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+using Common::SQLUtils::ColumnRef;
+
+// Rewrites ranges over the columns with the bucket index into lookups of the covered buckets,
+// the exact bounds are checked by the proxy on the decrypted values. Maintains the index column
+// on INSERT and UPDATE
+class BucketIndexMutator : public BaseMutator {
+public:
+  explicit BucketIndexMutator(MutationManager* manager);
+  BucketIndexMutator(const BucketIndexMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+protected:
+  // Bounds of a single column combined from all the predicates over it in the WHERE clause
+  struct Range {
+    const ColumnConfig* config_{nullptr};
+    // Predicates to be replaced with the bucket lookup
+    std::vector<hsql::Expr*> predicates_;
+
+    bool has_lower_{false};
+    OrderedValue lower_;
+    bool lower_inclusive_{false};
+
+    bool has_upper_{false};
+    OrderedValue upper_;
+    bool upper_inclusive_{false};
+  };
+
+  Result collectRanges(hsql::Expr* expr, std::map<ColumnRef, Range>& ranges);
+  Result addBound(Range& range, bool lower, hsql::Expr* literal, bool inclusive);
+  Result mutateRanges(hsql::SelectStatement* stmt, std::map<ColumnRef, Range>& ranges);
+  Result mutateInsertStatement();
+  Result mutateUpdateStatement();
+
+  Result getLiteralValue(hsql::Expr* literal, const ColumnConfig* column_config,
+                         OrderedValue& value);
+  Result createIndexLiteral(hsql::Expr* orig_literal, const ColumnConfig* column_config,
+                            hsql::Expr*& index_literal);
+
+protected:
+  // Exact bounds to be checked on the result, column indices are filled in by RowDescription
+  std::vector<std::pair<ColumnRef, ResultPlan::RangeCheck>> range_checks_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -23,11 +23,12 @@ Result EncryptionMutator::mutateQuery(hsql::SQLParserResult& query) {
   return Result::ok;
 }
 
-Result EncryptionMutator::mutateRowDescription(RowDescriptionMessage& message) {
-  data_row_config_.clear();
-
+Result EncryptionMutator::mutateRowDescription(RowDescriptionMessage& message,
+                                               ResultPlan& plan) {
   std::unordered_set<std::string> column_names;
-  for (auto& column : message.column_descriptions()) {
+  size_t columns_count = message.column_descriptions().size();
+  for (size_t i = 0; i < columns_count; i++) {
+    auto& column = message.column_descriptions()[i];
     if (column_names.find(column->name()) != column_names.end()) {
       return Result::makeError(fmt::format("postgres_tde: detected ambiguous column name {}. "
                                            "Please specify a different alias for each column",
@@ -38,14 +39,11 @@ Result EncryptionMutator::mutateRowDescription(RowDescriptionMessage& message) {
 
     auto column_ref = getSelectColumnByAlias(column->name());
     if (column_ref == nullptr) {
-      data_row_config_.push_back(nullptr);
       continue;
     }
 
     auto column_config =
         mgr_->getEncryptionConfig()->getColumnConfig(column_ref->table(), column_ref->column());
-    data_row_config_.push_back(
-        mgr_->getEncryptionConfig()->getColumnConfig(column_ref->table(), column_ref->column()));
 
     if (column_config != nullptr && column_config->isEncrypted()) {
       ENVOY_LOG(debug, "matched encrypted column: {} -> ({}, {})", column->name(),
@@ -57,41 +55,9 @@ Result EncryptionMutator::mutateRowDescription(RowDescriptionMessage& message) {
       // Replace data type OID and size
       column->dataType() = column_config->origDataType();
       column->dataSize() = column_config->origDataSize();
-    }
-  }
-
-  return Result::ok;
-}
-
-Result EncryptionMutator::mutateDataRow(std::unique_ptr<DataRowMessage>& message) {
-  ASSERT(message->columns().size() == data_row_config_.size());
-  size_t columns_count = message->columns().size();
 
-  auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
-  for (size_t i = 0; i < columns_count; i++) {
-    auto& column = message->columns()[i];
-    const ColumnConfig* config = data_row_config_[i];
-
-    if (config == nullptr || !config->isEncrypted() || column->is_null()) {
-      continue;
+      plan.addDecryption(i, column_config);
     }
-
-    // Decrypt data
-
-    auto& encrypted_column = column->value();
-    absl::string_view encrypted_hex_string(reinterpret_cast<const char*>(encrypted_column.data()),
-                                           encrypted_column.size());
-    encrypted_hex_string.remove_prefix(2); // 0x
-    auto encrypted_raw_data = absl::HexStringToBytes(encrypted_hex_string);
-    std::vector<uint8_t> decrypted_data;
-    Result result = crypto_util_ext.AESDecrypt(
-        config->encryptionKey(),
-        absl::string_view(encrypted_raw_data.data(), encrypted_raw_data.size()), decrypted_data);
-    if (!result.isOk) {
-      return result;
-    }
-
-    column = std::make_unique<VarByteN>(std::move(decrypted_data));
   }
 
   return Result::ok;
@@ -113,7 +79,7 @@ Result EncryptionMutator::visitExpression(hsql::Expr* expr) {
                                            expr->name));
     }
 
-    const std::string& table_name = getTableNameByAlias(expr->table);
+    absl::string_view table_name = getTableNameByAlias(expr->table);
     auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, expr->name);
     if (column_config != nullptr && column_config->isEncrypted()) {
       return Result::makeError(fmt::format("postgres_tde: invalid use of encrypted column {}.{}",
@@ -215,6 +181,12 @@ std::string EncryptionMutator::generateCryptoString(absl::string_view data,
   auto encrypted_data = crypto_util_ext.AESEncrypt(column_config->encryptionKey(), data);
 
   std::string encrypted_data_hex_str = std::string("\\x");
+  if (column_config->encryptionKeyVersion() != 0) {
+    // Versioned format: [version][IV][ciphertext]
+    uint8_t version = column_config->encryptionKeyVersion();
+    encrypted_data_hex_str.append(
+        absl::BytesToHexString(absl::string_view(reinterpret_cast<const char*>(&version), 1)));
+  }
   encrypted_data_hex_str.append(absl::BytesToHexString(absl::string_view(
       reinterpret_cast<const char*>(encrypted_data.data()), encrypted_data.size())));
   return encrypted_data_hex_str;
@@ -15,8 +15,7 @@ public:
   EncryptionMutator(const EncryptionMutator&) = delete;
 
   Result mutateQuery(hsql::SQLParserResult& query) override;
-  Result mutateRowDescription(RowDescriptionMessage&) override;
-  Result mutateDataRow(std::unique_ptr<DataRowMessage>&) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
 
 protected:
   Result visitExpression(hsql::Expr* expr) override;
@@ -26,9 +25,6 @@ protected:
 
   hsql::Expr* createEncryptedLiteral(hsql::Expr* orig_literal, const ColumnConfig* column_config);
   std::string generateCryptoString(absl::string_view data, const ColumnConfig* column_config);
-
-protected:
-  std::vector<const ColumnConfig*> data_row_config_;
 };
 
 } // namespace PostgresTDE
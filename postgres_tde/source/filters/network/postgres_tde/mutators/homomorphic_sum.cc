@@ -0,0 +1,347 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/homomorphic_sum.h"
+
+#include <cstring>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "source/common/common/fmt.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Aggregate defined by DDLRewriter along with the first homomorphic sum column
+constexpr char HOMOMORPHIC_SUM_AGGREGATE[] = "tde_paillier_sum";
+
+} // namespace
+
+HomomorphicSumMutator::HomomorphicSumMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result HomomorphicSumMutator::mutateQuery(hsql::SQLParserResult& query) {
+  insert_mutation_candidates_.clear();
+  update_mutation_candidates_.clear();
+  sum_columns_.clear();
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  // Positions of the sums are tracked for a single result only, other queries are left to
+  // the proxy aggregation
+  if (query.size() == 1 && query.getStatements()[0]->isType(hsql::kStmtSelect)) {
+    auto select = dynamic_cast<hsql::SelectStatement*>(query.getStatements()[0]);
+    if (canPushDown(select)) {
+      mutateSelectStatement(select);
+    }
+  }
+
+  CHECK_RESULT(mutateInsertStatement());
+  CHECK_RESULT(mutateUpdateStatement());
+  return Result::ok;
+}
+
+Result HomomorphicSumMutator::mutateRowDescription(RowDescriptionMessage& message,
+                                                   ResultPlan& plan) {
+  auto& descriptions = message.column_descriptions();
+  for (const SumColumn& sum : sum_columns_) {
+    if (sum.column_idx_ >= descriptions.size()) {
+      return Result::makeError("postgres_tde: unexpected columns in the result");
+    }
+
+    // Same types as SUM over the plaintext has
+    auto& description = descriptions[sum.column_idx_];
+    if (sum.config_->origDataType() == INT8OID) {
+      description->dataType() = NUMERICOID;
+      description->dataSize() = -1;
+    } else {
+      description->dataType() = INT8OID;
+      description->dataSize() = 8;
+    }
+
+    plan.addHomomorphicSumDecryption(sum.column_idx_, sum.config_);
+  }
+
+  if (!sum_columns_.empty()) {
+    ENVOY_LOG(debug, "{} sums will be decrypted by the proxy", sum_columns_.size());
+  }
+  return Result::ok;
+}
+
+const ColumnConfig* HomomorphicSumMutator::getEncryptedColumnConfig(
+    const hsql::Expr* column) const {
+  if (!column->isType(hsql::kExprColumnRef) || column->table == nullptr) {
+    return nullptr;
+  }
+
+  const ColumnConfig* column_config = mgr_->getEncryptionConfig()->getColumnConfig(
+      getTableNameByAlias(column->table), column->name);
+  if (column_config == nullptr || !column_config->isEncrypted()) {
+    return nullptr;
+  }
+
+  return column_config;
+}
+
+const ColumnConfig* HomomorphicSumMutator::getHomomorphicSumConfig(const hsql::Expr* expr) const {
+  if (!expr->isType(hsql::kExprFunctionRef) || expr->distinct || expr->exprList == nullptr ||
+      expr->exprList->size() != 1 || absl::AsciiStrToLower(expr->name) != "sum") {
+    return nullptr;
+  }
+
+  const ColumnConfig* column_config = getEncryptedColumnConfig((*expr->exprList)[0]);
+  if (column_config == nullptr || !column_config->hasHomomorphicSum()) {
+    return nullptr;
+  }
+
+  return column_config;
+}
+
+bool HomomorphicSumMutator::isEncryptedAggregate(const hsql::Expr* expr) const {
+  if (!expr->isType(hsql::kExprFunctionRef) || expr->exprList == nullptr) {
+    return false;
+  }
+
+  // Non-NULL values of encrypted columns are counted by the database just as well
+  if (absl::AsciiStrToLower(expr->name) == "count" && !expr->distinct) {
+    return false;
+  }
+
+  for (const hsql::Expr* arg : *expr->exprList) {
+    if (getEncryptedColumnConfig(arg) != nullptr) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool HomomorphicSumMutator::refersToSum(hsql::SelectStatement* stmt,
+                                        const hsql::Expr* expr) const {
+  if (expr->isType(hsql::kExprLiteralInt)) {
+    // Position in the select list
+    return expr->ival >= 1 && static_cast<size_t>(expr->ival) <= stmt->selectList->size() &&
+           getHomomorphicSumConfig((*stmt->selectList)[expr->ival - 1]) != nullptr;
+  }
+
+  if (expr->isType(hsql::kExprColumnRef) && expr->table == nullptr) {
+    // Unqualified names may refer to the aliases of the select list
+    for (const hsql::Expr* item : *stmt->selectList) {
+      if (item->alias != nullptr && strcmp(item->alias, expr->name) == 0 &&
+          getHomomorphicSumConfig(item) != nullptr) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  return getHomomorphicSumConfig(expr) != nullptr;
+}
+
+bool HomomorphicSumMutator::canPushDown(hsql::SelectStatement* stmt) const {
+  bool has_sum = false;
+  for (const hsql::Expr* expr : *stmt->selectList) {
+    if (expr->isType(hsql::kExprStar)) {
+      return false;
+    }
+
+    if (getHomomorphicSumConfig(expr) != nullptr) {
+      has_sum = true;
+      continue;
+    }
+
+    // Rows can't be grouped by the randomized ciphertexts and the other aggregates need the
+    // plaintext, the proxy has to aggregate such results
+    if (getEncryptedColumnConfig(expr) != nullptr || isEncryptedAggregate(expr)) {
+      return false;
+    }
+  }
+
+  if (!has_sum || stmt->selectDistinct) {
+    return false;
+  }
+
+  if (stmt->groupBy != nullptr) {
+    if (stmt->groupBy->having != nullptr) {
+      return false;
+    }
+
+    for (const hsql::Expr* expr : *stmt->groupBy->columns) {
+      if (getEncryptedColumnConfig(expr) != nullptr || refersToSum(stmt, expr)) {
+        return false;
+      }
+    }
+  }
+
+  // The database would sort by the ciphertexts of the sums
+  if (stmt->order != nullptr) {
+    for (const hsql::OrderDescription* order : *stmt->order) {
+      if (refersToSum(stmt, order->expr)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void HomomorphicSumMutator::mutateSelectStatement(hsql::SelectStatement* stmt) {
+  for (size_t i = 0; i < stmt->selectList->size(); i++) {
+    hsql::Expr*& expr = (*stmt->selectList)[i];
+    const ColumnConfig* column_config = getHomomorphicSumConfig(expr);
+    if (column_config == nullptr) {
+      continue;
+    }
+
+    const hsql::Expr* column = (*expr->exprList)[0];
+    auto args = new std::vector<hsql::Expr*>{
+        hsql::Expr::makeColumnRef(
+            Common::Utils::makeOwnedCString(column->table),
+            Common::Utils::makeOwnedCString(column_config->homomorphicColumnName())),
+        hsql::Expr::makeLiteral(
+            Common::Utils::makeOwnedCString(column_config->homomorphicModulus()))};
+    hsql::Expr* sum = hsql::Expr::makeFunctionRef(
+        Common::Utils::makeOwnedCString(HOMOMORPHIC_SUM_AGGREGATE), args, false);
+
+    // Keep the name of the result column
+    sum->alias = Common::Utils::makeOwnedCString(
+        expr->alias != nullptr ? std::string(expr->alias) : absl::AsciiStrToLower(expr->name));
+
+    delete expr;
+    expr = sum;
+    sum_columns_.push_back(SumColumn{i, column_config});
+  }
+
+  ENVOY_LOG(debug, "{} sums will be computed over the homomorphic ciphertexts",
+            sum_columns_.size());
+}
+
+Result HomomorphicSumMutator::mutateInsertStatement() {
+  for (hsql::InsertStatement* stmt : insert_mutation_candidates_) {
+    if (stmt->columns->size() != stmt->values->size()) {
+      return Result::makeError("postgres_tde: bad INSERT statement");
+    }
+
+    std::vector<char*> ciphertext_columns;
+    std::vector<hsql::Expr*> ciphertext_values;
+    absl::Cleanup cleanup = [&]() {
+      for (char* column : ciphertext_columns) {
+        free(column);
+      }
+      for (hsql::Expr* value : ciphertext_values) {
+        delete value;
+      }
+    };
+
+    for (size_t i = 0; i < stmt->columns->size(); i++) {
+      char* column = (*stmt->columns)[i];
+      hsql::Expr* value = (*stmt->values)[i];
+
+      auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(stmt->tableName, column);
+      if (column_config == nullptr || !column_config->hasHomomorphicSum()) {
+        continue;
+      }
+
+      if (!value->isLiteral()) {
+        return Result::makeError("postgres_tde: only literals can be used as INSERT values for "
+                                 "columns with homomorphic sum");
+      }
+
+      hsql::Expr* ciphertext_value;
+      CHECK_RESULT(createCiphertextLiteral(value, column_config, ciphertext_value));
+      ciphertext_values.push_back(ciphertext_value);
+      ciphertext_columns.push_back(
+          Common::Utils::makeOwnedCString(column_config->homomorphicColumnName()));
+    }
+
+    stmt->columns->insert(stmt->columns->end(), ciphertext_columns.begin(),
+                          ciphertext_columns.end());
+    ciphertext_columns.clear();
+    stmt->values->insert(stmt->values->end(), ciphertext_values.begin(), ciphertext_values.end());
+    ciphertext_values.clear();
+  }
+
+  return Result::ok;
+}
+
+Result HomomorphicSumMutator::mutateUpdateStatement() {
+  for (hsql::UpdateStatement* stmt : update_mutation_candidates_) {
+    std::vector<hsql::UpdateClause*> ciphertext_updates;
+    absl::Cleanup cleanup = [&]() {
+      for (hsql::UpdateClause* update : ciphertext_updates) {
+        free(update->column);
+        delete update->value;
+        delete update;
+      }
+    };
+
+    for (hsql::UpdateClause* update : *stmt->updates) {
+      auto column_config =
+          mgr_->getEncryptionConfig()->getColumnConfig(stmt->table->name, update->column);
+      if (column_config == nullptr || !column_config->hasHomomorphicSum()) {
+        continue;
+      }
+
+      if (!update->value->isLiteral()) {
+        return Result::makeError("postgres_tde: only literals can be used as UPDATE values for "
+                                 "columns with homomorphic sum");
+      }
+
+      hsql::Expr* ciphertext_value;
+      CHECK_RESULT(createCiphertextLiteral(update->value, column_config, ciphertext_value));
+      ciphertext_updates.push_back(new hsql::UpdateClause{
+          Common::Utils::makeOwnedCString(column_config->homomorphicColumnName()),
+          ciphertext_value});
+    }
+
+    stmt->updates->insert(stmt->updates->end(), ciphertext_updates.begin(),
+                          ciphertext_updates.end());
+    ciphertext_updates.clear();
+  }
+
+  return Result::ok;
+}
+
+Result HomomorphicSumMutator::createCiphertextLiteral(hsql::Expr* orig_literal,
+                                                      const ColumnConfig* column_config,
+                                                      hsql::Expr*& ciphertext_literal) {
+  ASSERT(orig_literal->isLiteral());
+
+  int64_t value = 0;
+  bool valid = false;
+  switch (orig_literal->type) {
+  case hsql::kExprLiteralNull:
+    // do nothing with null values
+    ciphertext_literal = hsql::Expr::makeNullLiteral();
+    return Result::ok;
+  case hsql::kExprLiteralInt:
+    value = orig_literal->ival;
+    valid = true;
+    break;
+  case hsql::kExprLiteralString:
+    valid = absl::SimpleAtoi(orig_literal->name, &value);
+    break;
+  default:
+    break;
+  }
+
+  if (!valid) {
+    return Result::makeError(
+        fmt::format("postgres_tde: invalid value for the homomorphic sum of column {}",
+                    column_config->columnName()));
+  }
+
+  std::string ciphertext;
+  column_config->homomorphicContext().encrypt(value, ciphertext);
+  ciphertext_literal = hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(ciphertext));
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
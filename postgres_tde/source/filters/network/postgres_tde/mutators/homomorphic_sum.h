@@ -0,0 +1,56 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+
+// Rewrites SUM over the columns with homomorphic sum support into the product of the Paillier
+// ciphertexts computed by the database, so only the aggregated values are decrypted by the proxy
+// instead of aggregating the whole result (see ProxyAggregateMutator). Applied only if all the
+// aggregates over encrypted columns of the query can be computed this way and the rows are
+// grouped by plain columns. Maintains the ciphertext column on INSERT and UPDATE
+class HomomorphicSumMutator : public BaseMutator {
+public:
+  explicit HomomorphicSumMutator(MutationManager* manager);
+  HomomorphicSumMutator(const HomomorphicSumMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+protected:
+  // Sum in the select list computed over the ciphertexts
+  struct SumColumn {
+    size_t column_idx_;
+    const ColumnConfig* config_;
+  };
+
+  // Returns the config of the column if the expression is SUM over a column with homomorphic
+  // sum support, nullptr otherwise
+  const ColumnConfig* getHomomorphicSumConfig(const hsql::Expr* expr) const;
+  const ColumnConfig* getEncryptedColumnConfig(const hsql::Expr* column) const;
+  bool isEncryptedAggregate(const hsql::Expr* expr) const;
+  bool canPushDown(hsql::SelectStatement* stmt) const;
+  // Whether the expression of GROUP BY or ORDER BY refers to a sum of the select list
+  bool refersToSum(hsql::SelectStatement* stmt, const hsql::Expr* expr) const;
+
+  void mutateSelectStatement(hsql::SelectStatement* stmt);
+  Result mutateInsertStatement();
+  Result mutateUpdateStatement();
+  Result createCiphertextLiteral(hsql::Expr* orig_literal, const ColumnConfig* column_config,
+                                 hsql::Expr*& ciphertext_literal);
+
+protected:
+  std::vector<SumColumn> sum_columns_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
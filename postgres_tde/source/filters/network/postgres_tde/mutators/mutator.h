@@ -4,6 +4,7 @@
 #include "envoy/common/pure.h"
 #include "postgres_tde/source/common/utils/utils.h"
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -19,8 +20,10 @@ public:
   virtual ~Mutator() = default;
 
   virtual Result mutateQuery(hsql::SQLParserResult&) PURE;
-  virtual Result mutateRowDescription(RowDescriptionMessage&) { return Result::ok; }
-  virtual Result mutateDataRow(std::unique_ptr<DataRowMessage>&) { return Result::ok; }
+
+  // Mutators don't process DataRow messages directly - instead, they describe the work
+  // to be done on the result's columns in the plan, which is then executed for each row
+  virtual Result mutateRowDescription(RowDescriptionMessage&, ResultPlan&) { return Result::ok; }
 
 protected:
   explicit Mutator(MutationManager *mgr): mgr_(mgr) {}
@@ -0,0 +1,299 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/order_index.h"
+#include "postgres_tde/source/filters/network/postgres_tde/order_index_encoder.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "source/common/common/fmt.h"
+#include "absl/strings/escaping.h"
+#include "absl/cleanup/cleanup.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+OrderIndexMutator::OrderIndexMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result OrderIndexMutator::mutateQuery(hsql::SQLParserResult& query) {
+  comparison_mutation_candidates_.clear();
+  order_by_mutation_candidates_.clear();
+  insert_mutation_candidates_.clear();
+  update_mutation_candidates_.clear();
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+  CHECK_RESULT(mutateComparisons());
+  CHECK_RESULT(mutateOrderByExpressions());
+  CHECK_RESULT(mutateInsertStatement());
+  CHECK_RESULT(mutateUpdateStatement());
+  return Result::ok;
+}
+
+Result OrderIndexMutator::visitSelectStatement(hsql::SelectStatement* stmt) {
+  CHECK_RESULT(Visitor::visitSelectStatement(stmt));
+
+  if (stmt->order != nullptr) {
+    // Rows are ordered by the index column instead
+    order_by_mutation_candidates_.push_back(stmt);
+  }
+  return Result::ok;
+}
+
+Result OrderIndexMutator::visitOperatorExpression(hsql::Expr* expr) {
+  switch (expr->opType) {
+  // Index values are deterministic, so they also serve equality lookups of the columns
+  // without blind index. Comparisons of blind-indexed columns are already rewritten by
+  // the blind index mutator at this point
+  case hsql::kOpEquals:
+  case hsql::kOpNotEquals:
+  case hsql::kOpLess:
+  case hsql::kOpLessEq:
+  case hsql::kOpGreater:
+  case hsql::kOpGreaterEq:
+    if (expr->expr->isType(hsql::kExprColumnRef) && expr->expr2->isLiteral()) {
+      ENVOY_LOG(debug, "order index candidate: {} {}", expr->expr->name, expr->expr2->name);
+      comparison_mutation_candidates_.push_back(expr);
+      return Result::ok;
+    }
+    return Visitor::visitOperatorExpression(expr);
+  case hsql::kOpBetween:
+    if (expr->expr->isType(hsql::kExprColumnRef) && (*expr->exprList)[0]->isLiteral() &&
+        (*expr->exprList)[1]->isLiteral()) {
+      ENVOY_LOG(debug, "order index candidate: {} BETWEEN", expr->expr->name);
+      comparison_mutation_candidates_.push_back(expr);
+      return Result::ok;
+    }
+    return Visitor::visitOperatorExpression(expr);
+  default:
+    return Visitor::visitOperatorExpression(expr);
+  }
+}
+
+Result OrderIndexMutator::mutateComparisons() {
+  for (hsql::Expr* expr : comparison_mutation_candidates_) {
+    hsql::Expr* column = expr->expr;
+
+    const ColumnConfig* column_config;
+    CHECK_RESULT(getOrderIndexConfig(column, column_config));
+    if (column_config == nullptr) {
+      continue;
+    }
+
+    // Bounds are replaced with their index values, so the comparison is done by the database
+    // over the index column
+    std::vector<hsql::Expr*> bounds = {expr->expr2};
+    if (expr->opType == hsql::kOpBetween) {
+      bounds = *expr->exprList;
+    }
+
+    std::vector<hsql::Expr*> index_bounds;
+    absl::Cleanup cleanup = [&]() {
+      for (hsql::Expr* bound : index_bounds) {
+        delete bound;
+      }
+    };
+
+    for (hsql::Expr* bound : bounds) {
+      hsql::Expr* index_bound;
+      CHECK_RESULT(createIndexLiteral(bound, column_config, index_bound));
+      index_bounds.push_back(index_bound);
+    }
+
+    free(column->name);
+    column->name = Common::Utils::makeOwnedCString(column_config->orderIndexColumnName());
+
+    if (expr->opType == hsql::kOpBetween) {
+      for (size_t i = 0; i < bounds.size(); i++) {
+        delete (*expr->exprList)[i];
+        (*expr->exprList)[i] = index_bounds[i];
+      }
+    } else {
+      delete expr->expr2;
+      expr->expr2 = index_bounds[0];
+    }
+    index_bounds.clear();
+  }
+
+  return Result::ok;
+}
+
+Result OrderIndexMutator::mutateOrderByExpressions() {
+  for (hsql::SelectStatement* stmt : order_by_mutation_candidates_) {
+    for (hsql::OrderDescription* desc : *stmt->order) {
+      ColumnRef column_ref;
+      hsql::Expr* column = resolveOrderColumn(stmt, desc->expr, column_ref);
+      if (column == nullptr) {
+        if (desc->expr->isType(hsql::kExprColumnRef) && desc->expr->table == nullptr) {
+          return Result::makeError(fmt::format(
+              "postgres_tde: unable to determine the source of column {}. Please specify "
+              "an explicit table/alias reference",
+              desc->expr->name));
+        }
+        continue;
+      }
+
+      const ColumnConfig* column_config;
+      CHECK_RESULT(getOrderIndexConfig(column, column_config));
+      if (column_config == nullptr) {
+        continue;
+      }
+
+      if (column == desc->expr) {
+        free(column->name);
+        column->name = Common::Utils::makeOwnedCString(column_config->orderIndexColumnName());
+        continue;
+      }
+
+      // Positions and aliases refer to the encrypted column of the select list, so the item is
+      // replaced with the index column of the same table
+      hsql::Expr* index_column = hsql::Expr::makeColumnRef(
+          Common::Utils::makeOwnedCString(column->table),
+          Common::Utils::makeOwnedCString(column_config->orderIndexColumnName()));
+      delete desc->expr;
+      desc->expr = index_column;
+    }
+  }
+
+  return Result::ok;
+}
+
+Result OrderIndexMutator::mutateInsertStatement() {
+  for (hsql::InsertStatement* stmt : insert_mutation_candidates_) {
+    if (stmt->columns->size() != stmt->values->size()) {
+      return Result::makeError("postgres_tde: bad INSERT statement");
+    }
+
+    std::vector<char*> index_columns;
+    std::vector<hsql::Expr*> index_values;
+    absl::Cleanup cleanup = [&]() {
+      for (char* column : index_columns) {
+        free(column);
+      }
+      for (hsql::Expr* value : index_values) {
+        delete value;
+      }
+    };
+
+    for (size_t i = 0; i < stmt->columns->size(); i++) {
+      char* column = (*stmt->columns)[i];
+      hsql::Expr* value = (*stmt->values)[i];
+
+      auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(stmt->tableName, column);
+      if (column_config == nullptr || !column_config->hasOrderIndex()) {
+        continue;
+      }
+
+      if (!value->isLiteral()) {
+        return Result::makeError(
+            "postgres_tde: only literals can be used as INSERT values for columns with order index");
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createIndexLiteral(value, column_config, index_value));
+      index_values.push_back(index_value);
+      index_columns.push_back(Common::Utils::makeOwnedCString(column_config->orderIndexColumnName()));
+    }
+
+    stmt->columns->insert(stmt->columns->end(), index_columns.begin(), index_columns.end());
+    index_columns.clear();
+    stmt->values->insert(stmt->values->end(), index_values.begin(), index_values.end());
+    index_values.clear();
+  }
+
+  return Result::ok;
+}
+
+Result OrderIndexMutator::mutateUpdateStatement() {
+  for (hsql::UpdateStatement* stmt : update_mutation_candidates_) {
+    std::vector<hsql::UpdateClause*> index_updates;
+    absl::Cleanup cleanup = [&]() {
+      for (hsql::UpdateClause* update : index_updates) {
+        free(update->column);
+        delete update->value;
+        delete update;
+      }
+    };
+
+    for (hsql::UpdateClause* update : *stmt->updates) {
+      auto column_config =
+          mgr_->getEncryptionConfig()->getColumnConfig(stmt->table->name, update->column);
+      if (column_config == nullptr || !column_config->hasOrderIndex()) {
+        continue;
+      }
+
+      if (!update->value->isLiteral()) {
+        return Result::makeError(
+            "postgres_tde: only literals can be used as UPDATE values for columns with order index");
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createIndexLiteral(update->value, column_config, index_value));
+      index_updates.push_back(new hsql::UpdateClause{
+          Common::Utils::makeOwnedCString(column_config->orderIndexColumnName()), index_value});
+    }
+
+    stmt->updates->insert(stmt->updates->end(), index_updates.begin(), index_updates.end());
+    index_updates.clear();
+  }
+
+  return Result::ok;
+}
+
+Result OrderIndexMutator::getOrderIndexConfig(hsql::Expr* column,
+                                              const ColumnConfig*& column_config) {
+  if (column->table == nullptr) {
+    return Result::makeError(
+        fmt::format("postgres_tde: unable to determine the source of column {}. Please specify "
+                    "an explicit table/alias reference",
+                    column->name));
+  }
+
+  absl::string_view table_name = getTableNameByAlias(column->table);
+  column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column->name);
+  if (column_config == nullptr || !column_config->hasOrderIndex()) {
+    ENVOY_LOG(debug, "order index is not configured for {}.{}", column->table, column->name);
+    column_config = nullptr;
+  }
+
+  return Result::ok;
+}
+
+Result OrderIndexMutator::createIndexLiteral(hsql::Expr* orig_literal,
+                                             const ColumnConfig* column_config,
+                                             hsql::Expr*& index_literal) {
+  ASSERT(orig_literal->isLiteral());
+
+  OrderIndexEncoder encoder(*column_config);
+  std::vector<uint8_t> index_value;
+  bool valid = false;
+  switch (orig_literal->type) {
+  case hsql::kExprLiteralNull:
+    // do nothing with null values
+    index_literal = hsql::Expr::makeNullLiteral();
+    return Result::ok;
+  case hsql::kExprLiteralString:
+    valid = encoder.encodeText(orig_literal->name, index_value);
+    break;
+  case hsql::kExprLiteralInt:
+    valid = encoder.encodeInt(orig_literal->ival, index_value);
+    break;
+  case hsql::kExprLiteralFloat:
+    valid = encoder.encodeFloat(orig_literal->fval, index_value);
+    break;
+  default:
+    break;
+  }
+
+  if (!valid) {
+    return Result::makeError(fmt::format(
+        "postgres_tde: invalid value for the order index of column {}", column_config->columnName()));
+  }
+
+  std::string index_hex_str = std::string("\\x");
+  index_hex_str.append(absl::BytesToHexString(
+      absl::string_view(reinterpret_cast<const char*>(index_value.data()), index_value.size())));
+  index_literal = hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(index_hex_str));
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
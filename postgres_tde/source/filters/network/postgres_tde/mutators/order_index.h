@@ -0,0 +1,44 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+
+// Rewrites comparisons and ORDER BY over the columns with the order-preserving index to use
+// the index column, and maintains the index column on INSERT and UPDATE
+class OrderIndexMutator : public BaseMutator {
+public:
+  explicit OrderIndexMutator(MutationManager* manager);
+  OrderIndexMutator(const OrderIndexMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+
+protected:
+  Result visitSelectStatement(hsql::SelectStatement* stmt) override;
+  Result visitOperatorExpression(hsql::Expr* expr) override;
+
+  Result mutateComparisons();
+  Result mutateOrderByExpressions();
+  Result mutateInsertStatement();
+  Result mutateUpdateStatement();
+
+  // Returns the config of the column if it has the order index, nullptr otherwise
+  Result getOrderIndexConfig(hsql::Expr* column, const ColumnConfig*& column_config);
+  Result createIndexLiteral(hsql::Expr* orig_literal, const ColumnConfig* column_config,
+                            hsql::Expr*& index_literal);
+
+protected:
+  std::vector<hsql::Expr*> comparison_mutation_candidates_;
+  std::vector<hsql::SelectStatement*> order_by_mutation_candidates_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
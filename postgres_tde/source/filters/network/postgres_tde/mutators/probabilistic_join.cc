@@ -1,4 +1,9 @@
 #include "postgres_tde/source/filters/network/postgres_tde/mutators/probabilistic_join.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
 #include "postgres_tde/source/common/crypto/utility_ext.h"
 #include "absl/strings/escaping.h"
@@ -9,6 +14,16 @@ namespace Extensions {
 namespace NetworkFilters {
 namespace PostgresTDE {
 
+namespace {
+
+// Over-fetch on top of the observed share of the false positives, so a typical page is
+// complete in one round trip
+constexpr double OVER_FETCH_MARGIN = 1.5;
+// Joins with more false positives are fetched again without the limit if the page is short
+constexpr double MAX_OVER_FETCH_FACTOR = 16;
+
+} // namespace
+
 ProbabilisticJoinMutator::ProbabilisticJoinMutator(MutationManager* manager)
     : BaseMutator(manager) {}
 
@@ -18,16 +33,18 @@ Result ProbabilisticJoinMutator::mutateQuery(hsql::SQLParserResult& query) {
   update_mutation_candidates_.clear();
 
   join_comparisons_.clear();
-  join_comparisons_indices_.clear();
+  limited_ = false;
 
   CHECK_RESULT(Visitor::visitQuery(query));
   CHECK_RESULT(mutateJoins());
   CHECK_RESULT(mutateInsertStatement());
   CHECK_RESULT(mutateUpdateStatement());
+  mutateLimit(query);
   return Result::ok;
 }
 
-Result ProbabilisticJoinMutator::mutateRowDescription(RowDescriptionMessage& message) {
+Result ProbabilisticJoinMutator::mutateRowDescription(RowDescriptionMessage& message,
+                                                      ResultPlan& plan) {
   size_t columns_count = message.column_descriptions().size();
 
   // Gather info about resulting columns and try to match them with the query
@@ -43,7 +60,7 @@ Result ProbabilisticJoinMutator::mutateRowDescription(RowDescriptionMessage& mes
   }
 
   // Determine column indices for each join comparison
-  for (auto& [left_column_ref, right_column_ref] : join_comparisons_) {
+  for (auto& [left_column_ref, right_column_ref, stats] : join_comparisons_) {
     if (columns2idx.find(left_column_ref) == columns2idx.end() ||
         columns2idx.find(right_column_ref) == columns2idx.end()) {
       return Result::makeError(
@@ -56,22 +73,13 @@ Result ProbabilisticJoinMutator::mutateRowDescription(RowDescriptionMessage& mes
     ENVOY_LOG(debug, "matched join: ({}.{}, {}.{}) -> (column {}, column {})",
               left_column_ref.table(), left_column_ref.column(), right_column_ref.table(),
               right_column_ref.column(), left_column_idx, right_column_idx);
-    join_comparisons_indices_.emplace_back(left_column_idx, right_column_idx);
-  }
 
-  return Result::ok;
-}
-
-Result ProbabilisticJoinMutator::mutateDataRow(std::unique_ptr<DataRowMessage>& message) {
-  for (auto [left_column_idx, right_column_idx]: join_comparisons_indices_) {
-    auto& left_column_data = message->columns()[left_column_idx];
-    auto& right_column_data = message->columns()[right_column_idx];
+    // Join keys are truncated, so most of the joined rows may be false positives
+    plan.addJoinCheck(left_column_idx, right_column_idx, stats);
+  }
 
-    if (*left_column_data != *right_column_data) {
-      ENVOY_LOG(debug, "discarding row because the join condition is not met: {}", message->toString());
-      message.reset();
-      return Result::ok;
-    }
+  if (limited_) {
+    plan.setJoinLimit(limit_, offset_, fetch_limit_);
   }
 
   return Result::ok;
@@ -108,17 +116,15 @@ Result ProbabilisticJoinMutator::mutateJoins() {
       }
     }
 
-    const std::string& left_table_name = getTableNameByAlias(left_column->table);
-    const std::string& left_column_name = left_column->name;
+    absl::string_view left_table_name = getTableNameByAlias(left_column->table);
+    absl::string_view left_column_name = left_column->name;
     auto left_column_config =
         mgr_->getEncryptionConfig()->getColumnConfig(left_table_name, left_column_name);
-    auto left_column_ref = ColumnRef(left_table_name, left_column_name);
 
-    const std::string& right_table_name = getTableNameByAlias(right_column->table);
-    const std::string& right_column_name = right_column->name;
+    absl::string_view right_table_name = getTableNameByAlias(right_column->table);
+    absl::string_view right_column_name = right_column->name;
     auto right_column_config =
         mgr_->getEncryptionConfig()->getColumnConfig(right_table_name, right_column_name);
-    auto right_column_ref = ColumnRef(right_table_name, right_column_name);
 
     if (left_column_config == nullptr || !left_column_config->hasJoin()) {
       ENVOY_LOG(debug, "join is not configured for {}.{}", left_table_name, left_column_name);
@@ -129,22 +135,28 @@ Result ProbabilisticJoinMutator::mutateJoins() {
       continue;
     }
 
+    // Names are copied as the AST is modified below
+    auto left_column_ref = ColumnRef(std::string(left_table_name), std::string(left_column_name));
+    auto right_column_ref =
+        ColumnRef(std::string(right_table_name), std::string(right_column_name));
+
     if (!isColumnSelected(left_column_ref) || !isColumnSelected(right_column_ref)) {
       return Result::makeError(
           "postgres_tde: columns present in join condition must be also present in SELECT body");
     }
 
-    const std::string& left_join_key_column_name = left_column_config->joinKeyColumnName();
-    free(left_column->name);
-    left_column->name = Common::Utils::makeOwnedCString(left_join_key_column_name);
-
-    const std::string& right_join_key_column_name = right_column_config->joinKeyColumnName();
-    free(right_column->name);
-    right_column->name = Common::Utils::makeOwnedCString(right_join_key_column_name);
-
-    ENVOY_LOG(debug, "join: {}.{} == {}.{} ", left_table_name, left_column_name, right_table_name,
-              right_column_name);
-    join_comparisons_.emplace_back(std::move(left_column_ref), std::move(right_column_ref));
+    // Keys of different sizes are matched by the common prefix
+    size_t key_size =
+        std::min(left_column_config->minJoinKeySize(), right_column_config->minJoinKeySize());
+    expr->expr = createJoinKeyOperand(left_column, left_column_config, key_size);
+    expr->expr2 = createJoinKeyOperand(right_column, right_column_config, key_size);
+
+    ENVOY_LOG(debug, "join: {}.{} == {}.{} by {} bytes of the join keys", left_column_ref.table(),
+              left_column_ref.column(), right_column_ref.table(), right_column_ref.column(),
+              key_size);
+    join_comparisons_.push_back(JoinComparison{std::move(left_column_ref),
+                                               std::move(right_column_ref),
+                                               left_column_config->joinStats(*right_column_config)});
   }
 
   return Result::ok;
@@ -182,7 +194,7 @@ Result ProbabilisticJoinMutator::mutateInsertStatement() {
       }
 
       join_columns.push_back(Common::Utils::makeOwnedCString(column_config->joinKeyColumnName()));
-      join_keys.push_back(createJoinKeyLiteral(value));
+      join_keys.push_back(createJoinKeyLiteral(value, column_config));
     }
 
     stmt->columns->insert(stmt->columns->end(), join_columns.begin(), join_columns.end());
@@ -219,7 +231,7 @@ Result ProbabilisticJoinMutator::mutateUpdateStatement() {
 
       join_key_updates.push_back(new hsql::UpdateClause{
           Common::Utils::makeOwnedCString(column_config->joinKeyColumnName()),
-          createJoinKeyLiteral(update->value)});
+          createJoinKeyLiteral(update->value, column_config)});
     }
 
     stmt->updates->insert(stmt->updates->end(), join_key_updates.begin(), join_key_updates.end());
@@ -229,7 +241,72 @@ Result ProbabilisticJoinMutator::mutateUpdateStatement() {
   return Result::ok;
 }
 
-hsql::Expr* ProbabilisticJoinMutator::createJoinKeyLiteral(hsql::Expr* orig_literal) {
+void ProbabilisticJoinMutator::mutateLimit(hsql::SQLParserResult& query) {
+  if (join_comparisons_.empty() || query.size() != 1 ||
+      !query.getStatements()[0]->isType(hsql::kStmtSelect)) {
+    return;
+  }
+
+  // Groups are formed by the database along with the false positives anyway
+  auto stmt = dynamic_cast<hsql::SelectStatement*>(query.getStatements()[0]);
+  if (stmt->limit == nullptr || stmt->groupBy != nullptr) {
+    return;
+  }
+
+  limit_ = stmt->limit->limit != hsql::kNoLimit ? stmt->limit->limit : ResultPlan::NO_LIMIT;
+  offset_ = stmt->limit->offset != hsql::kNoOffset ? stmt->limit->offset : 0;
+  fetch_limit_ = ResultPlan::NO_LIMIT;
+  limited_ = true;
+
+  if (over_fetch_ && limit_ != ResultPlan::NO_LIMIT) {
+    // Rows skipped by the offset are discarded by the proxy as well
+    double fetch_limit = std::ceil(static_cast<double>(limit_ + offset_) * overFetchFactor());
+    if (fetch_limit < static_cast<double>(std::numeric_limits<int64_t>::max())) {
+      fetch_limit_ = static_cast<uint64_t>(fetch_limit);
+    }
+  }
+
+  ENVOY_LOG(debug, "join limit {}, offset {} is applied by the proxy, {} rows are fetched",
+            limit_, offset_, fetch_limit_);
+
+  if (fetch_limit_ == ResultPlan::NO_LIMIT) {
+    delete stmt->limit;
+    stmt->limit = nullptr;
+    return;
+  }
+
+  stmt->limit->limit = static_cast<int64_t>(fetch_limit_);
+  stmt->limit->offset = hsql::kNoOffset;
+}
+
+double ProbabilisticJoinMutator::overFetchFactor() const {
+  // Every join check of the row has to pass
+  double factor = OVER_FETCH_MARGIN;
+  for (const JoinComparison& comparison : join_comparisons_) {
+    uint64_t rows_fetched = comparison.stats_.rows_fetched_.value();
+    uint64_t rows_kept = comparison.stats_.rows_kept_.value();
+    factor *= static_cast<double>(rows_fetched + 1) / static_cast<double>(rows_kept + 1);
+  }
+
+  return std::min(factor, MAX_OVER_FETCH_FACTOR);
+}
+
+hsql::Expr* ProbabilisticJoinMutator::createJoinKeyOperand(hsql::Expr* column,
+                                                           const ColumnConfig* column_config,
+                                                           size_t key_size) {
+  free(column->name);
+  column->name = Common::Utils::makeOwnedCString(column_config->joinKeyColumnName());
+  if (column_config->maxJoinKeySize() <= key_size) {
+    return column;
+  }
+
+  auto args = new std::vector<hsql::Expr*>{column, hsql::Expr::makeLiteral(int64_t(1)),
+                                           hsql::Expr::makeLiteral(int64_t(key_size))};
+  return hsql::Expr::makeFunctionRef(Common::Utils::makeOwnedCString("substring"), args, false);
+}
+
+hsql::Expr* ProbabilisticJoinMutator::createJoinKeyLiteral(hsql::Expr* orig_literal,
+                                                           const ColumnConfig* column_config) {
   ASSERT(orig_literal->isLiteral());
 
   switch (orig_literal->type) {
@@ -237,18 +314,23 @@ hsql::Expr* ProbabilisticJoinMutator::createJoinKeyLiteral(hsql::Expr* orig_lite
     // do nothing with null values
     return hsql::Expr::makeNullLiteral();
   case hsql::kExprLiteralString: {
-    const std::string& key_hex_str = generateJoinKeyString(absl::string_view(
-        static_cast<const char*>(orig_literal->name), strlen(orig_literal->name)));
+    const std::string& key_hex_str = generateJoinKeyString(
+        absl::string_view(static_cast<const char*>(orig_literal->name), strlen(orig_literal->name)),
+        column_config->joinKeySize());
     return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(key_hex_str));
   }
   case hsql::kExprLiteralInt: {
-    const std::string& key_hex_str = generateJoinKeyString(absl::string_view(
-        reinterpret_cast<const char*>(&orig_literal->ival), sizeof(orig_literal->ival)));
+    const std::string& key_hex_str = generateJoinKeyString(
+        absl::string_view(reinterpret_cast<const char*>(&orig_literal->ival),
+                          sizeof(orig_literal->ival)),
+        column_config->joinKeySize());
     return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(key_hex_str));
   }
   case hsql::kExprLiteralFloat: {
-    const std::string& key_hex_str = generateJoinKeyString(absl::string_view(
-        reinterpret_cast<const char*>(&orig_literal->fval), sizeof(orig_literal->fval)));
+    const std::string& key_hex_str = generateJoinKeyString(
+        absl::string_view(reinterpret_cast<const char*>(&orig_literal->fval),
+                          sizeof(orig_literal->fval)),
+        column_config->joinKeySize());
     return hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(key_hex_str));
   }
   default:
@@ -256,17 +338,16 @@ hsql::Expr* ProbabilisticJoinMutator::createJoinKeyLiteral(hsql::Expr* orig_lite
   }
 }
 
-std::string ProbabilisticJoinMutator::generateJoinKeyString(absl::string_view data) {
+std::string ProbabilisticJoinMutator::generateJoinKeyString(absl::string_view data,
+                                                            size_t key_size) {
   auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
   auto hash = crypto_util_ext.getSha256Digest(data);
-
-  size_t join_key_size = mgr_->getEncryptionConfig()->join_key_size();
-  ASSERT(join_key_size <= hash.size());
+  ASSERT(key_size <= hash.size());
 
   // Join key is the first few bytes of a hash
   std::string key_hex_str = std::string("\\x");
   key_hex_str.append(absl::BytesToHexString(
-      absl::string_view(reinterpret_cast<const char*>(hash.data()), join_key_size)));
+      absl::string_view(reinterpret_cast<const char*>(hash.data()), key_size)));
   return key_hex_str;
 }
 
@@ -16,8 +16,13 @@ public:
   ProbabilisticJoinMutator(const ProbabilisticJoinMutator&) = delete;
 
   Result mutateQuery(hsql::SQLParserResult& query) override;
-  Result mutateRowDescription(RowDescriptionMessage& message) override;
-  Result mutateDataRow(std::unique_ptr<DataRowMessage>& message) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+  // Whether LIMIT of the joins is sent to the database increased by the observed share of the
+  // false positives. Otherwise the whole result is fetched and limited by the proxy
+  void setOverFetch(bool over_fetch) { over_fetch_ = over_fetch; }
+  // Whether the last query has a join limited by the proxy
+  bool limited() const { return limited_; }
 
 protected:
   Result visitOperatorExpression(hsql::Expr* expr) override;
@@ -25,15 +30,32 @@ protected:
   Result mutateJoins();
   Result mutateInsertStatement();
   Result mutateUpdateStatement();
+  void mutateLimit(hsql::SQLParserResult& query);
+  // Rows to fetch for every row of the result, estimated by the join stats
+  double overFetchFactor() const;
 
-  hsql::Expr* createJoinKeyLiteral(hsql::Expr* orig_literal);
-  std::string generateJoinKeyString(absl::string_view data);
+  // Compares only the first key_size bytes of the join key if it may be longer
+  hsql::Expr* createJoinKeyOperand(hsql::Expr* column, const ColumnConfig* column_config,
+                                   size_t key_size);
+  hsql::Expr* createJoinKeyLiteral(hsql::Expr* orig_literal, const ColumnConfig* column_config);
+  std::string generateJoinKeyString(absl::string_view data, size_t key_size);
 
 protected:
   std::vector<hsql::Expr*> join_mutation_candidates_;
 
-  std::vector<std::pair<ColumnRef, ColumnRef>> join_comparisons_;
-  std::vector<std::pair<int, int>> join_comparisons_indices_;
+  struct JoinComparison {
+    ColumnRef left_;
+    ColumnRef right_;
+    JoinStats stats_;
+  };
+
+  std::vector<JoinComparison> join_comparisons_;
+
+  bool over_fetch_{true};
+  bool limited_{false};
+  uint64_t limit_{0};
+  uint64_t offset_{0};
+  uint64_t fetch_limit_{0};
 };
 
 } // namespace PostgresTDE
@@ -0,0 +1,372 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/proxy_aggregate.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/ascii.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_aggregator.h"
+#include "source/common/common/fmt.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Size of the aggregate type as reported in RowDescription, -1 for variable size
+uint16_t typeSize(int32_t data_type) {
+  switch (data_type) {
+  case INT8OID:
+  case FLOAT8OID:
+    return 8;
+  case FLOAT4OID:
+    return 4;
+  default:
+    return static_cast<uint16_t>(-1);
+  }
+}
+
+} // namespace
+
+ProxyAggregateMutator::ProxyAggregateMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result ProxyAggregateMutator::mutateQuery(hsql::SQLParserResult& query) {
+  insert_mutation_candidates_.clear();
+  update_mutation_candidates_.clear();
+  aggregate_candidates_.clear();
+  fetched_columns_.clear();
+  group_keys_.clear();
+  aggregates_.clear();
+  result_columns_.clear();
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  // Only the aggregates of the whole result can be computed by the proxy
+  hsql::SelectStatement* aggregated_select = nullptr;
+  for (hsql::SQLStatement* stmt : query.getStatements()) {
+    if (!stmt->isType(hsql::kStmtSelect)) {
+      continue;
+    }
+
+    auto select = dynamic_cast<hsql::SelectStatement*>(stmt);
+    if (!needsProxyAggregation(select)) {
+      continue;
+    }
+
+    if (query.size() > 1) {
+      return Result::makeError("postgres_tde: aggregates over encrypted columns can't be used in "
+                               "queries with multiple statements");
+    }
+
+    aggregated_select = select;
+  }
+
+  for (hsql::Expr* expr : aggregate_candidates_) {
+    bool selected = aggregated_select != nullptr &&
+                    std::find(aggregated_select->selectList->begin(),
+                              aggregated_select->selectList->end(),
+                              expr) != aggregated_select->selectList->end();
+    if (!selected && isEncryptedAggregate(expr)) {
+      return Result::makeError("postgres_tde: aggregates over encrypted columns are supported "
+                               "only in the select list of the query");
+    }
+  }
+
+  if (aggregated_select != nullptr) {
+    CHECK_RESULT(mutateSelectStatement(aggregated_select));
+  }
+
+  return Result::ok;
+}
+
+Result ProxyAggregateMutator::mutateRowDescription(RowDescriptionMessage& message,
+                                                   ResultPlan& plan) {
+  if (result_columns_.empty()) {
+    return Result::ok;
+  }
+
+  auto& descriptions = message.column_descriptions();
+  if (descriptions.size() != fetched_columns_.size()) {
+    return Result::makeError("postgres_tde: unexpected columns in the result to be aggregated");
+  }
+
+  for (size_t column_idx : group_keys_) {
+    plan.addGroupKey(column_idx);
+  }
+
+  for (ResultPlan::Aggregate& aggregate : aggregates_) {
+    if (aggregate.function_ != ResultPlan::AggregateFunction::CountRows) {
+      // Encrypted columns are already described with the original types
+      aggregate.data_type_ = descriptions[aggregate.column_idx_]->dataType();
+    }
+    plan.addAggregate(aggregate);
+  }
+
+  std::vector<std::unique_ptr<ColumnDescription>> result_descriptions;
+  for (const ResultColumn& column : result_columns_) {
+    plan.addOutputColumn(ResultPlan::OutputColumn{column.aggregate_, column.idx_});
+
+    if (!column.aggregate_) {
+      // Group keys are returned as is
+      auto description =
+          std::make_unique<ColumnDescription>(*descriptions[group_keys_[column.idx_]]);
+      description->name() = column.name_;
+      result_descriptions.push_back(std::move(description));
+      continue;
+    }
+
+    const ResultPlan::Aggregate& aggregate = aggregates_[column.idx_];
+    int32_t result_type;
+    CHECK_RESULT(
+        ResultAggregator::resultType(aggregate.function_, aggregate.data_type_, result_type));
+
+    if (result_type == aggregate.data_type_) {
+      // MIN and MAX keep the type modifier of the column, but not its origin
+      auto description =
+          std::make_unique<ColumnDescription>(*descriptions[aggregate.column_idx_]);
+      description->name() = column.name_;
+      description->value<1>().value() = 0;
+      description->value<2>().value() = 0;
+      result_descriptions.push_back(std::move(description));
+      continue;
+    }
+
+    result_descriptions.push_back(std::make_unique<ColumnDescription>(
+        String(column.name_), Int32(0), Int16(0), Int32(result_type), Int16(typeSize(result_type)),
+        Int32(static_cast<uint32_t>(-1)), Int16(0)));
+  }
+
+  ENVOY_LOG(debug, "result will be aggregated by the proxy: {} group keys, {} aggregates",
+            group_keys_.size(), aggregates_.size());
+  descriptions = std::move(result_descriptions);
+  return Result::ok;
+}
+
+Result ProxyAggregateMutator::visitExpression(hsql::Expr* expr) {
+  if (expr->isType(hsql::kExprFunctionRef)) {
+    aggregate_candidates_.push_back(expr);
+  }
+
+  return Visitor::visitExpression(expr);
+}
+
+bool ProxyAggregateMutator::parseAggregateFunction(const hsql::Expr* expr,
+                                                   ResultPlan::AggregateFunction& function) {
+  if (!expr->isType(hsql::kExprFunctionRef) || expr->exprList == nullptr ||
+      expr->exprList->size() != 1) {
+    return false;
+  }
+
+  std::string name = absl::AsciiStrToLower(expr->name);
+  bool star = (*expr->exprList)[0]->isType(hsql::kExprStar);
+  if (name == "count") {
+    if (star && expr->distinct) {
+      return false;
+    }
+    function = star ? ResultPlan::AggregateFunction::CountRows
+                    : ResultPlan::AggregateFunction::Count;
+    return true;
+  }
+
+  if (star) {
+    return false;
+  }
+
+  if (name == "min") {
+    function = ResultPlan::AggregateFunction::Min;
+  } else if (name == "max") {
+    function = ResultPlan::AggregateFunction::Max;
+  } else if (name == "sum") {
+    function = ResultPlan::AggregateFunction::Sum;
+  } else if (name == "avg") {
+    function = ResultPlan::AggregateFunction::Avg;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+bool ProxyAggregateMutator::isEncryptedAggregate(hsql::Expr* expr) const {
+  ResultPlan::AggregateFunction function;
+  if (!parseAggregateFunction(expr, function) ||
+      function == ResultPlan::AggregateFunction::CountRows) {
+    return false;
+  }
+
+  hsql::Expr* arg = (*expr->exprList)[0];
+  if (!arg->isType(hsql::kExprColumnRef) || arg->table == nullptr) {
+    return false;
+  }
+
+  const ColumnConfig* column_config = mgr_->getEncryptionConfig()->getColumnConfig(
+      getTableNameByAlias(arg->table), arg->name);
+  if (column_config == nullptr || !column_config->isEncrypted()) {
+    return false;
+  }
+
+  // Non-NULL values are counted by the database just as well
+  return function != ResultPlan::AggregateFunction::Count || expr->distinct;
+}
+
+bool ProxyAggregateMutator::needsProxyAggregation(hsql::SelectStatement* stmt) const {
+  for (hsql::Expr* expr : *stmt->selectList) {
+    if (isEncryptedAggregate(expr)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+hsql::Expr* ProxyAggregateMutator::resolveGroupKey(hsql::SelectStatement* stmt,
+                                                   hsql::Expr* expr) const {
+  if (expr->isType(hsql::kExprLiteralInt)) {
+    // Position in the select list
+    if (expr->ival < 1 || static_cast<size_t>(expr->ival) > stmt->selectList->size()) {
+      return nullptr;
+    }
+
+    expr = (*stmt->selectList)[expr->ival - 1];
+  } else if (expr->isType(hsql::kExprColumnRef) && expr->table == nullptr) {
+    // Unqualified names refer to the select list
+    hsql::Expr* select_expr = nullptr;
+    for (hsql::Expr* item : *stmt->selectList) {
+      const char* name = item->alias != nullptr ? item->alias : item->name;
+      if (item->isType(hsql::kExprColumnRef) && name != nullptr &&
+          strcmp(name, expr->name) == 0) {
+        select_expr = item;
+      }
+    }
+
+    expr = select_expr;
+  }
+
+  if (expr == nullptr || !expr->isType(hsql::kExprColumnRef) || expr->table == nullptr) {
+    return nullptr;
+  }
+
+  return expr;
+}
+
+size_t ProxyAggregateMutator::addFetchedColumn(const hsql::Expr* column) {
+  ColumnRef column_ref(std::string(getTableNameByAlias(column->table)), column->name);
+  for (size_t i = 0; i < fetched_columns_.size(); i++) {
+    if (fetched_columns_[i] == column_ref) {
+      return i;
+    }
+  }
+
+  fetched_columns_.push_back(column_ref);
+  fetched_exprs_.push_back(
+      hsql::Expr::makeColumnRef(Common::Utils::makeOwnedCString(column->table),
+                                Common::Utils::makeOwnedCString(column->name)));
+  return fetched_columns_.size() - 1;
+}
+
+Result ProxyAggregateMutator::mutateSelectStatement(hsql::SelectStatement* stmt) {
+  // Result of the database is the input of the aggregation, so nothing can be applied after it
+  if (stmt->order != nullptr || stmt->limit != nullptr || stmt->selectDistinct ||
+      (stmt->groupBy != nullptr && stmt->groupBy->having != nullptr)) {
+    return Result::makeError("postgres_tde: ORDER BY, LIMIT, HAVING and DISTINCT can't be used "
+                             "with aggregates over encrypted columns");
+  }
+
+  fetched_exprs_.clear();
+  absl::Cleanup fetched_exprs_cleaner = [this]() {
+    for (hsql::Expr* expr : fetched_exprs_) {
+      delete expr;
+    }
+    fetched_exprs_.clear();
+  };
+
+  if (stmt->groupBy != nullptr) {
+    for (hsql::Expr* expr : *stmt->groupBy->columns) {
+      hsql::Expr* column = resolveGroupKey(stmt, expr);
+      if (column == nullptr) {
+        return Result::makeError("postgres_tde: only columns can be used in GROUP BY together "
+                                 "with aggregates over encrypted columns");
+      }
+
+      size_t column_idx = addFetchedColumn(column);
+      if (std::find(group_keys_.begin(), group_keys_.end(), column_idx) == group_keys_.end()) {
+        group_keys_.push_back(column_idx);
+      }
+    }
+  }
+
+  for (hsql::Expr* expr : *stmt->selectList) {
+    if (expr->isType(hsql::kExprColumnRef)) {
+      // Selected columns must be the group keys, so that they have a single value in each group
+      ColumnRef column_ref(std::string(getTableNameByAlias(expr->table)), expr->name);
+      size_t key_idx = 0;
+      while (key_idx < group_keys_.size() && fetched_columns_[group_keys_[key_idx]] != column_ref) {
+        key_idx++;
+      }
+
+      if (key_idx == group_keys_.size()) {
+        return Result::makeError(fmt::format("postgres_tde: column {}.{} must appear in the GROUP "
+                                             "BY clause or be used in an aggregate function",
+                                             column_ref.table(), column_ref.column()));
+      }
+
+      result_columns_.push_back(
+          ResultColumn{expr->alias != nullptr ? expr->alias : expr->name, false, key_idx});
+      continue;
+    }
+
+    ResultPlan::AggregateFunction function;
+    if (!parseAggregateFunction(expr, function)) {
+      return Result::makeError("postgres_tde: only columns and MIN, MAX, SUM, AVG and COUNT can be "
+                               "selected together with aggregates over encrypted columns");
+    }
+
+    if (expr->distinct && function != ResultPlan::AggregateFunction::Count) {
+      return Result::makeError(
+          "postgres_tde: DISTINCT can be used only with COUNT over encrypted columns");
+    }
+
+    size_t column_idx = 0;
+    if (function != ResultPlan::AggregateFunction::CountRows) {
+      hsql::Expr* arg = (*expr->exprList)[0];
+      if (!arg->isType(hsql::kExprColumnRef)) {
+        return Result::makeError("postgres_tde: only columns can be aggregated together with "
+                                 "encrypted columns");
+      }
+
+      column_idx = addFetchedColumn(arg);
+    }
+
+    // Type of the column is known once the result is described
+    aggregates_.push_back(ResultPlan::Aggregate{function, expr->distinct, column_idx, 0});
+    result_columns_.push_back(
+        ResultColumn{expr->alias != nullptr ? std::string(expr->alias)
+                                            : absl::AsciiStrToLower(expr->name),
+                     true, aggregates_.size() - 1});
+  }
+
+  ENVOY_LOG(debug, "query will be aggregated by the proxy: {} columns fetched",
+            fetched_columns_.size());
+
+  // The database returns the rows to be aggregated without grouping
+  for (hsql::Expr* expr : *stmt->selectList) {
+    delete expr;
+  }
+  stmt->selectList->assign(fetched_exprs_.begin(), fetched_exprs_.end());
+  fetched_exprs_.clear();
+
+  delete stmt->groupBy;
+  stmt->groupBy = nullptr;
+
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+using Common::SQLUtils::ColumnRef;
+
+// Rewrites the queries with MIN, MAX, SUM, AVG or COUNT(DISTINCT) over encrypted columns to
+// fetch the group keys and the arguments of the aggregates, which are aggregated by the proxy
+// over the decrypted values instead. Replaces RowDescription with the one of the aggregated
+// result
+class ProxyAggregateMutator : public BaseMutator {
+public:
+  explicit ProxyAggregateMutator(MutationManager* manager);
+  ProxyAggregateMutator(const ProxyAggregateMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+protected:
+  // Column of the aggregated result: a group key or an aggregate, by its index
+  struct ResultColumn {
+    std::string name_;
+    bool aggregate_;
+    size_t idx_;
+  };
+
+  Result visitExpression(hsql::Expr* expr) override;
+
+  // Returns false if the expression is not one of the supported aggregates
+  static bool parseAggregateFunction(const hsql::Expr* expr,
+                                     ResultPlan::AggregateFunction& function);
+  // Whether the aggregate can't be computed by the database over the encrypted values
+  bool isEncryptedAggregate(hsql::Expr* expr) const;
+  bool needsProxyAggregation(hsql::SelectStatement* stmt) const;
+
+  Result mutateSelectStatement(hsql::SelectStatement* stmt);
+  // Resolves the column a GROUP BY item refers to, returns nullptr if it's not a column
+  hsql::Expr* resolveGroupKey(hsql::SelectStatement* stmt, hsql::Expr* expr) const;
+  // Index of the column in the rewritten select list, the column is added if it's not there yet
+  size_t addFetchedColumn(const hsql::Expr* column);
+
+protected:
+  std::vector<hsql::Expr*> aggregate_candidates_;
+
+  // Rewritten select list, column indices below refer to it
+  std::vector<ColumnRef> fetched_columns_;
+  std::vector<hsql::Expr*> fetched_exprs_;
+  // Indices of the group keys in the rewritten select list
+  std::vector<size_t> group_keys_;
+  std::vector<ResultPlan::Aggregate> aggregates_;
+  std::vector<ResultColumn> result_columns_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
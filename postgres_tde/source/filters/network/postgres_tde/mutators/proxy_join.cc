@@ -0,0 +1,283 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/proxy_join.h"
+
+#include <cstring>
+#include <utility>
+
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "source/common/common/fmt.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Aliases of the join key columns appended to the select lists of the sides
+constexpr char BUILD_KEY_ALIAS[] = "tde_join_build_key";
+constexpr char PROBE_KEY_ALIAS[] = "tde_join_probe_key";
+
+hsql::Expr* createKeyColumn(const hsql::Expr* key, const char* alias) {
+  hsql::Expr* column = hsql::Expr::makeColumnRef(Common::Utils::makeOwnedCString(key->table),
+                                                 Common::Utils::makeOwnedCString(key->name));
+  column->alias = Common::Utils::makeOwnedCString(alias);
+  return column;
+}
+
+} // namespace
+
+ProxyJoinMutator::ProxyJoinMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result ProxyJoinMutator::mutateQuery(hsql::SQLParserResult& query) {
+  joining_ = false;
+  result_idx_ = 0;
+  build_key_idx_ = 0;
+  probe_key_idx_ = 0;
+  key_name_.clear();
+  output_columns_.clear();
+  build_descriptions_.clear();
+
+  // The join becomes the only two results of the query
+  if (query.size() != 1 || !query.getStatements()[0]->isType(hsql::kStmtSelect)) {
+    return Result::ok;
+  }
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  auto select = dynamic_cast<hsql::SelectStatement*>(query.getStatements()[0]);
+  JoinTable tables[2];
+  hsql::Expr* key_comparison;
+  if (!analyzeJoin(select, tables, key_comparison)) {
+    return Result::ok;
+  }
+
+  rewriteJoin(query, select, tables, key_comparison);
+  joining_ = true;
+  return Result::ok;
+}
+
+Result ProxyJoinMutator::mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) {
+  if (!joining_) {
+    return Result::ok;
+  }
+
+  auto& descriptions = message.column_descriptions();
+  if (result_idx_++ == 0) {
+    // Build side, kept by the proxy until the probe side arrives
+    if (descriptions.size() != build_key_idx_ + 1) {
+      return Result::makeError("postgres_tde: unexpected columns in the result");
+    }
+
+    for (const auto& description : descriptions) {
+      build_descriptions_.push_back(std::make_unique<ColumnDescription>(*description));
+    }
+
+    plan.setJoinSide(ResultPlan::JoinSide::Build, build_key_idx_);
+    return Result::ok;
+  }
+
+  if (descriptions.size() != probe_key_idx_ + 1) {
+    return Result::makeError("postgres_tde: unexpected columns in the result");
+  }
+
+  // Values are matched by their text, so the types must have the same text format
+  if (!joinableTypes(build_descriptions_[build_key_idx_]->dataType(),
+                     descriptions[probe_key_idx_]->dataType())) {
+    return Result::makeError(
+        fmt::format("postgres_tde: columns of the join {} have types that can't be joined by the proxy",
+                    key_name_));
+  }
+
+  plan.setJoinSide(ResultPlan::JoinSide::Probe, probe_key_idx_);
+
+  std::vector<std::unique_ptr<ColumnDescription>> joined_descriptions;
+  for (const OutputColumn& column : output_columns_) {
+    const auto& source = column.column_.build_side_ ? build_descriptions_ : descriptions;
+    auto description = std::make_unique<ColumnDescription>(*source[column.column_.column_idx_]);
+    description->name() = column.name_;
+    joined_descriptions.push_back(std::move(description));
+
+    plan.addJoinOutputColumn(column.column_);
+  }
+
+  ENVOY_LOG(debug, "join {} will be executed by the proxy", key_name_);
+  descriptions = std::move(joined_descriptions);
+  return Result::ok;
+}
+
+bool ProxyJoinMutator::analyzeJoin(hsql::SelectStatement* stmt, JoinTable (&tables)[2],
+                                   hsql::Expr*& key_comparison) {
+  // Result of the database is the input of the join, so nothing can be applied after it
+  if (stmt->fromTable == nullptr || stmt->fromTable->type != hsql::kTableJoin ||
+      stmt->selectDistinct || stmt->groupBy != nullptr || stmt->order != nullptr ||
+      stmt->limit != nullptr) {
+    return false;
+  }
+
+  hsql::JoinDefinition* join = stmt->fromTable->join;
+  if (join->type != hsql::kJoinInner || join->condition == nullptr ||
+      join->left->type != hsql::kTableName || join->right->type != hsql::kTableName) {
+    return false;
+  }
+
+  tables[0].table_ = join->left;
+  tables[1].table_ = join->right;
+  for (JoinTable& table : tables) {
+    table.name_ =
+        table.table_->alias != nullptr ? table.table_->alias->name : table.table_->name;
+  }
+
+  if (strcmp(tables[0].name_, tables[1].name_) == 0) {
+    return false;
+  }
+
+  const char* const table_names[2] = {tables[0].name_, tables[1].name_};
+
+  for (const hsql::Expr* expr : *stmt->selectList) {
+    unsigned mask = 0;
+    if (!expr->isType(hsql::kExprColumnRef) || !collectTables(expr, table_names, mask)) {
+      return false;
+    }
+  }
+
+  std::vector<hsql::Expr*> conjuncts;
+  collectConjuncts(join->condition, conjuncts);
+  if (stmt->whereClause != nullptr) {
+    collectConjuncts(stmt->whereClause, conjuncts);
+  }
+
+  key_comparison = nullptr;
+  for (hsql::Expr* conjunct : conjuncts) {
+    unsigned mask = 0;
+    if (!collectTables(conjunct, table_names, mask) || hasResultChecks(conjunct)) {
+      return false;
+    }
+
+    if (mask != 3) {
+      // Conditions without columns are checked along with the first table
+      tables[mask == 2 ? 1 : 0].filters_.push_back(conjunct);
+      continue;
+    }
+
+    // The only condition on both tables is the equality of the join columns
+    if (key_comparison != nullptr || !conjunct->isType(hsql::kExprOperator) ||
+        conjunct->opType != hsql::kOpEquals || !conjunct->expr->isType(hsql::kExprColumnRef) ||
+        !conjunct->expr2->isType(hsql::kExprColumnRef)) {
+      return false;
+    }
+
+    key_comparison = conjunct;
+    bool swapped = strcmp(conjunct->expr->table, tables[0].name_) != 0;
+    tables[0].key_ = swapped ? conjunct->expr2 : conjunct->expr;
+    tables[1].key_ = swapped ? conjunct->expr : conjunct->expr2;
+  }
+
+  if (key_comparison == nullptr) {
+    return false;
+  }
+
+  // Plain columns are joined by the database, encrypted ones only if the proxy join is enabled
+  bool encrypted = false;
+  for (const JoinTable& table : tables) {
+    const ColumnConfig* column_config = mgr_->getEncryptionConfig()->getColumnConfig(
+        getTableNameByAlias(table.key_->table), table.key_->name);
+    if (column_config == nullptr || !column_config->isEncrypted()) {
+      continue;
+    }
+
+    if (!column_config->hasProxyJoin()) {
+      return false;
+    }
+    encrypted = true;
+  }
+
+  if (!encrypted) {
+    return false;
+  }
+
+  key_name_ = fmt::format("{}.{} = {}.{}", tables[0].key_->table, tables[0].key_->name,
+                          tables[1].key_->table, tables[1].key_->name);
+
+  // Sizes of the tables are unknown, but a filtered table is likely the smaller one
+  if (tables[0].filters_.empty() || !tables[1].filters_.empty()) {
+    std::swap(tables[0], tables[1]);
+  }
+
+  return true;
+}
+
+bool ProxyJoinMutator::joinableTypes(int32_t left_data_type, int32_t right_data_type) {
+  // Values are matched by their decrypted text, so only the types whose equal values have the
+  // same text are joinable. NUMERIC ('1.0' and '1'), floats and bpchar (trailing spaces) are not
+  auto is_integer = [](int32_t data_type) {
+    return data_type == INT2OID || data_type == INT4OID || data_type == INT8OID;
+  };
+  auto is_text = [](int32_t data_type) {
+    return data_type == TEXTOID || data_type == VARCHAROID;
+  };
+  auto is_exact = [](int32_t data_type) {
+    return data_type == UUIDOID || data_type == DATEOID || data_type == TIMESTAMPOID;
+  };
+
+  return (is_integer(left_data_type) && is_integer(right_data_type)) ||
+         (is_text(left_data_type) && is_text(right_data_type)) ||
+         (is_exact(left_data_type) && left_data_type == right_data_type);
+}
+
+void ProxyJoinMutator::rewriteJoin(hsql::SQLParserResult& query, hsql::SelectStatement* stmt,
+                                   JoinTable (&tables)[2], hsql::Expr* key_comparison) {
+  // Each table gets its own query selecting its columns of the result and the join column
+  std::vector<hsql::Expr*>* select_lists[2] = {new std::vector<hsql::Expr*>(),
+                                                new std::vector<hsql::Expr*>()};
+  for (size_t i = 0; i < stmt->selectList->size(); i++) {
+    hsql::Expr* expr = (*stmt->selectList)[i];
+    size_t table_idx = strcmp(expr->table, tables[0].name_) == 0 ? 0 : 1;
+
+    output_columns_.push_back(OutputColumn{
+        expr->alias != nullptr ? expr->alias : expr->name,
+        ResultPlan::JoinOutputColumn{table_idx == 0, select_lists[table_idx]->size()}});
+
+    // Columns of different tables may have the same name
+    free(expr->alias);
+    expr->alias = Common::Utils::makeOwnedCString(fmt::format("tde_join_{}", i));
+    select_lists[table_idx]->push_back(expr);
+  }
+  stmt->selectList->clear();
+  delete stmt->selectList;
+
+  build_key_idx_ = select_lists[0]->size();
+  probe_key_idx_ = select_lists[1]->size();
+  select_lists[0]->push_back(createKeyColumn(tables[0].key_, BUILD_KEY_ALIAS));
+  select_lists[1]->push_back(createKeyColumn(tables[1].key_, PROBE_KEY_ALIAS));
+
+  // The conditions are moved to the queries of their tables, the join itself is dropped
+  hsql::JoinDefinition* join = stmt->fromTable->join;
+  releaseConjuncts(join->condition);
+  releaseConjuncts(stmt->whereClause);
+  delete key_comparison;
+  join->left = nullptr;
+  join->right = nullptr;
+  delete stmt->fromTable;
+
+  stmt->fromTable = tables[0].table_;
+  stmt->selectList = select_lists[0];
+  stmt->whereClause = combineConjuncts(tables[0].filters_);
+
+  // Both queries are sent in one message, so they run in one implicit transaction, but under
+  // READ COMMITTED each of them takes its own snapshot: a row committed in between may be seen
+  // by one side only. Sessions with REPEATABLE READ by default get one snapshot for both
+  auto probe = new hsql::SelectStatement();
+  probe->fromTable = tables[1].table_;
+  probe->selectList = select_lists[1];
+  probe->whereClause = combineConjuncts(tables[1].filters_);
+  query.addStatement(probe);
+
+  ENVOY_LOG(debug, "join {} is split into the queries of {} and {}", key_name_, tables[0].name_,
+            tables[1].name_);
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
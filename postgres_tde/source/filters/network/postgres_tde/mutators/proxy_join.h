@@ -0,0 +1,68 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+
+// Rewrites the inner equi-joins of two tables over the columns with proxy join support into two
+// queries, one per table, which are joined by the proxy over the decrypted values instead (see
+// ResultJoiner). The conditions on a single table are moved to the query of that table. The first
+// query is the build side, the second one is the probe side, whose RowDescription is replaced
+// with the one of the joined result. Other joins are left to the probabilistic join
+class ProxyJoinMutator : public BaseMutator {
+public:
+  explicit ProxyJoinMutator(MutationManager* manager);
+  ProxyJoinMutator(const ProxyJoinMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+  // Whether the query is rewritten to a proxy join, so it has two results joined into one
+  bool joining() const { return joining_; }
+
+protected:
+  // Joined table with the conditions on it alone
+  struct JoinTable {
+    hsql::TableRef* table_{nullptr};
+    // Alias or table name the columns are qualified with
+    const char* name_{nullptr};
+    hsql::Expr* key_{nullptr};
+    std::vector<hsql::Expr*> filters_;
+  };
+
+  // Column of the joined result with the name from the original select list
+  struct OutputColumn {
+    std::string name_;
+    ResultPlan::JoinOutputColumn column_;
+  };
+
+  // Returns false if the statement can't be joined by the proxy. The build side goes first
+  bool analyzeJoin(hsql::SelectStatement* stmt, JoinTable (&tables)[2],
+                   hsql::Expr*& key_comparison);
+  static bool joinableTypes(int32_t left_data_type, int32_t right_data_type);
+
+  void rewriteJoin(hsql::SQLParserResult& query, hsql::SelectStatement* stmt,
+                   JoinTable (&tables)[2], hsql::Expr* key_comparison);
+
+protected:
+  bool joining_{false};
+  // Results received so far, the build side goes first
+  size_t result_idx_{0};
+  size_t build_key_idx_{0};
+  size_t probe_key_idx_{0};
+  std::string key_name_;
+  std::vector<OutputColumn> output_columns_;
+  std::vector<std::unique_ptr<ColumnDescription>> build_descriptions_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
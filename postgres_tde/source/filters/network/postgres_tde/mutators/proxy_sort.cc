@@ -0,0 +1,152 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/proxy_sort.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_sorter.h"
+#include "source/common/common/fmt.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+ProxySortMutator::ProxySortMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result ProxySortMutator::mutateQuery(hsql::SQLParserResult& query) {
+  insert_mutation_candidates_.clear();
+  update_mutation_candidates_.clear();
+  sort_keys_.clear();
+  limit_ = ResultPlan::NO_LIMIT;
+  offset_ = 0;
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  // Only the order of the whole result can be restored by the proxy, so ORDER BY of
+  // subqueries is left to the database
+  for (hsql::SQLStatement* stmt : query.getStatements()) {
+    if (!stmt->isType(hsql::kStmtSelect)) {
+      continue;
+    }
+
+    auto select = dynamic_cast<hsql::SelectStatement*>(stmt);
+    if (!needsProxySort(select)) {
+      continue;
+    }
+
+    if (query.size() > 1) {
+      return Result::makeError("postgres_tde: ORDER BY over encrypted columns without order "
+                               "index can't be used in queries with multiple statements");
+    }
+
+    CHECK_RESULT(mutateSelectStatement(select));
+  }
+
+  return Result::ok;
+}
+
+Result ProxySortMutator::mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) {
+  if (sort_keys_.empty()) {
+    return Result::ok;
+  }
+
+  std::map<ColumnRef, size_t> columns2idx;
+  for (size_t i = 0; i < message.column_descriptions().size(); i++) {
+    auto column_ref = getSelectColumnByAlias(message.column_descriptions()[i]->name());
+    if (column_ref != nullptr) {
+      columns2idx[*column_ref] = i;
+    }
+  }
+
+  for (auto& [column_ref, descending] : sort_keys_) {
+    auto it = columns2idx.find(column_ref);
+    if (it == columns2idx.end()) {
+      return Result::makeError(fmt::format("postgres_tde: column {}.{} must be present in SELECT "
+                                           "body to be sorted by the proxy",
+                                           column_ref.table(), column_ref.column()));
+    }
+
+    // Encrypted columns are already described with the original types
+    int32_t data_type = message.column_descriptions()[it->second]->dataType();
+    if (!ResultSorter::isSortableType(data_type)) {
+      return Result::makeError(fmt::format(
+          "postgres_tde: column {}.{} of type {} can't be sorted by the proxy",
+          column_ref.table(), column_ref.column(), data_type));
+    }
+
+    ENVOY_LOG(debug, "matched sort key: ({}, {}) -> column {}", column_ref.table(),
+              column_ref.column(), it->second);
+    plan.addSortKey(ResultPlan::SortKey{it->second, data_type, descending});
+  }
+
+  plan.setRowLimit(limit_, offset_);
+  return Result::ok;
+}
+
+bool ProxySortMutator::needsProxySort(hsql::SelectStatement* stmt) const {
+  if (stmt->order == nullptr) {
+    return false;
+  }
+
+  for (hsql::OrderDescription* desc : *stmt->order) {
+    ColumnRef column;
+    if (resolveOrderColumn(stmt, desc->expr, column) == nullptr) {
+      continue;
+    }
+
+    const ColumnConfig* column_config =
+        mgr_->getEncryptionConfig()->getColumnConfig(column.table(), column.column());
+    if (column_config != nullptr && column_config->isEncrypted() &&
+        !column_config->hasOrderIndex()) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+Result ProxySortMutator::mutateSelectStatement(hsql::SelectStatement* stmt) {
+  // The whole ORDER BY is done by the proxy, so each item must be a column of the result
+  for (hsql::OrderDescription* desc : *stmt->order) {
+    ColumnRef column;
+    if (resolveOrderColumn(stmt, desc->expr, column) == nullptr) {
+      return Result::makeError("postgres_tde: only columns can be used in ORDER BY together "
+                               "with encrypted columns without order index");
+    }
+
+    if (!isColumnSelected(column)) {
+      return Result::makeError(fmt::format("postgres_tde: column {}.{} must be present in SELECT "
+                                           "body to be sorted by the proxy",
+                                           column.table(), column.column()));
+    }
+
+    sort_keys_.emplace_back(column, desc->type == hsql::kOrderDesc);
+  }
+
+  if (stmt->limit != nullptr) {
+    if (stmt->limit->limit != hsql::kNoLimit) {
+      limit_ = stmt->limit->limit;
+    }
+    if (stmt->limit->offset != hsql::kNoOffset) {
+      offset_ = stmt->limit->offset;
+    }
+  }
+
+  ENVOY_LOG(debug, "result will be sorted by the proxy: {} keys, limit {}, offset {}",
+            sort_keys_.size(), limit_, offset_);
+
+  // The database returns the whole result in an arbitrary order
+  for (hsql::OrderDescription* desc : *stmt->order) {
+    delete desc;
+  }
+  delete stmt->order;
+  stmt->order = nullptr;
+
+  delete stmt->limit;
+  stmt->limit = nullptr;
+
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+using Common::SQLUtils::ColumnRef;
+
+// Removes ORDER BY over the encrypted columns without the order index, together with LIMIT
+// and OFFSET, from the query, so that the result is sorted and limited by the proxy over the
+// decrypted values instead
+class ProxySortMutator : public BaseMutator {
+public:
+  explicit ProxySortMutator(MutationManager* manager);
+  ProxySortMutator(const ProxySortMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+protected:
+  bool needsProxySort(hsql::SelectStatement* stmt) const;
+  Result mutateSelectStatement(hsql::SelectStatement* stmt);
+
+protected:
+  // Sort keys (column, descending) in the ORDER BY order, column indices are filled in by
+  // RowDescription
+  std::vector<std::pair<ColumnRef, bool>> sort_keys_;
+  uint64_t limit_;
+  uint64_t offset_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
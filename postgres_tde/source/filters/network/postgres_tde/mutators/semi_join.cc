@@ -0,0 +1,354 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/semi_join.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "source/common/common/fmt.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+constexpr char KEY_ALIAS[] = "tde_semijoin_key";
+
+// Input of the join key hash, the same as for the INSERT literals and the COPY values of the type
+bool joinKeyHashInput(int32_t data_type, absl::string_view value, std::string& hash_input) {
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID: {
+    int64_t ival;
+    if (!absl::SimpleAtoi(value, &ival)) {
+      return false;
+    }
+    hash_input.assign(reinterpret_cast<const char*>(&ival), sizeof(ival));
+    return true;
+  }
+  case FLOAT4OID:
+  case FLOAT8OID: {
+    double fval;
+    if (!absl::SimpleAtod(value, &fval)) {
+      return false;
+    }
+    hash_input.assign(reinterpret_cast<const char*>(&fval), sizeof(fval));
+    return true;
+  }
+  default:
+    hash_input.assign(value.data(), value.size());
+    return true;
+  }
+}
+
+} // namespace
+
+SemiJoinMutator::SemiJoinMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+void SemiJoinMutator::reset() {
+  state_ = State::Idle;
+  filtered_table_.clear();
+  filtered_key_config_ = nullptr;
+  keys_.clear();
+  keys_overflow_ = false;
+}
+
+void SemiJoinMutator::disable() {
+  reset();
+  state_ = State::Disabled;
+}
+
+Result SemiJoinMutator::mutateQuery(hsql::SQLParserResult& query) {
+  switch (state_) {
+  case State::Idle:
+    break;
+  case State::Filtering:
+    // Same query as the one the keys are fetched for
+    ASSERT(query.size() == 1 && query.getStatements()[0]->isType(hsql::kStmtSelect));
+    addKeyFilter(dynamic_cast<hsql::SelectStatement*>(query.getStatements()[0]));
+    state_ = State::Disabled;
+    return Result::ok;
+  case State::FetchingKeys:
+  case State::Disabled:
+    return Result::ok;
+  }
+
+  if (max_keys_ == 0 || query.size() != 1 ||
+      !query.getStatements()[0]->isType(hsql::kStmtSelect)) {
+    return Result::ok;
+  }
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  auto select = dynamic_cast<hsql::SelectStatement*>(query.getStatements()[0]);
+  SemiJoin semi_join;
+  if (!analyzeJoin(select, semi_join)) {
+    return Result::ok;
+  }
+
+  rewriteKeyQuery(select, semi_join);
+  state_ = State::FetchingKeys;
+  return Result::ok;
+}
+
+Result SemiJoinMutator::mutateRowDescription(RowDescriptionMessage& message, ResultPlan&) {
+  if (state_ != State::FetchingKeys) {
+    return Result::ok;
+  }
+
+  if (message.column_descriptions().size() != 1) {
+    return Result::makeError("postgres_tde: unexpected columns in the result");
+  }
+
+  return Result::ok;
+}
+
+void SemiJoinMutator::addKey(absl::string_view value) {
+  ASSERT(state_ == State::FetchingKeys);
+  if (keys_overflow_) {
+    return;
+  }
+
+  int32_t data_type =
+      filtered_key_config_->isEncrypted() ? filtered_key_config_->origDataType() : 0;
+  if (!joinKeyHashInput(data_type, value, hash_input_)) {
+    // Such a value can't be joined, but the query isn't filtered to let the database report it
+    keys_overflow_ = true;
+    return;
+  }
+
+  auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+  auto hash = crypto_util_ext.getSha256Digest(hash_input_);
+  size_t key_size = filtered_key_config_->minJoinKeySize();
+  ASSERT(key_size <= hash.size());
+
+  keys_.insert(absl::StrCat(
+      "\\x", absl::BytesToHexString(
+                 absl::string_view(reinterpret_cast<const char*>(hash.data()), key_size))));
+  if (keys_.size() > max_keys_) {
+    keys_overflow_ = true;
+    keys_.clear();
+  }
+}
+
+bool SemiJoinMutator::finishKeys() {
+  ASSERT(state_ == State::FetchingKeys);
+  state_ = keys_overflow_ ? State::Disabled : State::Filtering;
+  return !keys_overflow_;
+}
+
+bool SemiJoinMutator::analyzeJoin(hsql::SelectStatement* stmt, SemiJoin& semi_join) {
+  if (stmt->fromTable == nullptr || stmt->fromTable->type != hsql::kTableJoin) {
+    return false;
+  }
+
+  hsql::JoinDefinition* join = stmt->fromTable->join;
+  if (join->type != hsql::kJoinInner || join->condition == nullptr ||
+      join->left->type != hsql::kTableName || join->right->type != hsql::kTableName) {
+    return false;
+  }
+
+  hsql::TableRef* tables[2] = {join->left, join->right};
+  const char* table_names[2];
+  for (size_t i = 0; i < 2; i++) {
+    table_names[i] = tables[i]->alias != nullptr ? tables[i]->alias->name : tables[i]->name;
+  }
+
+  if (strcmp(table_names[0], table_names[1]) == 0) {
+    return false;
+  }
+
+  collectConjuncts(join->condition, semi_join.conjuncts_);
+  if (stmt->whereClause != nullptr) {
+    collectConjuncts(stmt->whereClause, semi_join.conjuncts_);
+  }
+
+  hsql::Expr* keys[2] = {nullptr, nullptr};
+  bool selective[2] = {false, false};
+  std::vector<hsql::Expr*> filters[2];
+  for (hsql::Expr* conjunct : semi_join.conjuncts_) {
+    unsigned mask = 0;
+    if (!collectTables(conjunct, table_names, mask)) {
+      continue;
+    }
+
+    if (mask == 3) {
+      // The first equality of the columns with join keys is the one pushed down
+      if (keys[0] == nullptr && conjunct->isType(hsql::kExprOperator) &&
+          conjunct->opType == hsql::kOpEquals && hasJoin(conjunct->expr) &&
+          hasJoin(conjunct->expr2)) {
+        bool swapped = strcmp(conjunct->expr->table, table_names[0]) != 0;
+        keys[0] = swapped ? conjunct->expr2 : conjunct->expr;
+        keys[1] = swapped ? conjunct->expr : conjunct->expr2;
+      }
+      continue;
+    }
+
+    // Conditions without columns are checked along with the first table
+    size_t table_idx = mask == 2 ? 1 : 0;
+    selective[table_idx] = selective[table_idx] || isBlindIndexLookup(conjunct);
+    // The key query selects the join column only, so the rows can't be checked by the proxy
+    if (!hasResultChecks(conjunct)) {
+      filters[table_idx].push_back(conjunct);
+    }
+  }
+
+  // Tables looked up by the blind index on both sides are small enough to be joined as is
+  if (keys[0] == nullptr || selective[0] == selective[1]) {
+    return false;
+  }
+
+  size_t selective_idx = selective[0] ? 0 : 1;
+  size_t filtered_idx = 1 - selective_idx;
+  semi_join.selective_table_ = tables[selective_idx];
+  semi_join.selective_key_ = keys[selective_idx];
+  semi_join.selective_filters_ = std::move(filters[selective_idx]);
+  semi_join.filtered_table_ = table_names[filtered_idx];
+  semi_join.filtered_key_config_ = mgr_->getEncryptionConfig()->getColumnConfig(
+      getTableNameByAlias(keys[filtered_idx]->table), keys[filtered_idx]->name);
+  return true;
+}
+
+bool SemiJoinMutator::hasJoin(const hsql::Expr* column) const {
+  if (!column->isType(hsql::kExprColumnRef) || column->table == nullptr) {
+    return false;
+  }
+
+  const ColumnConfig* column_config = mgr_->getEncryptionConfig()->getColumnConfig(
+      getTableNameByAlias(column->table), column->name);
+  return column_config != nullptr && column_config->hasJoin();
+}
+
+bool SemiJoinMutator::isBlindIndexLookup(const hsql::Expr* expr) const {
+  if (!expr->isType(hsql::kExprOperator) || expr->expr == nullptr ||
+      !expr->expr->isType(hsql::kExprColumnRef) || expr->expr->table == nullptr) {
+    return false;
+  }
+
+  switch (expr->opType) {
+  case hsql::kOpEquals:
+    if (!expr->expr2->isLiteral()) {
+      return false;
+    }
+    break;
+  case hsql::kOpIn:
+    if (expr->exprList == nullptr ||
+        !std::all_of(expr->exprList->begin(), expr->exprList->end(),
+                     [](const hsql::Expr* value) { return value->isLiteral(); })) {
+      return false;
+    }
+    break;
+  default:
+    return false;
+  }
+
+  const ColumnConfig* column_config = mgr_->getEncryptionConfig()->getColumnConfig(
+      getTableNameByAlias(expr->expr->table), expr->expr->name);
+  return column_config != nullptr && column_config->hasBlindIndex();
+}
+
+void SemiJoinMutator::rewriteKeyQuery(hsql::SelectStatement* stmt, SemiJoin& semi_join) {
+  filtered_table_ = semi_join.filtered_table_;
+  filtered_key_config_ = semi_join.filtered_key_config_;
+
+  // The key query selects the join column of the selective table, filtered by its conditions
+  hsql::Expr* key = hsql::Expr::makeColumnRef(
+      Common::Utils::makeOwnedCString(semi_join.selective_key_->table),
+      Common::Utils::makeOwnedCString(semi_join.selective_key_->name));
+  key->alias = Common::Utils::makeOwnedCString(KEY_ALIAS);
+
+  for (hsql::Expr* expr : *stmt->selectList) {
+    delete expr;
+  }
+  stmt->selectList->clear();
+  stmt->selectList->push_back(key);
+  stmt->selectDistinct = false;
+
+  delete stmt->groupBy;
+  stmt->groupBy = nullptr;
+
+  if (stmt->order != nullptr) {
+    for (hsql::OrderDescription* desc : *stmt->order) {
+      delete desc;
+    }
+  }
+  delete stmt->order;
+  stmt->order = nullptr;
+
+  delete stmt->limit;
+  stmt->limit = nullptr;
+
+  hsql::JoinDefinition* join = stmt->fromTable->join;
+  releaseConjuncts(join->condition);
+  releaseConjuncts(stmt->whereClause);
+  for (hsql::Expr* conjunct : semi_join.conjuncts_) {
+    if (std::find(semi_join.selective_filters_.begin(), semi_join.selective_filters_.end(),
+                  conjunct) == semi_join.selective_filters_.end()) {
+      delete conjunct;
+    }
+  }
+
+  if (join->left == semi_join.selective_table_) {
+    join->left = nullptr;
+  } else {
+    join->right = nullptr;
+  }
+  delete stmt->fromTable;
+
+  stmt->fromTable = semi_join.selective_table_;
+  stmt->whereClause = combineConjuncts(semi_join.selective_filters_);
+
+  ENVOY_LOG(debug, "join keys of {} will be fetched from {}", filtered_table_,
+            semi_join.selective_table_->name);
+}
+
+void SemiJoinMutator::addKeyFilter(hsql::SelectStatement* stmt) {
+  hsql::Expr* column =
+      hsql::Expr::makeColumnRef(Common::Utils::makeOwnedCString(filtered_table_),
+                                Common::Utils::makeOwnedCString(
+                                    filtered_key_config_->joinKeyColumnName()));
+
+  // Rows not rewritten after the key size change are compared by the prefix
+  size_t key_size = filtered_key_config_->minJoinKeySize();
+  if (filtered_key_config_->maxJoinKeySize() > key_size) {
+    auto args = new std::vector<hsql::Expr*>{column, hsql::Expr::makeLiteral(int64_t(1)),
+                                             hsql::Expr::makeLiteral(int64_t(key_size))};
+    column = hsql::Expr::makeFunctionRef(Common::Utils::makeOwnedCString("substring"), args,
+                                         false);
+  }
+
+  // Sorted, so the same keys give the same query text
+  std::vector<std::string> keys(keys_.begin(), keys_.end());
+  std::sort(keys.begin(), keys.end());
+
+  auto literals = new std::vector<hsql::Expr*>();
+  literals->reserve(std::max<size_t>(keys.size(), 1));
+  for (const std::string& key : keys) {
+    literals->push_back(hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(key)));
+  }
+
+  // Nothing is joined without the keys, but the query is still sent for the RowDescription
+  if (literals->empty()) {
+    literals->push_back(hsql::Expr::makeNullLiteral());
+  }
+
+  hsql::Expr* filter = hsql::Expr::makeInOperator(column, literals);
+  stmt->whereClause = stmt->whereClause != nullptr
+                          ? hsql::Expr::makeOpBinary(stmt->whereClause, hsql::kOpAnd, filter)
+                          : filter;
+
+  ENVOY_LOG(debug, "{} is filtered by {} join keys", filtered_table_, keys.size());
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
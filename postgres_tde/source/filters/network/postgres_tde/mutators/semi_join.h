@@ -0,0 +1,92 @@
+#pragma once
+
+#include "absl/container/flat_hash_set.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+
+// Pushes the join values of the selective side of a probabilistic join down to the other side.
+// The join of two tables, one of which is looked up by the blind index, is executed in two
+// rounds: the query is first rewritten into the key query, which fetches the join column of the
+// selective table only, then the original query is sent with the other table filtered by the
+// join keys of the fetched values (<column>_joinkey IN (...)). The filter uses the full size of
+// the join keys of the other column, while the join compares the common prefix of the keys, so
+// the database returns fewer false positives and may use an index over the join keys. While the
+// column has a previous join key size, the filter uses the common prefix of the two sizes
+class SemiJoinMutator : public BaseMutator {
+public:
+  explicit SemiJoinMutator(MutationManager* manager);
+  SemiJoinMutator(const SemiJoinMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+  // Joins with more distinct keys are not filtered, 0 disables the rewrite
+  void setMaxKeys(size_t max_keys) { max_keys_ = max_keys; }
+
+  // Starts over with a new query of the client
+  void reset();
+  // Leaves the next query as is, e.g. if the key query has failed
+  void disable();
+
+  // Whether the query is rewritten into the key query, so its result is consumed by the proxy
+  bool fetchingKeys() const { return state_ == State::FetchingKeys; }
+  // Adds a value of the join column fetched by the key query
+  void addKey(absl::string_view value);
+  // Completes the key query, the next query is filtered by the keys. Returns false if there are
+  // too many keys, so the next query is left as is
+  bool finishKeys();
+  size_t keysCount() const { return keys_.size(); }
+
+protected:
+  enum class State {
+    Idle,
+    FetchingKeys,
+    Filtering,
+    Disabled,
+  };
+
+  // Join of the table looked up by the blind index and the table to filter
+  struct SemiJoin {
+    hsql::TableRef* selective_table_{nullptr};
+    hsql::Expr* selective_key_{nullptr};
+    const char* filtered_table_{nullptr};
+    const ColumnConfig* filtered_key_config_{nullptr};
+    // Conditions on the selective table alone, the key query is filtered by them
+    std::vector<hsql::Expr*> selective_filters_;
+    std::vector<hsql::Expr*> conjuncts_;
+  };
+
+  // Returns false if the statement has no join to push the keys through
+  bool analyzeJoin(hsql::SelectStatement* stmt, SemiJoin& semi_join);
+  bool hasJoin(const hsql::Expr* column) const;
+  bool isBlindIndexLookup(const hsql::Expr* expr) const;
+
+  void rewriteKeyQuery(hsql::SelectStatement* stmt, SemiJoin& semi_join);
+  void addKeyFilter(hsql::SelectStatement* stmt);
+
+protected:
+  size_t max_keys_{0};
+  State state_{State::Idle};
+
+  // Column the original query is filtered by
+  std::string filtered_table_;
+  const ColumnConfig* filtered_key_config_{nullptr};
+
+  // Join keys of the fetched values as bytea literals
+  absl::flat_hash_set<std::string> keys_;
+  bool keys_overflow_{false};
+  std::string hash_input_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,297 @@
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/token_index.h"
+
+#include <algorithm>
+
+#include "postgres_tde/source/filters/network/postgres_tde/token_index_encoder.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
+#include "source/common/common/fmt.h"
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/ascii.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+TokenIndexMutator::TokenIndexMutator(MutationManager* manager) : BaseMutator(manager) {}
+
+Result TokenIndexMutator::mutateQuery(hsql::SQLParserResult& query) {
+  insert_mutation_candidates_.clear();
+  update_mutation_candidates_.clear();
+  pattern_checks_.clear();
+
+  CHECK_RESULT(Visitor::visitQuery(query));
+
+  // Rows can be filtered by the proxy only if the pattern restricts the whole result,
+  // so only the top-level conjunctions of SELECT statements are rewritten
+  for (hsql::SQLStatement* stmt : query.getStatements()) {
+    if (!stmt->isType(hsql::kStmtSelect)) {
+      continue;
+    }
+
+    auto select = dynamic_cast<hsql::SelectStatement*>(stmt);
+    if (select->whereClause == nullptr) {
+      continue;
+    }
+
+    std::vector<Predicate> predicates;
+    CHECK_RESULT(collectPatterns(select->whereClause, predicates));
+    if (predicates.empty()) {
+      continue;
+    }
+
+    if (query.size() > 1) {
+      return Result::makeError("postgres_tde: patterns over columns with token index can't be "
+                               "used in queries with multiple statements");
+    }
+
+    CHECK_RESULT(mutatePatterns(select, predicates));
+  }
+
+  CHECK_RESULT(mutateInsertStatement());
+  CHECK_RESULT(mutateUpdateStatement());
+  return Result::ok;
+}
+
+Result TokenIndexMutator::mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) {
+  if (pattern_checks_.empty()) {
+    return Result::ok;
+  }
+
+  std::map<ColumnRef, size_t> columns2idx;
+  for (size_t i = 0; i < message.column_descriptions().size(); i++) {
+    auto column_ref = getSelectColumnByAlias(message.column_descriptions()[i]->name());
+    if (column_ref != nullptr) {
+      columns2idx[*column_ref] = i;
+    }
+  }
+
+  for (auto& [column_ref, check] : pattern_checks_) {
+    auto it = columns2idx.find(column_ref);
+    if (it == columns2idx.end()) {
+      return Result::makeError(fmt::format("postgres_tde: column {}.{} must be present in SELECT "
+                                           "body to be matched with a pattern",
+                                           column_ref.table(), column_ref.column()));
+    }
+
+    ENVOY_LOG(debug, "matched pattern check: ({}, {}) -> column {}", column_ref.table(),
+              column_ref.column(), it->second);
+    check.column_idx_ = it->second;
+    plan.addPatternCheck(check);
+  }
+
+  return Result::ok;
+}
+
+Result TokenIndexMutator::collectPatterns(hsql::Expr* expr, std::vector<Predicate>& predicates) {
+  if (!expr->isType(hsql::kExprOperator)) {
+    return Result::ok;
+  }
+
+  switch (expr->opType) {
+  case hsql::kOpAnd:
+    CHECK_RESULT(collectPatterns(expr->expr, predicates));
+    return collectPatterns(expr->expr2, predicates);
+  case hsql::kOpLike:
+  case hsql::kOpILike:
+    if (!expr->expr->isType(hsql::kExprColumnRef) ||
+        !expr->expr2->isType(hsql::kExprLiteralString)) {
+      return Result::ok;
+    }
+    break;
+  default:
+    return Result::ok;
+  }
+
+  hsql::Expr* column = expr->expr;
+  if (column->table == nullptr) {
+    return Result::makeError(
+        fmt::format("postgres_tde: unable to determine the source of column {}. Please specify "
+                    "an explicit table/alias reference",
+                    column->name));
+  }
+
+  absl::string_view table_name = getTableNameByAlias(column->table);
+  auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(table_name, column->name);
+  if (column_config == nullptr || !column_config->hasTokenIndex()) {
+    return Result::ok;
+  }
+
+  ENVOY_LOG(debug, "token index candidate: {}.{}", table_name, column->name);
+  predicates.push_back(Predicate{ColumnRef(std::string(table_name), std::string(column->name)),
+                                 column_config, expr});
+  return Result::ok;
+}
+
+Result TokenIndexMutator::mutatePatterns(hsql::SelectStatement* stmt,
+                                         std::vector<Predicate>& predicates) {
+  for (Predicate& predicate : predicates) {
+    const ColumnConfig* column_config = predicate.config_;
+
+    // Rows are filtered after the database has limited or aggregated them
+    if (stmt->limit != nullptr || stmt->groupBy != nullptr) {
+      return Result::makeError(fmt::format("postgres_tde: LIMIT and GROUP BY can't be used with "
+                                           "a pattern over column {}",
+                                           column_config->columnName()));
+    }
+
+    if (!isColumnSelected(predicate.column_ref_)) {
+      return Result::makeError(fmt::format("postgres_tde: column {}.{} must be present in SELECT "
+                                           "body to be matched with a pattern",
+                                           predicate.column_ref_.table(),
+                                           predicate.column_ref_.column()));
+    }
+
+    hsql::Expr* expr = predicate.expr_;
+    absl::string_view pattern_text = expr->expr2->name;
+    bool case_insensitive = expr->opType == hsql::kOpILike;
+
+    // Only ASCII letters are folded by the index, while Postgres folds all of them
+    if (case_insensitive && !std::all_of(pattern_text.begin(), pattern_text.end(),
+                                         [](char c) { return absl::ascii_isascii(c); })) {
+      return Result::makeError(fmt::format(
+          "postgres_tde: ILIKE patterns over column {} must consist of ASCII characters",
+          column_config->columnName()));
+    }
+
+    LikePattern pattern;
+    if (!LikePattern::parse(pattern_text, case_insensitive, pattern)) {
+      return Result::makeError(fmt::format("postgres_tde: invalid LIKE pattern for column {}",
+                                           column_config->columnName()));
+    }
+
+    std::string tokens;
+    if (!TokenIndexEncoder(*column_config).encodePattern(pattern, tokens)) {
+      return Result::makeError(fmt::format("postgres_tde: LIKE pattern over column {} is too "
+                                           "short to be looked up by the token index",
+                                           column_config->columnName()));
+    }
+
+    // The parser has no array operators, so the lookup is kept as a custom
+    // operator - the operator text in the name of a kOpNone expression
+    hsql::Expr* column = expr->expr;
+    free(column->name);
+    column->name = Common::Utils::makeOwnedCString(column_config->tokenIndexColumnName());
+    free(expr->expr2->name);
+    expr->expr2->name = Common::Utils::makeOwnedCString(tokens);
+    expr->opType = hsql::kOpNone;
+    expr->name = Common::Utils::makeOwnedCString("@>");
+
+    ENVOY_LOG(debug, "pattern over {}.{} is looked up by the token index",
+              predicate.column_ref_.table(), predicate.column_ref_.column());
+    pattern_checks_.emplace_back(predicate.column_ref_,
+                                 ResultPlan::PatternCheck{0, std::move(pattern)});
+  }
+
+  return Result::ok;
+}
+
+Result TokenIndexMutator::mutateInsertStatement() {
+  for (hsql::InsertStatement* stmt : insert_mutation_candidates_) {
+    if (stmt->columns->size() != stmt->values->size()) {
+      return Result::makeError("postgres_tde: bad INSERT statement");
+    }
+
+    std::vector<char*> index_columns;
+    std::vector<hsql::Expr*> index_values;
+    absl::Cleanup cleanup = [&]() {
+      for (char* column : index_columns) {
+        free(column);
+      }
+      for (hsql::Expr* value : index_values) {
+        delete value;
+      }
+    };
+
+    for (size_t i = 0; i < stmt->columns->size(); i++) {
+      char* column = (*stmt->columns)[i];
+      hsql::Expr* value = (*stmt->values)[i];
+
+      auto column_config = mgr_->getEncryptionConfig()->getColumnConfig(stmt->tableName, column);
+      if (column_config == nullptr || !column_config->hasTokenIndex()) {
+        continue;
+      }
+
+      if (!value->isLiteral()) {
+        return Result::makeError(
+            "postgres_tde: only literals can be used as INSERT values for columns with token index");
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createIndexLiteral(value, column_config, index_value));
+      index_values.push_back(index_value);
+      index_columns.push_back(
+          Common::Utils::makeOwnedCString(column_config->tokenIndexColumnName()));
+    }
+
+    stmt->columns->insert(stmt->columns->end(), index_columns.begin(), index_columns.end());
+    index_columns.clear();
+    stmt->values->insert(stmt->values->end(), index_values.begin(), index_values.end());
+    index_values.clear();
+  }
+
+  return Result::ok;
+}
+
+Result TokenIndexMutator::mutateUpdateStatement() {
+  for (hsql::UpdateStatement* stmt : update_mutation_candidates_) {
+    std::vector<hsql::UpdateClause*> index_updates;
+    absl::Cleanup cleanup = [&]() {
+      for (hsql::UpdateClause* update : index_updates) {
+        free(update->column);
+        delete update->value;
+        delete update;
+      }
+    };
+
+    for (hsql::UpdateClause* update : *stmt->updates) {
+      auto column_config =
+          mgr_->getEncryptionConfig()->getColumnConfig(stmt->table->name, update->column);
+      if (column_config == nullptr || !column_config->hasTokenIndex()) {
+        continue;
+      }
+
+      if (!update->value->isLiteral()) {
+        return Result::makeError(
+            "postgres_tde: only literals can be used as UPDATE values for columns with token index");
+      }
+
+      hsql::Expr* index_value;
+      CHECK_RESULT(createIndexLiteral(update->value, column_config, index_value));
+      index_updates.push_back(new hsql::UpdateClause{
+          Common::Utils::makeOwnedCString(column_config->tokenIndexColumnName()), index_value});
+    }
+
+    stmt->updates->insert(stmt->updates->end(), index_updates.begin(), index_updates.end());
+    index_updates.clear();
+  }
+
+  return Result::ok;
+}
+
+Result TokenIndexMutator::createIndexLiteral(hsql::Expr* orig_literal,
+                                             const ColumnConfig* column_config,
+                                             hsql::Expr*& index_literal) {
+  ASSERT(orig_literal->isLiteral());
+
+  if (orig_literal->type == hsql::kExprLiteralNull) {
+    // do nothing with null values
+    index_literal = hsql::Expr::makeNullLiteral();
+    return Result::ok;
+  }
+
+  if (orig_literal->type != hsql::kExprLiteralString) {
+    return Result::makeError(fmt::format(
+        "postgres_tde: invalid value for the token index of column {}", column_config->columnName()));
+  }
+
+  std::string tokens;
+  TokenIndexEncoder(*column_config).encode(orig_literal->name, tokens);
+  index_literal = hsql::Expr::makeLiteral(Common::Utils::makeOwnedCString(tokens));
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
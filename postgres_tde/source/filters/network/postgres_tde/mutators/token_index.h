@@ -0,0 +1,48 @@
+#pragma once
+
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/base_mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Visitor;
+using Common::SQLUtils::ColumnRef;
+
+// Rewrites LIKE and ILIKE over the columns with the token index into containment lookups of
+// the pattern tokens, the exact match is checked by the proxy on the decrypted values.
+// Maintains the index column on INSERT and UPDATE
+class TokenIndexMutator : public BaseMutator {
+public:
+  explicit TokenIndexMutator(MutationManager* manager);
+  TokenIndexMutator(const TokenIndexMutator&) = delete;
+
+  Result mutateQuery(hsql::SQLParserResult& query) override;
+  Result mutateRowDescription(RowDescriptionMessage& message, ResultPlan& plan) override;
+
+protected:
+  struct Predicate {
+    ColumnRef column_ref_;
+    const ColumnConfig* config_;
+    hsql::Expr* expr_;
+  };
+
+  Result collectPatterns(hsql::Expr* expr, std::vector<Predicate>& predicates);
+  Result mutatePatterns(hsql::SelectStatement* stmt, std::vector<Predicate>& predicates);
+  Result mutateInsertStatement();
+  Result mutateUpdateStatement();
+
+  Result createIndexLiteral(hsql::Expr* orig_literal, const ColumnConfig* column_config,
+                            hsql::Expr*& index_literal);
+
+protected:
+  // Patterns to be checked on the result, column indices are filled in by RowDescription
+  std::vector<std::pair<ColumnRef, ResultPlan::PatternCheck>> pattern_checks_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,48 @@
+#include "postgres_tde/source/filters/network/postgres_tde/order_index_encoder.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+OrderIndexEncoder::OrderIndexEncoder(const ColumnConfig& column_config)
+    : data_type_(column_config.origDataType()),
+      ctx_(Common::Crypto::UtilityExtSingleton::get().createOrderPreservingContext(
+          column_config.orderIndexKey())) {
+  ASSERT(OrderedValue::isSupportedType(data_type_));
+}
+
+bool OrderIndexEncoder::encodeInt(int64_t value, std::vector<uint8_t>& out) {
+  OrderedValue ordered_value;
+  if (!OrderedValue::fromInt(data_type_, value, ordered_value)) {
+    return false;
+  }
+
+  ctx_->encrypt(ordered_value.ordinal(), out);
+  return true;
+}
+
+bool OrderIndexEncoder::encodeFloat(double value, std::vector<uint8_t>& out) {
+  OrderedValue ordered_value;
+  if (!OrderedValue::fromFloat(data_type_, value, ordered_value)) {
+    return false;
+  }
+
+  ctx_->encrypt(ordered_value.ordinal(), out);
+  return true;
+}
+
+bool OrderIndexEncoder::encodeText(absl::string_view value, std::vector<uint8_t>& out) {
+  OrderedValue ordered_value;
+  if (!OrderedValue::fromText(data_type_, value, ordered_value)) {
+    return false;
+  }
+
+  ctx_->encrypt(ordered_value.ordinal(), out);
+  return true;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/column_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Computes values of the order-preserving index column
+ *
+ * Values of the column type are mapped to unsigned 64-bit integers of the same order
+ * (see OrderedValue), which are then encrypted with the order-preserving encryption.
+ * Not thread safe.
+ */
+class OrderIndexEncoder {
+public:
+  explicit OrderIndexEncoder(const ColumnConfig& column_config);
+
+  // Each returns false if the value is not valid for the column type
+  bool encodeInt(int64_t value, std::vector<uint8_t>& out);
+  bool encodeFloat(double value, std::vector<uint8_t>& out);
+  bool encodeText(absl::string_view value, std::vector<uint8_t>& out);
+
+private:
+  int32_t data_type_;
+  Common::Crypto::OrderPreservingContextPtr ctx_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,275 @@
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "source/common/common/assert.h"
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+constexpr uint64_t SIGN_BIT = uint64_t(1) << 63;
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+int64_t daysFromCivil(int64_t year, int64_t month, int64_t day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// Consumes a number of min_digits to max_digits digits from the beginning of the text
+bool consumeNumber(absl::string_view& text, size_t min_digits, size_t max_digits, int64_t& out) {
+  size_t digits = 0;
+  out = 0;
+  while (digits < text.size() && digits < max_digits && absl::ascii_isdigit(text[digits])) {
+    out = out * 10 + (text[digits] - '0');
+    digits++;
+  }
+
+  text.remove_prefix(digits);
+  return digits >= min_digits;
+}
+
+bool consumeChar(absl::string_view& text, char c) {
+  if (text.empty() || text[0] != c) {
+    return false;
+  }
+
+  text.remove_prefix(1);
+  return true;
+}
+
+bool parseInfinity(absl::string_view text, int64_t& out) {
+  if (absl::EqualsIgnoreCase(text, "infinity")) {
+    out = std::numeric_limits<int64_t>::max();
+    return true;
+  }
+  if (absl::EqualsIgnoreCase(text, "-infinity")) {
+    out = std::numeric_limits<int64_t>::min();
+    return true;
+  }
+  return false;
+}
+
+// YYYY-MM-DD, the ISO format Postgres outputs dates in
+bool consumeDate(absl::string_view& text, int64_t& days) {
+  int64_t year, month, day;
+  if (!consumeNumber(text, 4, 7, year) || !consumeChar(text, '-') ||
+      !consumeNumber(text, 1, 2, month) || !consumeChar(text, '-') ||
+      !consumeNumber(text, 1, 2, day)) {
+    return false;
+  }
+
+  if (month < 1 || month > 12 || day < 1 || day > 31) {
+    return false;
+  }
+
+  days = daysFromCivil(year, month, day);
+  return true;
+}
+
+bool parseDate(absl::string_view text, int64_t& days) {
+  text = absl::StripAsciiWhitespace(text);
+  if (parseInfinity(text, days)) {
+    return true;
+  }
+
+  return consumeDate(text, days) && text.empty();
+}
+
+// YYYY-MM-DD[( |T)HH:MM[:SS[.ffffff]]], microseconds since the epoch
+bool parseTimestamp(absl::string_view text, int64_t& usecs) {
+  text = absl::StripAsciiWhitespace(text);
+  if (parseInfinity(text, usecs)) {
+    return true;
+  }
+
+  int64_t days;
+  if (!consumeDate(text, days)) {
+    return false;
+  }
+
+  int64_t hours = 0, minutes = 0, seconds = 0, fraction = 0;
+  if (!text.empty()) {
+    if (!consumeChar(text, ' ') && !consumeChar(text, 'T')) {
+      return false;
+    }
+
+    if (!consumeNumber(text, 1, 2, hours) || !consumeChar(text, ':') ||
+        !consumeNumber(text, 1, 2, minutes)) {
+      return false;
+    }
+
+    if (consumeChar(text, ':')) {
+      if (!consumeNumber(text, 1, 2, seconds)) {
+        return false;
+      }
+
+      if (consumeChar(text, '.')) {
+        size_t digits = text.size();
+        if (!consumeNumber(text, 1, 6, fraction)) {
+          return false;
+        }
+        for (digits -= text.size(); digits < 6; digits++) {
+          fraction *= 10;
+        }
+      }
+    }
+  }
+
+  // Time zones are ignored by Postgres for timestamps without time zone, but such values
+  // are not expected from the clients, so they are rejected
+  if (!text.empty() || hours > 24 || minutes > 59 || seconds > 60) {
+    return false;
+  }
+
+  usecs = (((days * 24 + hours) * 60 + minutes) * 60 + seconds) * USECS_PER_SECOND + fraction;
+  return true;
+}
+
+} // namespace
+
+bool OrderedValue::isSupportedType(int32_t data_type) {
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID:
+  case FLOAT4OID:
+  case FLOAT8OID:
+  case DATEOID:
+  case TIMESTAMPOID:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool OrderedValue::fromInt(int32_t data_type, int64_t value, OrderedValue& out) {
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID:
+    out.is_float_ = false;
+    out.int_value_ = value;
+    return true;
+  case FLOAT4OID:
+  case FLOAT8OID:
+    return fromFloat(data_type, static_cast<double>(value), out);
+  default:
+    return false;
+  }
+}
+
+bool OrderedValue::fromFloat(int32_t data_type, double value, OrderedValue& out) {
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID:
+    // Integral values only, like 1.0
+    if (std::trunc(value) != value || std::fabs(value) >= 0x1p63) {
+      return false;
+    }
+    out.is_float_ = false;
+    out.int_value_ = static_cast<int64_t>(value);
+    return true;
+  case FLOAT4OID:
+  case FLOAT8OID:
+    out.is_float_ = true;
+    out.float_value_ = value;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool OrderedValue::fromText(int32_t data_type, absl::string_view value, OrderedValue& out) {
+  switch (data_type) {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID: {
+    int64_t ival;
+    if (!absl::SimpleAtoi(value, &ival)) {
+      return false;
+    }
+    return fromInt(data_type, ival, out);
+  }
+  case FLOAT4OID:
+  case FLOAT8OID: {
+    double fval;
+    if (!absl::SimpleAtod(value, &fval)) {
+      return false;
+    }
+    return fromFloat(data_type, fval, out);
+  }
+  case DATEOID:
+    out.is_float_ = false;
+    return parseDate(value, out.int_value_);
+  case TIMESTAMPOID:
+    out.is_float_ = false;
+    return parseTimestamp(value, out.int_value_);
+  default:
+    return false;
+  }
+}
+
+uint64_t OrderedValue::ordinal() const {
+  if (!is_float_) {
+    return static_cast<uint64_t>(int_value_) ^ SIGN_BIT;
+  }
+
+  double value = float_value_;
+  if (std::isnan(value)) {
+    // Postgres sorts NaN above all other values, as the positive NaN is ordered here
+    value = std::numeric_limits<double>::quiet_NaN();
+  } else if (value == 0) {
+    // -0 is equal to 0
+    value = 0;
+  }
+
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return (bits & SIGN_BIT) ? ~bits : bits | SIGN_BIT;
+}
+
+int64_t OrderedValue::bucket(uint64_t width) const {
+  ASSERT(width > 0 && width <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()));
+  int64_t signed_width = static_cast<int64_t>(width);
+
+  if (!is_float_) {
+    // Rounded towards negative infinity, so that each bucket has the same width
+    int64_t bucket = int_value_ / signed_width;
+    if (int_value_ % signed_width != 0 && int_value_ < 0) {
+      bucket--;
+    }
+    return bucket;
+  }
+
+  // NaN is above all other values, as in ordinal()
+  double bucket = std::floor(float_value_ / static_cast<double>(width));
+  if (std::isnan(bucket) || bucket >= 0x1p63) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  if (bucket < -0x1p63) {
+    return std::numeric_limits<int64_t>::min();
+  }
+  return static_cast<int64_t>(bucket);
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Value of an integer, floating point, date or timestamp column
+ *
+ * Dates are kept as days and timestamps as microseconds since the epoch, so every supported
+ * value is either a 64-bit integer or a double. Values come either as query literals or in the
+ * text format of the type, both give the same result for the same value.
+ */
+class OrderedValue {
+public:
+  static bool isSupportedType(int32_t data_type);
+
+  // Each returns false if the value is not valid for the column type
+  static bool fromInt(int32_t data_type, int64_t value, OrderedValue& out);
+  static bool fromFloat(int32_t data_type, double value, OrderedValue& out);
+  static bool fromText(int32_t data_type, absl::string_view value, OrderedValue& out);
+
+  // Unsigned integer of the same order as the values of the type
+  uint64_t ordinal() const;
+
+  // Number of the bucket of the given width the value falls into, floor(value / width)
+  int64_t bucket(uint64_t width) const;
+
+private:
+  bool is_float_{false};
+  int64_t int_value_{0};
+  double float_value_{0};
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -2,6 +2,7 @@
 
 #include <vector>
 
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
 #include "absl/cleanup/cleanup.h"
 
@@ -23,7 +24,7 @@ constexpr absl::string_view BACKEND = "Backend";
 void DecoderImpl::initialize() {
   // Special handler for first message of the transaction.
   startup_msg_processor_ =
-      MessageProcessor{"Startup", BODY_FORMAT(Int32, Repeated<String>), {}};
+      MessageProcessor{"Startup", BODY_FORMAT(Int32, Repeated<String>), {&DecoderImpl::onStartup}};
 
   // Frontend messages.
   FE_messages_.direction_ = FRONTEND;
@@ -35,9 +36,12 @@ void DecoderImpl::initialize() {
   FE_known_msgs['B'] = MessageProcessor{
       "Bind", BODY_FORMAT(String, String, Array<Int16>, Array<VarByteN>, Array<Int16>), {}};
   FE_known_msgs['C'] = MessageProcessor{"Close", BODY_FORMAT(Byte1, String), {}};
-  FE_known_msgs['d'] = MessageProcessor{"CopyData", BODY_FORMAT(ByteN), {}};
-  FE_known_msgs['c'] = MessageProcessor{"CopyDone", NO_BODY, {}};
-  FE_known_msgs['f'] = MessageProcessor{"CopyFail", BODY_FORMAT(String), {}};
+  FE_known_msgs['d'] =
+      MessageProcessor{"CopyData", TYPED_BODY_FORMAT(CopyDataMessage), {&DecoderImpl::onCopyData}};
+  FE_known_msgs['c'] =
+      MessageProcessor{"CopyDone", TYPED_BODY_FORMAT(CopyDoneMessage), {&DecoderImpl::onCopyDone}};
+  FE_known_msgs['f'] =
+      MessageProcessor{"CopyFail", TYPED_BODY_FORMAT(CopyFailMessage), {&DecoderImpl::onCopyFail}};
   FE_known_msgs['D'] = MessageProcessor{"Describe", BODY_FORMAT(Byte1, String), {}};
   FE_known_msgs['E'] = MessageProcessor{"Execute", BODY_FORMAT(String, Int32), {}};
   FE_known_msgs['H'] = MessageProcessor{"Flush", NO_BODY, {}};
@@ -102,7 +106,11 @@ void DecoderImpl::initialize() {
   BE_known_msgs['S'] = MessageProcessor{"ParameterStatus", BODY_FORMAT(String, String), {}};
   BE_known_msgs['1'] = MessageProcessor{"ParseComplete", NO_BODY, {}};
   BE_known_msgs['s'] = MessageProcessor{"PortalSuspend", NO_BODY, {}};
-  BE_known_msgs['Z'] = MessageProcessor{"ReadyForQuery", TYPED_BODY_FORMAT(ReadyForQueryMessage), {}};
+  BE_known_msgs['Z'] = MessageProcessor{
+      "ReadyForQuery",
+      TYPED_BODY_FORMAT(ReadyForQueryMessage),
+      {&DecoderImpl::onReadyForQuery},
+  };
   BE_known_msgs['T'] = MessageProcessor{
       "RowDescription",
       TYPED_BODY_FORMAT(RowDescriptionMessage),
@@ -143,6 +151,15 @@ void DecoderImpl::emitBackendMessage(MessagePtr message) {
   message->write(backend_replacement_data_);
 }
 
+void DecoderImpl::emitFrontendMessage(MessagePtr message) {
+  ASSERT(message->isWriteable());
+  message->write(frontend_replacement_data_);
+}
+
+void DecoderImpl::emitBackendData(absl::string_view data) {
+  backend_replacement_data_.add(data);
+}
+
 /* Handler for messages when decoder is in Init State. There are very few message types which
    are allowed in this state.
    If the initial message has the correct syntax and  indicates that session should be in
@@ -425,6 +442,18 @@ void DecoderImpl::onParse() {
   }
 }
 
+void DecoderImpl::onStartup() {
+  auto message = dynamic_cast<MessageImpl<Int32, Repeated<String>>*>(replacement_message_.get());
+  ASSERT(message != nullptr);
+
+  // Name/value pairs terminated by an empty name, kept as is
+  std::string parameters;
+  for (auto& parameter : message->value<1>().value()) {
+    absl::StrAppend(&parameters, parameter->value(), absl::string_view("\0", 1));
+  }
+  session_.setStartupParameters(std::move(parameters));
+}
+
 void DecoderImpl::onQuery() {
   auto casted_message = Common::Utils::dynamic_unique_cast<QueryMessage>(std::move(replacement_message_));
   callbacks_->processQuery(casted_message);
@@ -433,6 +462,30 @@ void DecoderImpl::onQuery() {
   }
 }
 
+void DecoderImpl::onCopyData() {
+  auto casted_message = Common::Utils::dynamic_unique_cast<CopyDataMessage>(std::move(replacement_message_));
+  callbacks_->processCopyData(casted_message);
+  if (casted_message) {
+    replacement_message_ = std::move(casted_message);
+  }
+}
+
+void DecoderImpl::onCopyDone() {
+  auto casted_message = Common::Utils::dynamic_unique_cast<CopyDoneMessage>(std::move(replacement_message_));
+  callbacks_->processCopyDone(casted_message);
+  if (casted_message) {
+    replacement_message_ = std::move(casted_message);
+  }
+}
+
+void DecoderImpl::onCopyFail() {
+  auto casted_message = Common::Utils::dynamic_unique_cast<CopyFailMessage>(std::move(replacement_message_));
+  callbacks_->processCopyFail(casted_message);
+  if (casted_message) {
+    replacement_message_ = std::move(casted_message);
+  }
+}
+
 void DecoderImpl::onRowDescription() {
   auto casted_message = Common::Utils::dynamic_unique_cast<RowDescriptionMessage>(std::move(replacement_message_));
   callbacks_->processRowDescription(casted_message);
@@ -473,6 +526,14 @@ void DecoderImpl::onErrorResponse() {
   }
 }
 
+void DecoderImpl::onReadyForQuery() {
+  auto casted_message = Common::Utils::dynamic_unique_cast<ReadyForQueryMessage>(std::move(replacement_message_));
+  callbacks_->processReadyForQuery(casted_message);
+  if (casted_message) {
+    replacement_message_ = std::move(casted_message);
+  }
+}
+
 } // namespace PostgresTDE
 } // namespace NetworkFilters
 } // namespace Extensions
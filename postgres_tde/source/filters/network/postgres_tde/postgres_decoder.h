@@ -24,6 +24,9 @@ public:
 
   virtual void processQuery(std::unique_ptr<QueryMessage>&) PURE;
   virtual void processParse(std::unique_ptr<ParseMessage>&) PURE;
+  virtual void processCopyData(std::unique_ptr<CopyDataMessage>&) PURE;
+  virtual void processCopyDone(std::unique_ptr<CopyDoneMessage>&) PURE;
+  virtual void processCopyFail(std::unique_ptr<CopyFailMessage>&) PURE;
 
   virtual void processRowDescription(std::unique_ptr<RowDescriptionMessage>&) PURE;
   virtual void processDataRow(std::unique_ptr<DataRowMessage>&) PURE;
@@ -31,11 +34,14 @@ public:
   virtual void processCommandComplete(std::unique_ptr<CommandCompleteMessage>&) PURE;
   virtual void processEmptyQueryResponse(std::unique_ptr<EmptyQueryResponseMessage>&) PURE;
   virtual void processErrorResponse(std::unique_ptr<ErrorResponseMessage>&) PURE;
+  virtual void processReadyForQuery(std::unique_ptr<ReadyForQueryMessage>&) PURE;
 
   virtual bool onSSLRequest() PURE;
   virtual bool shouldEncryptUpstream() const PURE;
   virtual void sendUpstream(Buffer::Instance&) PURE;
   virtual bool encryptUpstream(bool, Buffer::Instance&) PURE;
+  // Replacement data was emitted outside of the processing of the received data
+  virtual void flushEmittedData() PURE;
 };
 
 class MutationManager;
@@ -57,7 +63,6 @@ public:
   virtual Result onData(Buffer::Instance& parse_data, bool frontend) PURE;
   virtual Buffer::Instance& getBackendReplacementData() PURE;
   virtual Buffer::Instance& getFrontendReplacementData() PURE;
-  virtual PostgresSession& getSession() PURE;
 };
 
 using DecoderPtr = std::unique_ptr<Decoder>;
@@ -71,6 +76,9 @@ public:
   Buffer::Instance& getBackendReplacementData() override { return backend_replacement_data_; }
 
   void emitBackendMessage(MessagePtr) override;
+  void emitFrontendMessage(MessagePtr) override;
+  void emitBackendData(absl::string_view data) override;
+  void flushEmittedMessages() override { callbacks_->flushEmittedData(); }
 
   PostgresSession& getSession() override { return session_; }
 
@@ -138,13 +146,18 @@ protected:
   };
 
   void processMessageBody(Buffer::Instance& message_data, bool frontend, MessageProcessor& processor);
+  void onStartup();
   void onQuery();
   void onRowDescription();
   void onDataRow();
   void onCommandComplete();
   void onEmptyQueryResponse();
   void onErrorResponse();
+  void onReadyForQuery();
   void onParse();
+  void onCopyData();
+  void onCopyDone();
+  void onCopyFail();
 
   DecoderCallbacks* callbacks_{};
   PostgresSession session_{};
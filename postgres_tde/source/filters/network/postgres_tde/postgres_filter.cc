@@ -21,7 +21,17 @@ PostgresFilterConfig::PostgresFilterConfig(const PostgresFilterConfigOptions& co
                                            Stats::Scope& scope)
     : enable_sql_parsing_(config_options.enable_sql_parsing_),
       terminate_ssl_(config_options.terminate_ssl_), upstream_ssl_(config_options.upstream_ssl_),
-      permissive_parsing_(config_options.permissive_parsing_), scope_{scope},
+      permissive_parsing_(config_options.permissive_parsing_),
+      proxy_sort_memory_limit_(config_options.proxy_sort_memory_limit_),
+      proxy_sort_spill_directory_(config_options.proxy_sort_spill_directory_),
+      proxy_sort_max_spill_size_(config_options.proxy_sort_max_spill_size_),
+      proxy_aggregation_memory_limit_(config_options.proxy_aggregation_memory_limit_),
+      proxy_join_memory_limit_(config_options.proxy_join_memory_limit_),
+      proxy_join_spill_directory_(config_options.proxy_join_spill_directory_),
+      proxy_join_max_spill_size_(config_options.proxy_join_max_spill_size_),
+      semi_join_max_keys_(config_options.semi_join_max_keys_),
+      query_coalescer_provider_(config_options.query_coalescer_provider_),
+      encryption_config_provider_(config_options.encryption_config_provider_), scope_{scope},
       stats_{generateStats(config_options.stats_prefix_, scope)} {}
 
 PostgresFilter::PostgresFilter(PostgresFilterConfigSharedPtr config) : config_{config} {
@@ -42,18 +52,13 @@ Network::FilterStatus PostgresFilter::onData(Buffer::Instance& data, bool) {
   data.drain(data.length());
 
   Buffer::Instance& frontend_data = decoder_->getFrontendReplacementData();
-  Buffer::Instance& backend_data = decoder_->getBackendReplacementData();
 
   Decoder::Result result = doDecode(frontend_validation_buffer_, true);
   switch (result) {
   case Decoder::Result::NeedMoreData:
   case Decoder::Result::ReadyForNext:
-    if (backend_data.length() > 0) {
-      // Write back if needed
-      data.move(backend_data, backend_data.length());
-      write_callbacks_->injectWriteDataToFilterChain(data, false);
-      ASSERT(data.length() == 0);
-    }
+    // Write back if needed
+    scheduleBackendFlush();
 
     if (frontend_data.length() > 0) {
       // Pass mutated data to the rest of the filter chain and continue
@@ -74,6 +79,19 @@ Network::FilterStatus PostgresFilter::onNewConnection() { return Network::Filter
 
 void PostgresFilter::initializeReadFilterCallbacks(Network::ReadFilterCallbacks& callbacks) {
   read_callbacks_ = &callbacks;
+  backend_flush_cb_ = read_callbacks_->connection().dispatcher().createSchedulableCallback(
+      [this]() { flushBackendData(false); });
+  backend_resume_cb_ = read_callbacks_->connection().dispatcher().createSchedulableCallback(
+      [this]() { decodeBackendData(backend_end_stream_); });
+  emitted_flush_cb_ = read_callbacks_->connection().dispatcher().createSchedulableCallback(
+      [this]() {
+        Buffer::Instance& frontend_data = decoder_->getFrontendReplacementData();
+        if (frontend_data.length() > 0) {
+          read_callbacks_->injectReadDataToFilterChain(frontend_data, false);
+        }
+        flushBackendData(false);
+      });
+  read_callbacks_->connection().addConnectionCallbacks(*this);
 }
 
 void PostgresFilter::initializeWriteFilterCallbacks(Network::WriteFilterCallbacks& callbacks) {
@@ -84,7 +102,39 @@ void PostgresFilter::initializeWriteFilterCallbacks(Network::WriteFilterCallback
 Network::FilterStatus PostgresFilter::onWrite(Buffer::Instance& data, bool end_stream) {
   backend_validation_buffer_.add(data);
   data.drain(data.length());
+  backend_end_stream_ = backend_end_stream_ || end_stream;
+
+  if (backend_decoding_paused_) {
+    ENVOY_CONN_LOG(trace, "postgres_proxy: backend decoding is paused, {} bytes pending",
+                   read_callbacks_->connection(), backend_validation_buffer_.length());
+    return Network::FilterStatus::StopIteration;
+  }
+
+  decodeBackendData(backend_end_stream_);
+  return Network::FilterStatus::StopIteration;
+}
+
+void PostgresFilter::onAboveWriteBufferHighWatermark() {
+  ENVOY_CONN_LOG(debug, "postgres_proxy: downstream is above high watermark, pausing decoder",
+                 read_callbacks_->connection());
+  config_->stats_.backpressure_paused_.inc();
+  backend_decoding_paused_ = true;
+  backend_resume_cb_->cancel();
+}
+
+void PostgresFilter::onBelowWriteBufferLowWatermark() {
+  ENVOY_CONN_LOG(debug, "postgres_proxy: downstream is below low watermark, resuming decoder",
+                 read_callbacks_->connection());
+  config_->stats_.backpressure_resumed_.inc();
+  backend_decoding_paused_ = false;
+
+  // Decode pending data outside of the connection's write path
+  if (backend_validation_buffer_.length() > 0 || backend_end_stream_) {
+    backend_resume_cb_->scheduleCallbackCurrentIteration();
+  }
+}
 
+void PostgresFilter::decodeBackendData(bool end_stream) {
   Buffer::Instance& frontend_data = decoder_->getFrontendReplacementData();
   Buffer::Instance& backend_data = decoder_->getBackendReplacementData();
 
@@ -92,22 +142,56 @@ Network::FilterStatus PostgresFilter::onWrite(Buffer::Instance& data, bool end_s
   switch (result) {
   case Decoder::Result::NeedMoreData:
   case Decoder::Result::ReadyForNext:
-    // Write back is not supported
-    ASSERT(frontend_data.length() == 0);
-
-    if (backend_data.length() > 0) {
-      // Pass mutated data to the rest of the filter chain and continue
-      data.move(backend_data, backend_data.length());
-      write_callbacks_->injectWriteDataToFilterChain(data, end_stream);
+    // Queries issued by the proxy on behalf of the client, e.g. the second round of a semi join
+    if (frontend_data.length() > 0) {
+      read_callbacks_->injectReadDataToFilterChain(frontend_data, false);
     }
 
-    return Network::FilterStatus::StopIteration;
+    // Pass mutated data to the rest of the filter chain
+    if (end_stream) {
+      flushBackendData(true);
+    } else {
+      scheduleBackendFlush();
+    }
+    return;
 
   case Decoder::Result::Stopped:
     ASSERT(backend_validation_buffer_.length() == 0);
     backend_data.drain(backend_data.length());
-    return Network::FilterStatus::StopIteration;
+    return;
+  }
+}
+
+void PostgresFilter::flushEmittedData() {
+  if (!emitted_flush_cb_->enabled()) {
+    emitted_flush_cb_->scheduleCallbackCurrentIteration();
+  }
+}
+
+void PostgresFilter::scheduleBackendFlush() {
+  Buffer::Instance& backend_data = decoder_->getBackendReplacementData();
+  if (backend_data.length() >= BACKEND_FLUSH_THRESHOLD) {
+    flushBackendData(false);
+    return;
+  }
+
+  if (backend_data.length() > 0 && !backend_flush_cb_->enabled()) {
+    backend_flush_cb_->scheduleCallbackCurrentIteration();
+  }
+}
+
+void PostgresFilter::flushBackendData(bool end_stream) {
+  backend_flush_cb_->cancel();
+
+  Buffer::Instance& backend_data = decoder_->getBackendReplacementData();
+  if (backend_data.length() == 0 && !end_stream) {
+    return;
   }
+
+  ENVOY_CONN_LOG(trace, "postgres_proxy: flushing {} bytes downstream",
+                 read_callbacks_->connection(), backend_data.length());
+  write_callbacks_->injectWriteDataToFilterChain(backend_data, end_stream);
+  ASSERT(backend_data.length() == 0);
 }
 
 DecoderPtr PostgresFilter::createDecoder(DecoderCallbacks* callbacks) {
@@ -126,6 +210,18 @@ void PostgresFilter::processParse(std::unique_ptr<ParseMessage>& message) {
   mutation_manager_->processParse(message);
 }
 
+void PostgresFilter::processCopyData(std::unique_ptr<CopyDataMessage>& message) {
+  mutation_manager_->processCopyData(message);
+}
+
+void PostgresFilter::processCopyDone(std::unique_ptr<CopyDoneMessage>& message) {
+  mutation_manager_->processCopyDone(message);
+}
+
+void PostgresFilter::processCopyFail(std::unique_ptr<CopyFailMessage>& message) {
+  mutation_manager_->processCopyFail(message);
+}
+
 void PostgresFilter::processRowDescription(std::unique_ptr<RowDescriptionMessage>& message) {
   mutation_manager_->processRowDescription(message);
 }
@@ -146,6 +242,10 @@ void PostgresFilter::processErrorResponse(std::unique_ptr<ErrorResponseMessage>&
   mutation_manager_->processErrorResponse(message);
 }
 
+void PostgresFilter::processReadyForQuery(std::unique_ptr<ReadyForQueryMessage>& message) {
+  mutation_manager_->processReadyForQuery(message);
+}
+
 bool PostgresFilter::onSSLRequest() {
   if (!config_->terminate_ssl_) {
     // Signal to the decoder to continue.
@@ -234,6 +334,14 @@ Decoder::Result PostgresFilter::doDecode(Buffer::Instance& parse_data,
   while (0 < parse_data.length()) {
     switch (decoder_->onData(parse_data, frontend)) {
     case Decoder::Result::ReadyForNext:
+      if (!frontend) {
+        // Large results are flushed while decoding, so the downstream watermark
+        // can pause the decoder in the middle of the buffer
+        scheduleBackendFlush();
+        if (backend_decoding_paused_) {
+          return Decoder::Result::NeedMoreData;
+        }
+      }
       continue;
     case Decoder::Result::NeedMoreData:
       return Decoder::Result::NeedMoreData;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "envoy/event/schedulable_cb.h"
 #include "envoy/network/filter.h"
 #include "envoy/stats/scope.h"
 #include "envoy/stats/stats.h"
@@ -9,6 +10,7 @@
 #include "source/common/common/logger.h"
 
 #include "postgres_tde/api/filters/network/postgres_tde/postgres_tde.pb.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/encryption_config_provider.h"
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_decoder.h"
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
 
@@ -53,7 +55,26 @@ namespace PostgresTDE {
   COUNTER(notices_debug)                                                                           \
   COUNTER(notices_info)                                                                            \
   COUNTER(notices_log)                                                                             \
-  COUNTER(notices_unknown)
+  COUNTER(notices_unknown)                                                                         \
+  COUNTER(backpressure_paused)                                                                     \
+  COUNTER(backpressure_resumed)                                                                    \
+  COUNTER(copy_rows_encrypted)                                                                     \
+  COUNTER(proxy_sort_rows)                                                                         \
+  COUNTER(proxy_sort_spills)                                                                       \
+  COUNTER(proxy_aggregation_rows)                                                                  \
+  COUNTER(proxy_aggregation_groups)                                                                \
+  COUNTER(join_rows_fetched)                                                                       \
+  COUNTER(join_rows_discarded)                                                                     \
+  COUNTER(join_limit_refetches)                                                                    \
+  COUNTER(proxy_join_rows)                                                                         \
+  COUNTER(proxy_join_spills)                                                                       \
+  COUNTER(semi_join_queries)                                                                       \
+  COUNTER(semi_join_keys)                                                                          \
+  COUNTER(semi_join_skipped)                                                                       \
+  COUNTER(query_coalescing_leaders)                                                                \
+  COUNTER(query_coalescing_waiters)                                                                \
+  COUNTER(query_coalescing_cache_hits)                                                             \
+  COUNTER(query_coalescing_fallbacks)
 
 /**
  * Struct definition for all Postgres proxy stats. @see stats_macros.h
@@ -74,6 +95,18 @@ public:
     envoy::extensions::filters::network::postgres_tde::PostgresTDE::SSLMode
         upstream_ssl_;
     bool permissive_parsing_;
+    uint64_t proxy_sort_memory_limit_;
+    std::string proxy_sort_spill_directory_;
+    uint64_t proxy_sort_max_spill_size_;
+    uint64_t proxy_aggregation_memory_limit_;
+    uint64_t proxy_join_memory_limit_;
+    std::string proxy_join_spill_directory_;
+    uint64_t proxy_join_max_spill_size_;
+    // 0 if semi joins are disabled
+    uint32_t semi_join_max_keys_;
+    // nullptr if query coalescing is disabled
+    QueryCoalescerProviderSharedPtr query_coalescer_provider_;
+    EncryptionConfigProviderSharedPtr encryption_config_provider_;
   };
   PostgresFilterConfig(const PostgresFilterConfigOptions& config_options, Stats::Scope& scope);
 
@@ -83,6 +116,16 @@ public:
       upstream_ssl_{
           envoy::extensions::filters::network::postgres_tde::PostgresTDE::DISABLE};
   bool permissive_parsing_{false};
+  uint64_t proxy_sort_memory_limit_;
+  std::string proxy_sort_spill_directory_;
+  uint64_t proxy_sort_max_spill_size_;
+  uint64_t proxy_aggregation_memory_limit_;
+  uint64_t proxy_join_memory_limit_;
+  std::string proxy_join_spill_directory_;
+  uint64_t proxy_join_max_spill_size_;
+  uint32_t semi_join_max_keys_;
+  QueryCoalescerProviderSharedPtr query_coalescer_provider_;
+  EncryptionConfigProviderSharedPtr encryption_config_provider_;
   Stats::Scope& scope_;
   PostgresProxyStats stats_;
 
@@ -95,6 +138,7 @@ private:
 using PostgresFilterConfigSharedPtr = std::shared_ptr<PostgresFilterConfig>;
 
 class PostgresFilter : public Network::Filter,
+                       public Network::ConnectionCallbacks,
                        DecoderCallbacks,
                        Logger::Loggable<Logger::Id::filter> {
 public:
@@ -110,19 +154,32 @@ public:
   // Network::WriteFilter
   Network::FilterStatus onWrite(Buffer::Instance& data, bool end_stream) override;
 
+  // Network::ConnectionCallbacks
+  void onEvent(Network::ConnectionEvent) override {}
+  void onAboveWriteBufferHighWatermark() override;
+  void onBelowWriteBufferLowWatermark() override;
+
   void processQuery(std::unique_ptr<QueryMessage>&) override;
   void processParse(std::unique_ptr<ParseMessage>&) override;
+  void processCopyData(std::unique_ptr<CopyDataMessage>&) override;
+  void processCopyDone(std::unique_ptr<CopyDoneMessage>&) override;
+  void processCopyFail(std::unique_ptr<CopyFailMessage>&) override;
   void processRowDescription(std::unique_ptr<RowDescriptionMessage>&) override;
   void processDataRow(std::unique_ptr<DataRowMessage>&) override;
   void processCommandComplete(std::unique_ptr<CommandCompleteMessage>&) override;
   void processEmptyQueryResponse(std::unique_ptr<EmptyQueryResponseMessage>&) override;
   void processErrorResponse(std::unique_ptr<ErrorResponseMessage>&) override;
+  void processReadyForQuery(std::unique_ptr<ReadyForQueryMessage>&) override;
   bool onSSLRequest() override;
   bool shouldEncryptUpstream() const override;
   void sendUpstream(Buffer::Instance&) override;
   bool encryptUpstream(bool, Buffer::Instance&) override;
+  void flushEmittedData() override;
 
   Decoder::Result doDecode(Buffer::Instance& data, bool);
+  void decodeBackendData(bool end_stream);
+  void scheduleBackendFlush();
+  void flushBackendData(bool end_stream);
   DecoderPtr createDecoder(DecoderCallbacks* callbacks);
   MutationManagerPtr createMutationManager();
   void setDecoder(std::unique_ptr<Decoder> decoder) { decoder_ = std::move(decoder); }
@@ -145,6 +202,22 @@ private:
 
   std::unique_ptr<Decoder> decoder_;
   std::unique_ptr<MutationManager> mutation_manager_;
+
+  // Data written back to the client is coalesced and flushed at most once per
+  // event loop iteration, unless the amount of pending data exceeds the threshold.
+  Event::SchedulableCallbackPtr backend_flush_cb_;
+  static constexpr uint64_t BACKEND_FLUSH_THRESHOLD = 256 * 1024;
+
+  // Data emitted on behalf of another connection of the worker (e.g. the result of a coalesced
+  // query) is sent from the event loop, outside of the processing of the other connection
+  Event::SchedulableCallbackPtr emitted_flush_cb_;
+
+  // Backend data is not decoded while the client is not able to keep up with the results
+  // (downstream write buffer is above the high watermark). The upstream connection is read
+  // disabled by the TCP proxy in the same case, so the amount of data buffered here is bounded.
+  bool backend_decoding_paused_{false};
+  bool backend_end_stream_{false};
+  Event::SchedulableCallbackPtr backend_resume_cb_;
 };
 
 } // namespace PostgresTDE
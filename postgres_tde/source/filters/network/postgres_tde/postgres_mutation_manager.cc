@@ -1,8 +1,9 @@
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_mutation_manager.h"
-#include "postgres_tde/source/filters/network/postgres_tde/mutators/blind_index.h"
-#include "postgres_tde/source/filters/network/postgres_tde/mutators/probabilistic_join.h"
-#include "postgres_tde/source/filters/network/postgres_tde/mutators/encryption.h"
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_filter.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ddl_rewriter.h"
+#include "source/common/common/fmt.h"
+
+#include "absl/strings/str_cat.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -11,28 +12,76 @@ namespace PostgresTDE {
 
 MutationManagerImpl::MutationManagerImpl(PostgresFilterConfigSharedPtr config,
                                          MutationManagerCallbacks* callbacks)
-    : error_state_(Result::ok),
+    : proxy_join_mutator_(this), semi_join_mutator_(this), homomorphic_sum_mutator_(this),
+      proxy_aggregate_mutator_(this), blind_index_mutator_(this), proxy_sort_mutator_(this),
+      order_index_mutator_(this), bucket_index_mutator_(this), token_index_mutator_(this),
+      probabilistic_join_mutator_(this), encryption_mutator_(this),
+      // Order is important
+      mutator_chain_{&proxy_join_mutator_, &semi_join_mutator_, &homomorphic_sum_mutator_,
+                     &proxy_aggregate_mutator_, &blind_index_mutator_, &proxy_sort_mutator_,
+                     &order_index_mutator_, &bucket_index_mutator_, &token_index_mutator_,
+                     &probabilistic_join_mutator_, &encryption_mutator_},
+      error_state_(Result::ok),
+      result_sorter_(config->proxy_sort_memory_limit_, config->proxy_sort_spill_directory_,
+                     config->proxy_sort_max_spill_size_),
+      result_aggregator_(config->proxy_aggregation_memory_limit_),
+      result_joiner_(config->proxy_join_memory_limit_, config->proxy_join_spill_directory_,
+                     config->proxy_join_max_spill_size_),
       config_(std::move(config)),
-      callbacks_(callbacks) {
-  // Order is important
-  mutator_chain_.push_back(std::make_unique<BlindIndexMutator>(this));
-  mutator_chain_.push_back(std::make_unique<ProbabilisticJoinMutator>(this));
-  mutator_chain_.push_back(std::make_unique<EncryptionMutator>(this));
-
-  dumper_ = std::make_unique<Common::SQLUtils::DumpVisitor>();
+      encryption_config_(config_->encryption_config_provider_->get()), callbacks_(callbacks) {
+  semi_join_mutator_.setMaxKeys(config_->semi_join_max_keys_);
 }
 
+MutationManagerImpl::~MutationManagerImpl() { leaveCoalescing(false); }
+
 void PostgresTDE::MutationManagerImpl::processQuery(std::unique_ptr<QueryMessage>& message) {
   ENVOY_LOG(debug, "MutationManagerImpl::processQuery - got {}", message->toString());
   ASSERT(error_state_.isOk);
 
+  // The previous query is still in flight if the client doesn't wait for its result
+  leaveCoalescing(true);
+
   retent_rows_.clear();
+  retent_rows_size_ = 0;
+  streaming_result_ = false;
+  result_sorter_.clear();
+  result_aggregator_.clear();
+  result_joiner_.clear();
+  join_results_left_ = 0;
+  copy_in_plan_.clear();
+  copy_aborted_ = false;
+  semi_join_mutator_.reset();
+  probabilistic_join_mutator_.setOverFetch(true);
+  original_query_.clear();
+  resend_query_ = false;
+
+  // Pick up the latest schema - it stays the same until the result of the query is processed
+  encryption_config_ = config_->encryption_config_provider_->get();
+
+  const bool idle = transaction_status_ == 'I';
+  transaction_status_ = 0;
 
   Result result = processQueryImpl(*message);
+  if (!result.isOk && semi_join_mutator_.fetchingKeys()) {
+    // The query is left untouched on errors, so it's retried without the semi join
+    ENVOY_LOG(debug, "semi join is skipped: {}", result.error);
+    semi_join_mutator_.disable();
+    original_query_.clear();
+    config_->stats_.semi_join_skipped_.inc();
+    result = processQueryImpl(*message);
+  }
+
+  invalidateWrittenTables();
+
   if (!result.isOk) {
     // Consume message and emit error back
     message.reset();
     emitErrorResponse(result);
+    return;
+  }
+
+  if (idle && shouldCoalesce()) {
+    coalesceQuery(message);
   }
 }
 
@@ -42,12 +91,88 @@ void PostgresTDE::MutationManagerImpl::processParse(std::unique_ptr<ParseMessage
   callbacks_->emitBackendMessage(createErrorResponseMessage("postgres_tde: prepared statements are not supported"));
 }
 
+void MutationManagerImpl::processCopyData(std::unique_ptr<CopyDataMessage>& message) {
+  ENVOY_LOG(trace, "MutationManagerImpl::processCopyData - got {} bytes", message->data().size());
+
+  if (copy_aborted_) {
+    message.reset();
+    return;
+  }
+
+  if (!copy_in_plan_.active()) {
+    // Pass through
+    return;
+  }
+
+  Result result = copy_in_plan_.execute(message->data());
+  if (!result.isOk) {
+    message.reset();
+    abortCopy(result);
+    return;
+  }
+
+  if (message->data().empty()) {
+    // Nothing but a part of a row, it's sent with the next chunk
+    message.reset();
+  }
+}
+
+void MutationManagerImpl::processCopyDone(std::unique_ptr<CopyDoneMessage>& message) {
+  ENVOY_LOG(debug, "MutationManagerImpl::processCopyDone");
+
+  if (copy_aborted_) {
+    message.reset();
+    return;
+  }
+
+  if (!copy_in_plan_.active()) {
+    // Pass through
+    return;
+  }
+
+  std::vector<uint8_t> last_row;
+  Result result = copy_in_plan_.finish(last_row);
+  if (!result.isOk) {
+    message.reset();
+    abortCopy(result);
+    return;
+  }
+
+  if (!last_row.empty()) {
+    // The last row goes right before CopyDone
+    callbacks_->emitFrontendMessage(createCopyDataMessage(std::move(last_row)));
+  }
+
+  ENVOY_LOG(debug, "COPY finished, {} rows encrypted", copy_in_plan_.rowsCount());
+  config_->stats_.copy_rows_encrypted_.add(copy_in_plan_.rowsCount());
+  copy_in_plan_.clear();
+}
+
+void MutationManagerImpl::processCopyFail(std::unique_ptr<CopyFailMessage>& message) {
+  ENVOY_LOG(debug, "MutationManagerImpl::processCopyFail - got {}", message->toString());
+
+  if (copy_aborted_) {
+    message.reset();
+    return;
+  }
+
+  // Pass through
+  copy_in_plan_.clear();
+}
+
 void MutationManagerImpl::processRowDescription(std::unique_ptr<RowDescriptionMessage>& message) {
   ENVOY_LOG(debug, "MutationManagerImpl::processRowDescription - got {}", message->toString());
 
-  ASSERT(error_state_.isOk);
+  if (!error_state_.isOk) {
+    // Build side of the proxy join failed, the probe side is dropped
+    ASSERT(join_results_left_ == 1);
+    message.reset();
+    return;
+  }
+
+  result_plan_.clear();
   for (auto it = mutator_chain_.rbegin(); it != mutator_chain_.rend(); it++) {
-    error_state_ = (*it)->mutateRowDescription(*message);
+    error_state_ = (*it)->mutateRowDescription(*message, result_plan_);
     if (!error_state_.isOk) {
       ENVOY_LOG(warn, "got error while processing RowDescription, result will be discarded: {}", error_state_.error);
       message.reset();
@@ -55,6 +180,33 @@ void MutationManagerImpl::processRowDescription(std::unique_ptr<RowDescriptionMe
     }
   }
 
+  result_plan_.compile();
+  if (semi_join_mutator_.fetchingKeys()) {
+    // Result of the key query is consumed by the proxy
+    message.reset();
+    return;
+  }
+
+  if (result_plan_.sorted()) {
+    result_sorter_.start(result_plan_);
+  }
+  if (result_plan_.aggregated()) {
+    result_aggregator_.start(result_plan_);
+  }
+
+  switch (result_plan_.joinSide()) {
+  case ResultPlan::JoinSide::Build:
+    // Only the joined result is sent to the client
+    result_joiner_.startBuild(result_plan_);
+    message.reset();
+    return;
+  case ResultPlan::JoinSide::Probe:
+    result_joiner_.startProbe(result_plan_);
+    break;
+  case ResultPlan::JoinSide::None:
+    break;
+  }
+
   ENVOY_LOG(debug, "MutationManagerImpl::processRowDescription - after {}", message->toString());
   retent_row_description_ = std::move(message);
 }
@@ -68,40 +220,155 @@ void MutationManagerImpl::processDataRow(std::unique_ptr<DataRowMessage>& messag
     return;
   }
 
-  for (auto it = mutator_chain_.rbegin(); it != mutator_chain_.rend(); it++) {
-    error_state_ = (*it)->mutateDataRow(message);
+  bool discard = false;
+  error_state_ = result_plan_.execute(*message, discard);
+  if (!error_state_.isOk) {
+    ENVOY_LOG(warn, "got error while processing DataRow, result will be discarded: {}",
+              error_state_.error);
+    message.reset();
+    return;
+  } else if (discard) {
+    message.reset();
+    return;
+  }
+
+  if (semi_join_mutator_.fetchingKeys()) {
+    if (!message->isNull(0)) {
+      semi_join_mutator_.addKey(message->column(0));
+    }
+    message.reset();
+    return;
+  }
+
+  if (result_sorter_.active()) {
+    // Rows are emitted in the sorted order once the result is complete
+    error_state_ = result_sorter_.add(std::move(message));
     if (!error_state_.isOk) {
-      ENVOY_LOG(warn, "got error while processing DataRow, result will be discarded: {}",
+      ENVOY_LOG(warn, "got error while sorting DataRow, result will be discarded: {}",
                 error_state_.error);
-      message.reset();
-      return;
-    } else if (!message) {
-      // Message was discarded by filter
-      return;
+      result_sorter_.clear();
+    }
+    return;
+  }
+
+  if (result_aggregator_.active()) {
+    // Only the state of the group is kept, aggregated rows are emitted once the result is complete
+    error_state_ = result_aggregator_.add(*message);
+    message.reset();
+    if (!error_state_.isOk) {
+      ENVOY_LOG(warn, "got error while aggregating DataRow, result will be discarded: {}",
+                error_state_.error);
+      result_aggregator_.clear();
     }
+    return;
+  }
+
+  if (result_joiner_.building()) {
+    // Build side is kept until the probe side arrives
+    error_state_ = result_joiner_.addBuildRow(std::move(message));
+    if (!error_state_.isOk) {
+      ENVOY_LOG(warn, "got error while joining DataRow, result will be discarded: {}",
+                error_state_.error);
+      result_joiner_.clear();
+    }
+    return;
+  }
+
+  if (result_joiner_.probing()) {
+    // Joined rows are emitted as the probe side arrives
+    error_state_ = result_joiner_.probe(
+        *message, [this](std::unique_ptr<DataRowMessage> row) { retainRow(std::move(row)); });
+    message.reset();
+    if (!error_state_.isOk) {
+      ENVOY_LOG(warn, "got error while joining DataRow, result will be discarded: {}",
+                error_state_.error);
+      result_joiner_.clear();
+    }
+    return;
   }
 
   ENVOY_LOG(debug, "MutationManagerImpl::processRowDescription - after {}", message->toString());
-  retent_rows_.push_back(std::move(message));
+  retainRow(std::move(message));
 }
 
 void MutationManagerImpl::processCommandComplete(std::unique_ptr<CommandCompleteMessage>& cc_message) {
   ENVOY_LOG(debug, "MutationManagerImpl::processCommandComplete - got {}", cc_message->toString());
 
-  if (error_state_.isOk) {
-    // Emit renent response
-    if (retent_row_description_) {
-      callbacks_->emitBackendMessage(std::move(retent_row_description_));
+  if (semi_join_mutator_.fetchingKeys()) {
+    // The original query is sent once the key query is over, see processReadyForQuery
+    if (!error_state_.isOk) {
+      ENVOY_LOG(warn, "semi join is skipped due to error: {}", error_state_.error);
+      error_state_ = Result::ok;
+      semi_join_mutator_.disable();
+      config_->stats_.semi_join_skipped_.inc();
+    } else if (semi_join_mutator_.finishKeys()) {
+      config_->stats_.semi_join_queries_.inc();
+      config_->stats_.semi_join_keys_.add(semi_join_mutator_.keysCount());
+    } else {
+      ENVOY_LOG(debug, "semi join is skipped: too many keys");
+      config_->stats_.semi_join_skipped_.inc();
     }
 
-    for (auto& row: retent_rows_) {
-      callbacks_->emitBackendMessage(std::move(row));
-    }
+    resend_query_ = true;
+    cc_message.reset();
+    return;
+  }
+
+  if (error_state_.isOk && result_plan_.joinLimitShort()) {
+    // Too many false positives to fill the page, the whole result is fetched instead
+    ENVOY_LOG(debug, "join limit is not reached with {} rows, fetching all rows",
+              result_plan_.joinLimitRows());
+    config_->stats_.join_limit_refetches_.inc();
+    retent_row_description_.reset();
+    retent_rows_.clear();
+    retent_rows_size_ = 0;
+    recordJoinStats();
+    probabilistic_join_mutator_.setOverFetch(false);
+    resend_query_ = true;
+    cc_message.reset();
+    return;
+  }
+
+  if (join_results_left_ == 2) {
+    // Build side of the proxy join is complete, the client gets a single CommandComplete
+    join_results_left_--;
+    cc_message.reset();
+    recordJoinStats();
+    return;
+  }
+
+  if (error_state_.isOk && result_joiner_.probing()) {
+    error_state_ = emitJoinedRows(*cc_message);
+  }
+
+  if (error_state_.isOk && result_sorter_.active()) {
+    error_state_ = emitSortedRows(*cc_message);
+  }
+
+  if (error_state_.isOk && result_aggregator_.active()) {
+    error_state_ = emitAggregatedRows(*cc_message);
+  }
+
+  if (error_state_.isOk && result_plan_.joinLimited()) {
+    // The database reports the number of rows before the false positives are discarded
+    cc_message->value<0>().value() = fmt::format("SELECT {}", result_plan_.joinLimitRows());
+  }
 
-    callbacks_->emitBackendMessage(std::move(cc_message));
+  if (error_state_.isOk) {
+    // Emit renent response
+    emitRetentRows();
+    emitBackendMessage(std::move(cc_message));
+    finishCoalescing(true);
   } else {
     emitErrorResponse(error_state_);
   }
+
+  recordJoinStats();
+  result_sorter_.clear();
+  result_aggregator_.clear();
+  result_joiner_.clear();
+  join_results_left_ = 0;
+  streaming_result_ = false;
 }
 
 void MutationManagerImpl::processEmptyQueryResponse(std::unique_ptr<EmptyQueryResponseMessage>&) {
@@ -114,12 +381,84 @@ void MutationManagerImpl::processEmptyQueryResponse(std::unique_ptr<EmptyQueryRe
 void MutationManagerImpl::processErrorResponse(std::unique_ptr<ErrorResponseMessage>& message) {
   ENVOY_LOG(debug, "MutationManagerImpl::processErrorResponse - got {}", message->toString());
 
+  if (join_results_left_ != 0) {
+    // The rest of the proxy join is skipped by the database, its error replaces the pending one
+    result_joiner_.clear();
+    join_results_left_ = 0;
+    error_state_ = Result::ok;
+  }
+
+  if (semi_join_mutator_.fetchingKeys()) {
+    // Key query failed, the client gets its error instead of the result of the original query
+    semi_join_mutator_.disable();
+    error_state_ = Result::ok;
+  }
+
   ASSERT(error_state_.isOk);
+  recordJoinStats();
+  // Waiters get the error of their own
+  finishCoalescing(false);
   // Pass through
 }
 
+void MutationManagerImpl::processReadyForQuery(std::unique_ptr<ReadyForQueryMessage>& message) {
+  ENVOY_LOG(debug, "MutationManagerImpl::processReadyForQuery - got {}", message->toString());
+
+  // The result of the leader is complete at CommandComplete, anything else isn't shared
+  finishCoalescing(false);
+  transaction_status_ = message->value<0>().value();
+  callbacks_->getSession().setInTransaction(transaction_status_ != 'I');
+  invalidateWrittenTables();
+  if (transaction_status_ == 'I') {
+    written_tables_.clear();
+    written_all_tables_ = false;
+  }
+
+  if (!resend_query_) {
+    // Pass through
+    return;
+  }
+
+  // The client is ready for the next query once the proxy is done with the current one, e.g.
+  // after the keys of the semi join are fetched
+  message.reset();
+  resend_query_ = false;
+  std::unique_ptr<QueryMessage> query = createQueryMessage(std::move(original_query_));
+  original_query_.clear();
+
+  Result result = processQueryImpl(*query);
+  if (!result.isOk) {
+    emitErrorResponse(result);
+    return;
+  }
+
+  callbacks_->emitFrontendMessage(std::move(query));
+}
+
 Result PostgresTDE::MutationManagerImpl::processQueryImpl(QueryMessage& message) {
+  if (encryption_config_ == nullptr) {
+    // Keys for the schema couldn't be resolved
+    return Result::makeError("postgres_tde: encryption schema is not available");
+  }
+
   std::string& query_str = message.queryString();
+  coalescable_ = false;
+
+  // COPY is not supported by the SQL parser, so it's recognized separately
+  CopyInPlan::Statement copy_statement;
+  if (CopyInPlan::parseStatement(query_str, copy_statement)) {
+    recordWrites({copy_statement.table_});
+    return processCopyStatement(message, copy_statement);
+  }
+
+  // Same for DDL, the storage layout of the tables with TDE is derived from the encryption schema
+  if (DDLRewriter::isDDL(query_str)) {
+    written_all_tables_ = true;
+    DDLRewriter rewriter(*encryption_config_);
+    CHECK_RESULT(rewriter.rewrite(query_str));
+    ENVOY_LOG(debug, "mutated query message: {}", message.toString());
+    return Result::ok;
+  }
 
   hsql::SQLParserResult parsed_query;
   hsql::SQLParser::parse(query_str, &parsed_query);
@@ -127,33 +466,309 @@ Result PostgresTDE::MutationManagerImpl::processQueryImpl(QueryMessage& message)
     if (config_->permissive_parsing_) {
       // Pass incorrect queries to the backend in order to get a detailed error message
       ENVOY_LOG(warn, "query passed through because of parse error");
+      if (!CoalescingVisitor::isTransactionControl(query_str)) {
+        // Anything may be written by the statement, or the session may be changed by it
+        written_all_tables_ = true;
+        session_altered_ = true;
+      }
       return Result::ok;
     } else {
       return Result::makeError("postgres_tde: unable to parse query");
     }
   }
 
-  for (MutatorPtr& mutator : mutator_chain_) {
+  // Tables are collected before the query is rewritten, unsupported queries are reported by the
+  // mutators
+  if (coalescingEnabled() && coalescing_visitor_.visitQuery(parsed_query).isOk) {
+    coalescable_ = coalescing_visitor_.coalescable();
+    recordWrites(coalescing_visitor_.writtenTables());
+  }
+
+  for (Mutator* mutator : mutator_chain_) {
     Result result = mutator->mutateQuery(parsed_query);
     if (!result.isOk) {
       return result;
     }
   }
 
-  Result result = dumper_->visitQuery(parsed_query);
+  Result result = dumper_.visitQuery(parsed_query);
   if (!result.isOk) {
     return result;
   }
 
-  query_str = dumper_->getResult();
+  if (semi_join_mutator_.fetchingKeys() || probabilistic_join_mutator_.limited()) {
+    // The query may be sent again once its result is received
+    original_query_ = query_str;
+  }
+
+  query_str = dumper_.getResult();
+  if (proxy_join_mutator_.joining()) {
+    join_results_left_ = 2;
+  }
+
   ENVOY_LOG(debug, "mutated query message: {}", message.toString());
   return Result::ok;
 }
 
+Result MutationManagerImpl::processCopyStatement(QueryMessage& message,
+                                                 const CopyInPlan::Statement& statement) {
+  if (!encryption_config_->hasTDEEnabled(statement.table_)) {
+    // Nothing to do with plain tables
+    return Result::ok;
+  }
+
+  if (!statement.supported_) {
+    return Result::makeError(
+        fmt::format("postgres_tde: only COPY {} (<columns>) FROM STDIN in text format is "
+                    "supported for tables with encryption",
+                    statement.table_));
+  }
+
+  CHECK_RESULT(copy_in_plan_.compile(*encryption_config_, statement, message.queryString()));
+  ENVOY_LOG(debug, "mutated query message: {}", message.toString());
+  return Result::ok;
+}
+
+void MutationManagerImpl::abortCopy(const Result& result) {
+  ASSERT(!result.isOk);
+  ENVOY_LOG(warn, "aborting COPY: {}", result.error);
+
+  // The backend is in the COPY mode, so the error is reported by the backend itself
+  // in response to CopyFail. The rest of the data is dropped.
+  callbacks_->emitFrontendMessage(createCopyFailMessage(result.error));
+  copy_in_plan_.clear();
+  copy_aborted_ = true;
+}
+
+void MutationManagerImpl::retainRow(std::unique_ptr<DataRowMessage> row) {
+  retent_rows_size_ += row->wireSize();
+  retent_rows_.push_back(std::move(row));
+
+  // Limited joins may be fetched again, their rows are held until the result is complete.
+  // The refetch itself has no limit, so it's streamed as usual
+  if (streaming_result_ ||
+      (retent_rows_size_ > MAX_RETENT_ROWS_SIZE && !result_plan_.joinLimitRefetchable())) {
+    streaming_result_ = true;
+    emitRetentRows();
+  }
+}
+
+void MutationManagerImpl::emitRetentRows() {
+  if (retent_row_description_) {
+    emitBackendMessage(std::move(retent_row_description_));
+  }
+
+  for (auto& row : retent_rows_) {
+    emitBackendMessage(std::move(row));
+  }
+
+  retent_rows_.clear();
+  retent_rows_size_ = 0;
+}
+
+Result MutationManagerImpl::emitSortedRows(CommandCompleteMessage& cc_message) {
+  ASSERT(retent_rows_.empty());
+  if (retent_row_description_) {
+    emitBackendMessage(std::move(retent_row_description_));
+  }
+
+  // Rows can't be taken back once the first one is sent, so errors of the sorting itself
+  // are reported after them, as for the streamed results
+  CHECK_RESULT(result_sorter_.finish([this](std::unique_ptr<DataRowMessage> row) {
+    emitBackendMessage(std::move(row));
+  }));
+
+  // The database reports the number of rows before the limit is applied
+  cc_message.value<0>().value() = fmt::format("SELECT {}", result_sorter_.rowsCount());
+  config_->stats_.proxy_sort_rows_.add(result_sorter_.rowsCount());
+  config_->stats_.proxy_sort_spills_.add(result_sorter_.spilledRuns());
+  return Result::ok;
+}
+
+Result MutationManagerImpl::emitAggregatedRows(CommandCompleteMessage& cc_message) {
+  ASSERT(retent_rows_.empty());
+  if (retent_row_description_) {
+    emitBackendMessage(std::move(retent_row_description_));
+  }
+
+  CHECK_RESULT(result_aggregator_.finish([this](std::unique_ptr<DataRowMessage> row) {
+    emitBackendMessage(std::move(row));
+  }));
+
+  // The database reports the number of rows before the aggregation
+  cc_message.value<0>().value() = fmt::format("SELECT {}", result_aggregator_.groupsCount());
+  config_->stats_.proxy_aggregation_rows_.add(result_aggregator_.rowsCount());
+  config_->stats_.proxy_aggregation_groups_.add(result_aggregator_.groupsCount());
+  return Result::ok;
+}
+
+Result MutationManagerImpl::emitJoinedRows(CommandCompleteMessage& cc_message) {
+  // Rows of the spilled partitions are joined once the probe side is complete
+  CHECK_RESULT(result_joiner_.finish(
+      [this](std::unique_ptr<DataRowMessage> row) { retainRow(std::move(row)); }));
+
+  // The database reports the number of rows of the probe side
+  cc_message.value<0>().value() = fmt::format("SELECT {}", result_joiner_.rowsCount());
+  config_->stats_.proxy_join_rows_.add(result_joiner_.rowsCount());
+  config_->stats_.proxy_join_spills_.add(result_joiner_.spilledPartitions());
+  return Result::ok;
+}
+
+void MutationManagerImpl::recordJoinStats() {
+  // The ratio of the kept rows shows whether the join keys are wide enough
+  for (const ResultPlan::JoinCheck& check : result_plan_.joinChecks()) {
+    uint64_t rows_discarded = check.rows_fetched_ - check.rows_kept_;
+    ENVOY_LOG(debug, "join of columns {} and {}: {} rows fetched, {} discarded",
+              check.left_column_idx_, check.right_column_idx_, check.rows_fetched_, rows_discarded);
+    config_->stats_.join_rows_fetched_.add(check.rows_fetched_);
+    config_->stats_.join_rows_discarded_.add(rows_discarded);
+    check.stats_.rows_fetched_.add(check.rows_fetched_);
+    check.stats_.rows_kept_.add(check.rows_kept_);
+  }
+
+  // Statements without a result must not report the counters again
+  result_plan_.clear();
+}
+
+void MutationManagerImpl::emitBackendMessage(MessagePtr message) {
+  if (coalescing_role_ == CoalescingRole::Leader) {
+    message->write(coalesced_result_);
+    if (coalesced_result_.length() > config_->query_coalescer_provider_->get().maxResultSize()) {
+      ENVOY_LOG(debug, "query coalescing: result is too large to share");
+      finishCoalescing(false);
+    }
+  }
+
+  callbacks_->emitBackendMessage(std::move(message));
+}
+
+bool MutationManagerImpl::coalescingEnabled() const {
+  return config_->query_coalescer_provider_ != nullptr;
+}
+
+bool MutationManagerImpl::shouldCoalesce() const {
+  // Queries sent again by the proxy depend on the result of the first round
+  return coalescingEnabled() && coalescable_ && !session_altered_ &&
+         !callbacks_->getSession().startupParameters().empty() &&
+         !semi_join_mutator_.fetchingKeys() && !probabilistic_join_mutator_.limited();
+}
+
+void MutationManagerImpl::coalesceQuery(std::unique_ptr<QueryMessage>& message) {
+  // The same query of the sessions with the same parameters has the same result
+  const std::string key = absl::StrCat(callbacks_->getSession().startupParameters(),
+                                       absl::string_view("\0", 1), message->queryString());
+
+  QueryCoalescer::ResultSharedPtr result;
+  switch (config_->query_coalescer_provider_->get().join(
+      key, std::move(coalescing_visitor_.readTables()), *this, result, coalescing_flight_)) {
+  case QueryCoalescer::Role::Cached:
+    ENVOY_LOG(debug, "query coalescing: result of the query is cached");
+    config_->stats_.query_coalescing_cache_hits_.inc();
+    message.reset();
+    callbacks_->emitBackendData(*result);
+    callbacks_->emitBackendMessage(createReadyForQueryMessage());
+    transaction_status_ = 'I';
+    return;
+
+  case QueryCoalescer::Role::Waiter:
+    ENVOY_LOG(debug, "query coalescing: waiting for the result of flight {}", coalescing_flight_);
+    config_->stats_.query_coalescing_waiters_.inc();
+    coalescing_role_ = CoalescingRole::Waiter;
+    coalesced_query_ = std::move(message->queryString());
+    message.reset();
+    return;
+
+  case QueryCoalescer::Role::Leader:
+    ENVOY_LOG(debug, "query coalescing: executing flight {}", coalescing_flight_);
+    config_->stats_.query_coalescing_leaders_.inc();
+    coalescing_role_ = CoalescingRole::Leader;
+    return;
+  }
+}
+
+void MutationManagerImpl::onCoalescedResult(QueryCoalescer::ResultSharedPtr result) {
+  ASSERT(coalescing_role_ == CoalescingRole::Waiter);
+  coalescing_role_ = CoalescingRole::None;
+
+  if (result != nullptr) {
+    callbacks_->emitBackendData(*result);
+    callbacks_->emitBackendMessage(createReadyForQueryMessage());
+    transaction_status_ = 'I';
+  } else {
+    // The state of the mutators is still the one of the query, so its result is handled as usual
+    ENVOY_LOG(debug, "query coalescing: leader failed, executing the query");
+    config_->stats_.query_coalescing_fallbacks_.inc();
+    callbacks_->emitFrontendMessage(createQueryMessage(std::move(coalesced_query_)));
+  }
+
+  coalesced_query_.clear();
+  // Called while another connection is processing its result
+  callbacks_->flushEmittedMessages();
+}
+
+void MutationManagerImpl::finishCoalescing(bool completed) {
+  if (coalescing_role_ != CoalescingRole::Leader) {
+    return;
+  }
+
+  // Waiters may be notified right away, so the role is reset first
+  coalescing_role_ = CoalescingRole::None;
+  QueryCoalescer& coalescer = config_->query_coalescer_provider_->get();
+  if (completed) {
+    coalescer.complete(coalescing_flight_, coalesced_result_.toString());
+  } else {
+    coalescer.fail(coalescing_flight_);
+  }
+  coalesced_result_.drain(coalesced_result_.length());
+}
+
+void MutationManagerImpl::leaveCoalescing(bool fallback) {
+  if (coalescing_role_ == CoalescingRole::Leader) {
+    finishCoalescing(false);
+    return;
+  }
+
+  if (coalescing_role_ != CoalescingRole::Waiter) {
+    return;
+  }
+
+  coalescing_role_ = CoalescingRole::None;
+  config_->query_coalescer_provider_->get().leave(coalescing_flight_, *this);
+  if (fallback) {
+    // Results must arrive in the order of the queries
+    config_->stats_.query_coalescing_fallbacks_.inc();
+    callbacks_->emitFrontendMessage(createQueryMessage(std::move(coalesced_query_)));
+  }
+  coalesced_query_.clear();
+}
+
+void MutationManagerImpl::recordWrites(const std::vector<std::string>& tables) {
+  if (coalescingEnabled()) {
+    written_tables_.insert(written_tables_.end(), tables.begin(), tables.end());
+  }
+}
+
+void MutationManagerImpl::invalidateWrittenTables() {
+  if (!coalescingEnabled()) {
+    return;
+  }
+
+  QueryCoalescer& coalescer = config_->query_coalescer_provider_->get();
+  if (written_all_tables_) {
+    coalescer.invalidateAll();
+    return;
+  }
+
+  for (const std::string& table : written_tables_) {
+    coalescer.invalidate(table);
+  }
+}
+
 void MutationManagerImpl::emitErrorResponse(const Result& result) {
   ASSERT(!result.isOk);
-  callbacks_->emitBackendMessage(createErrorResponseMessage(result.error));
-  callbacks_->emitBackendMessage(createReadyForQueryMessage());
+  finishCoalescing(false);
+  emitBackendMessage(createErrorResponseMessage(result.error));
+  emitBackendMessage(createReadyForQueryMessage());
   error_state_ = Result::ok;
 }
 
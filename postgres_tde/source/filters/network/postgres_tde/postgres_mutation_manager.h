@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <cstdint>
 
 #include "envoy/common/platform.h"
@@ -6,9 +7,26 @@
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/logger.h"
 
-#include "postgres_tde/source/filters/network/postgres_tde/config/dummy_config.h"
-#include "postgres_tde/source/filters/network/postgres_tde/mutators/mutator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/database_encryption_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/copy_in_plan.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/blind_index.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/bucket_index.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/token_index.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/encryption.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/homomorphic_sum.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/order_index.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/probabilistic_join.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/proxy_aggregate.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/proxy_join.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/proxy_sort.h"
+#include "postgres_tde/source/filters/network/postgres_tde/mutators/semi_join.h"
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_session.h"
+#include "postgres_tde/source/filters/network/postgres_tde/query_coalescer.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_aggregator.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_joiner.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_sorter.h"
 #include "postgres_tde/source/common/sqlutils/ast/dump_visitor.h"
 
 namespace Envoy {
@@ -24,6 +42,14 @@ public:
   virtual ~MutationManagerCallbacks() = default;
 
   virtual void emitBackendMessage(MessagePtr) PURE;
+  virtual void emitFrontendMessage(MessagePtr) PURE;
+  // Messages already in the wire format, e.g. a result shared by another connection
+  virtual void emitBackendData(absl::string_view data) PURE;
+  // Messages emitted outside of the processing of a received message, e.g. on behalf of
+  // another connection, are sent once the callback is called
+  virtual void flushEmittedMessages() PURE;
+
+  virtual PostgresSession& getSession() PURE;
 };
 
 /**
@@ -42,6 +68,9 @@ public:
 
   virtual void processQuery(std::unique_ptr<QueryMessage>&) PURE;
   virtual void processParse(std::unique_ptr<ParseMessage>&) PURE;
+  virtual void processCopyData(std::unique_ptr<CopyDataMessage>&) PURE;
+  virtual void processCopyDone(std::unique_ptr<CopyDoneMessage>&) PURE;
+  virtual void processCopyFail(std::unique_ptr<CopyFailMessage>&) PURE;
 
   // Backend messages
 
@@ -51,6 +80,7 @@ public:
   virtual void processCommandComplete(std::unique_ptr<CommandCompleteMessage>&) PURE;
   virtual void processEmptyQueryResponse(std::unique_ptr<EmptyQueryResponseMessage>&) PURE;
   virtual void processErrorResponse(std::unique_ptr<ErrorResponseMessage>&) PURE;
+  virtual void processReadyForQuery(std::unique_ptr<ReadyForQueryMessage>&) PURE;
 
   virtual const PostgresFilterConfig* getConfig() const PURE;
   virtual const DatabaseEncryptionConfig* getEncryptionConfig() const PURE;
@@ -58,12 +88,18 @@ public:
 
 using MutationManagerPtr = std::unique_ptr<MutationManager>;
 
-class MutationManagerImpl : public MutationManager, Logger::Loggable<Logger::Id::filter> {
+class MutationManagerImpl : public MutationManager,
+                            public QueryCoalescer::Waiter,
+                            Logger::Loggable<Logger::Id::filter> {
 public:
   MutationManagerImpl(PostgresFilterConfigSharedPtr config, MutationManagerCallbacks* callbacks);
+  ~MutationManagerImpl() override;
 
   void processQuery(std::unique_ptr<QueryMessage>& message) override;
   void processParse(std::unique_ptr<ParseMessage>& message) override;
+  void processCopyData(std::unique_ptr<CopyDataMessage>& message) override;
+  void processCopyDone(std::unique_ptr<CopyDoneMessage>& message) override;
+  void processCopyFail(std::unique_ptr<CopyFailMessage>& message) override;
 
   void processRowDescription(std::unique_ptr<RowDescriptionMessage>& message) override;
   void processDataRow(std::unique_ptr<DataRowMessage>& message) override;
@@ -71,30 +107,123 @@ public:
   void processCommandComplete(std::unique_ptr<CommandCompleteMessage>& cc_message) override;
   void processEmptyQueryResponse(std::unique_ptr<EmptyQueryResponseMessage>& message) override;
   void processErrorResponse(std::unique_ptr<ErrorResponseMessage>& message) override;
+  void processReadyForQuery(std::unique_ptr<ReadyForQueryMessage>& message) override;
 
   const PostgresFilterConfig* getConfig() const override {
     return config_.get();
   }
 
   const DatabaseEncryptionConfig* getEncryptionConfig() const override {
-    return &encryption_config_;
+    return encryption_config_.get();
   }
 
+  // QueryCoalescer::Waiter
+  void onCoalescedResult(QueryCoalescer::ResultSharedPtr result) override;
+
 protected:
   Result processQueryImpl(QueryMessage&);
+  Result processCopyStatement(QueryMessage&, const CopyInPlan::Statement& statement);
+  void abortCopy(const Result& result);
   void emitErrorResponse(const Result& result);
+  void retainRow(std::unique_ptr<DataRowMessage> row);
+  void emitRetentRows();
+  Result emitSortedRows(CommandCompleteMessage& cc_message);
+  Result emitAggregatedRows(CommandCompleteMessage& cc_message);
+  Result emitJoinedRows(CommandCompleteMessage& cc_message);
+  void recordJoinStats();
+  // Messages of the result of the query are emitted through the method, so the result of a
+  // coalesced query can be shared with the waiters
+  void emitBackendMessage(MessagePtr message);
+
+  bool coalescingEnabled() const;
+  bool shouldCoalesce() const;
+  void coalesceQuery(std::unique_ptr<QueryMessage>& message);
+  // Shares the result of the leader with the waiters, or lets them execute the query themselves
+  void finishCoalescing(bool completed);
+  // Leaves the flight, the query is sent to the database if the waiter should execute it anyway
+  void leaveCoalescing(bool fallback);
+  void recordWrites(const std::vector<std::string>& tables);
+  void invalidateWrittenTables();
 
 protected:
-  std::vector<MutatorPtr> mutator_chain_;
-  std::unique_ptr<Envoy::Extensions::Common::SQLUtils::DumpVisitor> dumper_;
+  // Mutators are stored inline to keep connection setup allocation-free
+  ProxyJoinMutator proxy_join_mutator_;
+  SemiJoinMutator semi_join_mutator_;
+  HomomorphicSumMutator homomorphic_sum_mutator_;
+  ProxyAggregateMutator proxy_aggregate_mutator_;
+  BlindIndexMutator blind_index_mutator_;
+  ProxySortMutator proxy_sort_mutator_;
+  OrderIndexMutator order_index_mutator_;
+  BucketIndexMutator bucket_index_mutator_;
+  TokenIndexMutator token_index_mutator_;
+  ProbabilisticJoinMutator probabilistic_join_mutator_;
+  EncryptionMutator encryption_mutator_;
+  std::array<Mutator*, 11> mutator_chain_;
+
+  Envoy::Extensions::Common::SQLUtils::DumpVisitor dumper_;
 
   Result error_state_;
 
+  // Compiled from RowDescription, executed for each DataRow of the current result
+  ResultPlan result_plan_;
+  // Active if the result is sorted by the proxy, the rows are emitted once the result is complete
+  ResultSorter result_sorter_;
+  // Active if the result is aggregated by the proxy, only the aggregated rows are emitted
+  ResultAggregator result_aggregator_;
+  // Active while the results of a proxy join are received, only the joined rows are emitted
+  ResultJoiner result_joiner_;
+  // Results of the proxy join left to receive. The client gets a single result, so the build
+  // side isn't passed and its errors are reported once the probe side is complete
+  uint32_t join_results_left_{0};
+  // Query of the client, kept while the proxy may send it again: with the keys of the semi join
+  // once they are fetched, or without the limit if a limited join has too many false positives
+  std::string original_query_;
+  bool resend_query_{false};
+
   std::unique_ptr<RowDescriptionMessage> retent_row_description_;
   std::vector<std::unique_ptr<DataRowMessage>> retent_rows_;
 
+  // Rows are retained until CommandComplete so that an error can replace the whole result.
+  // Once the retained rows exceed the limit, the result is streamed to the client instead
+  // (late errors are reported after the rows already sent, as Postgres itself does).
+  uint64_t retent_rows_size_{0};
+  bool streaming_result_{false};
+  static constexpr uint64_t MAX_RETENT_ROWS_SIZE = 1024 * 1024;
+
+  // Active while the data of COPY ... FROM STDIN into a table with TDE enabled is streamed
+  CopyInPlan copy_in_plan_;
+  // Set when COPY is aborted by the proxy, the rest of the COPY data is dropped
+  bool copy_aborted_{false};
+
+  enum class CoalescingRole {
+    None,
+    Leader,
+    Waiter,
+  };
+
+  // Tables of the current query, it's coalesced if it's a read-only single SELECT
+  CoalescingVisitor coalescing_visitor_;
+  bool coalescable_{false};
+  CoalescingRole coalescing_role_{CoalescingRole::None};
+  uint64_t coalescing_flight_{0};
+  // Leader: the result as sent to the client. Waiter: the rewritten query, sent to the database
+  // if the leader fails
+  Buffer::OwnedImpl coalesced_result_;
+  std::string coalesced_query_;
+  // Status of the last ReadyForQuery, unknown while a query is executed. Only the queries
+  // outside of transactions are coalesced
+  char transaction_status_{'I'};
+  // Results over the written tables are dropped once the query is received and once again when
+  // the transaction is over, as the writes become visible to other sessions
+  std::vector<std::string> written_tables_;
+  bool written_all_tables_{false};
+  // The session ran a statement the proxy doesn't understand (SET etc.), so its results may
+  // differ from the results of other sessions with the same startup parameters
+  bool session_altered_{false};
+
   PostgresFilterConfigSharedPtr config_;
-  DummyConfig encryption_config_;
+  // Snapshot captured for the current query
+  DatabaseEncryptionConfigConstSharedPtr encryption_config_;
   MutationManagerCallbacks* callbacks_;
 };
 
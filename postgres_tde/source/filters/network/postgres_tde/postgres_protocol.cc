@@ -1,10 +1,234 @@
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
 
+#include <cstring>
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
 namespace PostgresTDE {
 
+namespace {
+
+inline void storeBE16(uint8_t* out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value >> 8);
+  out[1] = static_cast<uint8_t>(value);
+}
+
+inline void storeBE32(uint8_t* out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value >> 24);
+  out[1] = static_cast<uint8_t>(value >> 16);
+  out[2] = static_cast<uint8_t>(value >> 8);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+inline uint16_t loadBE16(const uint8_t* in) {
+  return (static_cast<uint16_t>(in[0]) << 8) | static_cast<uint16_t>(in[1]);
+}
+
+inline uint32_t loadBE32(const uint8_t* in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+} // namespace
+
+// DataRowMessage methods.
+Message::ValidationResult DataRowMessage::validate(const Buffer::Instance& data,
+                                                   const uint64_t start_pos,
+                                                   const uint64_t length) {
+  uint64_t pos = start_pos;
+  uint64_t left = length;
+  validation_result_ = ValidationFailed;
+
+  // Number of columns
+  if (left < sizeof(uint16_t)) {
+    return validation_result_;
+  }
+  if ((data.length() - pos) < sizeof(uint16_t)) {
+    validation_result_ = ValidationNeedMoreData;
+    return validation_result_;
+  }
+
+  uint16_t columns_count = data.peekBEInt<uint16_t>(pos);
+  pos += sizeof(uint16_t);
+  left -= sizeof(uint16_t);
+
+  for (uint16_t i = 0; i < columns_count; i++) {
+    if (left < sizeof(int32_t)) {
+      return validation_result_;
+    }
+    if ((data.length() - pos) < sizeof(int32_t)) {
+      validation_result_ = ValidationNeedMoreData;
+      return validation_result_;
+    }
+
+    int32_t len = data.peekBEInt<int32_t>(pos);
+    pos += sizeof(int32_t);
+    left -= sizeof(int32_t);
+    if (len < 0) {
+      // NULL value, no payload follows
+      continue;
+    }
+
+    if (static_cast<uint64_t>(len) > left) {
+      // Column value would extend past the message boundaries.
+      return validation_result_;
+    }
+    if ((data.length() - pos) < static_cast<uint64_t>(len)) {
+      validation_result_ = ValidationNeedMoreData;
+      return validation_result_;
+    }
+
+    pos += len;
+    left -= len;
+  }
+
+  validation_result_ = ValidationOK;
+  return validation_result_;
+}
+
+bool DataRowMessage::read(const Buffer::Instance& data, const uint64_t length) {
+  // Do not call read unless validation was successful.
+  ASSERT(validation_result_ == ValidationOK);
+
+  // Copy the whole message body at once and reference column values right inside it
+  arena_.resize(length);
+  data.copyOut(0, length, arena_.data());
+  indexColumns();
+  return true;
+}
+
+void DataRowMessage::indexColumns() {
+  const uint8_t* body = arena_.data();
+  uint64_t pos = 0;
+
+  uint16_t columns_count = loadBE16(body);
+  pos += sizeof(uint16_t);
+
+  columns_.resize(columns_count);
+  for (uint16_t i = 0; i < columns_count; i++) {
+    int32_t len = static_cast<int32_t>(loadBE32(body + pos));
+    pos += sizeof(int32_t);
+
+    columns_[i].offset_ = pos;
+    columns_[i].length_ = len < 0 ? -1 : len;
+    if (len > 0) {
+      pos += len;
+    }
+  }
+}
+
+std::string DataRowMessage::toString() const {
+  std::string out = fmt::format("[Array of {}:{{", columns_.size());
+  for (size_t i = 0; i < columns_.size(); i++) {
+    if (isNull(i)) {
+      absl::StrAppend(&out, "[null]");
+      continue;
+    }
+
+    absl::string_view value = column(i);
+    absl::StrAppend(&out, fmt::format("[({} bytes):", value.size()));
+    absl::StrAppend(&out, absl::StrJoin(absl::Span<const uint8_t>(
+                                            reinterpret_cast<const uint8_t*>(value.data()),
+                                            value.size()),
+                                        " "));
+    absl::StrAppend(&out, "]");
+  }
+  absl::StrAppend(&out, "}]");
+  return out;
+}
+
+uint64_t DataRowMessage::wireSize() const {
+  // Identifier, message length, columns count
+  uint64_t size = sizeof(char) + sizeof(uint32_t) + sizeof(uint16_t);
+  for (const ColumnSlot& slot : columns_) {
+    size += sizeof(int32_t) + (slot.length_ > 0 ? slot.length_ : 0);
+  }
+  return size;
+}
+
+void DataRowMessage::write(Buffer::Instance& to) const {
+  const uint64_t size = wireSize();
+
+  // Serialize the whole message into a single reserved slice
+  Buffer::ReservationSingleSlice reservation = to.reserveSingleSlice(size);
+  uint8_t* out = static_cast<uint8_t*>(reservation.slice().mem_);
+
+  *out++ = 'D';
+  storeBE32(out, size - sizeof(char));
+  out += sizeof(uint32_t);
+  storeBE16(out, columns_.size());
+  out += sizeof(uint16_t);
+
+  for (const ColumnSlot& slot : columns_) {
+    storeBE32(out, static_cast<uint32_t>(slot.length_));
+    out += sizeof(int32_t);
+    if (slot.length_ > 0) {
+      memcpy(out, arena_.data() + slot.offset_, slot.length_);
+      out += slot.length_;
+    }
+  }
+
+  ASSERT(static_cast<uint64_t>(out - static_cast<uint8_t*>(reservation.slice().mem_)) == size);
+  reservation.commit(size);
+}
+
+void DataRowMessage::writeBody(std::string& out) const {
+  // Columns count and (length, value) pairs, the same as write() produces after the header
+  uint8_t be[sizeof(uint32_t)];
+  storeBE16(be, columns_.size());
+  out.append(reinterpret_cast<const char*>(be), sizeof(uint16_t));
+
+  for (const ColumnSlot& slot : columns_) {
+    storeBE32(be, static_cast<uint32_t>(slot.length_));
+    out.append(reinterpret_cast<const char*>(be), sizeof(uint32_t));
+    if (slot.length_ > 0) {
+      out.append(reinterpret_cast<const char*>(arena_.data()) + slot.offset_, slot.length_);
+    }
+  }
+}
+
+void DataRowMessage::readBody(absl::string_view body) {
+  arena_.assign(body.begin(), body.end());
+  indexColumns();
+}
+
+void DataRowMessage::setColumn(size_t idx, absl::string_view value) {
+  ASSERT(idx < columns_.size());
+
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(value.data());
+  if (!arena_.empty() && src >= arena_.data() && src < arena_.data() + arena_.size()) {
+    // Value is already in the arena - just reference it
+    columns_[idx] = {static_cast<uint32_t>(src - arena_.data()),
+                     static_cast<int32_t>(value.size())};
+    return;
+  }
+
+  const size_t offset = arena_.size();
+  arena_.resize(offset + value.size());
+  if (!value.empty()) {
+    memcpy(arena_.data() + offset, value.data(), value.size());
+  }
+
+  columns_[idx] = {static_cast<uint32_t>(offset), static_cast<int32_t>(value.size())};
+}
+
+bool DataRowMessage::columnsEqual(size_t left_idx, size_t right_idx) const {
+  const ColumnSlot& left = columns_[left_idx];
+  const ColumnSlot& right = columns_[right_idx];
+
+  if (left.length_ < 0 || right.length_ < 0) {
+    return left.length_ < 0 && right.length_ < 0;
+  }
+
+  return left.length_ == right.length_ &&
+         memcmp(arena_.data() + left.offset_, arena_.data() + right.offset_, left.length_) == 0;
+}
+
+std::unique_ptr<QueryMessage> createQueryMessage(std::string query) {
+  return std::make_unique<QueryMessage>(String(std::move(query)));
+}
+
 std::unique_ptr<ReadyForQueryMessage> createReadyForQueryMessage() {
   return std::make_unique<ReadyForQueryMessage>(Byte1('I'));
 }
@@ -18,6 +242,36 @@ std::unique_ptr<ErrorResponseMessage> createErrorResponseMessage(std::string err
                                                 Byte1('\0'));
 }
 
+std::unique_ptr<CopyDataMessage> createCopyDataMessage(std::vector<uint8_t> data) {
+  auto message = std::make_unique<CopyDataMessage>();
+  message->data() = std::move(data);
+  return message;
+}
+
+std::unique_ptr<CopyFailMessage> createCopyFailMessage(std::string error) {
+  return std::make_unique<CopyFailMessage>(String(std::move(error)));
+}
+
+std::unique_ptr<DataRowMessage>
+createDataRowMessage(const std::vector<std::optional<std::string>>& columns) {
+  std::string body;
+  uint8_t be[sizeof(uint32_t)];
+  storeBE16(be, columns.size());
+  body.append(reinterpret_cast<const char*>(be), sizeof(uint16_t));
+
+  for (const auto& column : columns) {
+    storeBE32(be, column.has_value() ? column->size() : static_cast<uint32_t>(-1));
+    body.append(reinterpret_cast<const char*>(be), sizeof(uint32_t));
+    if (column.has_value()) {
+      body.append(*column);
+    }
+  }
+
+  auto message = std::make_unique<DataRowMessage>();
+  message->readBody(body);
+  return message;
+}
+
 } // namespace PostgresTDE
 } // namespace NetworkFilters
 } // namespace Extensions
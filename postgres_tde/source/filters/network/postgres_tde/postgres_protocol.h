@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include "postgres_tde/source/filters/network/postgres_tde/postgres_message.h"
 
 namespace Envoy {
@@ -51,14 +53,56 @@ public:
   }
 };
 
-class DataRowMessage: public TypedMessage<'D', Array<VarByteN>> {
+// DataRow uses a flat row layout instead of Array<VarByteN>: all column values live
+// in a single contiguous byte arena and each column is described by an (offset, length)
+// slot. As on the wire, negative length denotes NULL.
+class DataRowMessage : public Message {
 public:
-  // Inherit constructors
-  using TypedMessage::TypedMessage;
+  DataRowMessage() = default;
 
-  auto& columns() {
-    return value<0>().value();
+  bool read(const Buffer::Instance& data, const uint64_t length) override;
+  ValidationResult validate(const Buffer::Instance& data, const uint64_t start_pos,
+                            const uint64_t length) override;
+  std::string toString() const override;
+
+  bool isWriteable() const override { return true; }
+  void write(Buffer::Instance& to) const override;
+
+  size_t columnsCount() const { return columns_.size(); }
+  bool isNull(size_t idx) const { return columns_[idx].length_ < 0; }
+
+  absl::string_view column(size_t idx) const {
+    ASSERT(!isNull(idx));
+    return {reinterpret_cast<const char*>(arena_.data()) + columns_[idx].offset_,
+            static_cast<size_t>(columns_[idx].length_)};
   }
+
+  // Replaces column value. The new value is appended to the arena, old bytes are
+  // just left unreferenced and skipped by write().
+  void setColumn(size_t idx, absl::string_view value);
+  void setNull(size_t idx) { columns_[idx].length_ = -1; }
+
+  bool columnsEqual(size_t left_idx, size_t right_idx) const;
+
+  // Size of the message on the wire, including identifier and length fields.
+  uint64_t wireSize() const;
+
+  // Message body as on the wire, without identifier and length fields. Used to keep
+  // rows outside of memory, readBody expects the output of writeBody.
+  void writeBody(std::string& out) const;
+  void readBody(absl::string_view body);
+
+private:
+  // Builds the column slots over the message body in the arena
+  void indexColumns();
+
+  struct ColumnSlot {
+    uint32_t offset_;
+    int32_t length_;
+  };
+
+  std::vector<ColumnSlot> columns_;
+  std::vector<uint8_t> arena_;
 };
 
 using CommandCompleteMessage = TypedMessage<'C', String>;
@@ -67,8 +111,27 @@ using ErrorResponseMessage = TypedMessage<'E', Repeated<Sequence<Byte1, String>>
 
 using ReadyForQueryMessage = TypedMessage<'Z', Byte1>;
 
+class CopyDataMessage : public TypedMessage<'d', ByteN> {
+public:
+  // Inherit constructors
+  using TypedMessage::TypedMessage;
+
+  auto& data() {
+    return value<0>().value();
+  }
+};
+
+using CopyDoneMessage = TypedMessage<'c'>;
+using CopyFailMessage = TypedMessage<'f', String>;
+
+std::unique_ptr<QueryMessage> createQueryMessage(std::string query);
 std::unique_ptr<ReadyForQueryMessage> createReadyForQueryMessage();
 std::unique_ptr<ErrorResponseMessage> createErrorResponseMessage(std::string error);
+std::unique_ptr<CopyDataMessage> createCopyDataMessage(std::vector<uint8_t> data);
+std::unique_ptr<CopyFailMessage> createCopyFailMessage(std::string error);
+// Columns without value are NULL
+std::unique_ptr<DataRowMessage>
+createDataRowMessage(const std::vector<std::optional<std::string>>& columns);
 
 } // namespace PostgresTDE
 } // namespace NetworkFilters
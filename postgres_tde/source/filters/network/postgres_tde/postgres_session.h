@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <string>
 
 #include "source/common/common/logger.h"
 
@@ -14,8 +15,14 @@ public:
   bool inTransaction() { return in_transaction_; };
   void setInTransaction(bool in_transaction) { in_transaction_ = in_transaction; };
 
+  // Parameters of the startup message (user, database, options etc.) as received, the results
+  // of the same query are the same only for the sessions with the same parameters
+  const std::string& startupParameters() const { return startup_parameters_; }
+  void setStartupParameters(std::string parameters) { startup_parameters_ = std::move(parameters); }
+
 private:
   bool in_transaction_{false};
+  std::string startup_parameters_;
 };
 
 } // namespace PostgresTDE
@@ -0,0 +1,258 @@
+#include "postgres_tde/source/filters/network/postgres_tde/query_coalescer.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "envoy/event/dispatcher.h"
+
+#include "source/common/common/assert.h"
+
+#include "absl/strings/ascii.h"
+
+#include "postgres_tde/source/common/sqlutils/tokenizer.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Common::SQLUtils::Token;
+
+namespace {
+
+// Functions whose result depends on the arguments only, queries calling any other function
+// (now(), random(), nextval() etc.) are executed by each connection
+constexpr std::initializer_list<absl::string_view> STABLE_FUNCTIONS = {
+    "count", "sum",   "min",    "max",    "avg",       "abs",    "round",  "floor", "ceil",
+    "lower", "upper", "length", "substr", "substring", "concat", "trim",   "coalesce",
+    "nullif"};
+
+bool hasTable(const std::vector<std::string>& tables, absl::string_view table) {
+  return std::find(tables.begin(), tables.end(), table) != tables.end();
+}
+
+} // namespace
+
+QueryCoalescer::QueryCoalescer(TimeSource& time_source, std::chrono::milliseconds result_ttl,
+                               uint64_t max_result_size, uint64_t max_cache_size)
+    : time_source_(time_source), result_ttl_(result_ttl), max_result_size_(max_result_size),
+      max_cache_size_(max_cache_size) {}
+
+QueryCoalescer::Role QueryCoalescer::join(const std::string& key, std::vector<std::string> tables,
+                                          Waiter& waiter, ResultSharedPtr& result,
+                                          uint64_t& flight) {
+  purgeExpired();
+
+  auto result_it = results_.find(key);
+  if (result_it != results_.end()) {
+    result = result_it->second.result_;
+    return Role::Cached;
+  }
+
+  auto flight_it = current_flights_.find(key);
+  if (flight_it != current_flights_.end()) {
+    flight = flight_it->second;
+    flights_[flight].waiters_.push_back(&waiter);
+    return Role::Waiter;
+  }
+
+  flight = next_flight_++;
+  Flight& new_flight = flights_[flight];
+  new_flight.key_ = key;
+  new_flight.tables_ = std::move(tables);
+  current_flights_[key] = flight;
+  return Role::Leader;
+}
+
+void QueryCoalescer::complete(uint64_t flight, std::string result) {
+  auto it = flights_.find(flight);
+  if (it == flights_.end()) {
+    return;
+  }
+
+  ResultSharedPtr shared_result = std::make_shared<const std::string>(std::move(result));
+  Flight& completed = it->second;
+  if (!completed.stale_ && result_ttl_.count() > 0 && shared_result->size() <= max_cache_size_) {
+    auto result_it = results_.find(completed.key_);
+    if (result_it != results_.end()) {
+      dropResult(result_it);
+    }
+    evict(shared_result->size());
+    cached_size_ += shared_result->size();
+    expiration_queue_.emplace_back(completed.key_, flight);
+    results_[completed.key_] = CachedResult{flight, shared_result, completed.tables_,
+                                            time_source_.monotonicTime() + result_ttl_};
+  }
+
+  finish(flight, std::move(shared_result));
+}
+
+void QueryCoalescer::fail(uint64_t flight) { finish(flight, nullptr); }
+
+void QueryCoalescer::leave(uint64_t flight, Waiter& waiter) {
+  auto it = flights_.find(flight);
+  if (it == flights_.end()) {
+    return;
+  }
+
+  auto& waiters = it->second.waiters_;
+  waiters.erase(std::remove(waiters.begin(), waiters.end(), &waiter), waiters.end());
+}
+
+void QueryCoalescer::invalidate(absl::string_view table) {
+  for (auto it = results_.begin(); it != results_.end();) {
+    if (hasTable(it->second.tables_, table)) {
+      dropResult(it++);
+    } else {
+      it++;
+    }
+  }
+
+  // Queries already sent may or may not see the write, the connections sending them after
+  // the write mustn't get their results
+  for (auto& [id, flight] : flights_) {
+    if (!flight.stale_ && hasTable(flight.tables_, table)) {
+      flight.stale_ = true;
+      current_flights_.erase(flight.key_);
+    }
+  }
+}
+
+void QueryCoalescer::invalidateAll() {
+  results_.clear();
+  expiration_queue_.clear();
+  cached_size_ = 0;
+
+  for (auto& [id, flight] : flights_) {
+    flight.stale_ = true;
+  }
+  current_flights_.clear();
+}
+
+void QueryCoalescer::purgeExpired() {
+  const MonotonicTime now = time_source_.monotonicTime();
+  while (!expiration_queue_.empty()) {
+    auto it = results_.find(expiration_queue_.front().first);
+    if (it != results_.end() && it->second.flight_ == expiration_queue_.front().second) {
+      if (it->second.expires_at_ > now) {
+        return;
+      }
+      dropResult(it);
+    }
+    expiration_queue_.pop_front();
+  }
+}
+
+void QueryCoalescer::evict(size_t size) {
+  // Results expire in the order they are added, so the oldest ones are evicted first
+  while (cached_size_ + size > max_cache_size_ && !expiration_queue_.empty()) {
+    auto it = results_.find(expiration_queue_.front().first);
+    if (it != results_.end() && it->second.flight_ == expiration_queue_.front().second) {
+      dropResult(it);
+    }
+    expiration_queue_.pop_front();
+  }
+}
+
+void QueryCoalescer::dropResult(absl::flat_hash_map<std::string, CachedResult>::iterator it) {
+  ASSERT(cached_size_ >= it->second.result_->size());
+  cached_size_ -= it->second.result_->size();
+  results_.erase(it);
+}
+
+void QueryCoalescer::finish(uint64_t flight, ResultSharedPtr result) {
+  auto it = flights_.find(flight);
+  if (it == flights_.end()) {
+    return;
+  }
+
+  // Waiters may join and leave other flights while they are notified
+  Flight finished = std::move(it->second);
+  flights_.erase(it);
+  auto current_it = current_flights_.find(finished.key_);
+  if (current_it != current_flights_.end() && current_it->second == flight) {
+    current_flights_.erase(current_it);
+  }
+
+  ENVOY_LOG(debug, "query coalescing: flight {} {}, {} waiters", flight,
+            result != nullptr ? "completed" : "failed", finished.waiters_.size());
+  for (Waiter* waiter : finished.waiters_) {
+    waiter->onCoalescedResult(result);
+  }
+}
+
+Result CoalescingVisitor::visitQuery(hsql::SQLParserResult& query) {
+  read_tables_.clear();
+  written_tables_.clear();
+  coalescable_ = query.size() == 1 && query.getStatements()[0]->isType(hsql::kStmtSelect);
+
+  Result result = Visitor::visitQuery(query);
+  if (!result.isOk) {
+    coalescable_ = false;
+  }
+  return result;
+}
+
+bool CoalescingVisitor::isTransactionControl(absl::string_view query) {
+  std::vector<Token> tokens;
+  if (!Common::SQLUtils::tokenizeStatement(query, tokens) || tokens.empty()) {
+    return false;
+  }
+
+  for (absl::string_view word : {"begin", "start", "commit", "end", "rollback", "abort"}) {
+    if (tokens[0].isWord(word)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Result CoalescingVisitor::visitExpression(hsql::Expr* expr) {
+  if (expr->isType(hsql::kExprFunctionRef)) {
+    const std::string name = absl::AsciiStrToLower(expr->name);
+    if (std::find(STABLE_FUNCTIONS.begin(), STABLE_FUNCTIONS.end(), name) ==
+        STABLE_FUNCTIONS.end()) {
+      coalescable_ = false;
+    }
+  }
+
+  return Visitor::visitExpression(expr);
+}
+
+Result CoalescingVisitor::visitTableRef(hsql::TableRef* table_ref) {
+  if (table_ref->type == hsql::kTableName && !hasTable(read_tables_, table_ref->name)) {
+    read_tables_.emplace_back(table_ref->name);
+  }
+
+  return Visitor::visitTableRef(table_ref);
+}
+
+Result CoalescingVisitor::visitInsertStatement(hsql::InsertStatement* stmt) {
+  written_tables_.emplace_back(stmt->tableName);
+  return Visitor::visitInsertStatement(stmt);
+}
+
+Result CoalescingVisitor::visitUpdateStatement(hsql::UpdateStatement* stmt) {
+  written_tables_.emplace_back(stmt->table->name);
+  return Visitor::visitUpdateStatement(stmt);
+}
+
+Result CoalescingVisitor::visitDeleteStatement(hsql::DeleteStatement* stmt) {
+  written_tables_.emplace_back(stmt->tableName);
+  return Visitor::visitDeleteStatement(stmt);
+}
+
+QueryCoalescerProvider::QueryCoalescerProvider(ThreadLocal::SlotAllocator& tls,
+                                               std::chrono::milliseconds result_ttl,
+                                               uint64_t max_result_size, uint64_t max_cache_size)
+    : tls_(ThreadLocal::TypedSlot<QueryCoalescer>::makeUnique(tls)) {
+  tls_->set([result_ttl, max_result_size, max_cache_size](Event::Dispatcher& dispatcher) {
+    return std::make_shared<QueryCoalescer>(dispatcher.timeSource(), result_ttl, max_result_size,
+                                            max_cache_size);
+  });
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
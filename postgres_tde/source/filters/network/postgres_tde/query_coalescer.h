@@ -0,0 +1,170 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envoy/common/time.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+/**
+ * Single-flight execution of identical read-only queries of the connections of a worker
+ *
+ * The first connection sending a query becomes the leader and executes it, the connections
+ * sending the same query while it's in flight wait for the result of the leader instead of
+ * sending the query to the database. The result (the messages sent to the client up to
+ * CommandComplete) is kept for a short time after completion, so the queries arriving right
+ * after it are answered with it as well.
+ * Queries are identified by the startup parameters of the session and the rewritten query,
+ * so only the sessions of the same user, database and options share the results. Results are
+ * dropped as soon as a connection of the worker writes to their tables, writes of other
+ * workers or bypassing the proxy are seen once the result expires.
+ * If the leader fails (e.g. gets an error or the result is too large to share), the waiters
+ * execute the query themselves.
+ * Not thread safe, each worker has its own instance.
+ */
+class QueryCoalescer : public ThreadLocal::ThreadLocalObject,
+                       Logger::Loggable<Logger::Id::filter> {
+public:
+  using ResultSharedPtr = std::shared_ptr<const std::string>;
+
+  class Waiter {
+  public:
+    virtual ~Waiter() = default;
+
+    // Called with the result of the leader, or nullptr if the waiter has to execute the query
+    virtual void onCoalescedResult(ResultSharedPtr result) PURE;
+  };
+
+  enum class Role {
+    // The result is already known
+    Cached,
+    // The query is executed by another connection, the result is passed to the waiter
+    Waiter,
+    // The query has to be executed, its result is passed to complete() or fail()
+    Leader,
+  };
+
+  QueryCoalescer(TimeSource& time_source, std::chrono::milliseconds result_ttl,
+                 uint64_t max_result_size, uint64_t max_cache_size);
+
+  // Joins the flight of the query. The result is set for Cached, the flight is set for Waiter
+  // and Leader
+  Role join(const std::string& key, std::vector<std::string> tables, Waiter& waiter,
+            ResultSharedPtr& result, uint64_t& flight);
+  void complete(uint64_t flight, std::string result);
+  void fail(uint64_t flight);
+  // The waiter is gone, e.g. its connection is closed
+  void leave(uint64_t flight, Waiter& waiter);
+
+  // Drops the results over the table, the flights in progress are not shared anymore
+  void invalidate(absl::string_view table);
+  void invalidateAll();
+
+  // Larger results are not shared, the leader fails once its result exceeds the size
+  uint64_t maxResultSize() const { return max_result_size_; }
+
+private:
+  struct Flight {
+    std::string key_;
+    std::vector<std::string> tables_;
+    std::vector<Waiter*> waiters_;
+    // Tables of the query were written while it was in flight, so the result isn't kept
+    bool stale_{false};
+  };
+
+  struct CachedResult {
+    uint64_t flight_;
+    ResultSharedPtr result_;
+    std::vector<std::string> tables_;
+    MonotonicTime expires_at_;
+  };
+
+  void purgeExpired();
+  void evict(size_t size);
+  void dropResult(absl::flat_hash_map<std::string, CachedResult>::iterator it);
+  void finish(uint64_t flight, ResultSharedPtr result);
+
+  TimeSource& time_source_;
+  const std::chrono::milliseconds result_ttl_;
+  const uint64_t max_result_size_;
+  const uint64_t max_cache_size_;
+
+  uint64_t next_flight_{1};
+  absl::flat_hash_map<uint64_t, Flight> flights_;
+  // Flight of each query which can still be joined
+  absl::flat_hash_map<std::string, uint64_t> current_flights_;
+
+  absl::flat_hash_map<std::string, CachedResult> results_;
+  // Keys and flights of the results in the order of expiration, invalidated results are skipped
+  std::deque<std::pair<std::string, uint64_t>> expiration_queue_;
+  uint64_t cached_size_{0};
+};
+
+/**
+ * Tables of a query as far as coalescing is concerned
+ *
+ * A query can be coalesced if it's a single SELECT calling only the functions known to be
+ * stable. Tables written by INSERT, UPDATE and DELETE are collected to drop the results over them.
+ */
+class CoalescingVisitor : public Common::SQLUtils::Visitor {
+public:
+  Result visitQuery(hsql::SQLParserResult& query) override;
+
+  bool coalescable() const { return coalescable_; }
+  std::vector<std::string>& readTables() { return read_tables_; }
+  std::vector<std::string>& writtenTables() { return written_tables_; }
+
+  // Transaction control statements, which are not supported by the SQL parser
+  static bool isTransactionControl(absl::string_view query);
+
+protected:
+  Result visitExpression(hsql::Expr* expr) override;
+  Result visitTableRef(hsql::TableRef* table_ref) override;
+  Result visitInsertStatement(hsql::InsertStatement* stmt) override;
+  Result visitUpdateStatement(hsql::UpdateStatement* stmt) override;
+  Result visitDeleteStatement(hsql::DeleteStatement* stmt) override;
+
+protected:
+  bool coalescable_{false};
+  std::vector<std::string> read_tables_;
+  std::vector<std::string> written_tables_;
+};
+
+/**
+ * Per-worker instances of the query coalescer
+ */
+class QueryCoalescerProvider {
+public:
+  QueryCoalescerProvider(ThreadLocal::SlotAllocator& tls, std::chrono::milliseconds result_ttl,
+                         uint64_t max_result_size, uint64_t max_cache_size);
+
+  // Instance of the calling worker
+  QueryCoalescer& get() const { return **tls_; }
+
+private:
+  ThreadLocal::TypedSlotPtr<QueryCoalescer> tls_;
+};
+
+using QueryCoalescerProviderSharedPtr = std::shared_ptr<QueryCoalescerProvider>;
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,377 @@
+#include "postgres_tde/source/filters/network/postgres_tde/result_aggregator.h"
+
+#include <cmath>
+
+#include "source/common/common/assert.h"
+#include "source/common/common/fmt.h"
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_sorter.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Digits after the decimal point of AVG over integers, as Postgres gives for small averages
+constexpr int AVG_SCALE = 16;
+
+bool isIntegerType(int32_t data_type) {
+  return data_type == INT2OID || data_type == INT4OID || data_type == INT8OID;
+}
+
+bool isFloatType(int32_t data_type) {
+  return data_type == FLOAT4OID || data_type == FLOAT8OID;
+}
+
+std::string int128ToString(absl::int128 value) {
+  bool negative = value < 0;
+  // Negated as unsigned, so that the minimum value doesn't overflow
+  absl::uint128 magnitude =
+      negative ? absl::uint128(0) - static_cast<absl::uint128>(value) : absl::uint128(value);
+
+  std::string out;
+  do {
+    out.push_back(static_cast<char>('0' + static_cast<int>(magnitude % 10)));
+    magnitude /= 10;
+  } while (magnitude != 0);
+
+  if (negative) {
+    out.push_back('-');
+  }
+  return std::string(out.rbegin(), out.rend());
+}
+
+std::string floatToString(double value) {
+  // Text format of Postgres for the special values
+  if (std::isnan(value)) {
+    return "NaN";
+  }
+  if (std::isinf(value)) {
+    return value > 0 ? "Infinity" : "-Infinity";
+  }
+  return fmt::format("{}", value);
+}
+
+// sum / count rounded half away from zero to AVG_SCALE digits
+std::string averageToString(absl::int128 sum, uint64_t count) {
+  bool negative = sum < 0;
+  absl::uint128 magnitude =
+      negative ? absl::uint128(0) - static_cast<absl::uint128>(sum) : absl::uint128(sum);
+
+  absl::uint128 integer_part = magnitude / count;
+  absl::uint128 remainder = magnitude % count;
+
+  std::string fraction;
+  for (int i = 0; i < AVG_SCALE; i++) {
+    remainder *= 10;
+    fraction.push_back(static_cast<char>('0' + static_cast<int>(remainder / count)));
+    remainder %= count;
+  }
+
+  if (remainder * 2 >= count) {
+    // Carry the rounding through the fraction into the integer part
+    int i = AVG_SCALE - 1;
+    for (; i >= 0 && fraction[i] == '9'; i--) {
+      fraction[i] = '0';
+    }
+    if (i >= 0) {
+      fraction[i]++;
+    } else {
+      integer_part += 1;
+    }
+  }
+
+  std::string out = int128ToString(static_cast<absl::int128>(integer_part));
+  if (negative && (integer_part != 0 || fraction.find_first_not_of('0') != std::string::npos)) {
+    out.insert(0, "-");
+  }
+  return absl::StrCat(out, ".", fraction);
+}
+
+} // namespace
+
+ResultAggregator::ResultAggregator(uint64_t memory_limit) : memory_limit_(memory_limit) {}
+
+Result ResultAggregator::resultType(ResultPlan::AggregateFunction function, int32_t data_type,
+                                    int32_t& result_type) {
+  switch (function) {
+  case ResultPlan::AggregateFunction::Count:
+  case ResultPlan::AggregateFunction::CountRows:
+    result_type = INT8OID;
+    return Result::ok;
+  case ResultPlan::AggregateFunction::Min:
+  case ResultPlan::AggregateFunction::Max:
+    if (ResultSorter::isSortableType(data_type)) {
+      result_type = data_type;
+      return Result::ok;
+    }
+    break;
+  case ResultPlan::AggregateFunction::Sum:
+    if (data_type == INT2OID || data_type == INT4OID) {
+      result_type = INT8OID;
+      return Result::ok;
+    }
+    if (data_type == INT8OID) {
+      result_type = NUMERICOID;
+      return Result::ok;
+    }
+    if (isFloatType(data_type)) {
+      result_type = data_type;
+      return Result::ok;
+    }
+    break;
+  case ResultPlan::AggregateFunction::Avg:
+    if (isIntegerType(data_type)) {
+      result_type = NUMERICOID;
+      return Result::ok;
+    }
+    if (isFloatType(data_type)) {
+      result_type = FLOAT8OID;
+      return Result::ok;
+    }
+    break;
+  }
+
+  return Result::makeError(fmt::format(
+      "postgres_tde: aggregate over column of type {} can't be computed by the proxy", data_type));
+}
+
+void ResultAggregator::start(const ResultPlan& plan) {
+  ASSERT(plan.aggregated());
+  clear();
+
+  active_ = true;
+  group_keys_ = plan.groupKeys();
+  aggregates_ = plan.aggregates();
+  output_columns_ = plan.outputColumns();
+
+  rows_count_ = 0;
+  groups_count_ = 0;
+}
+
+void ResultAggregator::clear() {
+  active_ = false;
+  group_keys_.clear();
+  aggregates_.clear();
+  output_columns_.clear();
+  groups_.clear();
+  group_index_.clear();
+  memory_used_ = 0;
+}
+
+Result ResultAggregator::add(const DataRowMessage& row) {
+  ASSERT(active_);
+
+  Group* group;
+  CHECK_RESULT(findGroup(row, group));
+
+  for (size_t i = 0; i < aggregates_.size(); i++) {
+    const ResultPlan::Aggregate& aggregate = aggregates_[i];
+    if (aggregate.function_ == ResultPlan::AggregateFunction::CountRows) {
+      group->states_[i].count_++;
+      continue;
+    }
+
+    // NULLs are ignored by the rest of the aggregates
+    if (row.isNull(aggregate.column_idx_)) {
+      continue;
+    }
+
+    CHECK_RESULT(accumulate(aggregate, row.column(aggregate.column_idx_), group->states_[i]));
+  }
+
+  if (memory_used_ > memory_limit_) {
+    return Result::makeError(
+        "postgres_tde: aggregated result exceeds the memory limit of the proxy");
+  }
+
+  rows_count_++;
+  return Result::ok;
+}
+
+Result ResultAggregator::findGroup(const DataRowMessage& row, Group*& group) {
+  // Values of the keys, each prefixed with its length, NULL is distinct from any value
+  group_key_.clear();
+  for (size_t column_idx : group_keys_) {
+    if (row.isNull(column_idx)) {
+      group_key_.push_back('\x01');
+      continue;
+    }
+
+    absl::string_view value = row.column(column_idx);
+    uint32_t size = value.size();
+    group_key_.push_back('\x00');
+    group_key_.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    group_key_.append(value.data(), value.size());
+  }
+
+  auto it = group_index_.find(group_key_);
+  if (it != group_index_.end()) {
+    group = &groups_[it->second];
+    return Result::ok;
+  }
+
+  Group new_group;
+  for (size_t column_idx : group_keys_) {
+    if (row.isNull(column_idx)) {
+      new_group.key_values_.emplace_back();
+    } else {
+      new_group.key_values_.emplace_back(std::string(row.column(column_idx)));
+    }
+  }
+  new_group.states_.resize(aggregates_.size());
+
+  // Key is stored twice, in the index and in the group
+  memory_used_ += 2 * group_key_.size() + sizeof(Group) +
+                  aggregates_.size() * sizeof(AggregateState);
+  if (memory_used_ > memory_limit_) {
+    return Result::makeError(
+        "postgres_tde: aggregated result exceeds the memory limit of the proxy");
+  }
+
+  group_index_.emplace(group_key_, groups_.size());
+  groups_.push_back(std::move(new_group));
+  group = &groups_.back();
+  return Result::ok;
+}
+
+Result ResultAggregator::accumulate(const ResultPlan::Aggregate& aggregate,
+                                    absl::string_view value, AggregateState& state) {
+  if (aggregate.distinct_) {
+    // Only COUNT(DISTINCT) is supported, duplicates are just not counted
+    auto [_, inserted] = state.distinct_values_.emplace(value);
+    if (!inserted) {
+      return Result::ok;
+    }
+    memory_used_ += value.size() + sizeof(std::string);
+  }
+
+  switch (aggregate.function_) {
+  case ResultPlan::AggregateFunction::Count:
+  case ResultPlan::AggregateFunction::CountRows:
+    break;
+  case ResultPlan::AggregateFunction::Min:
+  case ResultPlan::AggregateFunction::Max: {
+    bool is_min = aggregate.function_ == ResultPlan::AggregateFunction::Min;
+    bool replace = state.count_ == 0;
+    uint64_t ordinal = 0;
+    if (OrderedValue::isSupportedType(aggregate.data_type_)) {
+      OrderedValue ordered_value;
+      if (!OrderedValue::fromText(aggregate.data_type_, value, ordered_value)) {
+        return Result::makeError(fmt::format(
+            "postgres_tde: unable to aggregate column {}", aggregate.column_idx_ + 1));
+      }
+      ordinal = ordered_value.ordinal();
+      replace = replace || (is_min ? ordinal < state.ordinal_ : ordinal > state.ordinal_);
+    } else {
+      // Byte-wise, as the text is sorted by the proxy
+      replace = replace || (is_min ? value < state.value_ : value > state.value_);
+    }
+
+    if (replace) {
+      memory_used_ += value.size() - state.value_.size();
+      state.value_.assign(value.data(), value.size());
+      state.ordinal_ = ordinal;
+    }
+    break;
+  }
+  case ResultPlan::AggregateFunction::Sum:
+  case ResultPlan::AggregateFunction::Avg:
+    if (isIntegerType(aggregate.data_type_)) {
+      int64_t int_value;
+      if (!absl::SimpleAtoi(value, &int_value)) {
+        return Result::makeError(fmt::format(
+            "postgres_tde: unable to aggregate column {}", aggregate.column_idx_ + 1));
+      }
+      state.int_sum_ += int_value;
+    } else {
+      double float_value;
+      if (!absl::SimpleAtod(value, &float_value)) {
+        return Result::makeError(fmt::format(
+            "postgres_tde: unable to aggregate column {}", aggregate.column_idx_ + 1));
+      }
+      state.float_sum_ += float_value;
+    }
+    break;
+  }
+
+  state.count_++;
+  return Result::ok;
+}
+
+std::optional<std::string> ResultAggregator::aggregateValue(const ResultPlan::Aggregate& aggregate,
+                                                            const AggregateState& state) const {
+  if (aggregate.function_ == ResultPlan::AggregateFunction::Count ||
+      aggregate.function_ == ResultPlan::AggregateFunction::CountRows) {
+    return std::to_string(state.count_);
+  }
+
+  // Aggregates of no values are NULL
+  if (state.count_ == 0) {
+    return std::nullopt;
+  }
+
+  switch (aggregate.function_) {
+  case ResultPlan::AggregateFunction::Min:
+  case ResultPlan::AggregateFunction::Max:
+    return state.value_;
+  case ResultPlan::AggregateFunction::Sum:
+    if (isIntegerType(aggregate.data_type_)) {
+      return int128ToString(state.int_sum_);
+    }
+    if (aggregate.data_type_ == FLOAT4OID) {
+      return floatToString(static_cast<float>(state.float_sum_));
+    }
+    return floatToString(state.float_sum_);
+  case ResultPlan::AggregateFunction::Avg:
+    if (isIntegerType(aggregate.data_type_)) {
+      return averageToString(state.int_sum_, state.count_);
+    }
+    return floatToString(state.float_sum_ / state.count_);
+  case ResultPlan::AggregateFunction::Count:
+  case ResultPlan::AggregateFunction::CountRows:
+    break;
+  }
+
+  PANIC_DUE_TO_CORRUPT_ENUM;
+}
+
+Result ResultAggregator::finish(const RowCallback& callback) {
+  ASSERT(active_);
+
+  if (group_keys_.empty() && groups_.empty()) {
+    // Aggregates without GROUP BY always give a row
+    groups_.emplace_back();
+    groups_.back().states_.resize(aggregates_.size());
+  }
+
+  std::vector<std::optional<std::string>> columns(output_columns_.size());
+  for (const Group& group : groups_) {
+    for (size_t i = 0; i < output_columns_.size(); i++) {
+      const ResultPlan::OutputColumn& column = output_columns_[i];
+      columns[i] = column.aggregate_
+                       ? aggregateValue(aggregates_[column.idx_], group.states_[column.idx_])
+                       : group.key_values_[column.idx_];
+    }
+
+    callback(createDataRowMessage(columns));
+  }
+
+  groups_count_ = groups_.size();
+  ENVOY_LOG(debug, "aggregated result: {} rows into {} groups", rows_count_, groups_count_);
+  clear();
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/numeric/int128.h"
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/utils/utils.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+/**
+ * Computes aggregates the database can't compute over the encrypted values
+ *
+ * Rows are consumed as they arrive and only the state of each group is kept, so the memory
+ * depends on the number of groups (and the distinct values of COUNT(DISTINCT)), not on the
+ * number of rows. Groups are keyed by the decrypted values of the group keys and are emitted
+ * in the order they first appear in the result. Without group keys the result is a single row,
+ * even if there are no rows to aggregate.
+ * MIN and MAX compare the values in the same way as ResultSorter, SUM and AVG follow the result
+ * types of Postgres: integers are summed exactly, AVG of integers is a numeric with 16 digits
+ * after the decimal point.
+ * Not thread safe.
+ */
+class ResultAggregator : public Logger::Loggable<Logger::Id::filter> {
+public:
+  using RowCallback = std::function<void(std::unique_ptr<DataRowMessage>)>;
+
+  explicit ResultAggregator(uint64_t memory_limit);
+
+  // Type of the aggregate over the column of the given type, as reported by Postgres
+  static Result resultType(ResultPlan::AggregateFunction function, int32_t data_type,
+                           int32_t& result_type);
+
+  // Starts aggregation of a new result described by the plan
+  void start(const ResultPlan& plan);
+  void clear();
+  bool active() const { return active_; }
+
+  Result add(const DataRowMessage& row);
+
+  // Passes the aggregated rows to the callback and clears the aggregator
+  Result finish(const RowCallback& callback);
+
+  // Stats of the last aggregated result
+  uint64_t rowsCount() const { return rows_count_; }
+  uint64_t groupsCount() const { return groups_count_; }
+
+private:
+  struct AggregateState {
+    uint64_t count_{0};
+    // MIN and MAX: the current value and its ordinal if the type is supported by OrderedValue
+    std::string value_;
+    uint64_t ordinal_{0};
+    // SUM and AVG
+    absl::int128 int_sum_{0};
+    double float_sum_{0};
+    // COUNT(DISTINCT)
+    absl::flat_hash_set<std::string> distinct_values_;
+  };
+
+  struct Group {
+    std::vector<std::optional<std::string>> key_values_;
+    std::vector<AggregateState> states_;
+  };
+
+  Result findGroup(const DataRowMessage& row, Group*& group);
+  Result accumulate(const ResultPlan::Aggregate& aggregate, absl::string_view value,
+                    AggregateState& state);
+  std::optional<std::string> aggregateValue(const ResultPlan::Aggregate& aggregate,
+                                            const AggregateState& state) const;
+
+  const uint64_t memory_limit_;
+
+  bool active_{false};
+  std::vector<size_t> group_keys_;
+  std::vector<ResultPlan::Aggregate> aggregates_;
+  std::vector<ResultPlan::OutputColumn> output_columns_;
+
+  std::vector<Group> groups_;
+  absl::flat_hash_map<std::string, size_t> group_index_;
+  uint64_t memory_used_{0};
+
+  uint64_t rows_count_{0};
+  uint64_t groups_count_{0};
+
+  // Scratch buffer reused between rows
+  std::string group_key_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
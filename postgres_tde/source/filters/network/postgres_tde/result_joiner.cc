@@ -0,0 +1,239 @@
+#include "postgres_tde/source/filters/network/postgres_tde/result_joiner.h"
+
+#include "absl/hash/hash.h"
+#include "source/common/common/assert.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Partitions the sides are spilled to, a partition has to fit in memory to be joined
+constexpr size_t PARTITIONS_COUNT = 32;
+
+size_t partitionOf(absl::string_view key) {
+  return absl::Hash<absl::string_view>{}(key) % PARTITIONS_COUNT;
+}
+
+} // namespace
+
+ResultJoiner::ResultJoiner(uint64_t memory_limit, std::string spill_directory,
+                           uint64_t max_spill_size)
+    : memory_limit_(memory_limit), spill_directory_(std::move(spill_directory)),
+      max_spill_size_(max_spill_size) {}
+
+void ResultJoiner::startBuild(const ResultPlan& plan) {
+  ASSERT(plan.joinSide() == ResultPlan::JoinSide::Build);
+  clear();
+
+  state_ = State::Building;
+  build_key_idx_ = plan.joinKeyColumn();
+  rows_count_ = 0;
+  spilled_partitions_ = 0;
+}
+
+void ResultJoiner::startProbe(const ResultPlan& plan) {
+  ASSERT(state_ == State::Building && plan.joinSide() == ResultPlan::JoinSide::Probe);
+
+  state_ = State::Probing;
+  probe_key_idx_ = plan.joinKeyColumn();
+  output_columns_ = plan.joinOutputColumns();
+}
+
+void ResultJoiner::clear() {
+  state_ = State::Idle;
+  build_key_idx_ = 0;
+  probe_key_idx_ = 0;
+  output_columns_.clear();
+  table_.clear();
+  memory_used_ = 0;
+  partitions_.clear();
+  spill_size_ = 0;
+  encryption_ctx_.reset();
+  decryption_ctx_.reset();
+}
+
+Result ResultJoiner::addBuildRow(std::unique_ptr<DataRowMessage> row) {
+  ASSERT(state_ == State::Building);
+  if (row->isNull(build_key_idx_)) {
+    return Result::ok;
+  }
+
+  if (!partitions_.empty()) {
+    return spillRow(*row, true);
+  }
+
+  addToTable(std::move(row));
+  if (memory_used_ > memory_limit_) {
+    ENVOY_LOG(debug, "build side of the join exceeds the memory limit, spilling {} partitions",
+              PARTITIONS_COUNT);
+    CHECK_RESULT(spillTable());
+  }
+
+  return Result::ok;
+}
+
+Result ResultJoiner::probe(const DataRowMessage& row, const RowCallback& callback) {
+  ASSERT(state_ == State::Probing);
+  if (row.isNull(probe_key_idx_)) {
+    return Result::ok;
+  }
+
+  if (!partitions_.empty()) {
+    return spillRow(row, false);
+  }
+
+  auto it = table_.find(row.column(probe_key_idx_));
+  if (it == table_.end()) {
+    return Result::ok;
+  }
+
+  for (const auto& build_row : it->second) {
+    emitJoined(*build_row, row, callback);
+  }
+
+  return Result::ok;
+}
+
+Result ResultJoiner::finish(const RowCallback& callback) {
+  ASSERT(state_ == State::Probing);
+
+  for (Partition& partition : partitions_) {
+    CHECK_RESULT(joinPartition(partition, callback));
+  }
+
+  ENVOY_LOG(debug, "joined result: {} rows, {} partitions spilled", rows_count_,
+            spilled_partitions_);
+  clear();
+  return Result::ok;
+}
+
+void ResultJoiner::addToTable(std::unique_ptr<DataRowMessage> row) {
+  absl::string_view key = row->column(build_key_idx_);
+  memory_used_ += key.size() + row->wireSize();
+  table_[key].push_back(std::move(row));
+}
+
+Result ResultJoiner::spillTable() {
+  auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+  std::vector<uint8_t> key = crypto_util_ext.GenerateAESKey();
+  encryption_ctx_ = crypto_util_ext.createAESEncryptionContext(key);
+  decryption_ctx_ = crypto_util_ext.createAESDecryptionContext(key);
+
+  partitions_.resize(PARTITIONS_COUNT);
+  for (Partition& partition : partitions_) {
+    CHECK_RESULT(SpillFile::create(spill_directory_, "join", partition.build_));
+    CHECK_RESULT(SpillFile::create(spill_directory_, "join", partition.probe_));
+  }
+  spilled_partitions_ = PARTITIONS_COUNT;
+
+  for (const auto& [_, rows] : table_) {
+    for (const auto& row : rows) {
+      CHECK_RESULT(spillRow(*row, true));
+    }
+  }
+
+  table_.clear();
+  memory_used_ = 0;
+  return Result::ok;
+}
+
+Result ResultJoiner::spillRow(const DataRowMessage& row, bool build_side) {
+  Partition& partition =
+      partitions_[partitionOf(row.column(build_side ? build_key_idx_ : probe_key_idx_))];
+
+  record_.clear();
+  row.writeBody(record_);
+  SpillFile& file = build_side ? *partition.build_ : *partition.probe_;
+  uint64_t size = file.size();
+  CHECK_RESULT(file.write(*encryption_ctx_, record_));
+
+  spill_size_ += file.size() - size;
+  if (spill_size_ > max_spill_size_) {
+    return Result::makeError("postgres_tde: result is too large to be joined by the proxy");
+  }
+
+  return Result::ok;
+}
+
+Result ResultJoiner::readRow(SpillFile& file, std::unique_ptr<DataRowMessage>& row) {
+  bool has_row;
+  CHECK_RESULT(file.read(*decryption_ctx_, decrypted_data_, has_row));
+  if (!has_row) {
+    row.reset();
+    return Result::ok;
+  }
+
+  row = std::make_unique<DataRowMessage>();
+  row->readBody(absl::string_view(reinterpret_cast<const char*>(decrypted_data_.data()),
+                                  decrypted_data_.size()));
+  return Result::ok;
+}
+
+Result ResultJoiner::joinPartition(Partition& partition, const RowCallback& callback) {
+  CHECK_RESULT(partition.build_->flush());
+  CHECK_RESULT(partition.probe_->flush());
+  partition.build_->rewind();
+  partition.probe_->rewind();
+
+  std::unique_ptr<DataRowMessage> row;
+  while (true) {
+    CHECK_RESULT(readRow(*partition.build_, row));
+    if (row == nullptr) {
+      break;
+    }
+
+    addToTable(std::move(row));
+    if (memory_used_ > memory_limit_) {
+      return Result::makeError(
+          "postgres_tde: too many rows with the same join value, unable to join the result "
+          "within the memory limit");
+    }
+  }
+
+  while (true) {
+    CHECK_RESULT(readRow(*partition.probe_, row));
+    if (row == nullptr) {
+      break;
+    }
+
+    auto it = table_.find(row->column(probe_key_idx_));
+    if (it == table_.end()) {
+      continue;
+    }
+
+    for (const auto& build_row : it->second) {
+      emitJoined(*build_row, *row, callback);
+    }
+  }
+
+  table_.clear();
+  memory_used_ = 0;
+  return Result::ok;
+}
+
+void ResultJoiner::emitJoined(const DataRowMessage& build_row, const DataRowMessage& probe_row,
+                              const RowCallback& callback) {
+  values_.resize(output_columns_.size());
+  for (size_t i = 0; i < output_columns_.size(); i++) {
+    const ResultPlan::JoinOutputColumn& column = output_columns_[i];
+    const DataRowMessage& row = column.build_side_ ? build_row : probe_row;
+    if (row.isNull(column.column_idx_)) {
+      values_[i].reset();
+    } else {
+      values_[i].emplace(row.column(column.column_idx_));
+    }
+  }
+
+  callback(createDataRowMessage(values_));
+  rows_count_++;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
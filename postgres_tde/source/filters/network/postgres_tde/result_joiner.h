@@ -0,0 +1,120 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/common/utils/utils.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+#include "postgres_tde/source/filters/network/postgres_tde/spill_file.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+/**
+ * Joins two results of a query by the decrypted values of their key columns, for equi-joins
+ * the database can't do over the encrypted values
+ *
+ * The rows of the build side are kept in a hash table by the key, the rows of the probe side
+ * are matched against it as they arrive, so only the build side takes memory. Rows with NULL
+ * keys never match, as in the inner join of Postgres.
+ * Once the build side exceeds the memory limit, both sides are partitioned by the hash of the
+ * key and spilled to disk, and the partitions are joined one by one once the probe side is
+ * complete. A partition exceeding the limit on its own fails the join, as does a join whose
+ * partitions exceed the max spill size on disk. Spilled rows are encrypted with a key generated
+ * for the join, so the decrypted values never reach the disk.
+ * Not thread safe.
+ */
+class ResultJoiner : public Logger::Loggable<Logger::Id::filter> {
+public:
+  using RowCallback = std::function<void(std::unique_ptr<DataRowMessage>)>;
+
+  ResultJoiner(uint64_t memory_limit, std::string spill_directory, uint64_t max_spill_size);
+
+  // Starts a new join with the build side described by the plan
+  void startBuild(const ResultPlan& plan);
+  Result addBuildRow(std::unique_ptr<DataRowMessage> row);
+
+  // Switches to the probe side described by the plan, which also defines the joined rows
+  void startProbe(const ResultPlan& plan);
+  // Passes the joined rows to the callback, unless the sides are spilled
+  Result probe(const DataRowMessage& row, const RowCallback& callback);
+
+  // Joins the spilled partitions, if any, and clears the joiner
+  Result finish(const RowCallback& callback);
+  void clear();
+
+  bool building() const { return state_ == State::Building; }
+  bool probing() const { return state_ == State::Probing; }
+
+  // Stats of the last joined result
+  uint64_t rowsCount() const { return rows_count_; }
+  uint64_t spilledPartitions() const { return spilled_partitions_; }
+
+private:
+  enum class State {
+    Idle,
+    Building,
+    Probing,
+  };
+
+  using BuildTable =
+      absl::flat_hash_map<std::string, std::vector<std::unique_ptr<DataRowMessage>>>;
+
+  // Rows of both sides with the keys of the same hash
+  struct Partition {
+    SpillFilePtr build_;
+    SpillFilePtr probe_;
+  };
+
+  void addToTable(std::unique_ptr<DataRowMessage> row);
+  Result spillTable();
+  Result spillRow(const DataRowMessage& row, bool build_side);
+  Result readRow(SpillFile& file, std::unique_ptr<DataRowMessage>& row);
+  Result joinPartition(Partition& partition, const RowCallback& callback);
+  void emitJoined(const DataRowMessage& build_row, const DataRowMessage& probe_row,
+                  const RowCallback& callback);
+
+  const uint64_t memory_limit_;
+  const std::string spill_directory_;
+  const uint64_t max_spill_size_;
+
+  State state_{State::Idle};
+  size_t build_key_idx_{0};
+  size_t probe_key_idx_{0};
+  std::vector<ResultPlan::JoinOutputColumn> output_columns_;
+
+  BuildTable table_;
+  uint64_t memory_used_{0};
+  // Not empty once the sides are spilled
+  std::vector<Partition> partitions_;
+  // Bytes taken by the partitions on disk
+  uint64_t spill_size_{0};
+  // Generated for each join on the first spill
+  Common::Crypto::AESEncryptionContextPtr encryption_ctx_;
+  Common::Crypto::AESDecryptionContextPtr decryption_ctx_;
+
+  uint64_t rows_count_{0};
+  uint64_t spilled_partitions_{0};
+
+  // Scratch buffers reused between rows
+  std::string record_;
+  std::vector<uint8_t> decrypted_data_;
+  std::vector<std::optional<std::string>> values_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
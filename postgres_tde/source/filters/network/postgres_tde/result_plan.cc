@@ -0,0 +1,334 @@
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+
+#include <algorithm>
+
+#include "source/common/common/assert.h"
+#include "source/common/common/fmt.h"
+
+#include "absl/container/flat_hash_set.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+constexpr size_t AES_BLOCK_SIZE = 16;
+
+inline int hexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Decodes Postgres bytea hex output ("\x0123...") without intermediate allocations
+bool decodeByteaHex(absl::string_view hex, std::vector<uint8_t>& out) {
+  if (hex.size() < 2 || hex[0] != '\\' || hex[1] != 'x' || hex.size() % 2 != 0) {
+    return false;
+  }
+  hex.remove_prefix(2);
+
+  out.resize(hex.size() / 2);
+  for (size_t i = 0; i < out.size(); i++) {
+    int high = hexDigitValue(hex[2 * i]);
+    int low = hexDigitValue(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    out[i] = static_cast<uint8_t>((high << 4) | low);
+  }
+
+  return true;
+}
+
+} // namespace
+
+void ResultPlan::clear() {
+  filter_actions_.clear();
+  join_checks_.clear();
+  range_checks_.clear();
+  pattern_checks_.clear();
+  actions_.clear();
+  sort_keys_.clear();
+  limit_ = NO_LIMIT;
+  offset_ = 0;
+  group_keys_.clear();
+  aggregates_.clear();
+  output_columns_.clear();
+  join_side_ = JoinSide::None;
+  join_key_column_idx_ = 0;
+  join_output_columns_.clear();
+  join_limit_.reset();
+  decryption_contexts_.clear();
+}
+
+void ResultPlan::addDecryption(size_t column_idx, const ColumnConfig* config) {
+  ASSERT(config != nullptr && config->isEncrypted());
+
+  actions_.push_back(ColumnAction{column_idx, Action::Decrypt, config,
+                                  getDecryptionContext(config, config->encryptionKeyVersion())});
+}
+
+void ResultPlan::addHomomorphicSumDecryption(size_t column_idx, const ColumnConfig* config) {
+  ASSERT(config != nullptr && config->hasHomomorphicSum());
+
+  actions_.push_back(ColumnAction{column_idx, Action::DecryptHomomorphicSum, config, nullptr,
+                                  &config->homomorphicContext()});
+}
+
+void ResultPlan::addJoinCheck(size_t left_column_idx, size_t right_column_idx,
+                              const JoinStats& stats) {
+  join_checks_.push_back(JoinCheck{left_column_idx, right_column_idx, stats});
+}
+
+void ResultPlan::addRangeCheck(const RangeCheck& check) { range_checks_.push_back(check); }
+
+void ResultPlan::addPatternCheck(const PatternCheck& check) { pattern_checks_.push_back(check); }
+
+void ResultPlan::addSortKey(const SortKey& key) { sort_keys_.push_back(key); }
+
+void ResultPlan::setRowLimit(uint64_t limit, uint64_t offset) {
+  limit_ = limit;
+  offset_ = offset;
+}
+
+void ResultPlan::addGroupKey(size_t column_idx) { group_keys_.push_back(column_idx); }
+
+void ResultPlan::addAggregate(const Aggregate& aggregate) { aggregates_.push_back(aggregate); }
+
+void ResultPlan::addOutputColumn(const OutputColumn& column) { output_columns_.push_back(column); }
+
+void ResultPlan::setJoinSide(JoinSide side, size_t key_column_idx) {
+  join_side_ = side;
+  join_key_column_idx_ = key_column_idx;
+}
+
+void ResultPlan::addJoinOutputColumn(const JoinOutputColumn& column) {
+  ASSERT(join_side_ == JoinSide::Probe);
+  join_output_columns_.push_back(column);
+}
+
+void ResultPlan::setJoinLimit(uint64_t limit, uint64_t offset, uint64_t fetch_limit) {
+  join_limit_ = JoinLimit{limit, offset, fetch_limit};
+}
+
+uint64_t ResultPlan::joinLimitRows() const {
+  ASSERT(join_limit_.has_value());
+  if (join_limit_->rows_kept_ <= join_limit_->offset_) {
+    return 0;
+  }
+  return std::min(join_limit_->rows_kept_ - join_limit_->offset_, join_limit_->limit_);
+}
+
+bool ResultPlan::joinLimitShort() const {
+  if (!join_limit_.has_value() || join_limit_->fetch_limit_ == NO_LIMIT) {
+    return false;
+  }
+
+  return joinLimitRows() < join_limit_->limit_ &&
+         join_limit_->rows_fetched_ >= join_limit_->fetch_limit_;
+}
+
+void ResultPlan::compile() {
+  // Move actions on the checked columns to the filtering phase, so that
+  // the rest of the row is processed only if it passes the checks
+  absl::flat_hash_set<size_t> filter_columns;
+  for (const JoinCheck& check : join_checks_) {
+    filter_columns.insert(check.left_column_idx_);
+    filter_columns.insert(check.right_column_idx_);
+  }
+  for (const RangeCheck& check : range_checks_) {
+    filter_columns.insert(check.column_idx_);
+  }
+  for (const PatternCheck& check : pattern_checks_) {
+    filter_columns.insert(check.column_idx_);
+  }
+
+  std::vector<ColumnAction> actions;
+  actions.swap(actions_);
+  for (const ColumnAction& action : actions) {
+    if (filter_columns.contains(action.column_idx_)) {
+      filter_actions_.push_back(action);
+    } else {
+      actions_.push_back(action);
+    }
+  }
+
+  ENVOY_LOG(debug,
+            "compiled result plan: {} filter actions, {} join checks, {} range checks, "
+            "{} pattern checks, {} actions, {} sort keys, {} aggregates",
+            filter_actions_.size(), join_checks_.size(), range_checks_.size(),
+            pattern_checks_.size(), actions_.size(), sort_keys_.size(), aggregates_.size());
+}
+
+Result ResultPlan::execute(DataRowMessage& row, bool& discard) {
+  discard = false;
+
+  if (join_limit_.has_value()) {
+    join_limit_->rows_fetched_++;
+    // Rows over-fetched for the false positives aren't even checked once the limit is reached
+    if (joinLimitRows() >= join_limit_->limit_) {
+      discard = true;
+      return Result::ok;
+    }
+  }
+
+  for (const ColumnAction& action : filter_actions_) {
+    CHECK_RESULT(executeAction(row, action));
+  }
+
+  for (JoinCheck& check : join_checks_) {
+    check.rows_fetched_++;
+    // NULL never matches anything
+    if (row.isNull(check.left_column_idx_) || row.isNull(check.right_column_idx_) ||
+        !row.columnsEqual(check.left_column_idx_, check.right_column_idx_)) {
+      ENVOY_LOG(debug, "discarding row because the join condition is not met");
+      discard = true;
+      return Result::ok;
+    }
+    check.rows_kept_++;
+  }
+
+  for (const RangeCheck& check : range_checks_) {
+    bool in_range;
+    CHECK_RESULT(checkRange(row, check, in_range));
+    if (!in_range) {
+      ENVOY_LOG(debug, "discarding row because the value is out of range");
+      discard = true;
+      return Result::ok;
+    }
+  }
+
+  for (const PatternCheck& check : pattern_checks_) {
+    // NULL never matches a pattern
+    if (row.isNull(check.column_idx_) ||
+        !check.pattern_.matches(row.column(check.column_idx_))) {
+      ENVOY_LOG(debug, "discarding row because the value doesn't match the pattern");
+      discard = true;
+      return Result::ok;
+    }
+  }
+
+  if (join_limit_.has_value() && join_limit_->rows_kept_++ < join_limit_->offset_) {
+    ENVOY_LOG(debug, "discarding row because it's skipped by the offset");
+    discard = true;
+    return Result::ok;
+  }
+
+  for (const ColumnAction& action : actions_) {
+    CHECK_RESULT(executeAction(row, action));
+  }
+
+  return Result::ok;
+}
+
+Result ResultPlan::executeAction(DataRowMessage& row, const ColumnAction& action) {
+  ASSERT(action.column_idx_ < row.columnsCount());
+
+  switch (action.action_) {
+  case Action::Decrypt:
+    return decryptColumn(row, action);
+  case Action::DecryptHomomorphicSum:
+    return decryptHomomorphicSum(row, action);
+  }
+
+  PANIC_DUE_TO_CORRUPT_ENUM;
+}
+
+Common::Crypto::AESDecryptionContext*
+ResultPlan::getDecryptionContext(const ColumnConfig* config, uint8_t version) {
+  auto& ctx = decryption_contexts_[std::make_pair(config, version)];
+  if (ctx == nullptr) {
+    const std::vector<uint8_t>* key = config->encryptionKey(version);
+    if (key == nullptr) {
+      return nullptr;
+    }
+
+    ctx = Common::Crypto::UtilityExtSingleton::get().createAESDecryptionContext(*key);
+  }
+
+  return ctx.get();
+}
+
+Result ResultPlan::decryptColumn(DataRowMessage& row, const ColumnAction& action) {
+  if (row.isNull(action.column_idx_)) {
+    return Result::ok;
+  }
+
+  if (!decodeByteaHex(row.column(action.column_idx_), encrypted_data_)) {
+    return Result::makeError("postgres_tde: decryption failed");
+  }
+
+  absl::string_view encrypted_data(reinterpret_cast<const char*>(encrypted_data_.data()),
+                                   encrypted_data_.size());
+
+  // The unversioned format is IV + ciphertext, both are multiples of the block size,
+  // while the versioned one is prefixed with the key version byte
+  Common::Crypto::AESDecryptionContext* ctx = action.decryption_ctx_;
+  if (encrypted_data.size() % AES_BLOCK_SIZE == 1) {
+    uint8_t version = encrypted_data[0];
+    encrypted_data.remove_prefix(1);
+    if (version != action.config_->encryptionKeyVersion()) {
+      ctx = getDecryptionContext(action.config_, version);
+    }
+  } else if (action.config_->encryptionKeyVersion() != 0) {
+    ctx = getDecryptionContext(action.config_, 0);
+  }
+
+  if (ctx == nullptr) {
+    return Result::makeError("postgres_tde: decryption failed - unknown key version");
+  }
+
+  CHECK_RESULT(ctx->decrypt(encrypted_data, decrypted_data_));
+
+  row.setColumn(action.column_idx_,
+                absl::string_view(reinterpret_cast<const char*>(decrypted_data_.data()),
+                                  decrypted_data_.size()));
+  return Result::ok;
+}
+
+Result ResultPlan::decryptHomomorphicSum(DataRowMessage& row, const ColumnAction& action) {
+  // Sum of no values is NULL
+  if (row.isNull(action.column_idx_)) {
+    return Result::ok;
+  }
+
+  CHECK_RESULT(action.homomorphic_ctx_->decrypt(row.column(action.column_idx_), decrypted_sum_));
+  row.setColumn(action.column_idx_, decrypted_sum_);
+  return Result::ok;
+}
+
+Result ResultPlan::checkRange(DataRowMessage& row, const RangeCheck& check, bool& in_range) {
+  // NULL is never in range
+  if (row.isNull(check.column_idx_)) {
+    in_range = false;
+    return Result::ok;
+  }
+
+  OrderedValue value;
+  if (!OrderedValue::fromText(check.config_->origDataType(), row.column(check.column_idx_),
+                              value)) {
+    return Result::makeError(fmt::format("postgres_tde: unable to check the range of column {}",
+                                         check.config_->columnName()));
+  }
+
+  uint64_t ordinal = value.ordinal();
+  in_range = (check.lower_inclusive_ ? ordinal >= check.lower_ : ordinal > check.lower_) &&
+             (check.upper_inclusive_ ? ordinal <= check.upper_ : ordinal < check.upper_);
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
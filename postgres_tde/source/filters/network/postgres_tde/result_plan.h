@@ -0,0 +1,242 @@
+#pragma once
+
+#include <limits>
+#include <optional>
+
+#include "absl/container/flat_hash_map.h"
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/common/utils/utils.h"
+#include "postgres_tde/source/filters/network/postgres_tde/config/column_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/like_pattern.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+/**
+ * Compiled execution plan for the DataRow messages of a single result
+ *
+ * Mutators describe the work that should be done on each column while processing
+ * the RowDescription. After compile() the plan is executed for every DataRow in a flat
+ * loop over the columns that actually need some work:
+ * 1. columns participating in join comparisons, range and pattern checks are decrypted
+ * 2. join comparisons, range bounds and patterns are checked, non-matching rows are discarded
+ * 3. the rest of the columns are decrypted
+ * If the plan has sort keys, the processed rows are sorted by the proxy (see ResultSorter)
+ * before they are sent to the client. If it has output columns, the processed rows are
+ * aggregated by the proxy (see ResultAggregator) and only the aggregated rows are sent.
+ * If it has a join side, the processed rows are joined by the proxy with the rows of the other
+ * result of the query (see ResultJoiner). If it has a join limit, only the rows within the limit
+ * pass the checks.
+ */
+class ResultPlan : public Logger::Loggable<Logger::Id::filter> {
+public:
+  enum class Action {
+    Decrypt,
+    // Sum of the values computed by the database over the homomorphic ciphertexts
+    DecryptHomomorphicSum,
+  };
+
+  struct ColumnAction {
+    size_t column_idx_;
+    Action action_;
+    const ColumnConfig* config_;
+    // Context for the active key version
+    Common::Crypto::AESDecryptionContext* decryption_ctx_;
+    const Common::Crypto::HomomorphicContext* homomorphic_ctx_{nullptr};
+  };
+
+  struct JoinCheck {
+    size_t left_column_idx_;
+    size_t right_column_idx_;
+    // Counters of the compared columns, updated once the result is complete
+    JoinStats stats_;
+    // Rows of the result the check was applied to and the rows that matched
+    uint64_t rows_fetched_{0};
+    uint64_t rows_kept_{0};
+  };
+
+  // Exact bounds of a range that was looked up by a coarser index
+  struct RangeCheck {
+    size_t column_idx_;
+    const ColumnConfig* config_;
+    // Ordinals of the bounds, see OrderedValue
+    uint64_t lower_;
+    bool lower_inclusive_;
+    uint64_t upper_;
+    bool upper_inclusive_;
+  };
+
+  // LIKE pattern that was looked up by the token index
+  struct PatternCheck {
+    size_t column_idx_;
+    LikePattern pattern_;
+  };
+
+  // Key of the sorting done by the proxy, compared over the decrypted value
+  struct SortKey {
+    size_t column_idx_;
+    int32_t data_type_;
+    bool descending_;
+  };
+
+  enum class AggregateFunction {
+    Min,
+    Max,
+    Sum,
+    Avg,
+    Count,
+    // COUNT(*), counts the rows without reading any column
+    CountRows,
+  };
+
+  // Aggregate computed by the proxy over the decrypted values of a column
+  struct Aggregate {
+    AggregateFunction function_;
+    bool distinct_;
+    size_t column_idx_;
+    int32_t data_type_;
+  };
+
+  // Column of the aggregated result: a group key or an aggregate, by its index
+  struct OutputColumn {
+    bool aggregate_;
+    size_t idx_;
+  };
+
+  // Side of the join executed by the proxy the result belongs to. The build side is fetched
+  // first and kept by the proxy, the probe side is matched against it as it arrives
+  enum class JoinSide {
+    None,
+    Build,
+    Probe,
+  };
+
+  // Column of the joined result: a column of the build or the probe side, by its index
+  struct JoinOutputColumn {
+    bool build_side_;
+    size_t column_idx_;
+  };
+
+  // LIMIT of a probabilistic join, applied by the proxy to the rows that passed the checks, as
+  // the database limits the rows before the false positives are discarded
+  struct JoinLimit {
+    uint64_t limit_;
+    uint64_t offset_;
+    // Rows requested from the database, NO_LIMIT if the whole result is fetched
+    uint64_t fetch_limit_;
+    // Rows of the result and the rows that passed the checks so far
+    uint64_t rows_fetched_{0};
+    uint64_t rows_kept_{0};
+  };
+
+  static constexpr uint64_t NO_LIMIT = std::numeric_limits<uint64_t>::max();
+
+  void clear();
+
+  void addDecryption(size_t column_idx, const ColumnConfig* config);
+  void addHomomorphicSumDecryption(size_t column_idx, const ColumnConfig* config);
+  // Rows of a probabilistic join whose decrypted columns differ are false positives of the
+  // truncated join keys. They are discarded before the rest of the row is decrypted
+  void addJoinCheck(size_t left_column_idx, size_t right_column_idx, const JoinStats& stats);
+  void addRangeCheck(const RangeCheck& check);
+  void addPatternCheck(const PatternCheck& check);
+  void addSortKey(const SortKey& key);
+  // Rows returned after the sorting, applied only to sorted results
+  void setRowLimit(uint64_t limit, uint64_t offset);
+  void addGroupKey(size_t column_idx);
+  void addAggregate(const Aggregate& aggregate);
+  void addOutputColumn(const OutputColumn& column);
+  // Rows are matched by the decrypted value of the key column
+  void setJoinSide(JoinSide side, size_t key_column_idx);
+  // Output columns are set on the probe side
+  void addJoinOutputColumn(const JoinOutputColumn& column);
+  void setJoinLimit(uint64_t limit, uint64_t offset, uint64_t fetch_limit);
+
+  // Must be called after all actions are added and before execute
+  void compile();
+
+  bool empty() const {
+    return filter_actions_.empty() && join_checks_.empty() && range_checks_.empty() &&
+           pattern_checks_.empty() && actions_.empty();
+  }
+
+  // Counters of the rows matched by the join checks so far
+  const std::vector<JoinCheck>& joinChecks() const { return join_checks_; }
+
+  bool sorted() const { return !sort_keys_.empty(); }
+  const std::vector<SortKey>& sortKeys() const { return sort_keys_; }
+  uint64_t limit() const { return limit_; }
+  uint64_t offset() const { return offset_; }
+
+  bool aggregated() const { return !output_columns_.empty(); }
+  const std::vector<size_t>& groupKeys() const { return group_keys_; }
+  const std::vector<Aggregate>& aggregates() const { return aggregates_; }
+  const std::vector<OutputColumn>& outputColumns() const { return output_columns_; }
+
+  JoinSide joinSide() const { return join_side_; }
+  size_t joinKeyColumn() const { return join_key_column_idx_; }
+  const std::vector<JoinOutputColumn>& joinOutputColumns() const { return join_output_columns_; }
+
+  bool joinLimited() const { return join_limit_.has_value(); }
+  // Whether the result may turn out short and be fetched again without the limit
+  bool joinLimitRefetchable() const {
+    return join_limit_.has_value() && join_limit_->fetch_limit_ != NO_LIMIT;
+  }
+  // Rows within the join limit so far
+  uint64_t joinLimitRows() const;
+  // Whether the result is short of the join limit while the database may have more rows
+  bool joinLimitShort() const;
+
+  /**
+   * Executes the plan on the row
+   * @param row row to process
+   * @param discard set to true if the row doesn't belong to the result and should be discarded
+   */
+  Result execute(DataRowMessage& row, bool& discard);
+
+private:
+  Result executeAction(DataRowMessage& row, const ColumnAction& action);
+  Result decryptColumn(DataRowMessage& row, const ColumnAction& action);
+  Result decryptHomomorphicSum(DataRowMessage& row, const ColumnAction& action);
+  Result checkRange(DataRowMessage& row, const RangeCheck& check, bool& in_range);
+  Common::Crypto::AESDecryptionContext* getDecryptionContext(const ColumnConfig* config,
+                                                             uint8_t version);
+
+  std::vector<ColumnAction> filter_actions_;
+  std::vector<JoinCheck> join_checks_;
+  std::vector<RangeCheck> range_checks_;
+  std::vector<PatternCheck> pattern_checks_;
+  std::vector<ColumnAction> actions_;
+  std::vector<SortKey> sort_keys_;
+  uint64_t limit_{NO_LIMIT};
+  uint64_t offset_{0};
+  std::vector<size_t> group_keys_;
+  std::vector<Aggregate> aggregates_;
+  std::vector<OutputColumn> output_columns_;
+  JoinSide join_side_{JoinSide::None};
+  size_t join_key_column_idx_{0};
+  std::vector<JoinOutputColumn> join_output_columns_;
+  std::optional<JoinLimit> join_limit_;
+
+  // Prepared key contexts, one per key version used in the result
+  absl::flat_hash_map<std::pair<const ColumnConfig*, uint8_t>,
+                      Common::Crypto::AESDecryptionContextPtr>
+      decryption_contexts_;
+
+  // Scratch buffers reused between rows
+  std::vector<uint8_t> encrypted_data_;
+  std::vector<uint8_t> decrypted_data_;
+  std::string decrypted_sum_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
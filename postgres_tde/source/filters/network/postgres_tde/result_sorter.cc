@@ -0,0 +1,323 @@
+#include "postgres_tde/source/filters/network/postgres_tde/result_sorter.h"
+
+#include <algorithm>
+#include <queue>
+
+#include "source/common/common/assert.h"
+#include "source/common/common/fmt.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+#include "postgres_tde/source/filters/network/postgres_tde/common.h"
+#include "postgres_tde/source/filters/network/postgres_tde/ordered_value.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Key bytes of NULL and non-NULL values, NULL goes after any value in the ascending order
+constexpr char KEY_VALUE = '\x00';
+constexpr char KEY_NULL = '\x01';
+
+inline void appendBE32(std::string& out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>(value >> shift));
+  }
+}
+
+inline uint32_t loadBE32(const uint8_t* in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+bool keyLess(const std::string& left, const std::string& right) { return left < right; }
+
+} // namespace
+
+ResultSorter::ResultSorter(uint64_t memory_limit, std::string spill_directory,
+                           uint64_t max_spill_size)
+    : memory_limit_(memory_limit), spill_directory_(std::move(spill_directory)),
+      max_spill_size_(max_spill_size) {}
+
+bool ResultSorter::isSortableType(int32_t data_type) {
+  switch (data_type) {
+  case BOOLOID:
+  case TEXTOID:
+  case BPCHAROID:
+  case VARCHAROID:
+  case UUIDOID:
+    // The text output of these types compares in the order of the values
+    return true;
+  default:
+    return OrderedValue::isSupportedType(data_type);
+  }
+}
+
+void ResultSorter::start(const ResultPlan& plan) {
+  ASSERT(plan.sorted());
+  clear();
+
+  active_ = true;
+  keys_ = plan.sortKeys();
+  limit_ = plan.limit();
+  offset_ = plan.offset();
+  if (limit_ != ResultPlan::NO_LIMIT) {
+    // Saturated, huge offsets are no different from sorting the whole result
+    top_k_ = limit_ + offset_ >= limit_ ? limit_ + offset_ : 0;
+  }
+
+  rows_count_ = 0;
+  spilled_runs_ = 0;
+}
+
+void ResultSorter::clear() {
+  active_ = false;
+  keys_.clear();
+  limit_ = ResultPlan::NO_LIMIT;
+  offset_ = 0;
+  top_k_ = 0;
+  rows_.clear();
+  memory_used_ = 0;
+  runs_.clear();
+  spill_size_ = 0;
+  encryption_ctx_.reset();
+  decryption_ctx_.reset();
+  position_ = 0;
+}
+
+Result ResultSorter::add(std::unique_ptr<DataRowMessage> row) {
+  ASSERT(active_);
+  if (limit_ == 0) {
+    return Result::ok;
+  }
+
+  SortedRow sorted_row{std::string(), std::move(row)};
+  CHECK_RESULT(encodeKey(*sorted_row.row_, sorted_row.key_));
+
+  if (top_k_ != 0) {
+    addToHeap(std::move(sorted_row));
+    if (memory_used_ <= memory_limit_) {
+      return Result::ok;
+    }
+
+    // The rows of the heap don't fit in memory, the result is sorted as a whole instead
+    ENVOY_LOG(debug, "top-{} rows exceed the memory limit, switching to the external sort",
+              top_k_);
+    top_k_ = 0;
+  } else {
+    memory_used_ += sorted_row.key_.size() + sorted_row.row_->wireSize();
+    rows_.push_back(std::move(sorted_row));
+  }
+
+  if (memory_used_ > memory_limit_) {
+    CHECK_RESULT(spillRun());
+  }
+
+  return Result::ok;
+}
+
+void ResultSorter::addToHeap(SortedRow row) {
+  auto less = [](const SortedRow& left, const SortedRow& right) {
+    return keyLess(left.key_, right.key_);
+  };
+
+  if (rows_.size() == top_k_) {
+    // Max-heap, the front is the last row of the limited result so far
+    if (!keyLess(row.key_, rows_.front().key_)) {
+      return;
+    }
+
+    std::pop_heap(rows_.begin(), rows_.end(), less);
+    memory_used_ -= rows_.back().key_.size() + rows_.back().row_->wireSize();
+    rows_.pop_back();
+  }
+
+  memory_used_ += row.key_.size() + row.row_->wireSize();
+  rows_.push_back(std::move(row));
+  std::push_heap(rows_.begin(), rows_.end(), less);
+}
+
+Result ResultSorter::finish(const RowCallback& callback) {
+  ASSERT(active_);
+
+  if (runs_.empty()) {
+    std::sort(rows_.begin(), rows_.end(), [](const SortedRow& left, const SortedRow& right) {
+      return keyLess(left.key_, right.key_);
+    });
+
+    for (SortedRow& row : rows_) {
+      if (!emitRow(std::move(row.row_), callback)) {
+        break;
+      }
+    }
+  } else {
+    // The rest of the rows becomes the last run
+    CHECK_RESULT(spillRun());
+    CHECK_RESULT(mergeRuns(callback));
+  }
+
+  ENVOY_LOG(debug, "sorted result: {} rows, {} runs spilled", rows_count_, spilled_runs_);
+  clear();
+  return Result::ok;
+}
+
+Result ResultSorter::encodeKey(const DataRowMessage& row, std::string& key) {
+  key.clear();
+  for (const ResultPlan::SortKey& sort_key : keys_) {
+    size_t begin = key.size();
+    if (row.isNull(sort_key.column_idx_)) {
+      key.push_back(KEY_NULL);
+    } else {
+      key.push_back(KEY_VALUE);
+      absl::string_view value = row.column(sort_key.column_idx_);
+
+      OrderedValue ordered_value;
+      if (OrderedValue::isSupportedType(sort_key.data_type_)) {
+        if (!OrderedValue::fromText(sort_key.data_type_, value, ordered_value)) {
+          return Result::makeError(fmt::format(
+              "postgres_tde: unable to sort the result by column {}", sort_key.column_idx_ + 1));
+        }
+
+        uint64_t ordinal = ordered_value.ordinal();
+        for (int shift = 56; shift >= 0; shift -= 8) {
+          key.push_back(static_cast<char>(ordinal >> shift));
+        }
+      } else {
+        // Zero bytes are escaped and the value is terminated, so that a value goes before
+        // the longer values it is a prefix of
+        for (char c : value) {
+          key.push_back(c);
+          if (c == '\0') {
+            key.push_back('\xff');
+          }
+        }
+        key.append(2, '\0');
+      }
+    }
+
+    if (sort_key.descending_) {
+      for (size_t i = begin; i < key.size(); i++) {
+        key[i] = static_cast<char>(~key[i]);
+      }
+    }
+  }
+
+  return Result::ok;
+}
+
+Result ResultSorter::spillRun() {
+  if (encryption_ctx_ == nullptr) {
+    auto& crypto_util_ext = Common::Crypto::UtilityExtSingleton::get();
+    std::vector<uint8_t> key = crypto_util_ext.GenerateAESKey();
+    encryption_ctx_ = crypto_util_ext.createAESEncryptionContext(key);
+    decryption_ctx_ = crypto_util_ext.createAESDecryptionContext(key);
+  }
+
+  auto run = std::make_unique<Run>();
+  CHECK_RESULT(SpillFile::create(spill_directory_, "sort", run->file_));
+
+  std::sort(rows_.begin(), rows_.end(), [](const SortedRow& left, const SortedRow& right) {
+    return keyLess(left.key_, right.key_);
+  });
+
+  // Each record is [key length][key][row body]
+  for (const SortedRow& row : rows_) {
+    record_.clear();
+    appendBE32(record_, row.key_.size());
+    record_.append(row.key_);
+    row.row_->writeBody(record_);
+    CHECK_RESULT(run->file_->write(*encryption_ctx_, record_));
+    if (spill_size_ + run->file_->size() > max_spill_size_) {
+      return Result::makeError("postgres_tde: result is too large to be sorted by the proxy");
+    }
+  }
+  CHECK_RESULT(run->file_->flush());
+  spill_size_ += run->file_->size();
+
+  ENVOY_LOG(debug, "spilled {} sorted rows ({} bytes in memory)", rows_.size(), memory_used_);
+  runs_.push_back(std::move(run));
+  spilled_runs_++;
+  rows_.clear();
+  memory_used_ = 0;
+  return Result::ok;
+}
+
+Result ResultSorter::readRow(Run& run, bool& has_row) {
+  CHECK_RESULT(run.file_->read(*decryption_ctx_, decrypted_data_, has_row));
+  if (!has_row) {
+    return Result::ok;
+  }
+
+  absl::string_view record(reinterpret_cast<const char*>(decrypted_data_.data()),
+                           decrypted_data_.size());
+  if (record.size() < sizeof(uint32_t)) {
+    return Result::makeError("postgres_tde: unable to read the spilled rows");
+  }
+
+  uint32_t key_size = loadBE32(decrypted_data_.data());
+  record.remove_prefix(sizeof(uint32_t));
+  if (record.size() < key_size) {
+    return Result::makeError("postgres_tde: unable to read the spilled rows");
+  }
+
+  run.current_.key_.assign(record.data(), key_size);
+  record.remove_prefix(key_size);
+  run.current_.row_ = std::make_unique<DataRowMessage>();
+  run.current_.row_->readBody(record);
+  return Result::ok;
+}
+
+Result ResultSorter::mergeRuns(const RowCallback& callback) {
+  // Min-heap of the runs by their current rows
+  auto greater = [this](size_t left, size_t right) {
+    return keyLess(runs_[right]->current_.key_, runs_[left]->current_.key_);
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> queue(greater);
+
+  for (size_t i = 0; i < runs_.size(); i++) {
+    runs_[i]->file_->rewind();
+
+    bool has_row;
+    CHECK_RESULT(readRow(*runs_[i], has_row));
+    if (has_row) {
+      queue.push(i);
+    }
+  }
+
+  while (!queue.empty()) {
+    size_t i = queue.top();
+    queue.pop();
+    if (!emitRow(std::move(runs_[i]->current_.row_), callback)) {
+      break;
+    }
+
+    bool has_row;
+    CHECK_RESULT(readRow(*runs_[i], has_row));
+    if (has_row) {
+      queue.push(i);
+    }
+  }
+
+  return Result::ok;
+}
+
+bool ResultSorter::emitRow(std::unique_ptr<DataRowMessage> row, const RowCallback& callback) {
+  if (position_++ < offset_) {
+    return true;
+  }
+
+  if (rows_count_ == limit_) {
+    return false;
+  }
+
+  callback(std::move(row));
+  rows_count_++;
+  return rows_count_ != limit_;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
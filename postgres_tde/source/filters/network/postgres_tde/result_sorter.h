@@ -0,0 +1,113 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/common/logger.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/common/utils/utils.h"
+#include "postgres_tde/source/filters/network/postgres_tde/postgres_protocol.h"
+#include "postgres_tde/source/filters/network/postgres_tde/result_plan.h"
+#include "postgres_tde/source/filters/network/postgres_tde/spill_file.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+/**
+ * Sorts the rows of a result by the decrypted values, for ORDER BY the database can't do
+ *
+ * Each row gets a binary key which compares byte-wise in the order of the sort keys. NULLs
+ * go last in the ascending order and first in the descending one, as in Postgres, and text
+ * is compared byte-wise, as with the C collation.
+ * Limited results keep only the first limit + offset rows in a heap. Other results are kept
+ * in memory up to the memory limit and then spilled to disk in sorted runs, which are merged
+ * once the result is complete. Spilled rows are encrypted with a key generated for the result,
+ * so the decrypted values never reach the disk. The runs of a result may take up to the max
+ * spill size on disk, larger results fail.
+ * Not thread safe.
+ */
+class ResultSorter : public Logger::Loggable<Logger::Id::filter> {
+public:
+  using RowCallback = std::function<void(std::unique_ptr<DataRowMessage>)>;
+
+  ResultSorter(uint64_t memory_limit, std::string spill_directory, uint64_t max_spill_size);
+
+  // Text-like types and the types supported by OrderedValue
+  static bool isSortableType(int32_t data_type);
+
+  // Starts sorting of a new result by the sort keys of the plan
+  void start(const ResultPlan& plan);
+  void clear();
+  bool active() const { return active_; }
+
+  Result add(std::unique_ptr<DataRowMessage> row);
+
+  // Passes the rows within the limit to the callback in the sorted order and clears the sorter
+  Result finish(const RowCallback& callback);
+
+  // Stats of the last sorted result
+  uint64_t rowsCount() const { return rows_count_; }
+  uint64_t spilledRuns() const { return spilled_runs_; }
+
+private:
+  struct SortedRow {
+    std::string key_;
+    std::unique_ptr<DataRowMessage> row_;
+  };
+
+  // Sorted run spilled to a file
+  struct Run {
+    SpillFilePtr file_;
+    // Row the run is positioned at while the runs are merged
+    SortedRow current_;
+  };
+
+  Result encodeKey(const DataRowMessage& row, std::string& key);
+  void addToHeap(SortedRow row);
+  Result spillRun();
+  Result readRow(Run& run, bool& has_row);
+  Result mergeRuns(const RowCallback& callback);
+  // Applies the offset and the limit, returns false once the limit is reached
+  bool emitRow(std::unique_ptr<DataRowMessage> row, const RowCallback& callback);
+
+  const uint64_t memory_limit_;
+  const std::string spill_directory_;
+  const uint64_t max_spill_size_;
+
+  bool active_{false};
+  std::vector<ResultPlan::SortKey> keys_;
+  uint64_t limit_{ResultPlan::NO_LIMIT};
+  uint64_t offset_{0};
+  // Rows kept by the heap of a limited result, zero if the result is sorted as a whole
+  uint64_t top_k_{0};
+
+  std::vector<SortedRow> rows_;
+  uint64_t memory_used_{0};
+  std::vector<std::unique_ptr<Run>> runs_;
+  // Bytes taken by the runs on disk
+  uint64_t spill_size_{0};
+  // Generated for each result on the first spill
+  Common::Crypto::AESEncryptionContextPtr encryption_ctx_;
+  Common::Crypto::AESDecryptionContextPtr decryption_ctx_;
+
+  // Position in the sorted result while the rows are emitted
+  uint64_t position_{0};
+  uint64_t rows_count_{0};
+  uint64_t spilled_runs_{0};
+
+  // Scratch buffers reused between rows
+  std::string record_;
+  std::vector<uint8_t> decrypted_data_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,110 @@
+#include "postgres_tde/source/filters/network/postgres_tde/spill_file.h"
+
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include "absl/strings/str_cat.h"
+
+#include "postgres_tde/source/common/sqlutils/ast/visitor.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+constexpr char WRITE_ERROR[] = "postgres_tde: unable to spill the rows to disk";
+constexpr char READ_ERROR[] = "postgres_tde: unable to read the spilled rows";
+
+inline void storeBE32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+  }
+}
+
+inline uint32_t loadBE32(const uint8_t* in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+} // namespace
+
+SpillFile::~SpillFile() { fclose(file_); }
+
+Result SpillFile::create(const std::string& directory, absl::string_view name,
+                         SpillFilePtr& file) {
+  std::string path = absl::StrCat(directory, "/postgres_tde_", name, "_XXXXXX");
+  int fd = mkstemp(path.data());
+  if (fd < 0) {
+    return Result::makeError(WRITE_ERROR);
+  }
+  unlink(path.c_str());
+
+  FILE* stream = fdopen(fd, "w+b");
+  if (stream == nullptr) {
+    close(fd);
+    return Result::makeError(WRITE_ERROR);
+  }
+
+  file.reset(new SpillFile(stream));
+  return Result::ok;
+}
+
+Result SpillFile::write(Common::Crypto::AESEncryptionContext& ctx, absl::string_view record) {
+  // Each record is [length][encrypted record]
+  ctx.encrypt(record, encrypted_data_);
+
+  uint8_t size_bytes[sizeof(uint32_t)];
+  storeBE32(size_bytes, encrypted_data_.size());
+  if (fwrite(size_bytes, 1, sizeof(size_bytes), file_) != sizeof(size_bytes) ||
+      fwrite(encrypted_data_.data(), 1, encrypted_data_.size(), file_) !=
+          encrypted_data_.size()) {
+    return Result::makeError(WRITE_ERROR);
+  }
+
+  size_ += sizeof(size_bytes) + encrypted_data_.size();
+  return Result::ok;
+}
+
+Result SpillFile::flush() {
+  if (fflush(file_) != 0) {
+    return Result::makeError(WRITE_ERROR);
+  }
+
+  return Result::ok;
+}
+
+void SpillFile::rewind() { ::rewind(file_); }
+
+Result SpillFile::read(Common::Crypto::AESDecryptionContext& ctx, std::vector<uint8_t>& record,
+                       bool& has_record) {
+  uint8_t size_bytes[sizeof(uint32_t)];
+  size_t read = fread(size_bytes, 1, sizeof(size_bytes), file_);
+  if (read == 0 && feof(file_)) {
+    has_record = false;
+    return Result::ok;
+  }
+
+  if (read != sizeof(size_bytes)) {
+    return Result::makeError(READ_ERROR);
+  }
+
+  encrypted_data_.resize(loadBE32(size_bytes));
+  if (fread(encrypted_data_.data(), 1, encrypted_data_.size(), file_) !=
+      encrypted_data_.size()) {
+    return Result::makeError(READ_ERROR);
+  }
+
+  CHECK_RESULT(ctx.decrypt(absl::string_view(reinterpret_cast<const char*>(encrypted_data_.data()),
+                                             encrypted_data_.size()),
+                           record));
+  has_record = true;
+  return Result::ok;
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
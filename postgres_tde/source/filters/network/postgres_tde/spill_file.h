@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "postgres_tde/source/common/crypto/utility_ext.h"
+#include "postgres_tde/source/common/utils/utils.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+using Extensions::Common::Utils::Result;
+
+class SpillFile;
+using SpillFilePtr = std::unique_ptr<SpillFile>;
+
+/**
+ * Temporary file of records spilled by the proxy when a result doesn't fit in memory
+ *
+ * The file is removed right after it's created, so nothing is left on disk once it's closed,
+ * even if the process dies. Each record is encrypted with the key of the owner, which is
+ * generated for a single result, so the decrypted values never reach the disk.
+ * Records are written sequentially and read back after rewind(). The I/O is blocking, so the
+ * owners keep the files small enough not to stall the worker thread for long.
+ */
+class SpillFile {
+public:
+  ~SpillFile();
+
+  // name is a part of the file name template, e.g. "sort" for postgres_tde_sort_XXXXXX
+  static Result create(const std::string& directory, absl::string_view name, SpillFilePtr& file);
+
+  Result write(Common::Crypto::AESEncryptionContext& ctx, absl::string_view record);
+  // Must be called after the last write
+  Result flush();
+  void rewind();
+
+  // has_record is set to false at the end of the file
+  Result read(Common::Crypto::AESDecryptionContext& ctx, std::vector<uint8_t>& record,
+              bool& has_record);
+
+  // Bytes written to the file
+  uint64_t size() const { return size_; }
+
+private:
+  explicit SpillFile(FILE* file) : file_(file) {}
+
+  FILE* file_;
+  uint64_t size_{0};
+  // Scratch buffer reused between records
+  std::vector<uint8_t> encrypted_data_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,78 @@
+#include "postgres_tde/source/filters/network/postgres_tde/token_index_encoder.h"
+
+#include <algorithm>
+
+#include "source/common/crypto/utility.h"
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+namespace {
+
+// Truncated HMAC is enough to tell the n-grams apart, while keeping the arrays compact
+constexpr size_t TOKEN_BYTES = 8;
+
+} // namespace
+
+TokenIndexEncoder::TokenIndexEncoder(const ColumnConfig& column_config)
+    : key_(column_config.tokenIndexKey()), token_size_(column_config.tokenSize()) {}
+
+void TokenIndexEncoder::encode(absl::string_view value, std::string& out) const {
+  std::vector<std::string> tokens;
+  addTokens(value, true, true, tokens);
+  formatArray(tokens, out);
+}
+
+bool TokenIndexEncoder::encodePattern(const LikePattern& pattern, std::string& out) const {
+  std::vector<std::string> tokens;
+  for (const LikePattern::Segment& segment : pattern.segments()) {
+    addTokens(segment.text_, segment.anchored_start_, segment.anchored_end_, tokens);
+  }
+
+  if (tokens.empty()) {
+    return false;
+  }
+
+  formatArray(tokens, out);
+  return true;
+}
+
+void TokenIndexEncoder::addTokens(absl::string_view text, bool pad_start, bool pad_end,
+                                  std::vector<std::string>& tokens) const {
+  std::string padded;
+  padded.reserve(text.size() + 2 * (token_size_ - 1));
+  if (pad_start) {
+    padded.append(token_size_ - 1, '\0');
+  }
+  padded.append(absl::AsciiStrToLower(text));
+  if (pad_end) {
+    padded.append(token_size_ - 1, '\0');
+  }
+
+  auto& crypto_util = Envoy::Common::Crypto::UtilitySingleton::get();
+  for (size_t i = 0; i + token_size_ <= padded.size(); i++) {
+    std::vector<uint8_t> hmac =
+        crypto_util.getSha256Hmac(key_, absl::string_view(padded).substr(i, token_size_));
+    tokens.push_back(absl::BytesToHexString(
+        absl::string_view(reinterpret_cast<const char*>(hmac.data()), TOKEN_BYTES)));
+  }
+}
+
+void TokenIndexEncoder::formatArray(std::vector<std::string>& tokens, std::string& out) {
+  // Each n-gram is stored once, the order doesn't matter for the containment
+  std::sort(tokens.begin(), tokens.end());
+  tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+  out = absl::StrCat("{", absl::StrJoin(tokens, ","), "}");
+}
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "postgres_tde/source/filters/network/postgres_tde/config/column_config.h"
+#include "postgres_tde/source/filters/network/postgres_tde/like_pattern.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace PostgresTDE {
+
+/**
+ * Computes values of the token index column
+ *
+ * The value is lowercased, padded with token size - 1 zero bytes on both sides and split into
+ * overlapping n-grams, each n-gram is stored as the truncated HMAC. The padding makes the
+ * n-grams at the beginning and the end of the value distinct, so the prefixes and suffixes
+ * are looked up as precisely as the substrings. Tokens are formatted as a Postgres array
+ * literal, which is valid both in queries and in the COPY text format.
+ */
+class TokenIndexEncoder {
+public:
+  explicit TokenIndexEncoder(const ColumnConfig& column_config);
+
+  void encode(absl::string_view value, std::string& out) const;
+
+  // Tokens every value matching the pattern contains. Returns false if the literal
+  // parts of the pattern are too short to produce any token
+  bool encodePattern(const LikePattern& pattern, std::string& out) const;
+
+private:
+  void addTokens(absl::string_view text, bool pad_start, bool pad_end,
+                 std::vector<std::string>& tokens) const;
+  static void formatArray(std::vector<std::string>& tokens, std::string& out);
+
+  const std::vector<uint8_t>& key_;
+  size_t token_size_;
+};
+
+} // namespace PostgresTDE
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
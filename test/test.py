@@ -1,9 +1,41 @@
+import base64
+import hashlib
+import io
+import json
 import psycopg2
 import pytest
+import subprocess
+import sys
+import time
+import uuid
+from concurrent.futures import ThreadPoolExecutor
 from datetime import datetime
+from decimal import Decimal
+from urllib.parse import quote
+from urllib.request import urlopen
 
 HOST = "localhost"
 ENCRYPTED_HOST = "localhost"
+ADMIN_URL = "http://localhost:8001"
+STAT_PREFIX = "postgres.stats"
+CACHED_STAT_PREFIX = "postgres.cached"
+RELOAD_STAT_PREFIX = "postgres.reload"
+
+def read_counter(name, prefix=STAT_PREFIX):
+    stats_filter = quote(f"^{prefix}[.]{name}$")
+    with urlopen(f"{ADMIN_URL}/stats?format=json&filter={stats_filter}") as response:
+        stats = json.load(response)["stats"]
+    return next(stat["value"] for stat in stats if stat.get("name") == f"{prefix}.{name}")
+
+def rewrite(path, content):
+    with open(path, 'w') as f:
+        f.write(content)
+
+def wait_for(condition, timeout=10):
+    deadline = time.monotonic() + timeout
+    while not condition():
+        assert time.monotonic() < deadline
+        time.sleep(0.1)
 
 @pytest.fixture
 def cursor():
@@ -78,6 +110,35 @@ def test_blind_index_correctness(prepare_schema, enc_cursor):
     enc_cursor.execute("SELECT c.id, c.name FROM cities c WHERE c.name = 'City 2';")
     assert sorted(enc_cursor.fetchall()) == [('33008eec-464e-4022-a6c4-90c7cc70612e', 'City 2')]
 
+    enc_cursor.execute("SELECT c.id, c.name FROM cities c WHERE c.name IN ('City 1', 'City 2', 'City 3');")
+    assert sorted(enc_cursor.fetchall()) == [('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'City 1'), ('33008eec-464e-4022-a6c4-90c7cc70612e', 'City 2')]
+
+    enc_cursor.execute("SELECT c.id, c.name FROM cities c WHERE c.name NOT IN ('City 1');")
+    assert sorted(enc_cursor.fetchall()) == [('33008eec-464e-4022-a6c4-90c7cc70612e', 'City 2')]
+
+
+def test_composite_blind_index(prepare_schema, enc_cursor):
+    # Equalities over name and kladr_id are looked up by the single hash of the pair
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'City 1', '2', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.copy_expert("COPY cities (id, name, kladr_id, created_at, updated_at) FROM STDIN",
+                           io.StringIO("c07b21de-c660-46b0-bffd-b1e6272141a9\tCity 2\t1\t2023-11-02 10:30:02\t2023-12-20 00:00:52\n"))
+
+    enc_cursor.execute("SELECT c.id FROM cities c WHERE c.kladr_id = '2' AND c.name = 'City 1';")
+    assert enc_cursor.fetchall() == [('33008eec-464e-4022-a6c4-90c7cc70612e',)]
+
+    enc_cursor.execute("SELECT c.id FROM cities c WHERE c.name = 'City 2' AND c.kladr_id = '1';")
+    assert enc_cursor.fetchall() == [('c07b21de-c660-46b0-bffd-b1e6272141a9',)]
+
+    enc_cursor.execute("UPDATE cities SET name = 'City 3', kladr_id = '1' WHERE cities.id = '33008eec-464e-4022-a6c4-90c7cc70612e';")
+    enc_cursor.execute("SELECT c.id FROM cities c WHERE c.name = 'City 3' AND c.kladr_id = '1';")
+    assert enc_cursor.fetchall() == [('33008eec-464e-4022-a6c4-90c7cc70612e',)]
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("UPDATE cities SET name = 'City 4' WHERE cities.id = '33008eec-464e-4022-a6c4-90c7cc70612e';")
+
+    assert str(excinfo.value) == "postgres_tde: columns name, kladr_id of composite blind index must be updated together\n"
+
 
 def test_join_correctness(prepare_schema, enc_cursor):
     # Rows ID correspond to the similar join key (first 2 bytes of SHA256), so encrypted join requires skipping some rows at the proxy level
@@ -94,6 +155,143 @@ def test_join_correctness(prepare_schema, enc_cursor):
     assert sorted(enc_cursor.fetchall()) == [('4df0dc1a-2d9d-4682-848b-c323e922c60f', '4df0dc1a-2d9d-4682-848b-c323e922c60f', 'City 2', 'Region 2')]
 
 
+def test_join_limit(prepare_schema, enc_cursor):
+    # Join keys of cities.id are 1 byte long, the IDs are chosen to share it, so every city is joined
+    # with every region by the database and only one of 20 rows is kept
+    ids = [f"00000000-0000-0000-0000-{i:012d}" for i in range(10000)]
+    ids = [id for id in ids if hashlib.sha256(id.encode()).digest()[0] == 0][:20]
+    for i, id in enumerate(ids):
+        enc_cursor.execute(f"INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('{id}', 'City {i}', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+        enc_cursor.execute(f"INSERT INTO city2region (id, region) VALUES ('{id}', 'Region {i}');")
+
+    query = "SELECT c.id AS c_id, c2r.id AS c2r_id, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id"
+    enc_cursor.execute(query)
+    joined = enc_cursor.fetchall()
+    assert sorted(c_id for c_id, _, _ in joined) == sorted(ids)
+    assert all(c_id == c2r_id for c_id, c2r_id, _ in joined)
+
+    # LIMIT and OFFSET count the joined rows only
+    for limit, offset, rows_count in [(1, 0, 1), (2, 0, 2), (1, 1, 1), (5, 15, 5), (5, 18, 2), (20, 0, 20), (1, 20, 0)]:
+        enc_cursor.execute(f"{query} LIMIT {limit} OFFSET {offset}")
+        rows = enc_cursor.fetchall()
+        assert len(rows) == rows_count
+        assert enc_cursor.rowcount == rows_count
+        assert len(set(rows)) == rows_count and set(rows) <= set(joined)
+
+    # Rows of a joined city follow each other, so 20 joined rows take at least 381 rows of the database,
+    # more than the proxy fetches even with the largest over-fetch factor (20 * 16). The page is
+    # fetched again without the limit
+    refetches = read_counter("join_limit_refetches")
+    enc_cursor.execute(f"{query} LIMIT 5 OFFSET 15")
+    assert len(set(enc_cursor.fetchall()) & set(joined)) == 5
+    assert enc_cursor.rowcount == 5
+    assert read_counter("join_limit_refetches") > refetches
+
+
+def test_join_key_size(prepare_schema, cursor, enc_cursor):
+    # city2region.id has wider join keys than cities.id, the keys are joined by the common prefix
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute("INSERT INTO city2region (id, region) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'Region 1');")
+
+    cursor.execute("SELECT length(c.id_joinkey), length(c2r.id_joinkey), substring(c2r.id_joinkey, 1, 1) = c.id_joinkey FROM cities c, city2region c2r")
+    assert cursor.fetchall() == [(1, 2, True)]
+
+    enc_cursor.execute("SELECT c.id AS c_id, c2r.id AS c2r_id, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id;")
+    assert enc_cursor.fetchall() == [('1e63b6ff-4fe5-4498-90d1-d84693a84db8', '1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'Region 1')]
+
+
+def test_semi_join(prepare_schema, enc_cursor):
+    # Lookups by the blind index fetch the join keys of cities first, city2region is filtered by them
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('4df0dc1a-2d9d-4682-848b-c323e922c60f', 'City 2', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute("INSERT INTO city2region (id, region) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'Region 1');")
+    enc_cursor.execute("INSERT INTO city2region (id, region) VALUES ('4df0dc1a-2d9d-4682-848b-c323e922c60f', 'Region 2');")
+
+    queries = read_counter("semi_join_queries")
+    keys = read_counter("semi_join_keys")
+    enc_cursor.execute("SELECT c.name, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id WHERE c.name = 'City 2'")
+    assert enc_cursor.fetchall() == [('City 2', 'Region 2')]
+
+    enc_cursor.execute("SELECT c.name, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id WHERE c.name IN ('City 1', 'City 2') ORDER BY c2r.region DESC")
+    assert enc_cursor.fetchall() == [('City 2', 'Region 2'), ('City 1', 'Region 1')]
+    assert read_counter("semi_join_queries") - queries == 2
+    # The ids of City 1 and City 2 share the 2-byte join key, so each query pushes down one key
+    assert read_counter("semi_join_keys") - keys == 2
+
+    # No keys - no rows
+    enc_cursor.execute("SELECT c.name, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id WHERE c.name = 'City 3'")
+    assert enc_cursor.fetchall() == []
+
+    # More distinct keys than max_keys (1000 of the 2-byte keys of city2region) - the query is sent as is
+    rows = "".join(f"{uuid.uuid4()}\tCity 4\t1\t2023-11-02 10:30:02\t2023-12-20 00:00:52\n" for _ in range(1500))
+    enc_cursor.copy_expert("COPY cities (id, name, kladr_id, created_at, updated_at) FROM STDIN", io.StringIO(rows))
+    enc_cursor.execute("INSERT INTO city2region (id, region) VALUES (%s, 'Region 4');", (rows[:36],))
+
+    skipped = read_counter("semi_join_skipped")
+    enc_cursor.execute("SELECT c.name, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id WHERE c.name = 'City 4'")
+    assert enc_cursor.fetchall() == [('City 4', 'Region 4')]
+    assert read_counter("semi_join_skipped") - skipped == 1
+
+
+def test_query_coalescing(prepare_schema, enc_cursor):
+    # Identical queries of concurrent sessions share the result of one of them
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    query = "SELECT c.id, c.name FROM cities c WHERE c.name = 'City 1'"
+
+    def execute(_):
+        conn = psycopg2.connect(dbname="postgres", host=ENCRYPTED_HOST, user="postgres", password="postgres", port="5433")
+        conn.autocommit = True
+        with conn.cursor() as cursor:
+            cursor.execute(query)
+            rows = cursor.fetchall()
+        conn.close()
+        return rows
+
+    leaders = read_counter("query_coalescing_leaders")
+    waiters = read_counter("query_coalescing_waiters")
+    with ThreadPoolExecutor(max_workers=8) as pool:
+        results = list(pool.map(execute, range(32)))
+
+    assert all(rows == [('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1')] for rows in results)
+    # Results aren't kept on this listener, so each query either executes or waits for another one
+    assert read_counter("query_coalescing_leaders") - leaders + read_counter("query_coalescing_waiters") - waiters == 32
+
+    # Writes through the proxy are seen by the next query
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('4df0dc1a-2d9d-4682-848b-c323e922c60f', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute(query)
+    assert len(enc_cursor.fetchall()) == 2
+
+    enc_cursor.execute("DELETE FROM cities WHERE cities.id = '4df0dc1a-2d9d-4682-848b-c323e922c60f'")
+    enc_cursor.execute(query)
+    assert enc_cursor.fetchall() == [('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1')]
+
+
+def test_query_coalescing_cache(prepare_schema, enc_cursor):
+    # Results are kept by the second listener, the queries of one connection are served by one worker
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+    query = "SELECT c.id, c.name FROM cities c WHERE c.name = 'City 1'"
+
+    conn = psycopg2.connect(dbname="postgres", host=ENCRYPTED_HOST, user="postgres", password="postgres", port="5434")
+    conn.autocommit = True
+    with conn.cursor() as cursor:
+        # Writes through the listener drop the results left by the previous runs
+        cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('4df0dc1a-2d9d-4682-848b-c323e922c60f', 'City 1', '1', null, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', null);")
+        cursor.execute(query)
+        assert len(cursor.fetchall()) == 2
+
+        cache_hits = read_counter("query_coalescing_cache_hits", CACHED_STAT_PREFIX)
+        cursor.execute(query)
+        assert len(cursor.fetchall()) == 2
+        assert read_counter("query_coalescing_cache_hits", CACHED_STAT_PREFIX) == cache_hits + 1
+
+        cursor.execute("DELETE FROM cities WHERE cities.id = '4df0dc1a-2d9d-4682-848b-c323e922c60f'")
+        cursor.execute(query)
+        assert cursor.fetchall() == [('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'City 1')]
+        assert read_counter("query_coalescing_cache_hits", CACHED_STAT_PREFIX) == cache_hits + 1
+
+    conn.close()
+
+
 # Ensure that encrypted indexing is allowed only for indexed columns
 def test_blind_index_requirements(prepare_schema, enc_cursor):
     with pytest.raises(psycopg2.DatabaseError) as excinfo:
@@ -159,3 +357,430 @@ def test_update_literal_requirement(prepare_schema, enc_cursor):
         enc_cursor.execute("UPDATE cities SET priority = 1 + 1 WHERE cities.id = '08a3f421-cf10-4dc9-855a-7b7e8565f2b1';")
 
     assert str(excinfo.value) == "postgres_tde: only literals can be used as UPDATE values for blind-indexed columns\n"
+
+
+def test_range_queries(prepare_schema, enc_cursor):
+    # Range predicates and ORDER BY over encrypted columns are served by the order index
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Test city 1', '1900000400000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0700');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Test city second', '1900000100000', null, '2022-01-15 08:00:00', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Test city No 3', '5605500100000', -2, '2024-03-01 00:00:00', '2023-12-20 00:00:52.932486', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('89c1e189-3cc0-4cd6-b4db-3b556f945344', 'Test city 4', '0200000200000', 5, '2023-11-02 10:30:02.490528', '2023-12-20 00:00:52.932486', null);")
+
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.created_at BETWEEN '2023-01-01' AND '2023-12-31 23:59:59' ORDER BY c.created_at DESC")
+    assert enc_cursor.fetchall() == [('Test city 4',), ('Test city 1',)]
+
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.priority >= 1 ORDER BY c.priority")
+    assert enc_cursor.fetchall() == [('Test city 1',), ('Test city 4',)]
+
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.priority < 1")
+    assert enc_cursor.fetchall() == [('Test city No 3',)]
+
+    enc_cursor.execute("UPDATE cities SET created_at = '2021-06-01 12:00:00' WHERE cities.id = '89c1e189-3cc0-4cd6-b4db-3b556f945344'")
+    enc_cursor.execute("SELECT c.name, c.created_at FROM cities c ORDER BY c.created_at LIMIT 1")
+    assert enc_cursor.fetchall() == [('Test city 4', datetime(2021, 6, 1, 12, 0, 0))]
+
+    # Positions and aliases of the select list are ordered by the index column as well
+    enc_cursor.execute("SELECT c.priority, c.name FROM cities c ORDER BY 1")
+    assert enc_cursor.fetchall() == [(-2, 'Test city No 3'), (1, 'Test city 1'), (5, 'Test city 4'), (None, 'Test city second')]
+
+    enc_cursor.execute("SELECT c.name, c.created_at AS created FROM cities c ORDER BY created DESC LIMIT 2")
+    assert enc_cursor.fetchall() == [('Test city No 3', datetime(2024, 3, 1, 0, 0, 0)), ('Test city 1', datetime(2023, 11, 2, 10, 30, 2, 490527))]
+
+    # Columns without order index still can't be compared
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.id FROM cities c WHERE c.timezone > '+0300'")
+
+    assert str(excinfo.value) == "postgres_tde: invalid use of encrypted column cities.timezone\n"
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.id FROM cities c WHERE c.priority > 1.5")
+
+    assert str(excinfo.value) == "postgres_tde: invalid value for the order index of column priority\n"
+
+
+def test_bucket_ranges(prepare_schema, enc_cursor):
+    # Ranges over updated_at are looked up by daily buckets and filtered by the proxy
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Test city 1', '1900000400000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0700');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Test city second', '1900000100000', null, '2022-01-15 08:00:00', '2023-12-20 18:30:00', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Test city No 3', '5605500100000', -2, '2024-03-01 00:00:00', '2023-12-22 09:00:00', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('89c1e189-3cc0-4cd6-b4db-3b556f945344', 'Test city 4', '0200000200000', 5, '2023-11-02 10:30:02.490528', '2023-12-25 12:00:00', null);")
+
+    # Bounds fall in the middle of the buckets, rows of the same days outside of them are filtered
+    enc_cursor.execute("SELECT c.name, c.updated_at FROM cities c WHERE c.updated_at >= '2023-12-20 12:00' AND c.updated_at < '2023-12-25 12:00' ORDER BY c.created_at")
+    assert enc_cursor.fetchall() == [
+        ('Test city second', datetime(2023, 12, 20, 18, 30, 0)),
+        ('Test city No 3', datetime(2023, 12, 22, 9, 0, 0)),
+    ]
+
+    enc_cursor.execute("SELECT c.name, c.updated_at FROM cities c WHERE c.updated_at BETWEEN '2023-12-25' AND '2023-12-31'")
+    assert enc_cursor.fetchall() == [('Test city 4', datetime(2023, 12, 25, 12, 0, 0))]
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.name, c.updated_at FROM cities c WHERE c.updated_at > '2023-12-20'")
+
+    assert str(excinfo.value) == "postgres_tde: range over column updated_at must have both bounds to be looked up by the bucket index\n"
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.name FROM cities c WHERE c.updated_at BETWEEN '2023-12-25' AND '2023-12-31'")
+
+    assert str(excinfo.value) == "postgres_tde: column cities.updated_at must be present in SELECT body to be compared with a range\n"
+
+
+def test_pattern_search(prepare_schema, enc_cursor):
+    # Patterns over name are looked up by the n-gram tokens and matched exactly by the proxy
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Kaliningrad', '3900000100000', 2, '2022-01-15 08:00:00', '2023-12-20 18:30:00', '+0200');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', '3400000100000', 3, '2024-03-01 00:00:00', '2023-12-22 09:00:00', '+0300');")
+    enc_cursor.execute("UPDATE cities SET name = 'Mozhaysk', kladr_id = '5002800100000' WHERE cities.id = '33008eec-464e-4022-a6c4-90c7cc70612e'")
+
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.name LIKE 'Mo%' ORDER BY c.priority")
+    assert enc_cursor.fetchall() == [('Moscow',), ('Mozhaysk',)]
+
+    # Tokens are case-insensitive, LIKE is checked exactly
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.name LIKE '%GRAD%'")
+    assert enc_cursor.fetchall() == []
+
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.name ILIKE '%GRAD' AND c.id != '08a3f421-cf10-4dc9-855a-7b7e8565f2b1'")
+    assert enc_cursor.fetchall() == [('Kaliningrad',)]
+
+    enc_cursor.execute("SELECT c.name FROM cities c WHERE c.name LIKE 'M_sc_w'")
+    assert enc_cursor.fetchall() == [('Moscow',)]
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.name FROM cities c WHERE c.name LIKE '%ow%'")
+
+    assert str(excinfo.value) == "postgres_tde: LIKE pattern over column name is too short to be looked up by the token index\n"
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.id FROM cities c WHERE c.name LIKE 'Mos%'")
+
+    assert str(excinfo.value) == "postgres_tde: column cities.name must be present in SELECT body to be matched with a pattern\n"
+
+
+def test_proxy_sort(prepare_schema, enc_cursor):
+    # Columns without order index are sorted and limited by the proxy
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Kaliningrad', '3900000100000', 2, '2022-01-15 08:00:00', '2023-12-20 18:30:00', '+0200');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', '3400000100000', 3, '2024-03-01 00:00:00', '2023-12-22 09:00:00', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('89c1e189-3cc0-4cd6-b4db-3b556f945344', 'Mozhaysk', '5002800100000', 4, '2023-11-02 10:30:02.490528', '2023-12-25 12:00:00', '+0300');")
+
+    enc_cursor.execute("SELECT c.name FROM cities c ORDER BY c.name")
+    assert enc_cursor.fetchall() == [('Kaliningrad',), ('Moscow',), ('Mozhaysk',), ('Volgograd',)]
+
+    enc_cursor.execute("SELECT c.name AS city FROM cities c ORDER BY city DESC LIMIT 2 OFFSET 1")
+    assert enc_cursor.fetchall() == [('Mozhaysk',), ('Moscow',)]
+    assert enc_cursor.rowcount == 2
+
+    # NULLs go last, ties are sorted by the next key
+    enc_cursor.execute("SELECT c.timezone, c.name FROM cities c ORDER BY 1, c.name DESC")
+    assert enc_cursor.fetchall() == [('+0200', 'Kaliningrad'), ('+0300', 'Mozhaysk'), ('+0300', 'Moscow'), (None, 'Volgograd')]
+
+    # LIMIT is applied after the rows outside of the range are filtered
+    enc_cursor.execute("SELECT c.name, c.updated_at FROM cities c WHERE c.updated_at BETWEEN '2023-12-20 12:00' AND '2023-12-31' ORDER BY c.updated_at DESC LIMIT 2")
+    assert enc_cursor.fetchall() == [('Mozhaysk', datetime(2023, 12, 25, 12, 0, 0)), ('Volgograd', datetime(2023, 12, 22, 9, 0, 0))]
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.id FROM cities c ORDER BY c.name")
+
+    assert str(excinfo.value) == "postgres_tde: column cities.name must be present in SELECT body to be sorted by the proxy\n"
+
+
+def test_proxy_aggregation(prepare_schema, enc_cursor):
+    # Aggregates over encrypted columns are computed by the proxy
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Kaliningrad', '3900000100000', 2, '2022-01-15 08:00:00', '2023-12-20 18:30:00', '+0200');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', '3400000100000', 3, '2024-03-01 00:00:00', '2023-12-22 09:00:00', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('89c1e189-3cc0-4cd6-b4db-3b556f945344', 'Mozhaysk', '5002800100000', 4, '2023-11-02 10:30:02.490528', '2023-12-25 12:00:00', '+0300');")
+
+    enc_cursor.execute("SELECT c.timezone, MAX(c.priority) AS max_priority, MIN(c.priority), SUM(c.priority), AVG(c.priority), COUNT(DISTINCT c.name) FROM cities c GROUP BY c.timezone")
+    assert enc_cursor.rowcount == 3
+    assert {row[0]: row[1:] for row in enc_cursor.fetchall()} == {
+        '+0300': (4, 1, 5, Decimal('2.5000000000000000'), 2),
+        '+0200': (2, 2, 2, Decimal('2.0000000000000000'), 1),
+        None:    (3, 3, 3, Decimal('3.0000000000000000'), 1),
+    }
+    assert [column.name for column in enc_cursor.description] == ['timezone', 'max_priority', 'min', 'sum', 'avg', 'count']
+
+    # Without GROUP BY the result is a single row, even if nothing is found
+    enc_cursor.execute("SELECT MAX(c.name), COUNT(*) FROM cities c WHERE c.priority >= 2")
+    assert enc_cursor.fetchall() == [('Volgograd', 3)]
+
+    enc_cursor.execute("SELECT MAX(c.name), COUNT(*) FROM cities c WHERE c.priority > 100")
+    assert enc_cursor.fetchall() == [(None, 0)]
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("SELECT c.name, MAX(c.priority) FROM cities c GROUP BY c.timezone")
+
+    assert str(excinfo.value) == "postgres_tde: column cities.name must appear in the GROUP BY clause or be used in an aggregate function\n"
+
+
+def test_homomorphic_sum(prepare_schema, enc_cursor):
+    # SUM over priority is computed by the database over the Paillier ciphertexts, only the sum is decrypted
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Kaliningrad', '3900000100000', 2, '2022-01-15 08:00:00', '2023-12-20 18:30:00', '+0200');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', '3400000100000', null, '2024-03-01 00:00:00', '2023-12-22 09:00:00', null);")
+    enc_cursor.execute("UPDATE cities SET priority = '-10' WHERE cities.id = '33008eec-464e-4022-a6c4-90c7cc70612e'")
+
+    enc_cursor.execute("SELECT SUM(c.priority) AS total, COUNT(c.priority) FROM cities c")
+    assert enc_cursor.fetchall() == [(-7, 3)]
+    assert [column.name for column in enc_cursor.description] == ['total', 'count']
+
+    enc_cursor.execute("SELECT SUM(c.priority) FROM cities c WHERE c.priority >= 2")
+    assert enc_cursor.fetchall() == [(2,)]
+
+    # Sum of no values is NULL
+    enc_cursor.execute("SELECT SUM(c.priority) FROM cities c WHERE c.priority > 100")
+    assert enc_cursor.fetchall() == [(None,)]
+
+    # Other aggregates need the plaintext, so such queries are still aggregated by the proxy
+    enc_cursor.execute("SELECT SUM(c.priority), MAX(c.priority) FROM cities c")
+    assert enc_cursor.fetchall() == [(-7, 2)]
+
+
+def test_proxy_join(prepare_schema, enc_cursor):
+    # kladr_id has no join keys, such joins are split into a query per table and joined by the proxy
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('c07b21de-c660-46b0-bffd-b1e6272141a9', 'Zelenograd', '7700000000000', 2, '2022-01-15 08:00:00', '2023-12-20 18:30:00', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', '3400000100000', 3, '2024-03-01 00:00:00', '2023-12-22 09:00:00', null);")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('89c1e189-3cc0-4cd6-b4db-3b556f945344', 'Mozhaysk', null, 4, '2023-11-02 10:30:02.490528', '2023-12-25 12:00:00', '+0300');")
+
+    enc_cursor.execute("SELECT c1.name AS city, c2.name AS neighbour, c2.kladr_id FROM cities c1 JOIN cities c2 ON c1.kladr_id = c2.kladr_id WHERE c1.name = 'Moscow'")
+    assert sorted(enc_cursor.fetchall()) == [('Moscow', 'Moscow', '7700000000000'), ('Moscow', 'Zelenograd', '7700000000000')]
+    assert [column.name for column in enc_cursor.description] == ['city', 'neighbour', 'kladr_id']
+    assert enc_cursor.rowcount == 2
+
+    # NULLs are never joined
+    enc_cursor.execute("SELECT c1.name AS city, c2.name AS neighbour FROM cities c1 JOIN cities c2 ON c1.kladr_id = c2.kladr_id")
+    assert enc_cursor.rowcount == 5
+
+
+def test_copy(prepare_schema, enc_cursor):
+    # COPY is encrypted by the proxy, blind index and join key are filled in
+    data = io.StringIO(
+        "08a3f421-cf10-4dc9-855a-7b7e8565f2b1\tTest\\tcity 1\t1900000400000\t1\t2023-11-02 10:30:02.490527\t2023-12-20 00:00:52.932486\t+0700\n"
+        "33008eec-464e-4022-a6c4-90c7cc70612e\tTest city No 3\t5605500100000\t\\N\t2023-11-02 10:30:02.490527\t2023-12-20 00:00:52.932486\t\\N\n")
+    enc_cursor.copy_expert("COPY cities (id, name, kladr_id, priority, created_at, updated_at, timezone) FROM STDIN", data)
+    enc_cursor.execute("INSERT INTO city2region (id, region) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Region 1');")
+
+    enc_cursor.execute("SELECT c.id, c.name, c.kladr_id, c.priority, c.created_at, c.updated_at, c.timezone FROM cities c")
+    assert sorted(enc_cursor.fetchall()) == [
+        ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Test\tcity 1',    '1900000400000', 1,    datetime(2023, 11, 2, 10, 30, 2, 490527), datetime(2023, 12, 20, 0, 0, 52, 932486), '+0700'),
+        ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Test city No 3', '5605500100000', None, datetime(2023, 11, 2, 10, 30, 2, 490527), datetime(2023, 12, 20, 0, 0, 52, 932486), None),
+    ]
+
+    enc_cursor.execute("SELECT c.id FROM cities c WHERE c.name = 'Test city No 3'")
+    assert enc_cursor.fetchall() == [('33008eec-464e-4022-a6c4-90c7cc70612e',)]
+
+    enc_cursor.execute("SELECT c.id AS c_id, c2r.id AS c2r_id, c.name, c2r.region FROM cities c JOIN city2region c2r ON c.id = c2r.id")
+    assert enc_cursor.fetchall() == [('33008eec-464e-4022-a6c4-90c7cc70612e', '33008eec-464e-4022-a6c4-90c7cc70612e', 'Test city No 3', 'Region 1')]
+
+    # CRLF line endings are not a part of the last value, the end marker is recognized too
+    data = io.StringIO(
+        "c07b21de-c660-46b0-bffd-b1e6272141a9\tCRLF city\t7700000000000\t\\N\t2023-11-02 10:30:02\t2023-12-20 00:00:52\t+0300\r\n"
+        "\\.\r\n")
+    enc_cursor.copy_expert("COPY cities (id, name, kladr_id, priority, created_at, updated_at, timezone) FROM STDIN", data)
+    enc_cursor.execute("SELECT c.timezone FROM cities c WHERE c.name = 'CRLF city'")
+    assert enc_cursor.fetchall() == [('+0300',)]
+
+    # Only the plain form of COPY is supported
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.copy_expert("COPY cities FROM STDIN", io.StringIO(""))
+
+    assert str(excinfo.value) == "postgres_tde: only COPY cities (<columns>) FROM STDIN in text format is supported for tables with encryption\n"
+
+
+def test_reencrypt(prepare_schema, cursor, enc_cursor):
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', null, null, '2024-03-01 00:00:00', '2023-12-22 09:00:00', null);")
+    cursor.execute("SELECT id_bi, name FROM cities")
+    ciphertexts = dict((bytes(id_bi), bytes(name)) for id_bi, name in cursor.fetchall())
+
+    # Rows are rewritten through the proxy, so the values are encrypted again with fresh IVs
+    subprocess.run([sys.executable, "../maintenance/reencrypt.py", "--table", "cities", "--pk", "id",
+                    "--columns", "id,name,kladr_id,priority,created_at,updated_at,timezone",
+                    "--batch-size", "1", "--max-rows-per-second", "1000"], check=True)
+
+    cursor.execute("SELECT id_bi, name FROM cities")
+    for id_bi, name in cursor.fetchall():
+        assert ciphertexts[bytes(id_bi)] != bytes(name)
+
+    enc_cursor.execute("SELECT c.id, c.name, c.kladr_id, c.priority, c.timezone FROM cities c")
+    assert sorted(enc_cursor.fetchall()) == [
+        ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow',    '7700000000000', 1,    '+0300'),
+        ('33008eec-464e-4022-a6c4-90c7cc70612e', 'Volgograd', None,            None, None),
+    ]
+
+    enc_cursor.execute("SELECT c.id FROM cities c WHERE c.name = 'Volgograd'")
+    assert enc_cursor.fetchall() == [('33008eec-464e-4022-a6c4-90c7cc70612e',)]
+
+
+def test_rewrite_concurrent_write(prepare_schema, enc_cursor):
+    sys.path.insert(0, "../maintenance")
+    import rewrite
+
+    enc_cursor.execute("INSERT INTO cities (id, name, kladr_id, priority, created_at, updated_at, timezone) VALUES ('08a3f421-cf10-4dc9-855a-7b7e8565f2b1', 'Moscow', '7700000000000', 1, '2023-11-02 10:30:02.490527', '2023-12-20 00:00:52.932486', '+0300');")
+    enc_cursor.execute("SELECT c.xmin, c.id, c.timezone FROM cities c")
+    row = enc_cursor.fetchone()
+
+    # The row written by the application after it was read isn't overwritten with the old values
+    enc_cursor.execute("UPDATE cities SET timezone = '+0400' WHERE cities.id = '08a3f421-cf10-4dc9-855a-7b7e8565f2b1'")
+    assert not rewrite.write_back(enc_cursor, "cities", "id", ["timezone"], row)
+    enc_cursor.execute("SELECT c.xmin, c.id, c.timezone FROM cities c")
+    row = enc_cursor.fetchone()
+    assert row[2] == '+0400'
+
+    assert rewrite.write_back(enc_cursor, "cities", "id", ["timezone"], row)
+    enc_cursor.execute("SELECT c.timezone FROM cities c")
+    assert enc_cursor.fetchall() == [('+0400',)]
+
+
+def test_ddl(cursor, enc_cursor):
+    try:
+        cursor.execute(open('cleanup.sql', 'r').read())
+    except psycopg2.errors.UndefinedTable:
+        pass
+
+    # Tables are declared with the logical types, the storage layout is derived from the schema
+    enc_cursor.execute("""
+        CREATE TABLE cities (
+            id uuid NOT NULL, name varchar(100) NOT NULL, priority int,
+            created_at timestamp NOT NULL, updated_at timestamp NOT NULL, timezone text
+        );
+        ALTER TABLE cities ADD COLUMN kladr_id text NOT NULL;
+        CREATE TABLE city2region (id uuid NOT NULL);
+        ALTER TABLE city2region ADD COLUMN region text NOT NULL;
+    """)
+
+    cursor.execute("SELECT table_name, column_name, data_type, is_nullable FROM information_schema.columns WHERE table_name IN ('cities', 'city2region')")
+    assert sorted(cursor.fetchall()) == [
+        ('cities', 'created_at', 'bytea', 'NO'),
+        ('cities', 'created_at_ore', 'bytea', 'NO'),
+        ('cities', 'id', 'bytea', 'NO'),
+        ('cities', 'id_bi', 'bytea', 'NO'),
+        ('cities', 'id_joinkey', 'bytea', 'NO'),
+        ('cities', 'kladr_id', 'bytea', 'NO'),
+        ('cities', 'name', 'bytea', 'NO'),
+        ('cities', 'name_bi', 'bytea', 'NO'),
+        ('cities', 'name_kladr_id_bi', 'bytea', 'YES'),
+        ('cities', 'name_tokens', 'ARRAY', 'NO'),
+        ('cities', 'priority', 'bytea', 'YES'),
+        ('cities', 'priority_he', 'numeric', 'YES'),
+        ('cities', 'priority_ore', 'bytea', 'YES'),
+        ('cities', 'timezone', 'bytea', 'YES'),
+        ('cities', 'updated_at', 'bytea', 'NO'),
+        ('cities', 'updated_at_bucket', 'bytea', 'NO'),
+        ('city2region', 'id', 'bytea', 'NO'),
+        ('city2region', 'id_joinkey', 'bytea', 'NO'),
+        ('city2region', 'region', 'bytea', 'NO'),
+    ]
+
+    cursor.execute("SELECT indexname FROM pg_indexes WHERE tablename IN ('cities', 'city2region') AND indexname LIKE '%_idx'")
+    assert sorted(cursor.fetchall()) == [
+        ('cities_created_at_ore_idx',),
+        ('cities_id_bi_idx',),
+        ('cities_id_joinkey_idx',),
+        ('cities_name_bi_idx',),
+        ('cities_name_kladr_id_bi_idx',),
+        ('cities_name_tokens_idx',),
+        ('cities_priority_ore_idx',),
+        ('cities_updated_at_bucket_idx',),
+        ('city2region_id_joinkey_idx',),
+    ]
+
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("ALTER TABLE cities ALTER COLUMN priority TYPE bigint")
+
+    assert str(excinfo.value) == "postgres_tde: ALTER TABLE ALTER is not supported for column cities.priority with encryption\n"
+
+    # Uniqueness can't be enforced over the randomized ciphertext
+    with pytest.raises(psycopg2.DatabaseError) as excinfo:
+        enc_cursor.execute("ALTER TABLE city2region ADD PRIMARY KEY (id)")
+
+    assert str(excinfo.value) == "postgres_tde: PRIMARY KEY constraint is not supported for encrypted column city2region.id\n"
+
+
+# The listener on port 5435 reads the schema and the keys from the files in reload/
+def test_key_reload(prepare_schema, cursor):
+    keys = open('reload/keys.yaml', 'r').read()
+
+    def counter(name):
+        return read_counter(name, RELOAD_STAT_PREFIX)
+
+    def decrypt(key, data):
+        # 16-byte IV followed by the AES-256-CBC ciphertext
+        return subprocess.run(["openssl", "enc", "-d", "-aes-256-cbc", "-K", key.hex(), "-iv", data[:16].hex()],
+                              input=data[16:], capture_output=True, check=True).stdout
+
+    def data_key(path):
+        wrapped = base64.b64decode(open(path, 'r').read().split("region_key:")[1].strip())
+        return decrypt(open('reload/master.key', 'rb').read(), wrapped)
+
+    conn = psycopg2.connect(dbname="postgres", host=ENCRYPTED_HOST, user="postgres", password="postgres", port="5435")
+    conn.autocommit = True
+    try:
+        with conn.cursor() as reload_cursor:
+            def check_roundtrip(region):
+                # Rows encrypted with another key can't be decrypted, so each check starts with an empty table
+                cursor.execute("DELETE FROM city2region")
+                reload_cursor.execute(f"INSERT INTO city2region (id, region) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', '{region}');")
+                reload_cursor.execute("SELECT c2r.region FROM city2region c2r")
+                assert reload_cursor.fetchall() == [(region,)]
+
+            check_roundtrip('Region 1')
+
+            # Data key rotated in the provider is picked up once the cache refreshes it
+            applied = counter("schema_reload_success")
+            rewrite('reload/keys.yaml', open('reload/keys_rotated.yaml', 'r').read())
+            wait_for(lambda: counter("schema_reload_success") > applied)
+            check_roundtrip('Region 2')
+            cursor.execute("SELECT region FROM city2region")
+            assert decrypt(data_key('reload/keys_rotated.yaml'), bytes(cursor.fetchone()[0])) == b'Region 2'
+
+            # Keys which can't be fetched anymore are used no longer than the cache TTL
+            expired = counter("schema_keys_expired")
+            rewrite('reload/keys.yaml', "keys: {}\n")
+            wait_for(lambda: counter("schema_keys_expired") > expired)
+            with pytest.raises(psycopg2.DatabaseError) as excinfo:
+                reload_cursor.execute("SELECT c2r.region FROM city2region c2r")
+            assert str(excinfo.value) == "postgres_tde: encryption schema is not available\n"
+
+            # The schema is applied again once the keys are back
+            applied = counter("schema_reload_success")
+            rewrite('reload/keys.yaml', keys)
+            wait_for(lambda: counter("schema_reload_success") > applied)
+            check_roundtrip('Region 1')
+    finally:
+        rewrite('reload/keys.yaml', keys)
+        conn.close()
+
+
+def test_schema_reload(prepare_schema, cursor):
+    schema = open('reload/schema.yaml', 'r').read()
+
+    def counter(name):
+        return read_counter(name, RELOAD_STAT_PREFIX)
+
+    conn = psycopg2.connect(dbname="postgres", host=ENCRYPTED_HOST, user="postgres", password="postgres", port="5435")
+    conn.autocommit = True
+    try:
+        with conn.cursor() as reload_cursor:
+            reload_cursor.execute("INSERT INTO city2region (id, region) VALUES ('1e63b6ff-4fe5-4498-90d1-d84693a84db8', 'Region 1');")
+
+            # Invalid schema is rejected and the previous one stays in use
+            failed = counter("schema_reload_failed")
+            rewrite('reload/schema.yaml', "tables: [")
+            wait_for(lambda: counter("schema_reload_failed") > failed)
+            reload_cursor.execute("SELECT c2r.region FROM city2region c2r")
+            assert reload_cursor.fetchall() == [('Region 1',)]
+
+            # Columns removed from the schema are passed as is
+            applied = counter("schema_reload_success")
+            rewrite('reload/schema.yaml', schema.split("  - { name: region")[0])
+            wait_for(lambda: counter("schema_reload_success") > applied)
+            cursor.execute("SELECT region FROM city2region")
+            ciphertext = bytes(cursor.fetchone()[0])
+            reload_cursor.execute("SELECT c2r.region FROM city2region c2r")
+            assert bytes(reload_cursor.fetchone()[0]) == ciphertext
+    finally:
+        rewrite('reload/schema.yaml', schema)
+        conn.close()